@@ -0,0 +1,145 @@
+/*****************************************************************************
+ * alloc_map-test.c                                                          *
+ *                                                                           *
+ * This file executes the allocation map to test its merging and splitting.  *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "alloc_map.h"
+#include "color.h"
+
+#define TEST_RANGES 4096
+#define TEST_MAX 4
+
+/* every sector of [start, end) in group, and the sectors either side not */
+void check_range(struct alloc_map* map, uint64_t group, uint64_t start,
+                 uint64_t end)
+{
+    uint64_t found, i;
+
+    for (i = start; i < end; i++)
+        assert(alloc_map_lookup(map, i, &found) && found == group);
+
+    assert(start == 0 || !alloc_map_lookup(map, start - 1, &found) ||
+           found != group);
+    assert(!alloc_map_lookup(map, end, &found) || found != group);
+}
+
+int main(int argc, char* argv[])
+{
+    struct alloc_map* map;
+    struct alloc_map_stats stats;
+    uint64_t group, i;
+
+    fprintf_blue(stdout, "-- Allocation Map Test Suite --\n");
+
+    fprintf_light_blue(stdout, "* test add and lookup\n");
+    map = alloc_map_init(ALLOC_MAP_DEFAULT_RANGES);
+    assert(map != NULL);
+    assert(!alloc_map_lookup(map, 0, &group));
+    assert(alloc_map_add(map, 1, 8, 16) == EXIT_SUCCESS);
+    check_range(map, 1, 8, 16);
+    assert(alloc_map_add(map, 1, 24, 32) == EXIT_SUCCESS);
+    check_range(map, 1, 24, 32);
+    assert(!alloc_map_lookup(map, 20, NULL));
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == 2 && stats.sectors == 16 && stats.added == 16);
+
+    fprintf_light_blue(stdout, "* test merging\n");
+    assert(alloc_map_add(map, 1, 16, 24) == EXIT_SUCCESS);
+    check_range(map, 1, 8, 32);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == 1 && stats.sectors == 24);
+    /* overlapping adds only count their new sectors */
+    assert(alloc_map_add(map, 1, 0, 12) == EXIT_SUCCESS);
+    check_range(map, 1, 0, 32);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == 1 && stats.sectors == 32 && stats.added == 32);
+    /* a neighbour from another group stays separate */
+    assert(alloc_map_add(map, 2, 32, 40) == EXIT_SUCCESS);
+    check_range(map, 2, 32, 40);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == 2);
+
+    fprintf_light_blue(stdout, "* test remove\n");
+    assert(alloc_map_remove(map, 4, 8) == 4);
+    check_range(map, 1, 0, 4);
+    check_range(map, 1, 8, 32);
+    assert(alloc_map_remove(map, 28, 36) == 8);
+    check_range(map, 1, 8, 28);
+    check_range(map, 2, 36, 40);
+    assert(alloc_map_remove(map, 0, 64) == 28);
+    assert(alloc_map_remove(map, 0, 64) == 0);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == 0 && stats.sectors == 0 && stats.removed == 40);
+
+    fprintf_light_blue(stdout, "* test replacing another group\n");
+    assert(alloc_map_add(map, 1, 0, 16) == EXIT_SUCCESS);
+    assert(alloc_map_add(map, 3, 4, 8) == EXIT_SUCCESS);
+    check_range(map, 1, 0, 4);
+    check_range(map, 3, 4, 8);
+    check_range(map, 1, 8, 16);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == 3 && stats.sectors == 16);
+    alloc_map_destroy(map);
+
+    fprintf_light_blue(stdout, "* test limit\n");
+    map = alloc_map_init(TEST_MAX);
+    assert(alloc_map_add(map, 0, 0, 1) == EXIT_SUCCESS);
+    assert(alloc_map_add(map, 0, 2, 3) == EXIT_SUCCESS);
+    assert(alloc_map_add(map, 0, 4, 5) == EXIT_SUCCESS);
+    assert(alloc_map_add(map, 0, 6, 7) == EXIT_FAILURE);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.rejected == 1 && stats.ranges == 3);
+    alloc_map_destroy(map);
+
+    map = alloc_map_init(TEST_MAX);
+    assert(alloc_map_add(map, 0, 0, 10) == EXIT_SUCCESS);
+    assert(alloc_map_add(map, 0, 20, 30) == EXIT_SUCCESS);
+    assert(alloc_map_add(map, 0, 40, 50) == EXIT_SUCCESS);
+    assert(alloc_map_remove(map, 4, 6) == 2);
+    /* a split with the map full forgets the straddling range's tail */
+    assert(alloc_map_remove(map, 24, 26) == 6);
+    check_range(map, 0, 0, 4);
+    check_range(map, 0, 6, 10);
+    check_range(map, 0, 20, 24);
+    assert(!alloc_map_lookup(map, 26, NULL));
+    alloc_map_destroy(map);
+
+    fprintf_light_blue(stdout, "* test growth\n");
+    map = alloc_map_init(ALLOC_MAP_DEFAULT_RANGES);
+    for (i = 0; i < TEST_RANGES; i++)
+        assert(alloc_map_add(map, i, i * 8, i * 8 + 4) == EXIT_SUCCESS);
+    alloc_map_get_stats(map, &stats);
+    assert(stats.ranges == TEST_RANGES && stats.sectors == TEST_RANGES * 4);
+    for (i = 0; i < TEST_RANGES; i++)
+    {
+        assert(alloc_map_lookup(map, i * 8 + 3, &group) && group == i);
+        assert(!alloc_map_lookup(map, i * 8 + 4, NULL));
+    }
+    alloc_map_destroy(map);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
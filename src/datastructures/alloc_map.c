@@ -0,0 +1,296 @@
+/*****************************************************************************
+ * alloc_map.c                                                               *
+ *                                                                           *
+ * This file contains implementations for functions tracking sector ranges   *
+ * the guest has just allocated.  Ranges are disjoint and kept sorted in one *
+ * array, so a lookup is a binary search and neighbours merge on insert.     *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_map.h"
+
+#define ALLOC_MAP_INITIAL_RANGES 64
+
+struct alloc_range
+{
+    uint64_t start;
+    uint64_t end;
+    uint64_t group;
+};
+
+struct alloc_map
+{
+    pthread_mutex_t lock;
+    struct alloc_range* ranges;
+    size_t len;
+    size_t cap;
+    size_t max;
+    struct alloc_map_stats stats;
+};
+
+/* the first range ending after sector */
+static size_t __search(struct alloc_map* map, uint64_t sector)
+{
+    size_t low = 0, high = map->len, mid;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+
+        if (map->ranges[mid].end <= sector)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static void __insert(struct alloc_map* map, size_t i,
+                     const struct alloc_range* range)
+{
+    memmove(&(map->ranges[i + 1]), &(map->ranges[i]),
+            (map->len - i) * sizeof(struct alloc_range));
+    map->ranges[i] = *range;
+    map->len++;
+}
+
+static void __delete(struct alloc_map* map, size_t i)
+{
+    memmove(&(map->ranges[i]), &(map->ranges[i + 1]),
+            (map->len - i - 1) * sizeof(struct alloc_range));
+    map->len--;
+}
+
+/* room for count more ranges; an add needs two, a split one */
+static bool __reserve(struct alloc_map* map, size_t count)
+{
+    struct alloc_range* ranges;
+    size_t cap;
+
+    if (map->len + count > map->max)
+        return false;
+
+    if (map->len + count <= map->cap)
+        return true;
+
+    cap = map->cap * 2 < map->max ? map->cap * 2 : map->max;
+
+    if ((ranges = (struct alloc_range*)
+                  realloc(map->ranges, cap * sizeof(struct alloc_range)))
+        == NULL)
+        return false;
+
+    map->ranges = ranges;
+    map->cap = cap;
+
+    return true;
+}
+
+static uint64_t __remove(struct alloc_map* map, uint64_t start, uint64_t end)
+{
+    struct alloc_range* range, split;
+    uint64_t removed = 0;
+    size_t i = __search(map, start);
+
+    while (i < map->len && map->ranges[i].start < end)
+    {
+        range = &(map->ranges[i]);
+
+        if (range->start < start && range->end > end)
+        {
+            /* with no room to split, the tail is forgotten as well */
+            if (!__reserve(map, 1))
+            {
+                removed += map->ranges[i].end - start;
+                map->ranges[i].end = start;
+                break;
+            }
+
+            split = map->ranges[i];
+            split.start = end;
+            map->ranges[i].end = start;
+            __insert(map, i + 1, &split);
+            removed += end - start;
+            break;
+        }
+        else if (range->start < start)
+        {
+            removed += range->end - start;
+            range->end = start;
+            i++;
+        }
+        else if (range->end > end)
+        {
+            removed += end - range->start;
+            range->start = end;
+            break;
+        }
+        else
+        {
+            removed += range->end - range->start;
+            __delete(map, i);
+        }
+    }
+
+    map->stats.sectors -= removed;
+
+    return removed;
+}
+
+struct alloc_map* alloc_map_init(size_t max_ranges)
+{
+    struct alloc_map* map = (struct alloc_map*)
+                            calloc(1, sizeof(struct alloc_map));
+
+    if (map == NULL)
+        return NULL;
+
+    map->max = max_ranges < 2 ? 2 : max_ranges;
+    map->cap = ALLOC_MAP_INITIAL_RANGES < map->max ?
+               ALLOC_MAP_INITIAL_RANGES : map->max;
+
+    if ((map->ranges = (struct alloc_range*)
+                       malloc(map->cap * sizeof(struct alloc_range))) == NULL)
+    {
+        free(map);
+        return NULL;
+    }
+
+    pthread_mutex_init(&(map->lock), NULL);
+
+    return map;
+}
+
+void alloc_map_destroy(struct alloc_map* map)
+{
+    if (map == NULL)
+        return;
+
+    pthread_mutex_destroy(&(map->lock));
+    free(map->ranges);
+    free(map);
+}
+
+int alloc_map_add(struct alloc_map* map, uint64_t group, uint64_t start,
+                  uint64_t end)
+{
+    struct alloc_range range = { start, end, group };
+    struct alloc_range* prev, *next;
+    size_t i;
+
+    if (start >= end)
+        return EXIT_SUCCESS;
+
+    pthread_mutex_lock(&(map->lock));
+
+    if (!__reserve(map, 2))
+    {
+        map->stats.rejected++;
+        pthread_mutex_unlock(&(map->lock));
+        return EXIT_FAILURE;
+    }
+
+    map->stats.added += end - start - __remove(map, start, end);
+    map->stats.sectors += end - start;
+
+    i = __search(map, start);
+    prev = i ? &(map->ranges[i - 1]) : NULL;
+    next = i < map->len ? &(map->ranges[i]) : NULL;
+
+    if (prev && prev->end == start && prev->group == group)
+    {
+        prev->end = end;
+
+        if (next && next->start == end && next->group == group)
+        {
+            prev->end = next->end;
+            __delete(map, i);
+        }
+    }
+    else if (next && next->start == end && next->group == group)
+    {
+        next->start = start;
+    }
+    else
+    {
+        __insert(map, i, &range);
+    }
+
+    map->stats.ranges = map->len;
+    pthread_mutex_unlock(&(map->lock));
+
+    return EXIT_SUCCESS;
+}
+
+uint64_t alloc_map_remove(struct alloc_map* map, uint64_t start,
+                          uint64_t end)
+{
+    uint64_t removed;
+
+    if (start >= end)
+        return 0;
+
+    pthread_mutex_lock(&(map->lock));
+    removed = __remove(map, start, end);
+    map->stats.removed += removed;
+    map->stats.ranges = map->len;
+    pthread_mutex_unlock(&(map->lock));
+
+    return removed;
+}
+
+bool alloc_map_lookup(struct alloc_map* map, uint64_t sector,
+                      uint64_t* group)
+{
+    bool found;
+    size_t i;
+
+    pthread_mutex_lock(&(map->lock));
+
+    i = __search(map, sector);
+
+    if ((found = i < map->len && map->ranges[i].start <= sector))
+    {
+        map->stats.hits++;
+
+        if (group)
+            *group = map->ranges[i].group;
+    }
+    else
+    {
+        map->stats.misses++;
+    }
+
+    pthread_mutex_unlock(&(map->lock));
+
+    return found;
+}
+
+void alloc_map_get_stats(struct alloc_map* map,
+                         struct alloc_map_stats* stats)
+{
+    pthread_mutex_lock(&(map->lock));
+    *stats = map->stats;
+    pthread_mutex_unlock(&(map->lock));
+}
@@ -1,10 +1,103 @@
-check_PROGRAMS		+= bin/test/bitarray-test
-noinst_LTLIBRARIES 	+= lib/libbitarray.la
+check_PROGRAMS		+= bin/test/alloc_map-test \
+					   bin/test/bitarray-test \
+					   bin/test/clock_cache-test \
+					   bin/test/coalesce-test \
+					   bin/test/kv_mem-test \
+					   bin/test/mpscq-test \
+					   bin/test/pending_cache-test \
+					   bin/test/shmring-test \
+					   bin/test/sector_index-test \
+					   bin/test/shadow_store-test \
+					   bin/test/spillq-test
+noinst_LTLIBRARIES 	+= lib/liballoc_map.la \
+					   lib/libbitarray.la \
+					   lib/libclock_cache.la \
+					   lib/libcoalesce.la \
+					   lib/libkv_mem.la \
+					   lib/libmpscq.la \
+					   lib/libpending_cache.la \
+					   lib/libshmring.la \
+					   lib/libsector_index.la \
+					   lib/libshadow_store.la \
+					   lib/libspillq.la
+
+lib_liballoc_map_la_SOURCES = src/datastructures/alloc_map.c
+lib_liballoc_map_la_LIBADD  = -lpthread
 
 lib_libbitarray_la_SOURCES = src/datastructures/bitarray.c
 lib_libbitarray_la_LIBADD  = $(libdir)/libcolor.la \
 							 $(libdir)/libbson.la \
 							 $(libdir)/libutil.la
 
+lib_libclock_cache_la_SOURCES = src/datastructures/clock_cache.c
+lib_libclock_cache_la_LIBADD  = -lpthread
+
+lib_libcoalesce_la_SOURCES = src/datastructures/coalesce.c
+lib_libcoalesce_la_LIBADD  = $(libdir)/libcolor.la \
+							 $(libdir)/libutil.la
+
+lib_libkv_mem_la_SOURCES = src/datastructures/kv_mem.c
+lib_libkv_mem_la_LIBADD  = $(libdir)/libcolor.la \
+						   -lpthread
+
+lib_libmpscq_la_SOURCES = src/datastructures/mpscq.c
+
+lib_libpending_cache_la_SOURCES = src/datastructures/pending_cache.c
+lib_libpending_cache_la_LIBADD  = $(libdir)/libclock_cache.la
+
+lib_libshmring_la_SOURCES = src/datastructures/shmring.c
+lib_libshmring_la_LIBADD  = $(libdir)/libcolor.la \
+							$(libdir)/libutil.la \
+							-lrt \
+							-lpthread
+
+lib_libsector_index_la_SOURCES = src/datastructures/sector_index.c
+lib_libsector_index_la_LIBADD  = $(libdir)/libcolor.la \
+								 -lpthread
+
+lib_libshadow_store_la_SOURCES = src/datastructures/shadow_store.c
+lib_libshadow_store_la_LIBADD  = $(libdir)/libclock_cache.la
+
+lib_libspillq_la_SOURCES = src/datastructures/spillq.c
+lib_libspillq_la_LIBADD  = $(libdir)/libcolor.la \
+						   $(libdir)/libutil.la \
+						   -lpthread
+
+bin_test_alloc_map_test_SOURCES = src/datastructures/alloc_map-test.c
+bin_test_alloc_map_test_LDADD   = $(libdir)/liballoc_map.la \
+								  $(libdir)/libcolor.la
+
 bin_test_bitarray_test_SOURCES = src/datastructures/bitarray-test.c
 bin_test_bitarray_test_LDADD   = $(libdir)/libbitarray.la
+
+bin_test_clock_cache_test_SOURCES = src/datastructures/clock_cache-test.c
+bin_test_clock_cache_test_LDADD   = $(libdir)/libclock_cache.la \
+									$(libdir)/libcolor.la
+
+bin_test_coalesce_test_SOURCES = src/datastructures/coalesce-test.c
+bin_test_coalesce_test_LDADD   = $(libdir)/libcoalesce.la
+
+bin_test_kv_mem_test_SOURCES = src/datastructures/kv_mem-test.c
+bin_test_kv_mem_test_LDADD   = $(libdir)/libkv_mem.la
+
+bin_test_mpscq_test_SOURCES = src/datastructures/mpscq-test.c
+bin_test_mpscq_test_LDADD   = $(libdir)/libmpscq.la \
+							  $(libdir)/libcolor.la \
+							  -lpthread
+
+bin_test_pending_cache_test_SOURCES = src/datastructures/pending_cache-test.c
+bin_test_pending_cache_test_LDADD   = $(libdir)/libpending_cache.la \
+									  $(libdir)/libcolor.la
+
+bin_test_shmring_test_SOURCES = src/datastructures/shmring-test.c
+bin_test_shmring_test_LDADD   = $(libdir)/libshmring.la
+
+bin_test_sector_index_test_SOURCES = src/datastructures/sector_index-test.c
+bin_test_sector_index_test_LDADD   = $(libdir)/libsector_index.la
+
+bin_test_shadow_store_test_SOURCES = src/datastructures/shadow_store-test.c
+bin_test_shadow_store_test_LDADD   = $(libdir)/libshadow_store.la \
+									 $(libdir)/libcolor.la
+
+bin_test_spillq_test_SOURCES = src/datastructures/spillq-test.c
+bin_test_spillq_test_LDADD   = $(libdir)/libspillq.la
@@ -0,0 +1,168 @@
+/*****************************************************************************
+ * clock_cache-test.c                                                        *
+ *                                                                           *
+ * This file contains tests for the byte-budgeted CLOCK hash table under     *
+ * the pending-write cache and the metadata shadow store.                    *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock_cache.h"
+#include "color.h"
+
+#define TEST_BLOCK_SIZE 4096
+#define TEST_BUDGET 8 /* blocks */
+#define TEST_KEYS 4096
+
+void put_blocks(struct clock_cache* cache, uint64_t start, uint64_t end,
+                bool pinned)
+{
+    uint8_t buf[TEST_BLOCK_SIZE];
+    uint64_t i;
+
+    for (i = start; i < end; i++)
+    {
+        memset(buf, (int) (i & 0xff), TEST_BLOCK_SIZE);
+        assert(clock_cache_put(cache, i, buf, TEST_BLOCK_SIZE, pinned) ==
+               EXIT_SUCCESS);
+    }
+}
+
+/* whether key is held, with its fill intact */
+bool check_block(struct clock_cache* cache, uint64_t key)
+{
+    uint8_t buf[TEST_BLOCK_SIZE];
+    size_t len = TEST_BLOCK_SIZE, i;
+
+    if (!clock_cache_get(cache, key, buf, &len))
+        return false;
+
+    assert(len == TEST_BLOCK_SIZE);
+    for (i = 0; i < len; i++)
+        assert(buf[i] == (key & 0xff));
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    struct clock_cache* cache;
+    struct clock_cache_stats stats;
+    uint8_t buf[2 * TEST_BLOCK_SIZE] = { 0 };
+    size_t len;
+    uint64_t i;
+
+    fprintf_blue(stdout, "-- CLOCK Cache Test Suite --\n");
+
+    fprintf_light_blue(stdout, "* test put and get\n");
+    cache = clock_cache_init(TEST_BUDGET * TEST_BLOCK_SIZE);
+    assert(cache != NULL);
+    assert(!check_block(cache, 7));
+    put_blocks(cache, 7, 8, false);
+    assert(check_block(cache, 7));
+    assert(check_block(cache, 7));
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == 1 && stats.bytes == TEST_BLOCK_SIZE);
+    assert(stats.hits == 2 && stats.misses == 1);
+
+    fprintf_light_blue(stdout, "* test take\n");
+    len = sizeof(buf);
+    assert(clock_cache_take(cache, 7, buf, &len) && len == TEST_BLOCK_SIZE);
+    assert(!clock_cache_take(cache, 7, buf, &len));
+    put_blocks(cache, 7, 8, false);
+    len = TEST_BLOCK_SIZE / 2;
+    assert(!clock_cache_take(cache, 7, buf, &len) && len == TEST_BLOCK_SIZE);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == 0 && stats.bytes == 0);
+
+    fprintf_light_blue(stdout, "* test replace and remove\n");
+    put_blocks(cache, 1, 2, false);
+    put_blocks(cache, 1, 2, true);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == 1 && stats.pinned == 1);
+    len = TEST_BLOCK_SIZE / 2;
+    assert(!clock_cache_get(cache, 1, buf, &len) && len == TEST_BLOCK_SIZE);
+    assert(clock_cache_remove(cache, 1));
+    assert(!clock_cache_remove(cache, 1));
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == 0 && stats.pinned == 0 && stats.bytes == 0);
+
+    fprintf_light_blue(stdout, "* test eviction spares referenced entries\n");
+    put_blocks(cache, 0, TEST_BUDGET, false);
+    /* everything is referenced, so the hand clears all and takes key 0 */
+    for (i = 0; i < TEST_BUDGET; i++)
+        assert(check_block(cache, i));
+    put_blocks(cache, TEST_BUDGET, TEST_BUDGET + 1, false);
+    assert(!check_block(cache, 0));
+    /* key 2 is referenced again, so key 1 goes before it */
+    assert(check_block(cache, 2));
+    put_blocks(cache, TEST_BUDGET + 1, TEST_BUDGET + 2, false);
+    assert(!check_block(cache, 1));
+    assert(check_block(cache, 2));
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == TEST_BUDGET && stats.evictions == 2);
+    clock_cache_destroy(cache);
+
+    fprintf_light_blue(stdout, "* test eviction spares pinned entries\n");
+    cache = clock_cache_init(TEST_BUDGET * TEST_BLOCK_SIZE);
+    put_blocks(cache, 100, 102, true);
+    put_blocks(cache, 0, 2 * TEST_BUDGET, false);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.bytes <= TEST_BUDGET * TEST_BLOCK_SIZE);
+    assert(stats.evictions == TEST_BUDGET + 2);
+    assert(stats.pinned_evictions == 0);
+    assert(check_block(cache, 100) && check_block(cache, 101));
+    assert(!check_block(cache, 0));
+    assert(check_block(cache, 2 * TEST_BUDGET - 1));
+
+    fprintf_light_blue(stdout, "* test pinned entries go last\n");
+    put_blocks(cache, 200, 200 + 2 * TEST_BUDGET, true);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == TEST_BUDGET && stats.pinned == TEST_BUDGET);
+    assert(stats.pinned_evictions > 0);
+    assert(check_block(cache, 200 + 2 * TEST_BUDGET - 1));
+
+    fprintf_light_blue(stdout, "* test budget\n");
+    clock_cache_configure(cache, TEST_BLOCK_SIZE);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == 1 && stats.bytes == TEST_BLOCK_SIZE);
+    assert(clock_cache_put(cache, 300, buf, sizeof(buf), false) ==
+           EXIT_FAILURE);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.rejected == 1);
+    clock_cache_destroy(cache);
+
+    fprintf_light_blue(stdout, "* test growth\n");
+    cache = clock_cache_init(TEST_KEYS * TEST_BLOCK_SIZE);
+    for (i = 0; i < TEST_KEYS; i++)
+        put_blocks(cache, i * 256, i * 256 + 1, false);
+    clock_cache_get_stats(cache, &stats);
+    assert(stats.entries == TEST_KEYS && stats.evictions == 0);
+    for (i = 0; i < TEST_KEYS; i++)
+        assert(check_block(cache, i * 256));
+    clock_cache_destroy(cache);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,371 @@
+/*****************************************************************************
+ * clock_cache.c                                                             *
+ *                                                                           *
+ * This file contains implementations for functions keeping byte strings in  *
+ * a hash table under a byte budget.  Entries sit on one ring swept by a     *
+ * CLOCK hand; pinned entries are evicted only once nothing else is left.    *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock_cache.h"
+
+#define CLOCK_CACHE_INITIAL_BITS 10 /* 1024 buckets */
+
+struct clock_entry
+{
+    struct clock_entry* next;       /* hash chain */
+    struct clock_entry* clock_prev;
+    struct clock_entry* clock_next;
+    uint64_t key;
+    bool referenced;
+    bool pinned;
+    size_t len;
+    uint8_t data[];
+};
+
+/* entries sit on one ring swept by the clock hand; a new entry goes in just
+ * behind the hand so it is the last one considered */
+struct clock_cache
+{
+    pthread_mutex_t lock;
+    struct clock_entry** buckets;
+    unsigned int bits;
+    struct clock_entry* hand;
+    size_t budget;
+    struct clock_cache_stats stats;
+};
+
+static size_t __bucket(struct clock_cache* cache, uint64_t key)
+{
+    return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> (64 - cache->bits));
+}
+
+static struct clock_entry** __find(struct clock_cache* cache, uint64_t key)
+{
+    struct clock_entry** entry = &(cache->buckets[__bucket(cache, key)]);
+
+    while (*entry && (*entry)->key != key)
+        entry = &((*entry)->next);
+
+    return entry;
+}
+
+/* doubles the table once it averages one entry per bucket */
+static void __grow(struct clock_cache* cache)
+{
+    struct clock_entry** old = cache->buckets, *entry, *next;
+    size_t i, count = (size_t) 1 << cache->bits;
+    struct clock_entry** buckets;
+    size_t bucket;
+
+    if (cache->stats.entries < count)
+        return;
+
+    if ((buckets = (struct clock_entry**)
+                   calloc(count * 2, sizeof(struct clock_entry*))) == NULL)
+        return;
+
+    cache->buckets = buckets;
+    cache->bits++;
+
+    for (i = 0; i < count; i++)
+    {
+        for (entry = old[i]; entry; entry = next)
+        {
+            next = entry->next;
+            bucket = __bucket(cache, entry->key);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+        }
+    }
+
+    free(old);
+}
+
+static void __unlink(struct clock_cache* cache, struct clock_entry** slot)
+{
+    struct clock_entry* entry = *slot;
+
+    *slot = entry->next;
+
+    if (entry->clock_next == entry)
+    {
+        cache->hand = NULL;
+    }
+    else
+    {
+        entry->clock_prev->clock_next = entry->clock_next;
+        entry->clock_next->clock_prev = entry->clock_prev;
+
+        if (cache->hand == entry)
+            cache->hand = entry->clock_next;
+    }
+
+    cache->stats.entries--;
+    cache->stats.bytes -= entry->len;
+
+    if (entry->pinned)
+        cache->stats.pinned--;
+}
+
+/* referenced entries get a second pass; pinned ones are passed over for as
+ * long as anything unpinned remains */
+static void __evict(struct clock_cache* cache)
+{
+    bool spare_pinned = cache->stats.pinned < cache->stats.entries;
+    struct clock_entry* entry;
+
+    while (1)
+    {
+        entry = cache->hand;
+        cache->hand = entry->clock_next;
+
+        if (spare_pinned && entry->pinned)
+            continue;
+
+        if (entry->referenced)
+        {
+            entry->referenced = false;
+            continue;
+        }
+
+        break;
+    }
+
+    cache->stats.evictions++;
+    cache->stats.evicted_bytes += entry->len;
+
+    if (entry->pinned)
+        cache->stats.pinned_evictions++;
+
+    __unlink(cache, __find(cache, entry->key));
+    free(entry);
+}
+
+struct clock_cache* clock_cache_init(size_t budget)
+{
+    struct clock_cache* cache = (struct clock_cache*)
+                                calloc(1, sizeof(struct clock_cache));
+
+    if (cache == NULL)
+        return NULL;
+
+    cache->bits = CLOCK_CACHE_INITIAL_BITS;
+    cache->buckets = (struct clock_entry**)
+                     calloc((size_t) 1 << cache->bits,
+                            sizeof(struct clock_entry*));
+
+    if (cache->buckets == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+
+    cache->budget = budget;
+    pthread_mutex_init(&(cache->lock), NULL);
+
+    return cache;
+}
+
+void clock_cache_destroy(struct clock_cache* cache)
+{
+    struct clock_entry* entry, *next;
+    size_t i;
+
+    if (cache == NULL)
+        return;
+
+    for (i = 0; i < ((size_t) 1 << cache->bits); i++)
+    {
+        for (entry = cache->buckets[i]; entry; entry = next)
+        {
+            next = entry->next;
+            free(entry);
+        }
+    }
+
+    pthread_mutex_destroy(&(cache->lock));
+    free(cache->buckets);
+    free(cache);
+}
+
+void clock_cache_configure(struct clock_cache* cache, size_t budget)
+{
+    pthread_mutex_lock(&(cache->lock));
+    cache->budget = budget;
+
+    while (cache->stats.bytes > cache->budget)
+        __evict(cache);
+
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+int clock_cache_put(struct clock_cache* cache, uint64_t key,
+                    const uint8_t* data, size_t len, bool pinned)
+{
+    struct clock_entry** slot, *entry, *old;
+    bool referenced = false;
+
+    if ((entry = (struct clock_entry*)
+                 malloc(sizeof(struct clock_entry) + len)) == NULL)
+        return EXIT_FAILURE;
+
+    entry->key = key;
+    entry->pinned = pinned;
+    entry->len = len;
+    memcpy(entry->data, data, len);
+
+    pthread_mutex_lock(&(cache->lock));
+
+    /* a key rewritten while cached is hot, keep it around */
+    if ((old = *(slot = __find(cache, key))))
+    {
+        __unlink(cache, slot);
+        free(old);
+        referenced = true;
+    }
+
+    if (len > cache->budget)
+    {
+        cache->stats.rejected++;
+        pthread_mutex_unlock(&(cache->lock));
+        free(entry);
+        return EXIT_FAILURE;
+    }
+
+    while (cache->stats.bytes + len > cache->budget)
+        __evict(cache);
+
+    entry->referenced = referenced;
+
+    if (cache->hand)
+    {
+        entry->clock_next = cache->hand;
+        entry->clock_prev = cache->hand->clock_prev;
+        cache->hand->clock_prev->clock_next = entry;
+        cache->hand->clock_prev = entry;
+    }
+    else
+    {
+        entry->clock_next = entry->clock_prev = entry;
+        cache->hand = entry;
+    }
+
+    slot = &(cache->buckets[__bucket(cache, key)]);
+    entry->next = *slot;
+    *slot = entry;
+
+    cache->stats.entries++;
+    cache->stats.bytes += len;
+
+    if (pinned)
+        cache->stats.pinned++;
+
+    __grow(cache);
+    pthread_mutex_unlock(&(cache->lock));
+
+    return EXIT_SUCCESS;
+}
+
+bool clock_cache_get(struct clock_cache* cache, uint64_t key, uint8_t* data,
+                     size_t* len)
+{
+    struct clock_entry* entry;
+    bool found = false;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    if ((entry = *__find(cache, key)))
+    {
+        cache->stats.hits++;
+        entry->referenced = true;
+
+        if ((found = entry->len <= *len))
+            memcpy(data, entry->data, entry->len);
+
+        *len = entry->len;
+    }
+    else
+    {
+        cache->stats.misses++;
+    }
+
+    pthread_mutex_unlock(&(cache->lock));
+
+    return found;
+}
+
+bool clock_cache_take(struct clock_cache* cache, uint64_t key, uint8_t* data,
+                      size_t* len)
+{
+    struct clock_entry** slot, *entry;
+    bool found;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    if ((entry = *(slot = __find(cache, key))) == NULL)
+    {
+        cache->stats.misses++;
+        pthread_mutex_unlock(&(cache->lock));
+        return false;
+    }
+
+    cache->stats.hits++;
+    __unlink(cache, slot);
+    pthread_mutex_unlock(&(cache->lock));
+
+    if ((found = entry->len <= *len))
+        memcpy(data, entry->data, entry->len);
+
+    *len = entry->len;
+    free(entry);
+
+    return found;
+}
+
+bool clock_cache_remove(struct clock_cache* cache, uint64_t key)
+{
+    struct clock_entry** slot, *entry;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    if ((entry = *(slot = __find(cache, key))) == NULL)
+    {
+        pthread_mutex_unlock(&(cache->lock));
+        return false;
+    }
+
+    __unlink(cache, slot);
+    pthread_mutex_unlock(&(cache->lock));
+    free(entry);
+
+    return true;
+}
+
+void clock_cache_get_stats(struct clock_cache* cache,
+                           struct clock_cache_stats* stats)
+{
+    pthread_mutex_lock(&(cache->lock));
+    *stats = cache->stats;
+    pthread_mutex_unlock(&(cache->lock));
+}
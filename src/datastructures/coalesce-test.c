@@ -0,0 +1,206 @@
+/*****************************************************************************
+ * coalesce-test.c                                                           *
+ *                                                                           *
+ * This file executes the write-coalescing window to test its merging,       *
+ * extent cap and emit order.                                                *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coalesce.h"
+#include "color.h"
+
+#define TEST_WINDOW_US 60000000 /* never expires during the test */
+#define TEST_MAX_WRITES 8
+#define TEST_CAP_SECTORS (COALESCE_MAX_EXTENT / SECTOR_SIZE)
+
+struct emitted
+{
+    size_t count;
+    int64_t start[TEST_MAX_WRITES];
+    int nb_sectors[TEST_MAX_WRITES];
+    uint8_t* data[TEST_MAX_WRITES];
+};
+
+int record_write(void* ctx, struct qemu_bdrv_write* write)
+{
+    struct emitted* out = (struct emitted*) ctx;
+    size_t len = ((size_t) write->header.nb_sectors) * SECTOR_SIZE;
+
+    assert(out->count < TEST_MAX_WRITES);
+
+    out->start[out->count] = write->header.sector_num;
+    out->nb_sectors[out->count] = write->header.nb_sectors;
+    out->data[out->count] = (uint8_t*) malloc(len);
+    assert(out->data[out->count] != NULL);
+    memcpy(out->data[out->count], write->data, len);
+    out->count++;
+
+    return EXIT_SUCCESS;
+}
+
+void add_write(struct coalescer* window, int64_t sector, int nb_sectors,
+               uint8_t fill)
+{
+    struct qemu_bdrv_write write;
+    uint8_t* data = (uint8_t*) malloc(((size_t) nb_sectors) * SECTOR_SIZE);
+
+    assert(data != NULL);
+    memset(data, fill, ((size_t) nb_sectors) * SECTOR_SIZE);
+
+    write.header.sector_num = sector;
+    write.header.nb_sectors = nb_sectors;
+    write.data = data;
+
+    assert(coalesce_add(window, &write) == EXIT_SUCCESS);
+    free(data);
+}
+
+/* sectors [from, to) of emitted write i all hold fill */
+void check_fill(struct emitted* out, size_t i, int64_t from, int64_t to,
+                uint8_t fill)
+{
+    size_t j;
+
+    for (j = (from - out->start[i]) * SECTOR_SIZE;
+         j < (to - out->start[i]) * SECTOR_SIZE; j++)
+        assert(out->data[i][j] == fill);
+}
+
+void flush(struct coalescer* window, struct emitted* out)
+{
+    size_t i;
+
+    for (i = 0; i < out->count; i++)
+        free(out->data[i]);
+
+    memset(out, 0, sizeof(struct emitted));
+    assert(coalesce_flush(window, record_write, out) == EXIT_SUCCESS);
+}
+
+int main(int argc, char* argv[])
+{
+    struct coalescer* window;
+    struct coalesce_stats stats;
+    struct emitted out = { 0 };
+
+    fprintf_blue(stdout, "-- Coalescing Window Test Suite --\n");
+
+    fprintf_light_blue(stdout, "* test empty window\n");
+    window = coalesce_init(TEST_WINDOW_US, 0);
+    assert(window != NULL);
+    assert(!coalesce_ready(window));
+    assert(coalesce_remaining(window) == -1);
+    flush(window, &out);
+    assert(out.count == 0);
+
+    fprintf_light_blue(stdout, "* test emit in arrival order\n");
+    add_write(window, 100, 8, 'a');
+    add_write(window, 10, 8, 'b');
+    add_write(window, 50, 8, 'c');
+    assert(coalesce_remaining(window) > 0);
+    flush(window, &out);
+    assert(out.count == 3);
+    assert(out.start[0] == 100 && out.start[1] == 10 && out.start[2] == 50);
+    check_fill(&out, 0, 100, 108, 'a');
+    check_fill(&out, 1, 10, 18, 'b');
+    check_fill(&out, 2, 50, 58, 'c');
+
+    fprintf_light_blue(stdout, "* test overlap, newer data wins\n");
+    add_write(window, 0, 8, 'a');
+    add_write(window, 4, 8, 'b');
+    flush(window, &out);
+    assert(out.count == 1);
+    assert(out.start[0] == 0 && out.nb_sectors[0] == 12);
+    check_fill(&out, 0, 0, 4, 'a');
+    check_fill(&out, 0, 4, 12, 'b');
+
+    fprintf_light_blue(stdout, "* test rewrite in place\n");
+    add_write(window, 0, 16, 'a');
+    add_write(window, 4, 4, 'b');
+    flush(window, &out);
+    assert(out.count == 1 && out.nb_sectors[0] == 16);
+    check_fill(&out, 0, 0, 4, 'a');
+    check_fill(&out, 0, 4, 8, 'b');
+    check_fill(&out, 0, 8, 16, 'a');
+
+    fprintf_light_blue(stdout, "* test merged extent keeps oldest order\n");
+    add_write(window, 16, 8, 'a');
+    add_write(window, 100, 8, 'b');
+    add_write(window, 8, 8, 'c');
+    add_write(window, 24, 8, 'd');
+    flush(window, &out);
+    assert(out.count == 2);
+    assert(out.start[0] == 8 && out.nb_sectors[0] == 24);
+    assert(out.start[1] == 100);
+    check_fill(&out, 0, 8, 16, 'c');
+    check_fill(&out, 0, 16, 24, 'a');
+    check_fill(&out, 0, 24, 32, 'd');
+
+    fprintf_light_blue(stdout, "* test adjacent merges stop at the cap\n");
+    add_write(window, 0, TEST_CAP_SECTORS, 'a');
+    add_write(window, TEST_CAP_SECTORS, 8, 'b');
+    flush(window, &out);
+    assert(out.count == 2);
+    assert(out.start[0] == 0 && out.nb_sectors[0] == TEST_CAP_SECTORS);
+    assert(out.start[1] == TEST_CAP_SECTORS && out.nb_sectors[1] == 8);
+
+    fprintf_light_blue(stdout, "* test overlaps merge past the cap\n");
+    add_write(window, 0, TEST_CAP_SECTORS, 'a');
+    add_write(window, TEST_CAP_SECTORS - 2, 8, 'b');
+    flush(window, &out);
+    assert(out.count == 1);
+    assert(out.nb_sectors[0] == TEST_CAP_SECTORS + 6);
+    check_fill(&out, 0, TEST_CAP_SECTORS - 4, TEST_CAP_SECTORS - 2, 'a');
+    check_fill(&out, 0, TEST_CAP_SECTORS - 2, TEST_CAP_SECTORS + 6, 'b');
+
+    fprintf_light_blue(stdout, "* test stats\n");
+    coalesce_get_stats(window, &stats);
+    assert(stats.writes_in == 15);
+    assert(stats.writes_out == 10);
+    assert(stats.bytes_in == (2 * TEST_CAP_SECTORS + 108) * SECTOR_SIZE);
+    assert(stats.bytes_out == (2 * TEST_CAP_SECTORS + 98) * SECTOR_SIZE);
+    coalesce_destroy(window);
+
+    fprintf_light_blue(stdout, "* test byte budget\n");
+    window = coalesce_init(TEST_WINDOW_US, 16 * SECTOR_SIZE);
+    add_write(window, 0, 8, 'a');
+    assert(!coalesce_ready(window));
+    add_write(window, 0, 8, 'b');
+    assert(coalesce_ready(window));
+    flush(window, &out);
+    assert(out.count == 1 && !coalesce_ready(window));
+    coalesce_destroy(window);
+
+    fprintf_light_blue(stdout, "* test time budget\n");
+    window = coalesce_init(0, 0);
+    add_write(window, 0, 8, 'a');
+    assert(coalesce_remaining(window) == 0 && coalesce_ready(window));
+    flush(window, &out);
+    flush(window, &out);
+    coalesce_destroy(window);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+/*****************************************************************************
+ * coalesce.c                                                                *
+ *                                                                           *
+ * This file contains implementations for functions implementing a window    *
+ * which merges overlapping and adjacent QEMU writes, keeping the last write *
+ * for each sector, before they are handed on for inference.                 *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "coalesce.h"
+#include "color.h"
+#include "util.h"
+
+#define COALESCE_INITIAL_EXTENTS 64
+
+/* extents are kept sorted by start sector and never overlap or touch, seq is
+ * the arrival order of the oldest write merged into the extent */
+struct coalesce_extent
+{
+    int64_t start;
+    uint64_t nb_sectors;
+    uint64_t seq;
+    uint8_t* data;
+};
+
+struct coalescer
+{
+    struct coalesce_extent* extents;
+    size_t count;
+    size_t capacity;
+    uint64_t window_us;
+    uint64_t window_bytes;
+    uint64_t bytes;
+    uint64_t seq;
+    struct timeval opened;
+    struct coalesce_stats stats;
+};
+
+static int64_t __extent_end(struct coalesce_extent* extent)
+{
+    return extent->start + (int64_t) extent->nb_sectors;
+}
+
+static int __seq_compare(const void* a, const void* b)
+{
+    const struct coalesce_extent* x = (const struct coalesce_extent*) a;
+    const struct coalesce_extent* y = (const struct coalesce_extent*) b;
+
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/* first extent whose end reaches sector, i.e. overlapping or adjacent */
+static size_t __find_extent(struct coalescer* window, int64_t sector)
+{
+    size_t lo = 0, hi = window->count, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (__extent_end(&(window->extents[mid])) < sector)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int __reserve(struct coalescer* window)
+{
+    struct coalesce_extent* extents;
+
+    if (window->count < window->capacity)
+        return EXIT_SUCCESS;
+
+    extents = (struct coalesce_extent*)
+              realloc(window->extents, 2 * window->capacity *
+                                       sizeof(struct coalesce_extent));
+
+    if (extents == NULL)
+        return EXIT_FAILURE;
+
+    window->extents = extents;
+    window->capacity *= 2;
+
+    return EXIT_SUCCESS;
+}
+
+struct coalescer* coalesce_init(uint64_t window_us, uint64_t window_bytes)
+{
+    struct coalescer* window = (struct coalescer*)
+                               calloc(1, sizeof(struct coalescer));
+
+    if (window == NULL)
+        return NULL;
+
+    window->extents = (struct coalesce_extent*)
+                      malloc(COALESCE_INITIAL_EXTENTS *
+                             sizeof(struct coalesce_extent));
+
+    if (window->extents == NULL)
+    {
+        free(window);
+        return NULL;
+    }
+
+    window->capacity = COALESCE_INITIAL_EXTENTS;
+    window->window_us = window_us;
+    window->window_bytes = window_bytes ? window_bytes :
+                                          COALESCE_DEFAULT_BYTES;
+
+    return window;
+}
+
+void coalesce_destroy(struct coalescer* window)
+{
+    size_t i;
+
+    if (window)
+    {
+        for (i = 0; i < window->count; i++)
+            free(window->extents[i].data);
+
+        free(window->extents);
+        free(window);
+    }
+}
+
+static int __add(struct coalescer* window, struct qemu_bdrv_write* write)
+{
+    struct coalesce_extent* extents = window->extents;
+    struct coalesce_extent merged;
+    int64_t start = write->header.sector_num;
+    int64_t end = start + write->header.nb_sectors;
+    size_t len = ((size_t) write->header.nb_sectors) * SECTOR_SIZE;
+    size_t lo, hi, i;
+
+    if (window->count == 0)
+        gettimeofday(&(window->opened), NULL);
+
+    lo = __find_extent(window, start);
+    hi = lo;
+
+    while (hi < window->count && extents[hi].start <= end)
+        hi++;
+
+    /* rewrite of a block already in the window, the hot path */
+    if (hi == lo + 1 && extents[lo].start <= start &&
+        __extent_end(&(extents[lo])) >= end)
+    {
+        memcpy(&(extents[lo].data[(start - extents[lo].start) *
+                                  SECTOR_SIZE]), write->data, len);
+        return EXIT_SUCCESS;
+    }
+
+    /* only merely touching neighbours are optional, keep extents bounded */
+    if (hi > lo)
+    {
+        merged.start = start < extents[lo].start ? start : extents[lo].start;
+        merged.nb_sectors = (end > __extent_end(&(extents[hi - 1])) ?
+                             end : __extent_end(&(extents[hi - 1]))) -
+                            merged.start;
+
+        if (merged.nb_sectors * SECTOR_SIZE > COALESCE_MAX_EXTENT)
+        {
+            if (__extent_end(&(extents[lo])) == start)
+                lo++;
+            if (hi > lo && extents[hi - 1].start == end)
+                hi--;
+        }
+    }
+
+    if (hi == lo)
+    {
+        if (__reserve(window))
+            return EXIT_FAILURE;
+
+        extents = window->extents;
+        merged.start = start;
+        merged.nb_sectors = write->header.nb_sectors;
+        merged.seq = window->seq++;
+
+        if ((merged.data = (uint8_t*) malloc(len)) == NULL)
+            return EXIT_FAILURE;
+
+        memcpy(merged.data, write->data, len);
+        memmove(&(extents[lo + 1]), &(extents[lo]),
+                (window->count - lo) * sizeof(struct coalesce_extent));
+        extents[lo] = merged;
+        window->count++;
+
+        return EXIT_SUCCESS;
+    }
+
+    merged.start = start < extents[lo].start ? start : extents[lo].start;
+    merged.nb_sectors = (end > __extent_end(&(extents[hi - 1])) ?
+                         end : __extent_end(&(extents[hi - 1]))) -
+                        merged.start;
+    merged.seq = window->seq++;
+
+    if ((merged.data = (uint8_t*) malloc(merged.nb_sectors * SECTOR_SIZE)) ==
+        NULL)
+        return EXIT_FAILURE;
+
+    /* older data first, then the new write over it */
+    for (i = lo; i < hi; i++)
+    {
+        memcpy(&(merged.data[(extents[i].start - merged.start) *
+                             SECTOR_SIZE]),
+               extents[i].data, extents[i].nb_sectors * SECTOR_SIZE);
+
+        if (extents[i].seq < merged.seq)
+            merged.seq = extents[i].seq;
+
+        free(extents[i].data);
+    }
+
+    memcpy(&(merged.data[(start - merged.start) * SECTOR_SIZE]), write->data,
+           len);
+
+    extents[lo] = merged;
+    memmove(&(extents[lo + 1]), &(extents[hi]),
+            (window->count - hi) * sizeof(struct coalesce_extent));
+    window->count -= hi - lo - 1;
+
+    return EXIT_SUCCESS;
+}
+
+/* a write that could not be held is left to the caller, so is not counted */
+int coalesce_add(struct coalescer* window, struct qemu_bdrv_write* write)
+{
+    size_t len = ((size_t) write->header.nb_sectors) * SECTOR_SIZE;
+
+    if (__add(window, write))
+        return EXIT_FAILURE;
+
+    window->stats.writes_in++;
+    window->stats.bytes_in += len;
+    window->bytes += len;
+
+    return EXIT_SUCCESS;
+}
+
+bool coalesce_ready(struct coalescer* window)
+{
+    return window->count &&
+           (window->bytes >= window->window_bytes ||
+            coalesce_remaining(window) == 0);
+}
+
+int64_t coalesce_remaining(struct coalescer* window)
+{
+    struct timeval now;
+    uint64_t elapsed;
+
+    if (window->count == 0)
+        return -1;
+
+    gettimeofday(&now, NULL);
+    elapsed = diff_time(window->opened, now);
+
+    return elapsed >= window->window_us ? 0 : window->window_us - elapsed;
+}
+
+int coalesce_flush(struct coalescer* window, coalesce_emit emit, void* ctx)
+{
+    struct qemu_bdrv_write write;
+    int ret = EXIT_SUCCESS;
+    size_t i;
+
+    /* emit in arrival order so the inferencer sees causally ordered data */
+    qsort(window->extents, window->count, sizeof(struct coalesce_extent),
+          __seq_compare);
+
+    for (i = 0; i < window->count; i++)
+    {
+        write.header.sector_num = window->extents[i].start;
+        write.header.nb_sectors = (int) window->extents[i].nb_sectors;
+        write.data = window->extents[i].data;
+
+        if (emit(ctx, &write))
+            ret = EXIT_FAILURE;
+
+        window->stats.writes_out++;
+        window->stats.bytes_out += window->extents[i].nb_sectors *
+                                   SECTOR_SIZE;
+        free(window->extents[i].data);
+    }
+
+    window->count = 0;
+    window->bytes = 0;
+    window->seq = 0;
+
+    return ret;
+}
+
+void coalesce_get_stats(struct coalescer* window,
+                        struct coalesce_stats* stats)
+{
+    *stats = window->stats;
+}
@@ -0,0 +1,227 @@
+/*****************************************************************************
+ * kv_mem-test.c                                                             *
+ *                                                                           *
+ * This file contains tests for the embedded in-memory key-value engine.     *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "kv_mem.h"
+
+#define TEST_STORE "/tmp/kv_mem-test.store"
+#define TEST_KEYS 10000
+
+/* encodes the space separated words of cmd as a RESP command */
+char* encode(const char* cmd)
+{
+    static char buf[4096];
+    char words[1024], *word, *save;
+    size_t len = 0;
+    int argc = 0;
+    const char* p;
+
+    for (p = cmd; *p; p++)
+        argc += (*p != ' ' && (p == cmd || p[-1] == ' '));
+
+    len += sprintf(&(buf[len]), "*%d\r\n", argc);
+    strcpy(words, cmd);
+
+    for (word = strtok_r(words, " ", &save); word;
+         word = strtok_r(NULL, " ", &save))
+        len += sprintf(&(buf[len]), "$%zu\r\n%s\r\n", strlen(word), word);
+
+    return buf;
+}
+
+void expect(struct kv_mem* mem, int* db, const char* cmd, const char* reply)
+{
+    uint8_t* out;
+    size_t len;
+    char* encoded = encode(cmd);
+
+    assert(kv_mem_execute(mem, db, (uint8_t*) encoded, strlen(encoded), &out,
+                          &len) == EXIT_SUCCESS);
+
+    if (len != strlen(reply) || memcmp(out, reply, len))
+    {
+        fprintf_light_red(stderr, "%s -> %.*s\n", cmd, (int) len, out);
+        assert(false);
+    }
+
+    free(out);
+}
+
+int main(int argc, char* argv[])
+{
+    struct kv_mem* mem = kv_mem_init(NULL);
+    char cmd[64], reply[64];
+    uint8_t* out;
+    size_t len;
+    pid_t child;
+    FILE* file;
+    int db = 0, i, status;
+
+    fprintf_blue(stdout, "-- KV Mem Test Suite --\n");
+    assert(mem != NULL);
+
+    fprintf_light_blue(stdout, "* test strings\n");
+    expect(mem, &db, "GET missing", "$-1\r\n");
+    expect(mem, &db, "SET sector:5 start:0:end:4096:file:1", "+OK\r\n");
+    expect(mem, &db, "GET sector:5", "$23\r\nstart:0:end:4096:file:1\r\n");
+    expect(mem, &db, "MGET sector:5 missing", "*2\r\n$23\r\n"
+                     "start:0:end:4096:file:1\r\n$-1\r\n");
+    expect(mem, &db, "INCR counter", ":1\r\n");
+    expect(mem, &db, "INCR counter", ":2\r\n");
+    expect(mem, &db, "SETBIT bits 9 1", ":0\r\n");
+    expect(mem, &db, "GETBIT bits 9", ":1\r\n");
+    expect(mem, &db, "GETBIT bits 8", ":0\r\n");
+    expect(mem, &db, "DEL sector:5 missing", ":1\r\n");
+
+    fprintf_light_blue(stdout, "* test hashes\n");
+    expect(mem, &db, "HSET file:1 path /a", ":1\r\n");
+    expect(mem, &db, "HMSET file:1 path /b size 10", "+OK\r\n");
+    expect(mem, &db, "HMGET file:1 path size none",
+                     "*3\r\n$2\r\n/b\r\n$2\r\n10\r\n$-1\r\n");
+    expect(mem, &db, "GET file:1", "-WRONGTYPE Operation against a key "
+                     "holding the wrong kind of value\r\n");
+
+    fprintf_light_blue(stdout, "* test lists\n");
+    expect(mem, &db, "RPUSH l b c", ":2\r\n");
+    expect(mem, &db, "LPUSH l a", ":3\r\n");
+    expect(mem, &db, "LINSERT l AFTER b x", ":4\r\n");
+    expect(mem, &db, "LRANGE l 0 -1",
+                     "*4\r\n$1\r\na\r\n$1\r\nb\r\n$1\r\nx\r\n$1\r\nc\r\n");
+    expect(mem, &db, "LSET l -1 z", "+OK\r\n");
+    expect(mem, &db, "LINDEX l 3", "$1\r\nz\r\n");
+    expect(mem, &db, "LTRIM l 1 2", "+OK\r\n");
+    expect(mem, &db, "RPOP l", "$1\r\nx\r\n");
+    expect(mem, &db, "BRPOP l 1", "*2\r\n$1\r\nl\r\n$1\r\nb\r\n");
+    expect(mem, &db, "LLEN l", ":0\r\n");
+    expect(mem, &db, "EXISTS l", ":0\r\n");
+    expect(mem, &db, "RPUSH r a b a c a", ":5\r\n");
+    expect(mem, &db, "LREM r -1 a", ":1\r\n");
+    expect(mem, &db, "LREM r 1 a", ":1\r\n");
+    expect(mem, &db, "LRANGE r 0 -1",
+                     "*3\r\n$1\r\nb\r\n$1\r\na\r\n$1\r\nc\r\n");
+    expect(mem, &db, "LREM r 0 b", ":1\r\n");
+    expect(mem, &db, "LREM r 0 a", ":1\r\n");
+    expect(mem, &db, "LREM r 0 c", ":1\r\n");
+    expect(mem, &db, "EXISTS r", ":0\r\n");
+
+    for (i = 0; i < TEST_KEYS; i++)
+    {
+        snprintf(cmd, sizeof(cmd), "LPUSH big %d", i);
+        snprintf(reply, sizeof(reply), ":%d\r\n", i + 1);
+        expect(mem, &db, cmd, reply);
+    }
+    expect(mem, &db, "LINDEX big 0", "$4\r\n9999\r\n");
+    expect(mem, &db, "RPOP big", "$1\r\n0\r\n");
+
+    fprintf_light_blue(stdout, "* test sets\n");
+    expect(mem, &db, "SADD s1 a b c", ":3\r\n");
+    expect(mem, &db, "SADD s2 b", ":1\r\n");
+    expect(mem, &db, "SREM s1 c", ":1\r\n");
+    expect(mem, &db, "SDIFF s1 s2", "*1\r\n$1\r\na\r\n");
+
+    fprintf_light_blue(stdout, "* test databases and pipelines\n");
+    expect(mem, &db, "SELECT 3", "+OK\r\n");
+    assert(db == 3);
+    expect(mem, &db, "GET counter", "$-1\r\n");
+    len = strlen(encode("SET k v"));
+    memcpy(cmd, encode("SET k v"), len);
+    memcpy(&(cmd[len]), encode("GET k"), strlen(encode("GET k")));
+    len += strlen(encode("GET k"));
+    assert(kv_mem_execute(mem, &db, (uint8_t*) cmd, len, &out, &len) ==
+           EXIT_SUCCESS);
+    assert(len == 12 && memcmp(out, "+OK\r\n$1\r\nv\r\n", len) == 0);
+    free(out);
+    assert(kv_mem_execute(mem, &db, (uint8_t*) "*1\r\n$3\r\nGE", 10, &out,
+                          &len) == EXIT_FAILURE);
+    expect(mem, &db, "EVAL x 0", "-ERR unknown command 'EVAL'\r\n");
+
+    fprintf_light_blue(stdout, "* test reopening a store file\n");
+    kv_mem_destroy(mem);
+    unlink(TEST_STORE);
+    mem = kv_mem_init(TEST_STORE);
+    db = 0;
+    expect(mem, &db, "SET a 1", "+OK\r\n");
+    expect(mem, &db, "RPUSH q x y", ":2\r\n");
+    expect(mem, &db, "HSET h f v", ":1\r\n");
+    expect(mem, &db, "SELECT 12", "+OK\r\n");
+    expect(mem, &db, "SADD s m", ":1\r\n");
+    assert(kv_mem_save(mem) == EXIT_SUCCESS);
+    kv_mem_destroy(mem);
+
+    mem = kv_mem_init(TEST_STORE);
+    assert(mem != NULL);
+    db = 0;
+    assert(kv_mem_keys(mem, 0) == 3 && kv_mem_keys(mem, 12) == 1);
+    expect(mem, &db, "LRANGE q 0 -1", "*2\r\n$1\r\nx\r\n$1\r\ny\r\n");
+    expect(mem, &db, "HGET h f", "$1\r\nv\r\n");
+    expect(mem, &db, "SELECT 12", "+OK\r\n");
+    expect(mem, &db, "SMEMBERS s", "*1\r\n$1\r\nm\r\n");
+
+    fprintf_light_blue(stdout, "* test processes sharing a store file\n");
+    db = 0;
+    child = fork();
+    assert(child >= 0);
+
+    if (child == 0)
+    {
+        /* attaches on its own, then dies without detaching */
+        mem = kv_mem_init(TEST_STORE);
+        assert(mem != NULL);
+        expect(mem, &db, "HSET h g w", ":1\r\n");
+        sleep(1);
+        expect(mem, &db, "RPUSH wake 1", ":1\r\n");
+        _exit(EXIT_SUCCESS);
+    }
+
+    expect(mem, &db, "BRPOP wake 10", "*2\r\n$4\r\nwake\r\n$1\r\n1\r\n");
+    assert(waitpid(child, &status, 0) == child && WIFEXITED(status) &&
+           WEXITSTATUS(status) == EXIT_SUCCESS);
+    expect(mem, &db, "HGET h g", "$1\r\nw\r\n");
+    kv_mem_destroy(mem);
+
+    mem = kv_mem_init(TEST_STORE);
+    assert(mem != NULL && kv_mem_keys(mem, 0) == 3);
+    kv_mem_destroy(mem);
+    unlink(TEST_STORE);
+
+    fprintf_light_blue(stdout, "* test refusing a foreign file\n");
+    file = fopen(TEST_STORE, "w");
+    assert(file != NULL);
+    for (i = 0; i < 64; i++)
+        fputs("*1\r\n$4\r\nPING\r\n", file);
+    fclose(file);
+    assert(kv_mem_init(TEST_STORE) == NULL);
+    unlink(TEST_STORE);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1999 @@
+/*****************************************************************************
+ * kv_mem.c                                                                  *
+ *                                                                           *
+ * This file contains implementations for functions implementing an          *
+ * embedded key-value engine which speaks the Redis protocol, with strings,  *
+ * hashes, lists and sets, kept in a shared mapping that several processes   *
+ * can attach to, optionally backed by a file.                               *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "kv_mem.h"
+
+#define KV_MEM_MAGIC 0x314d454d564b5947ULL /* "GYKVMEM1" */
+#define KV_MEM_MAX_BYTES (64ULL << 30) /* address space to reserve */
+#define KV_MEM_MIN_BYTES (16ULL << 20) /* smallest reservation accepted */
+#define KV_MEM_INITIAL_BYTES (1ULL << 20)
+#define KV_MEM_MIN_CLASS 5 /* 32 byte blocks */
+#define KV_MEM_CLASSES 64
+#define KV_MEM_INITIAL_BUCKETS 16
+#define KV_MEM_INITIAL_LIST 8
+#define KV_MEM_INITIAL_OUT 256
+#define KV_MEM_INT_MAX 32 /* longest decimal integer argument */
+
+enum KV_MEM_TYPE
+{
+    KV_MEM_STRING,
+    KV_MEM_HASH,
+    KV_MEM_LIST,
+    KV_MEM_SET
+};
+
+/* every process maps the store at its own address, so everything kept in
+ * the store links by byte offset from the start of the mapping; 0 is the
+ * header and doubles as the NULL offset */
+typedef uint64_t kv_off;
+
+/* a request argument, pointing into the caller's buffer */
+struct kv_buf
+{
+    uint8_t* data;
+    size_t len;
+};
+
+/* a binary string kept in the store */
+struct kv_str
+{
+    kv_off data;
+    uint64_t len;
+};
+
+struct kv_mem_entry
+{
+    kv_off next;
+    uint64_t hash;
+    struct kv_str key;
+    kv_off value;
+};
+
+/* chained hash table keyed by binary strings; it is the keyspace of a
+ * database, the field table of a hash and the member table of a set */
+struct kv_mem_dict
+{
+    kv_off buckets;
+    uint64_t nbuckets;
+    uint64_t count;
+};
+
+/* circular deque so both LPUSH and RPOP stay O(1) */
+struct kv_mem_list
+{
+    kv_off items;
+    uint64_t head;
+    uint64_t count;
+    uint64_t capacity;
+};
+
+struct kv_mem_value
+{
+    uint64_t type;
+    union
+    {
+        struct kv_str str;
+        kv_off dict;
+        kv_off list;
+    } u;
+};
+
+/* start of the shared mapping; the lock and condition variable are process
+ * shared, and the lock is robust so a crashed process does not wedge the
+ * others */
+struct kv_mem_header
+{
+    uint64_t magic;
+    uint64_t limit; /* bytes every attached process reserves */
+    uint64_t size;  /* bytes backed by the file */
+    uint64_t used;  /* allocation frontier */
+    kv_off free[KV_MEM_CLASSES];
+    kv_off dbs[KV_MEM_DATABASES];
+    pthread_mutex_t lock;
+    pthread_cond_t pushed;
+};
+
+/* one process's view of a store */
+struct kv_mem
+{
+    struct kv_mem_header* hdr;
+    uint64_t limit;
+    int fd;
+    char* path;
+};
+
+struct kv_out
+{
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+    bool oom;
+};
+
+typedef void (*kv_mem_free_value)(struct kv_mem* mem, kv_off value);
+
+/***** Helper Functions, not exposed *****/
+static void* __at(struct kv_mem* mem, kv_off off)
+{
+    return off ? ((uint8_t*) mem->hdr) + off : NULL;
+}
+
+static kv_off __off(struct kv_mem* mem, const void* ptr)
+{
+    return ptr ? (kv_off) ((const uint8_t*) ptr - (uint8_t*) mem->hdr) : 0;
+}
+
+static void __lock(struct kv_mem* mem)
+{
+    if (pthread_mutex_lock(&(mem->hdr->lock)) == EOWNERDEAD)
+    {
+        fprintf_light_red(stderr, "kv_mem: a process died holding the "
+                                  "store lock.\n");
+        pthread_mutex_consistent(&(mem->hdr->lock));
+    }
+}
+
+static void __unlock(struct kv_mem* mem)
+{
+    pthread_mutex_unlock(&(mem->hdr->lock));
+}
+
+/* the whole reservation is mapped up front, so backing more of it is only a
+ * matter of lengthening the file; the mapping never moves */
+static int __grow(struct kv_mem* mem, uint64_t needed)
+{
+    struct kv_mem_header* hdr = mem->hdr;
+    uint64_t size = hdr->size;
+
+    while (size < needed)
+        size *= 2;
+
+    if (size > hdr->limit)
+        size = hdr->limit;
+
+    if (size < needed || (mem->fd >= 0 && ftruncate(mem->fd, size)))
+        return EXIT_FAILURE;
+
+    hdr->size = size;
+
+    return EXIT_SUCCESS;
+}
+
+/* power of two blocks led by their size class, recycled through one free
+ * list per class; a free block keeps the next one after its class */
+static void* __alloc(struct kv_mem* mem, size_t len)
+{
+    struct kv_mem_header* hdr = mem->hdr;
+    uint64_t class = KV_MEM_MIN_CLASS;
+    uint64_t* block;
+    kv_off off;
+
+    while ((1ULL << class) < len + sizeof(uint64_t))
+        class++;
+
+    if ((off = hdr->free[class]))
+    {
+        block = (uint64_t*) __at(mem, off);
+        hdr->free[class] = block[1];
+        return &(block[1]);
+    }
+
+    off = hdr->used;
+
+    if (off + (1ULL << class) > hdr->size &&
+        __grow(mem, off + (1ULL << class)))
+        return NULL;
+
+    hdr->used += 1ULL << class;
+    block = (uint64_t*) __at(mem, off);
+    block[0] = class;
+
+    return &(block[1]);
+}
+
+static void* __zalloc(struct kv_mem* mem, size_t len)
+{
+    void* ptr = __alloc(mem, len);
+
+    if (ptr)
+        memset(ptr, 0, len);
+
+    return ptr;
+}
+
+static void __free(struct kv_mem* mem, void* ptr)
+{
+    uint64_t* block;
+
+    if (ptr == NULL)
+        return;
+
+    block = ((uint64_t*) ptr) - 1;
+    block[1] = mem->hdr->free[block[0]];
+    mem->hdr->free[block[0]] = __off(mem, block);
+}
+
+static uint64_t __hash(const uint8_t* data, size_t len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static uint8_t* __bytes(struct kv_mem* mem, const struct kv_str* str)
+{
+    return (uint8_t*) __at(mem, str->data);
+}
+
+static int __str_set(struct kv_mem* mem, struct kv_str* str,
+                     const uint8_t* data, size_t len)
+{
+    uint8_t* copy = (uint8_t*) __alloc(mem, len ? len : 1);
+
+    if (copy == NULL)
+        return EXIT_FAILURE;
+
+    memcpy(copy, data, len);
+    __free(mem, __bytes(mem, str));
+    str->data = __off(mem, copy);
+    str->len = len;
+
+    return EXIT_SUCCESS;
+}
+
+static bool __str_equal(struct kv_mem* mem, const struct kv_str* a,
+                        const uint8_t* data, size_t len)
+{
+    return a->len == len && memcmp(__bytes(mem, a), data, len) == 0;
+}
+
+static struct kv_mem_dict* __dict(struct kv_mem* mem, kv_off off)
+{
+    return (struct kv_mem_dict*) __at(mem, off);
+}
+
+static struct kv_mem_entry* __entry(struct kv_mem* mem, kv_off off)
+{
+    return (struct kv_mem_entry*) __at(mem, off);
+}
+
+static kv_off* __buckets(struct kv_mem* mem, struct kv_mem_dict* dict)
+{
+    return (kv_off*) __at(mem, dict->buckets);
+}
+
+static struct kv_mem_dict* __dict_init(struct kv_mem* mem)
+{
+    struct kv_mem_dict* dict = (struct kv_mem_dict*)
+                               __zalloc(mem, sizeof(struct kv_mem_dict));
+    kv_off* buckets;
+
+    if (dict == NULL)
+        return NULL;
+
+    buckets = (kv_off*) __zalloc(mem, KV_MEM_INITIAL_BUCKETS *
+                                      sizeof(kv_off));
+
+    if (buckets == NULL)
+    {
+        __free(mem, dict);
+        return NULL;
+    }
+
+    dict->buckets = __off(mem, buckets);
+    dict->nbuckets = KV_MEM_INITIAL_BUCKETS;
+
+    return dict;
+}
+
+static void __dict_clear(struct kv_mem* mem, struct kv_mem_dict* dict,
+                         kv_mem_free_value free_value)
+{
+    kv_off* buckets = __buckets(mem, dict);
+    struct kv_mem_entry* entry;
+    kv_off next;
+    size_t i;
+
+    for (i = 0; i < dict->nbuckets; i++)
+    {
+        for (entry = __entry(mem, buckets[i]); entry;
+             entry = __entry(mem, next))
+        {
+            next = entry->next;
+            if (free_value)
+                free_value(mem, entry->value);
+            __free(mem, __bytes(mem, &(entry->key)));
+            __free(mem, entry);
+        }
+
+        buckets[i] = 0;
+    }
+
+    dict->count = 0;
+}
+
+static void __dict_destroy(struct kv_mem* mem, struct kv_mem_dict* dict,
+                           kv_mem_free_value free_value)
+{
+    if (dict)
+    {
+        __dict_clear(mem, dict, free_value);
+        __free(mem, __buckets(mem, dict));
+        __free(mem, dict);
+    }
+}
+
+static struct kv_mem_entry* __dict_find(struct kv_mem* mem,
+                                        struct kv_mem_dict* dict,
+                                        const uint8_t* key, size_t len)
+{
+    uint64_t hash = __hash(key, len);
+    struct kv_mem_entry* entry;
+
+    for (entry = __entry(mem, __buckets(mem, dict)[hash &
+                                                 (dict->nbuckets - 1)]);
+         entry; entry = __entry(mem, entry->next))
+    {
+        if (entry->hash == hash && __str_equal(mem, &(entry->key), key, len))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void __dict_grow(struct kv_mem* mem, struct kv_mem_dict* dict)
+{
+    kv_off* old = __buckets(mem, dict), *buckets;
+    struct kv_mem_entry* entry;
+    size_t nbuckets = dict->nbuckets * 2, i;
+    kv_off next;
+
+    buckets = (kv_off*) __zalloc(mem, nbuckets * sizeof(kv_off));
+
+    /* a full table is only slower, not wrong */
+    if (buckets == NULL)
+        return;
+
+    for (i = 0; i < dict->nbuckets; i++)
+    {
+        for (entry = __entry(mem, old[i]); entry; entry = __entry(mem, next))
+        {
+            next = entry->next;
+            entry->next = buckets[entry->hash & (nbuckets - 1)];
+            buckets[entry->hash & (nbuckets - 1)] = __off(mem, entry);
+        }
+    }
+
+    __free(mem, old);
+    dict->buckets = __off(mem, buckets);
+    dict->nbuckets = nbuckets;
+}
+
+/* finds or creates the entry for key, a new entry has no value */
+static struct kv_mem_entry* __dict_insert(struct kv_mem* mem,
+                                          struct kv_mem_dict* dict,
+                                          const uint8_t* key, size_t len,
+                                          bool* created)
+{
+    struct kv_mem_entry* entry = __dict_find(mem, dict, key, len);
+    kv_off* bucket;
+
+    *created = false;
+
+    if (entry)
+        return entry;
+
+    if ((entry = (struct kv_mem_entry*)
+                 __zalloc(mem, sizeof(struct kv_mem_entry))) == NULL)
+        return NULL;
+
+    if (__str_set(mem, &(entry->key), key, len))
+    {
+        __free(mem, entry);
+        return NULL;
+    }
+
+    if (dict->count >= dict->nbuckets)
+        __dict_grow(mem, dict);
+
+    entry->hash = __hash(key, len);
+    bucket = &(__buckets(mem, dict)[entry->hash & (dict->nbuckets - 1)]);
+    entry->next = *bucket;
+    *bucket = __off(mem, entry);
+    dict->count++;
+    *created = true;
+
+    return entry;
+}
+
+static bool __dict_delete(struct kv_mem* mem, struct kv_mem_dict* dict,
+                          const uint8_t* key, size_t len,
+                          kv_mem_free_value free_value)
+{
+    uint64_t hash = __hash(key, len);
+    kv_off* link = &(__buckets(mem, dict)[hash & (dict->nbuckets - 1)]);
+    struct kv_mem_entry* entry;
+
+    for (entry = __entry(mem, *link); entry;
+         link = &(entry->next), entry = __entry(mem, *link))
+    {
+        if (entry->hash == hash && __str_equal(mem, &(entry->key), key, len))
+        {
+            *link = entry->next;
+            if (free_value)
+                free_value(mem, entry->value);
+            __free(mem, __bytes(mem, &(entry->key)));
+            __free(mem, entry);
+            dict->count--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void __free_str(struct kv_mem* mem, kv_off value)
+{
+    struct kv_str* str = (struct kv_str*) __at(mem, value);
+
+    if (str)
+    {
+        __free(mem, __bytes(mem, str));
+        __free(mem, str);
+    }
+}
+
+static struct kv_mem_list* __list(struct kv_mem* mem, kv_off off)
+{
+    return (struct kv_mem_list*) __at(mem, off);
+}
+
+static struct kv_mem_list* __list_init(struct kv_mem* mem)
+{
+    struct kv_mem_list* list = (struct kv_mem_list*)
+                               __zalloc(mem, sizeof(struct kv_mem_list));
+    struct kv_str* items;
+
+    if (list == NULL)
+        return NULL;
+
+    items = (struct kv_str*) __alloc(mem, KV_MEM_INITIAL_LIST *
+                                          sizeof(struct kv_str));
+
+    if (items == NULL)
+    {
+        __free(mem, list);
+        return NULL;
+    }
+
+    list->items = __off(mem, items);
+    list->capacity = KV_MEM_INITIAL_LIST;
+
+    return list;
+}
+
+static struct kv_str* __list_at(struct kv_mem* mem, struct kv_mem_list* list,
+                                size_t i)
+{
+    return &(((struct kv_str*) __at(mem, list->items))
+             [(list->head + i) % list->capacity]);
+}
+
+static void __list_destroy(struct kv_mem* mem, struct kv_mem_list* list)
+{
+    size_t i;
+
+    if (list)
+    {
+        for (i = 0; i < list->count; i++)
+            __free(mem, __bytes(mem, __list_at(mem, list, i)));
+
+        __free(mem, __at(mem, list->items));
+        __free(mem, list);
+    }
+}
+
+static int __list_reserve(struct kv_mem* mem, struct kv_mem_list* list)
+{
+    struct kv_str* items;
+    size_t i;
+
+    if (list->count < list->capacity)
+        return EXIT_SUCCESS;
+
+    items = (struct kv_str*) __alloc(mem, 2 * list->capacity *
+                                          sizeof(struct kv_str));
+
+    if (items == NULL)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < list->count; i++)
+        items[i] = *__list_at(mem, list, i);
+
+    __free(mem, __at(mem, list->items));
+    list->items = __off(mem, items);
+    list->head = 0;
+    list->capacity *= 2;
+
+    return EXIT_SUCCESS;
+}
+
+/* inserts a copy of data so that it becomes element pos */
+static int __list_insert(struct kv_mem* mem, struct kv_mem_list* list,
+                         size_t pos, const uint8_t* data, size_t len)
+{
+    struct kv_str item = { 0, 0 };
+    size_t i;
+
+    if (__list_reserve(mem, list) || __str_set(mem, &item, data, len))
+        return EXIT_FAILURE;
+
+    if (pos == 0)
+    {
+        list->head = (list->head + list->capacity - 1) % list->capacity;
+    }
+    else
+    {
+        for (i = list->count; i > pos; i--)
+            *__list_at(mem, list, i) = *__list_at(mem, list, i - 1);
+    }
+
+    *__list_at(mem, list, pos) = item;
+    list->count++;
+
+    return EXIT_SUCCESS;
+}
+
+/* removes element pos handing its data to item */
+static void __list_remove(struct kv_mem* mem, struct kv_mem_list* list,
+                          size_t pos, struct kv_str* item)
+{
+    size_t i;
+
+    *item = *__list_at(mem, list, pos);
+
+    if (pos == 0)
+    {
+        list->head = (list->head + 1) % list->capacity;
+    }
+    else
+    {
+        for (i = pos; i + 1 < list->count; i++)
+            *__list_at(mem, list, i) = *__list_at(mem, list, i + 1);
+    }
+
+    list->count--;
+}
+
+static void __free_value(struct kv_mem* mem, kv_off off)
+{
+    struct kv_mem_value* value = (struct kv_mem_value*) __at(mem, off);
+
+    if (value == NULL)
+        return;
+
+    switch (value->type)
+    {
+        case KV_MEM_STRING:
+            __free(mem, __bytes(mem, &(value->u.str)));
+            break;
+        case KV_MEM_HASH:
+            __dict_destroy(mem, __dict(mem, value->u.dict), __free_str);
+            break;
+        case KV_MEM_SET:
+            __dict_destroy(mem, __dict(mem, value->u.dict), NULL);
+            break;
+        case KV_MEM_LIST:
+            __list_destroy(mem, __list(mem, value->u.list));
+            break;
+    }
+
+    __free(mem, value);
+}
+
+static struct kv_mem_value* __value_init(struct kv_mem* mem, int type)
+{
+    struct kv_mem_value* value = (struct kv_mem_value*)
+                                 __zalloc(mem, sizeof(struct kv_mem_value));
+
+    if (value == NULL)
+        return NULL;
+
+    value->type = type;
+
+    switch (type)
+    {
+        case KV_MEM_HASH:
+        case KV_MEM_SET:
+            value->u.dict = __off(mem, __dict_init(mem));
+            if (value->u.dict == 0)
+            {
+                __free(mem, value);
+                return NULL;
+            }
+            break;
+        case KV_MEM_LIST:
+            value->u.list = __off(mem, __list_init(mem));
+            if (value->u.list == 0)
+            {
+                __free(mem, value);
+                return NULL;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return value;
+}
+
+/***** reply encoding *****/
+static void __out_raw(struct kv_out* out, const void* data, size_t len)
+{
+    uint8_t* grown;
+    size_t cap = out->cap ? out->cap : KV_MEM_INITIAL_OUT;
+
+    if (out->oom)
+        return;
+
+    while (out->len + len > cap)
+        cap *= 2;
+
+    if (cap != out->cap)
+    {
+        if ((grown = (uint8_t*) realloc(out->data, cap)) == NULL)
+        {
+            out->oom = true;
+            return;
+        }
+
+        out->data = grown;
+        out->cap = cap;
+    }
+
+    memcpy(&(out->data[out->len]), data, len);
+    out->len += len;
+}
+
+static void __out_header(struct kv_out* out, char type, int64_t value)
+{
+    char buf[KV_MEM_INT_MAX + 4];
+    int len = snprintf(buf, sizeof(buf), "%c%"PRId64"\r\n", type, value);
+
+    __out_raw(out, buf, len);
+}
+
+static void __out_status(struct kv_out* out, const char* status)
+{
+    __out_raw(out, "+", 1);
+    __out_raw(out, status, strlen(status));
+    __out_raw(out, "\r\n", 2);
+}
+
+static void __out_error(struct kv_out* out, const char* error)
+{
+    __out_raw(out, "-", 1);
+    __out_raw(out, error, strlen(error));
+    __out_raw(out, "\r\n", 2);
+}
+
+static void __out_int(struct kv_out* out, int64_t value)
+{
+    __out_header(out, ':', value);
+}
+
+static void __out_nil(struct kv_out* out)
+{
+    __out_raw(out, "$-1\r\n", 5);
+}
+
+static void __out_bulk(struct kv_out* out, const uint8_t* data, size_t len)
+{
+    __out_header(out, '$', (int64_t) len);
+    __out_raw(out, data, len);
+    __out_raw(out, "\r\n", 2);
+}
+
+static void __out_array(struct kv_out* out, size_t count)
+{
+    __out_header(out, '*', (int64_t) count);
+}
+
+/***** request parsing *****/
+static int __parse_int(const uint8_t* buf, size_t len, size_t* pos,
+                       int64_t* value)
+{
+    bool negative = false;
+    int64_t result = 0;
+    size_t i = *pos;
+
+    if (i < len && buf[i] == '-')
+    {
+        negative = true;
+        i++;
+    }
+
+    for (; i < len && buf[i] >= '0' && buf[i] <= '9'; i++)
+        result = result * 10 + (buf[i] - '0');
+
+    if (i + 1 >= len)
+        return 0;
+
+    if (buf[i] != '\r' || buf[i + 1] != '\n')
+        return -1;
+
+    *pos = i + 2;
+    *value = negative ? -result : result;
+
+    return 1;
+}
+
+/* 1 on a complete command, 0 when more input is needed, -1 on garbage;
+ * argv points into buf */
+static int __parse_command(const uint8_t* buf, size_t len, size_t* consumed,
+                           struct kv_buf** argv, int* argc)
+{
+    size_t pos = 0;
+    int64_t count, arglen, i;
+    int ret;
+
+    if (len == 0)
+        return 0;
+
+    if (buf[0] != '*')
+        return -1;
+
+    pos = 1;
+
+    if ((ret = __parse_int(buf, len, &pos, &count)) <= 0)
+        return ret;
+
+    if (count <= 0)
+        return -1;
+
+    if ((*argv = (struct kv_buf*) malloc(count * sizeof(struct kv_buf))) ==
+        NULL)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        if (pos >= len)
+            ret = 0;
+        else if (buf[pos++] != '$')
+            ret = -1;
+        else
+            ret = __parse_int(buf, len, &pos, &arglen);
+
+        if (ret == 1 && arglen < 0)
+            ret = -1;
+        if (ret == 1 && pos + arglen + 2 > len)
+            ret = 0;
+
+        if (ret <= 0)
+        {
+            free(*argv);
+            *argv = NULL;
+            return ret;
+        }
+
+        (*argv)[i].data = (uint8_t*) &(buf[pos]);
+        (*argv)[i].len = arglen;
+        pos += arglen + 2;
+    }
+
+    *argc = (int) count;
+    *consumed = pos;
+
+    return 1;
+}
+
+static bool __arg_is(const struct kv_buf* arg, const char* name)
+{
+    return arg->len == strlen(name) &&
+           strncasecmp((const char*) arg->data, name, arg->len) == 0;
+}
+
+static int __arg_int(const struct kv_buf* arg, int64_t* value)
+{
+    char buf[KV_MEM_INT_MAX + 1];
+    char* end;
+
+    if (arg->len == 0 || arg->len > KV_MEM_INT_MAX)
+        return EXIT_FAILURE;
+
+    memcpy(buf, arg->data, arg->len);
+    buf[arg->len] = 0;
+    errno = 0;
+    *value = strtoll(buf, &end, 10);
+
+    return (*end || errno) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/***** keyspace access *****/
+#define KV_MEM_ERR_WRONGTYPE "WRONGTYPE Operation against a key holding " \
+                             "the wrong kind of value"
+#define KV_MEM_ERR_OOM "OOM command not allowed when used memory > " \
+                       "'maxmemory'"
+#define KV_MEM_ERR_INT "ERR value is not an integer or out of range"
+#define KV_MEM_ERR_ARGS "ERR wrong number of arguments"
+#define KV_MEM_ERR_SYNTAX "ERR syntax error"
+
+static struct kv_mem_dict* __db(struct kv_mem* mem, int db)
+{
+    return __dict(mem, mem->hdr->dbs[db]);
+}
+
+/* -1 on a type mismatch, otherwise 0 with *value NULL if key is unset */
+static int __get(struct kv_mem* mem, struct kv_mem_dict* keys,
+                 const struct kv_buf* key, int type,
+                 struct kv_mem_value** value)
+{
+    struct kv_mem_entry* entry = __dict_find(mem, keys, key->data, key->len);
+
+    *value = entry ? (struct kv_mem_value*) __at(mem, entry->value) : NULL;
+
+    return (*value && (*value)->type != type) ? -1 : 0;
+}
+
+/* -1 on a type mismatch, -2 when out of memory */
+static int __get_or_create(struct kv_mem* mem, struct kv_mem_dict* keys,
+                           const struct kv_buf* key, int type,
+                           struct kv_mem_value** value)
+{
+    struct kv_mem_entry* entry;
+    bool created;
+
+    if ((entry = __dict_insert(mem, keys, key->data, key->len, &created)) ==
+        NULL)
+        return -2;
+
+    if (created &&
+        (entry->value = __off(mem, __value_init(mem, type))) == 0)
+    {
+        __dict_delete(mem, keys, key->data, key->len, NULL);
+        return -2;
+    }
+
+    *value = (struct kv_mem_value*) __at(mem, entry->value);
+
+    return (*value)->type != type ? -1 : 0;
+}
+
+static void __out_get_error(struct kv_out* out, int ret)
+{
+    __out_error(out, ret == -1 ? KV_MEM_ERR_WRONGTYPE : KV_MEM_ERR_OOM);
+}
+
+static void __out_str(struct kv_mem* mem, struct kv_out* out,
+                      const struct kv_str* str)
+{
+    __out_bulk(out, __bytes(mem, str), str->len);
+}
+
+/* containers vanish with their last element, as they do in Redis */
+static void __drop_if_empty(struct kv_mem* mem, struct kv_mem_dict* keys,
+                            const struct kv_buf* key,
+                            struct kv_mem_value* value)
+{
+    if ((value->type == KV_MEM_LIST &&
+         __list(mem, value->u.list)->count == 0) ||
+        ((value->type == KV_MEM_HASH || value->type == KV_MEM_SET) &&
+         __dict(mem, value->u.dict)->count == 0))
+        __dict_delete(mem, keys, key->data, key->len, __free_value);
+}
+
+static int __set_string(struct kv_mem* mem, struct kv_mem_dict* keys,
+                        const struct kv_buf* key, const uint8_t* data,
+                        size_t len)
+{
+    struct kv_mem_value* value;
+    struct kv_str str = { 0, 0 };
+
+    if (__str_set(mem, &str, data, len))
+        return EXIT_FAILURE;
+
+    __dict_delete(mem, keys, key->data, key->len, __free_value);
+
+    if (__get_or_create(mem, keys, key, KV_MEM_STRING, &value))
+    {
+        __free(mem, __bytes(mem, &str));
+        return EXIT_FAILURE;
+    }
+
+    value->u.str = str;
+
+    return EXIT_SUCCESS;
+}
+
+/* clamps Redis style inclusive, possibly negative, ranges */
+static bool __range(int64_t count, int64_t* start, int64_t* stop)
+{
+    if (*start < 0)
+        *start += count;
+    if (*stop < 0)
+        *stop += count;
+    if (*start < 0)
+        *start = 0;
+    if (*stop >= count)
+        *stop = count - 1;
+
+    return *start <= *stop && *start < count;
+}
+
+/***** commands *****/
+static void __cmd_string(struct kv_mem* mem, struct kv_mem_dict* keys,
+                         int argc, struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value;
+    struct kv_buf current;
+    int64_t n;
+    int i, ret;
+    char buf[KV_MEM_INT_MAX];
+
+    if (__arg_is(&(argv[0]), "GET") && argc == 2)
+    {
+        if (__get(mem, keys, &(argv[1]), KV_MEM_STRING, &value))
+            __out_error(out, KV_MEM_ERR_WRONGTYPE);
+        else if (value)
+            __out_str(mem, out, &(value->u.str));
+        else
+            __out_nil(out);
+    }
+    else if (__arg_is(&(argv[0]), "SET") && argc >= 3)
+    {
+        if (__set_string(mem, keys, &(argv[1]), argv[2].data, argv[2].len))
+            __out_error(out, KV_MEM_ERR_OOM);
+        else
+            __out_status(out, "OK");
+    }
+    else if (__arg_is(&(argv[0]), "SETEX") && argc == 4)
+    {
+        /* nothing here outlives the store long enough to need expiry */
+        if (__set_string(mem, keys, &(argv[1]), argv[3].data, argv[3].len))
+            __out_error(out, KV_MEM_ERR_OOM);
+        else
+            __out_status(out, "OK");
+    }
+    else if (__arg_is(&(argv[0]), "MGET") && argc >= 2)
+    {
+        __out_array(out, argc - 1);
+
+        for (i = 1; i < argc; i++)
+        {
+            if (__get(mem, keys, &(argv[i]), KV_MEM_STRING, &value) == 0 &&
+                value)
+                __out_str(mem, out, &(value->u.str));
+            else
+                __out_nil(out);
+        }
+    }
+    else if (__arg_is(&(argv[0]), "INCR") && argc == 2)
+    {
+        n = 0;
+
+        if (__get(mem, keys, &(argv[1]), KV_MEM_STRING, &value))
+        {
+            __out_error(out, KV_MEM_ERR_WRONGTYPE);
+            return;
+        }
+
+        if (value)
+        {
+            current.data = __bytes(mem, &(value->u.str));
+            current.len = value->u.str.len;
+
+            if (__arg_int(&current, &n))
+            {
+                __out_error(out, KV_MEM_ERR_INT);
+                return;
+            }
+        }
+
+        n++;
+        ret = snprintf(buf, sizeof(buf), "%"PRId64, n);
+
+        if (__set_string(mem, keys, &(argv[1]), (uint8_t*) buf, ret))
+            __out_error(out, KV_MEM_ERR_OOM);
+        else
+            __out_int(out, n);
+    }
+    else
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+    }
+}
+
+static void __cmd_bit(struct kv_mem* mem, struct kv_mem_dict* keys, int argc,
+                      struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value;
+    int64_t offset, bit = 0;
+    uint8_t* grown, *data;
+    size_t byte;
+    int old = 0, ret;
+
+    if (argc < 3 || __arg_int(&(argv[2]), &offset) || offset < 0 ||
+        (__arg_is(&(argv[0]), "SETBIT") &&
+         (argc != 4 || __arg_int(&(argv[3]), &bit) || (bit != 0 && bit != 1))))
+    {
+        __out_error(out, KV_MEM_ERR_SYNTAX);
+        return;
+    }
+
+    byte = offset / 8;
+
+    if (__arg_is(&(argv[0]), "GETBIT"))
+    {
+        if (__get(mem, keys, &(argv[1]), KV_MEM_STRING, &value))
+            __out_error(out, KV_MEM_ERR_WRONGTYPE);
+        else
+            __out_int(out, value && byte < value->u.str.len ?
+                           (__bytes(mem, &(value->u.str))[byte] >>
+                            (7 - offset % 8)) & 1 : 0);
+        return;
+    }
+
+    if ((ret = __get_or_create(mem, keys, &(argv[1]), KV_MEM_STRING,
+                               &value)))
+    {
+        __out_get_error(out, ret);
+        return;
+    }
+
+    if (byte >= value->u.str.len)
+    {
+        if ((grown = (uint8_t*) __alloc(mem, byte + 1)) == NULL)
+        {
+            __out_error(out, KV_MEM_ERR_OOM);
+            return;
+        }
+
+        if (value->u.str.len)
+            memcpy(grown, __bytes(mem, &(value->u.str)), value->u.str.len);
+
+        memset(&(grown[value->u.str.len]), 0, byte + 1 - value->u.str.len);
+        __free(mem, __bytes(mem, &(value->u.str)));
+        value->u.str.data = __off(mem, grown);
+        value->u.str.len = byte + 1;
+    }
+
+    data = __bytes(mem, &(value->u.str));
+    old = (data[byte] >> (7 - offset % 8)) & 1;
+
+    if (bit)
+        data[byte] |= 1 << (7 - offset % 8);
+    else
+        data[byte] &= ~(1 << (7 - offset % 8));
+
+    __out_int(out, old);
+}
+
+static void __cmd_hash(struct kv_mem* mem, struct kv_mem_dict* keys,
+                       int argc, struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value;
+    struct kv_mem_dict* fields;
+    struct kv_mem_entry* entry;
+    struct kv_str* field;
+    kv_off* buckets;
+    int64_t added = 0;
+    bool created;
+    size_t i;
+    int j, ret;
+
+    if (__arg_is(&(argv[0]), "HSET") || __arg_is(&(argv[0]), "HMSET"))
+    {
+        if (argc < 4 || argc % 2)
+        {
+            __out_error(out, KV_MEM_ERR_ARGS);
+            return;
+        }
+
+        if ((ret = __get_or_create(mem, keys, &(argv[1]), KV_MEM_HASH,
+                                   &value)))
+        {
+            __out_get_error(out, ret);
+            return;
+        }
+
+        fields = __dict(mem, value->u.dict);
+
+        for (j = 2; j < argc; j += 2)
+        {
+            entry = __dict_insert(mem, fields, argv[j].data, argv[j].len,
+                                  &created);
+
+            if (entry && created &&
+                (entry->value = __off(mem, __zalloc(mem,
+                                                    sizeof(struct kv_str))))
+                == 0)
+                __dict_delete(mem, fields, argv[j].data, argv[j].len, NULL);
+
+            if (entry == NULL || entry->value == 0 ||
+                __str_set(mem, (struct kv_str*) __at(mem, entry->value),
+                          argv[j + 1].data, argv[j + 1].len))
+            {
+                __drop_if_empty(mem, keys, &(argv[1]), value);
+                __out_error(out, KV_MEM_ERR_OOM);
+                return;
+            }
+
+            added += created;
+        }
+
+        if (__arg_is(&(argv[0]), "HMSET"))
+            __out_status(out, "OK");
+        else
+            __out_int(out, added);
+
+        return;
+    }
+
+    if (argc < 2 || __get(mem, keys, &(argv[1]), KV_MEM_HASH, &value))
+    {
+        __out_error(out, argc < 2 ? KV_MEM_ERR_ARGS : KV_MEM_ERR_WRONGTYPE);
+        return;
+    }
+
+    fields = value ? __dict(mem, value->u.dict) : NULL;
+
+    if ((__arg_is(&(argv[0]), "HGET") && argc == 3) ||
+        __arg_is(&(argv[0]), "HMGET"))
+    {
+        if (__arg_is(&(argv[0]), "HMGET"))
+            __out_array(out, argc - 2);
+
+        for (j = 2; j < argc; j++)
+        {
+            entry = fields ? __dict_find(mem, fields, argv[j].data,
+                                         argv[j].len) : NULL;
+            field = entry ? (struct kv_str*) __at(mem, entry->value) : NULL;
+
+            if (field)
+                __out_str(mem, out, field);
+            else
+                __out_nil(out);
+        }
+    }
+    else if (__arg_is(&(argv[0]), "HGETALL") && argc == 2)
+    {
+        __out_array(out, fields ? 2 * fields->count : 0);
+
+        for (i = 0; fields && i < fields->nbuckets; i++)
+        {
+            buckets = __buckets(mem, fields);
+
+            for (entry = __entry(mem, buckets[i]); entry;
+                 entry = __entry(mem, entry->next))
+            {
+                __out_str(mem, out, &(entry->key));
+                __out_str(mem, out, (struct kv_str*) __at(mem, entry->value));
+            }
+        }
+    }
+    else if (__arg_is(&(argv[0]), "HDEL") && argc >= 3)
+    {
+        for (j = 2; fields && j < argc; j++)
+            added += __dict_delete(mem, fields, argv[j].data, argv[j].len,
+                                   __free_str);
+
+        if (value)
+            __drop_if_empty(mem, keys, &(argv[1]), value);
+
+        __out_int(out, added);
+    }
+    else
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+    }
+}
+
+static void __cmd_push(struct kv_mem* mem, struct kv_mem_dict* keys,
+                       int argc, struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value;
+    struct kv_mem_list* list;
+    bool left = __arg_is(&(argv[0]), "LPUSH");
+    int i, ret;
+
+    if (argc < 3)
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+        return;
+    }
+
+    if ((ret = __get_or_create(mem, keys, &(argv[1]), KV_MEM_LIST, &value)))
+    {
+        __out_get_error(out, ret);
+        return;
+    }
+
+    list = __list(mem, value->u.list);
+
+    for (i = 2; i < argc; i++)
+    {
+        if (__list_insert(mem, list, left ? 0 : list->count, argv[i].data,
+                          argv[i].len))
+        {
+            __drop_if_empty(mem, keys, &(argv[1]), value);
+            __out_error(out, KV_MEM_ERR_OOM);
+            return;
+        }
+    }
+
+    __out_int(out, list->count);
+    pthread_cond_broadcast(&(mem->hdr->pushed));
+}
+
+static int __wait(struct kv_mem* mem, const struct timespec* deadline)
+{
+    int ret = deadline ? pthread_cond_timedwait(&(mem->hdr->pushed),
+                                                &(mem->hdr->lock), deadline) :
+                         pthread_cond_wait(&(mem->hdr->pushed),
+                                           &(mem->hdr->lock));
+
+    if (ret == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&(mem->hdr->lock));
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/* BRPOP blocks on the store's condition variable, which any process that
+ * pushes signals, releasing the lock */
+static void __cmd_pop(struct kv_mem* mem, int* db, int argc,
+                      struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value;
+    struct kv_mem_list* list;
+    struct kv_str item;
+    struct timespec deadline;
+    struct timeval now;
+    int64_t timeout = 0;
+    bool blocking = __arg_is(&(argv[0]), "BRPOP");
+    bool left = __arg_is(&(argv[0]), "LPOP");
+    int i, keys = blocking ? argc - 1 : argc;
+
+    if (argc < 2 || (blocking && (argc < 3 ||
+                                  __arg_int(&(argv[argc - 1]), &timeout))))
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+    deadline.tv_sec = now.tv_sec + timeout;
+    deadline.tv_nsec = now.tv_usec * 1000;
+
+    while (1)
+    {
+        for (i = 1; i < keys; i++)
+        {
+            if (__get(mem, __db(mem, *db), &(argv[i]), KV_MEM_LIST, &value))
+            {
+                __out_error(out, KV_MEM_ERR_WRONGTYPE);
+                return;
+            }
+
+            if (value == NULL)
+                continue;
+
+            list = __list(mem, value->u.list);
+            __list_remove(mem, list, left ? 0 : list->count - 1, &item);
+
+            if (blocking)
+            {
+                __out_array(out, 2);
+                __out_bulk(out, argv[i].data, argv[i].len);
+            }
+
+            __out_str(mem, out, &item);
+            __free(mem, __bytes(mem, &item));
+            __drop_if_empty(mem, __db(mem, *db), &(argv[i]), value);
+            return;
+        }
+
+        if (!blocking)
+            break;
+
+        if (__wait(mem, timeout ? &deadline : NULL) == ETIMEDOUT)
+            break;
+    }
+
+    if (blocking)
+        __out_raw(out, "*-1\r\n", 5);
+    else
+        __out_nil(out);
+}
+
+static void __cmd_list(struct kv_mem* mem, struct kv_mem_dict* keys,
+                       int argc, struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value;
+    struct kv_mem_list* list;
+    struct kv_str item;
+    int64_t start, stop, i, count;
+    int64_t limit, step, removed = 0;
+    bool after;
+
+    if (argc < 2 || __get(mem, keys, &(argv[1]), KV_MEM_LIST, &value))
+    {
+        __out_error(out, argc < 2 ? KV_MEM_ERR_ARGS : KV_MEM_ERR_WRONGTYPE);
+        return;
+    }
+
+    list = value ? __list(mem, value->u.list) : NULL;
+    count = list ? (int64_t) list->count : 0;
+
+    if (__arg_is(&(argv[0]), "LLEN") && argc == 2)
+    {
+        __out_int(out, count);
+    }
+    else if ((__arg_is(&(argv[0]), "LRANGE") ||
+              __arg_is(&(argv[0]), "LTRIM")) && argc == 4)
+    {
+        if (__arg_int(&(argv[2]), &start) || __arg_int(&(argv[3]), &stop))
+        {
+            __out_error(out, KV_MEM_ERR_INT);
+            return;
+        }
+
+        if (!__range(count, &start, &stop))
+        {
+            start = count;
+            stop = count - 1;
+        }
+
+        if (__arg_is(&(argv[0]), "LRANGE"))
+        {
+            __out_array(out, stop - start + 1);
+
+            for (i = start; i <= stop; i++)
+                __out_str(mem, out, __list_at(mem, list, i));
+
+            return;
+        }
+
+        for (i = count - 1; list && i > stop; i--)
+        {
+            __list_remove(mem, list, i, &item);
+            __free(mem, __bytes(mem, &item));
+        }
+
+        for (i = 0; list && i < start && list->count; i++)
+        {
+            __list_remove(mem, list, 0, &item);
+            __free(mem, __bytes(mem, &item));
+        }
+
+        if (value)
+            __drop_if_empty(mem, keys, &(argv[1]), value);
+
+        __out_status(out, "OK");
+    }
+    else if (__arg_is(&(argv[0]), "LINDEX") && argc == 3)
+    {
+        if (__arg_int(&(argv[2]), &i))
+        {
+            __out_error(out, KV_MEM_ERR_INT);
+            return;
+        }
+
+        if (i < 0)
+            i += count;
+
+        if (i < 0 || i >= count)
+        {
+            __out_nil(out);
+            return;
+        }
+
+        __out_str(mem, out, __list_at(mem, list, i));
+    }
+    else if (__arg_is(&(argv[0]), "LSET") && argc == 4)
+    {
+        if (__arg_int(&(argv[2]), &i))
+        {
+            __out_error(out, KV_MEM_ERR_INT);
+            return;
+        }
+
+        if (i < 0)
+            i += count;
+
+        if (list == NULL)
+            __out_error(out, "ERR no such key");
+        else if (i < 0 || i >= count)
+            __out_error(out, "ERR index out of range");
+        else if (__str_set(mem, __list_at(mem, list, i), argv[3].data,
+                           argv[3].len))
+            __out_error(out, KV_MEM_ERR_OOM);
+        else
+            __out_status(out, "OK");
+    }
+    else if (__arg_is(&(argv[0]), "LINSERT") && argc == 5)
+    {
+        after = __arg_is(&(argv[2]), "AFTER");
+
+        if (!after && !__arg_is(&(argv[2]), "BEFORE"))
+        {
+            __out_error(out, KV_MEM_ERR_SYNTAX);
+            return;
+        }
+
+        if (list == NULL)
+        {
+            __out_int(out, 0);
+            return;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            if (__str_equal(mem, __list_at(mem, list, i), argv[3].data,
+                            argv[3].len))
+                break;
+        }
+
+        if (i == count)
+            __out_int(out, -1);
+        else if (__list_insert(mem, list, i + after, argv[4].data,
+                               argv[4].len))
+            __out_error(out, KV_MEM_ERR_OOM);
+        else
+            __out_int(out, list->count);
+    }
+    else if (__arg_is(&(argv[0]), "LREM") && argc == 4)
+    {
+        /* a positive count removes from the head, a negative one from the
+         * tail, zero every match */
+        if (__arg_int(&(argv[2]), &limit))
+        {
+            __out_error(out, KV_MEM_ERR_INT);
+            return;
+        }
+
+        step = limit < 0 ? -1 : 1;
+        limit *= step;
+
+        for (i = step < 0 ? count - 1 : 0;
+             list && i >= 0 && i < (int64_t) list->count &&
+             (limit == 0 || removed < limit); i += step)
+        {
+            if (!__str_equal(mem, __list_at(mem, list, i), argv[3].data,
+                             argv[3].len))
+                continue;
+
+            __list_remove(mem, list, i, &item);
+            __free(mem, __bytes(mem, &item));
+            removed++;
+
+            /* the next element slid into this index */
+            if (step > 0)
+                i--;
+        }
+
+        if (value)
+            __drop_if_empty(mem, keys, &(argv[1]), value);
+
+        __out_int(out, removed);
+    }
+    else
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+    }
+}
+
+static void __out_members(struct kv_mem* mem, struct kv_out* out,
+                          struct kv_mem_dict* members, size_t count,
+                          struct kv_mem_dict* keys, int argc,
+                          struct kv_buf* argv)
+{
+    struct kv_mem_value* value;
+    struct kv_mem_entry* entry;
+    size_t i;
+    int j;
+
+    __out_array(out, count);
+
+    for (i = 0; members && i < members->nbuckets; i++)
+    {
+        for (entry = __entry(mem, __buckets(mem, members)[i]); entry;
+             entry = __entry(mem, entry->next))
+        {
+            for (j = 0; j < argc; j++)
+            {
+                if (__get(mem, keys, &(argv[j]), KV_MEM_SET, &value) == 0 &&
+                    value && __dict_find(mem, __dict(mem, value->u.dict),
+                                         __bytes(mem, &(entry->key)),
+                                         entry->key.len))
+                    break;
+            }
+
+            if (j == argc)
+                __out_str(mem, out, &(entry->key));
+        }
+    }
+}
+
+static void __cmd_set(struct kv_mem* mem, struct kv_mem_dict* keys, int argc,
+                      struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_value* value, *other;
+    struct kv_mem_dict* members;
+    struct kv_mem_entry* entry;
+    int64_t changed = 0;
+    size_t count = 0, i;
+    bool created;
+    int j, k, ret;
+
+    if (argc < 2)
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+        return;
+    }
+
+    if (__arg_is(&(argv[0]), "SADD") && argc >= 3)
+    {
+        if ((ret = __get_or_create(mem, keys, &(argv[1]), KV_MEM_SET,
+                                   &value)))
+        {
+            __out_get_error(out, ret);
+            return;
+        }
+
+        for (j = 2; j < argc; j++)
+        {
+            if (__dict_insert(mem, __dict(mem, value->u.dict), argv[j].data,
+                              argv[j].len, &created) == NULL)
+            {
+                __drop_if_empty(mem, keys, &(argv[1]), value);
+                __out_error(out, KV_MEM_ERR_OOM);
+                return;
+            }
+
+            changed += created;
+        }
+
+        __out_int(out, changed);
+        return;
+    }
+
+    if (__get(mem, keys, &(argv[1]), KV_MEM_SET, &value))
+    {
+        __out_error(out, KV_MEM_ERR_WRONGTYPE);
+        return;
+    }
+
+    members = value ? __dict(mem, value->u.dict) : NULL;
+
+    if (__arg_is(&(argv[0]), "SREM") && argc >= 3)
+    {
+        for (j = 2; members && j < argc; j++)
+            changed += __dict_delete(mem, members, argv[j].data,
+                                     argv[j].len, NULL);
+
+        if (value)
+            __drop_if_empty(mem, keys, &(argv[1]), value);
+
+        __out_int(out, changed);
+    }
+    else if (__arg_is(&(argv[0]), "SISMEMBER") && argc == 3)
+    {
+        __out_int(out, members && __dict_find(mem, members, argv[2].data,
+                                              argv[2].len) != NULL);
+    }
+    else if (__arg_is(&(argv[0]), "SMEMBERS") && argc == 2)
+    {
+        __out_members(mem, out, members, members ? members->count : 0, keys,
+                      0, NULL);
+    }
+    else if (__arg_is(&(argv[0]), "SDIFF"))
+    {
+        for (j = 2; j < argc; j++)
+        {
+            if (__get(mem, keys, &(argv[j]), KV_MEM_SET, &other))
+            {
+                __out_error(out, KV_MEM_ERR_WRONGTYPE);
+                return;
+            }
+        }
+
+        /* count first so the array header can lead */
+        for (i = 0; members && i < members->nbuckets; i++)
+        {
+            for (entry = __entry(mem, __buckets(mem, members)[i]); entry;
+                 entry = __entry(mem, entry->next))
+            {
+                for (k = 2; k < argc; k++)
+                {
+                    __get(mem, keys, &(argv[k]), KV_MEM_SET, &other);
+                    if (other && __dict_find(mem, __dict(mem, other->u.dict),
+                                             __bytes(mem, &(entry->key)),
+                                             entry->key.len))
+                        break;
+                }
+
+                count += (k == argc);
+            }
+        }
+
+        __out_members(mem, out, members, count, keys, argc - 2, &(argv[2]));
+    }
+    else
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+    }
+}
+
+static void __cmd_keys(struct kv_mem* mem, int* db, int argc,
+                       struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_dict* keys = __db(mem, *db);
+    int64_t n = 0;
+    int i;
+
+    if (__arg_is(&(argv[0]), "SELECT") && argc == 2)
+    {
+        if (__arg_int(&(argv[1]), &n) || n < 0 || n >= KV_MEM_DATABASES)
+        {
+            __out_error(out, "ERR DB index is out of range");
+            return;
+        }
+
+        *db = (int) n;
+        __out_status(out, "OK");
+    }
+    else if (__arg_is(&(argv[0]), "DEL") && argc >= 2)
+    {
+        for (i = 1; i < argc; i++)
+            n += __dict_delete(mem, keys, argv[i].data, argv[i].len,
+                               __free_value);
+
+        __out_int(out, n);
+    }
+    else if (__arg_is(&(argv[0]), "EXISTS") && argc >= 2)
+    {
+        for (i = 1; i < argc; i++)
+            n += __dict_find(mem, keys, argv[i].data, argv[i].len) != NULL;
+
+        __out_int(out, n);
+    }
+    else if (__arg_is(&(argv[0]), "DBSIZE") && argc == 1)
+    {
+        __out_int(out, keys->count);
+    }
+    else if (__arg_is(&(argv[0]), "FLUSHDB") && argc == 1)
+    {
+        __dict_clear(mem, keys, __free_value);
+        __out_status(out, "OK");
+    }
+    else
+    {
+        __out_error(out, KV_MEM_ERR_ARGS);
+    }
+}
+
+static void __dispatch(struct kv_mem* mem, int* db, int argc,
+                       struct kv_buf* argv, struct kv_out* out)
+{
+    struct kv_mem_dict* keys = __db(mem, *db);
+    char error[64];
+    struct kv_buf* cmd = &(argv[0]);
+
+    if (__arg_is(cmd, "GET") || __arg_is(cmd, "SET") ||
+        __arg_is(cmd, "SETEX") || __arg_is(cmd, "MGET") ||
+        __arg_is(cmd, "INCR"))
+        __cmd_string(mem, keys, argc, argv, out);
+    else if (__arg_is(cmd, "SETBIT") || __arg_is(cmd, "GETBIT"))
+        __cmd_bit(mem, keys, argc, argv, out);
+    else if (__arg_is(cmd, "HSET") || __arg_is(cmd, "HMSET") ||
+             __arg_is(cmd, "HGET") || __arg_is(cmd, "HMGET") ||
+             __arg_is(cmd, "HGETALL") || __arg_is(cmd, "HDEL"))
+        __cmd_hash(mem, keys, argc, argv, out);
+    else if (__arg_is(cmd, "LPUSH") || __arg_is(cmd, "RPUSH"))
+        __cmd_push(mem, keys, argc, argv, out);
+    else if (__arg_is(cmd, "LPOP") || __arg_is(cmd, "RPOP") ||
+             __arg_is(cmd, "BRPOP"))
+        __cmd_pop(mem, db, argc, argv, out);
+    else if (__arg_is(cmd, "LLEN") || __arg_is(cmd, "LRANGE") ||
+             __arg_is(cmd, "LTRIM") || __arg_is(cmd, "LINDEX") ||
+             __arg_is(cmd, "LSET") || __arg_is(cmd, "LINSERT") ||
+             __arg_is(cmd, "LREM"))
+        __cmd_list(mem, keys, argc, argv, out);
+    else if (__arg_is(cmd, "SADD") || __arg_is(cmd, "SREM") ||
+             __arg_is(cmd, "SISMEMBER") || __arg_is(cmd, "SMEMBERS") ||
+             __arg_is(cmd, "SDIFF"))
+        __cmd_set(mem, keys, argc, argv, out);
+    else if (__arg_is(cmd, "SELECT") || __arg_is(cmd, "DEL") ||
+             __arg_is(cmd, "EXISTS") || __arg_is(cmd, "DBSIZE") ||
+             __arg_is(cmd, "FLUSHDB"))
+        __cmd_keys(mem, db, argc, argv, out);
+    else if (__arg_is(cmd, "PING"))
+        __out_status(out, "PONG");
+    else if (__arg_is(cmd, "PUBLISH") && argc == 3)
+        /* nobody can subscribe to an embedded engine */
+        __out_int(out, 0);
+    else
+    {
+        snprintf(error, sizeof(error), "ERR unknown command '%.*s'",
+                 (int) (cmd->len < 16 ? cmd->len : 16), cmd->data);
+        __out_error(out, error);
+    }
+}
+
+/* runs every complete command in buf, returns the bytes consumed */
+static size_t __execute(struct kv_mem* mem, int* db, const uint8_t* buf,
+                        size_t len, struct kv_out* out)
+{
+    struct kv_buf* argv;
+    size_t pos = 0, consumed;
+    int argc = 0, ret;
+
+    while ((ret = __parse_command(&(buf[pos]), len - pos, &consumed, &argv,
+                                  &argc)) == 1)
+    {
+        __dispatch(mem, db, argc, argv, out);
+        free(argv);
+        pos += consumed;
+    }
+
+    if (ret < 0)
+        __out_error(out, "ERR Protocol error");
+
+    return pos;
+}
+
+/* lays out an empty store; the magic goes last so a creator dying part way
+ * leaves a store the next opener formats again */
+static int __format(struct kv_mem* mem, uint64_t size)
+{
+    struct kv_mem_header* hdr = mem->hdr;
+    pthread_mutexattr_t lock_attr;
+    pthread_condattr_t cond_attr;
+    int i;
+
+    memset(hdr, 0, sizeof(struct kv_mem_header));
+    hdr->limit = mem->limit;
+    hdr->size = size;
+    hdr->used = (sizeof(struct kv_mem_header) + 63) & ~63ULL;
+
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_setpshared(&lock_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&lock_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&(hdr->lock), &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&(hdr->pushed), &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    for (i = 0; i < KV_MEM_DATABASES; i++)
+    {
+        if ((hdr->dbs[i] = __off(mem, __dict_init(mem))) == 0)
+            return EXIT_FAILURE;
+    }
+
+    __sync_synchronize();
+    hdr->magic = KV_MEM_MAGIC;
+
+    return EXIT_SUCCESS;
+}
+
+/* reserves the store's whole address range at once; a new store takes the
+ * largest reservation the process can get, an existing one needs exactly
+ * the reservation it was created with */
+static int __reserve(struct kv_mem* mem, uint64_t limit, bool fresh)
+{
+    void* base = MAP_FAILED;
+    int flags = MAP_SHARED | MAP_NORESERVE;
+
+    if (mem->fd < 0)
+        flags |= MAP_ANONYMOUS;
+
+    for (; base == MAP_FAILED && limit >= KV_MEM_MIN_BYTES; limit /= 2)
+    {
+        base = mmap(NULL, limit, PROT_READ | PROT_WRITE, flags, mem->fd, 0);
+
+        if (base != MAP_FAILED)
+        {
+            mem->hdr = (struct kv_mem_header*) base;
+            mem->limit = limit;
+        }
+
+        if (!fresh)
+            break;
+    }
+
+    return base == MAP_FAILED ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int __attach(struct kv_mem* mem, const char* path)
+{
+    struct kv_mem_header hdr = { 0 };
+    struct stat st;
+    bool fresh = true;
+    int ret;
+
+    if ((mem->path = strdup(path)) == NULL ||
+        (mem->fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+        return EXIT_FAILURE;
+
+    /* holds off other openers while a new store is formatted */
+    if (flock(mem->fd, LOCK_EX) || fstat(mem->fd, &st))
+        return EXIT_FAILURE;
+
+    if (st.st_size >= (off_t) sizeof(struct kv_mem_header) &&
+        pread(mem->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr))
+    {
+        if (hdr.magic == KV_MEM_MAGIC)
+        {
+            fresh = false;
+        }
+        else if (hdr.magic)
+        {
+            fprintf_light_red(stderr, "kv_mem: %s is not a store.\n", path);
+            flock(mem->fd, LOCK_UN);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ret = __reserve(mem, fresh ? KV_MEM_MAX_BYTES : hdr.limit, fresh);
+
+    if (ret == EXIT_SUCCESS && fresh)
+    {
+        ret = ftruncate(mem->fd, KV_MEM_INITIAL_BYTES) ||
+              __format(mem, KV_MEM_INITIAL_BYTES) ? EXIT_FAILURE :
+                                                    EXIT_SUCCESS;
+    }
+
+    flock(mem->fd, LOCK_UN);
+
+    return ret;
+}
+
+/***** Core API *****/
+struct kv_mem* kv_mem_init(const char* path)
+{
+    struct kv_mem* mem = (struct kv_mem*) calloc(1, sizeof(struct kv_mem));
+
+    if (mem == NULL)
+        return NULL;
+
+    mem->fd = -1;
+
+    if (path ? __attach(mem, path) :
+               __reserve(mem, KV_MEM_MAX_BYTES, true) ||
+               __format(mem, mem->limit))
+    {
+        fprintf_light_red(stderr, "kv_mem: failed opening store %s.\n",
+                                  path ? path : "in memory");
+        kv_mem_destroy(mem);
+        return NULL;
+    }
+
+    return mem;
+}
+
+/* only detaches this process, the store lives on in its file and in the
+ * other processes that have it mapped */
+void kv_mem_destroy(struct kv_mem* mem)
+{
+    if (mem)
+    {
+        if (mem->hdr)
+            munmap(mem->hdr, mem->limit);
+
+        if (mem->fd >= 0)
+            close(mem->fd);
+
+        free(mem->path);
+        free(mem);
+    }
+}
+
+int kv_mem_execute(struct kv_mem* mem, int* db, const uint8_t* cmd,
+                   size_t len, uint8_t** reply, size_t* reply_len)
+{
+    struct kv_out out = { NULL, 0, 0, false };
+    size_t used;
+
+    __lock(mem);
+    used = __execute(mem, db, cmd, len, &out);
+    __unlock(mem);
+
+    if (out.oom || used != len)
+    {
+        free(out.data);
+        return EXIT_FAILURE;
+    }
+
+    *reply = out.data;
+    *reply_len = out.len;
+
+    return EXIT_SUCCESS;
+}
+
+/* every command already lands in the file's pages, this only waits until
+ * they reach the disk */
+int kv_mem_save(struct kv_mem* mem)
+{
+    uint64_t size;
+
+    if (mem->fd < 0)
+        return EXIT_SUCCESS;
+
+    __lock(mem);
+    size = mem->hdr->size;
+    __unlock(mem);
+
+    if (msync(mem->hdr, size, MS_SYNC))
+    {
+        fprintf_light_red(stderr, "kv_mem: failed syncing store %s.\n",
+                                  mem->path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+uint64_t kv_mem_keys(struct kv_mem* mem, int db)
+{
+    uint64_t count;
+
+    __lock(mem);
+    count = __db(mem, db)->count;
+    __unlock(mem);
+
+    return count;
+}
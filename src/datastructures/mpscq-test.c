@@ -0,0 +1,118 @@
+/*****************************************************************************
+ * mpscq-test.c                                                              *
+ *                                                                           *
+ * This file contains tests for the lock-free multi-producer single-consumer *
+ * queue.                                                                    *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "color.h"
+#include "mpscq.h"
+
+#define TEST_PRODUCERS 4
+#define TEST_ITEMS 200000
+
+struct item
+{
+    struct mpscq_node node;
+    uint64_t producer;
+    uint64_t seq;
+};
+
+struct mpscq* queue;
+
+void* producer(void* data)
+{
+    uint64_t id = (uint64_t) (uintptr_t) data, i;
+    struct item* item;
+
+    for (i = 0; i < TEST_ITEMS; i++)
+    {
+        item = (struct item*) malloc(sizeof(struct item));
+        assert(item != NULL);
+        item->producer = id;
+        item->seq = i;
+        mpscq_push(queue, &(item->node));
+    }
+
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    pthread_t threads[TEST_PRODUCERS];
+    uint64_t next[TEST_PRODUCERS] = { 0 }, received = 0, i;
+    struct item items[3], *item;
+
+    fprintf_blue(stdout, "-- MPSC Queue Test Suite --\n");
+    queue = mpscq_init();
+    assert(queue != NULL);
+
+    fprintf_light_blue(stdout, "* test empty queue\n");
+    assert(mpscq_empty(queue));
+    assert(mpscq_pop(queue) == NULL);
+
+    fprintf_light_blue(stdout, "* test single threaded FIFO\n");
+    for (i = 0; i < 3; i++)
+    {
+        items[i].seq = i;
+        mpscq_push(queue, &(items[i].node));
+    }
+    assert(!mpscq_empty(queue));
+    for (i = 0; i < 3; i++)
+        assert(((struct item*) mpscq_pop(queue))->seq == i);
+    assert(mpscq_pop(queue) == NULL);
+    assert(mpscq_empty(queue));
+
+    fprintf_light_blue(stdout, "* test concurrent producers keep order\n");
+    for (i = 0; i < TEST_PRODUCERS; i++)
+        assert(pthread_create(&(threads[i]), NULL, producer,
+                              (void*) (uintptr_t) i) == 0);
+
+    while (received < TEST_PRODUCERS * TEST_ITEMS)
+    {
+        if ((item = (struct item*) mpscq_pop(queue)) == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+
+        assert(item->seq == next[item->producer]);
+        next[item->producer]++;
+        received++;
+        free(item);
+    }
+
+    for (i = 0; i < TEST_PRODUCERS; i++)
+        pthread_join(threads[i], NULL);
+
+    assert(mpscq_pop(queue) == NULL);
+    mpscq_destroy(queue);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
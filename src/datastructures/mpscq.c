@@ -0,0 +1,110 @@
+/*****************************************************************************
+ * mpscq.c                                                                   *
+ *                                                                           *
+ * This file contains implementations for functions implementing an          *
+ * intrusive, lock-free, multi-producer single-consumer FIFO.                *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <stdlib.h>
+
+#include "mpscq.h"
+
+/* producers swing head with one atomic exchange and then link the previous
+ * node to theirs; the consumer owns tail and walks the links, a stub node
+ * keeps the list non-empty so neither side ever touches the other's end */
+struct mpscq
+{
+    struct mpscq_node* head;
+    struct mpscq_node* tail;
+    struct mpscq_node stub;
+};
+
+/***** Core API *****/
+struct mpscq* mpscq_init(void)
+{
+    struct mpscq* queue = (struct mpscq*) calloc(1, sizeof(struct mpscq));
+
+    if (queue == NULL)
+        return NULL;
+
+    queue->head = &(queue->stub);
+    queue->tail = &(queue->stub);
+
+    return queue;
+}
+
+void mpscq_destroy(struct mpscq* queue)
+{
+    free(queue);
+}
+
+void mpscq_push(struct mpscq* queue, struct mpscq_node* node)
+{
+    struct mpscq_node* prev;
+
+    __atomic_store_n(&(node->next), NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&(queue->head), node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&(prev->next), node, __ATOMIC_RELEASE);
+}
+
+struct mpscq_node* mpscq_pop(struct mpscq* queue)
+{
+    struct mpscq_node* tail = queue->tail;
+    struct mpscq_node* next = __atomic_load_n(&(tail->next), __ATOMIC_ACQUIRE);
+
+    if (tail == &(queue->stub))
+    {
+        if (next == NULL)
+            return NULL;
+
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&(tail->next), __ATOMIC_ACQUIRE);
+    }
+
+    if (next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    /* a producer has swung head but not linked its node yet */
+    if (tail != __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE))
+        return NULL;
+
+    /* tail is the last node: put the stub behind it so it can be handed
+     * out without leaving the list empty */
+    mpscq_push(queue, &(queue->stub));
+    next = __atomic_load_n(&(tail->next), __ATOMIC_ACQUIRE);
+
+    if (next)
+    {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+bool mpscq_empty(struct mpscq* queue)
+{
+    return queue->tail == &(queue->stub) &&
+           __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE) == &(queue->stub);
+}
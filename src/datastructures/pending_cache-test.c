@@ -0,0 +1,80 @@
+/*****************************************************************************
+ * pending_cache-test.c                                                      *
+ *                                                                           *
+ * This file contains tests for the bounded pending-write cache.             *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "color.h"
+#include "pending_cache.h"
+
+#define TEST_BLOCK_SIZE 4096
+
+int main(int argc, char* argv[])
+{
+    struct pending_cache* cache;
+    struct clock_cache_stats stats;
+    uint8_t buf[TEST_BLOCK_SIZE] = { 0 };
+    size_t len;
+
+    fprintf_blue(stdout, "-- Pending Cache Test Suite --\n");
+
+    fprintf_light_blue(stdout, "* test a write is taken once\n");
+    cache = pending_cache_init(2 * TEST_BLOCK_SIZE);
+    assert(cache != NULL);
+    memset(buf, 'a', TEST_BLOCK_SIZE);
+    assert(pending_cache_put(cache, 8, buf, TEST_BLOCK_SIZE, false) ==
+           EXIT_SUCCESS);
+    memset(buf, 0, TEST_BLOCK_SIZE);
+    len = TEST_BLOCK_SIZE;
+    assert(pending_cache_take(cache, 8, buf, &len) == EXIT_SUCCESS);
+    assert(len == TEST_BLOCK_SIZE && buf[0] == 'a');
+    len = TEST_BLOCK_SIZE;
+    assert(pending_cache_take(cache, 8, buf, &len) == EXIT_SUCCESS);
+    assert(len == 0);
+
+    fprintf_light_blue(stdout, "* test a write too large is dropped\n");
+    assert(pending_cache_put(cache, 8, buf, TEST_BLOCK_SIZE, false) ==
+           EXIT_SUCCESS);
+    len = TEST_BLOCK_SIZE / 2;
+    assert(pending_cache_take(cache, 8, buf, &len) == EXIT_SUCCESS);
+    assert(len == 0);
+    assert(!pending_cache_remove(cache, 8));
+
+    fprintf_light_blue(stdout, "* test last blocks outlive other writes\n");
+    assert(pending_cache_put(cache, 16, buf, TEST_BLOCK_SIZE, true) ==
+           EXIT_SUCCESS);
+    assert(pending_cache_put(cache, 24, buf, TEST_BLOCK_SIZE, false) ==
+           EXIT_SUCCESS);
+    assert(pending_cache_put(cache, 32, buf, TEST_BLOCK_SIZE, false) ==
+           EXIT_SUCCESS);
+    pending_cache_get_stats(cache, &stats);
+    assert(stats.pinned == 1 && stats.evictions == 1);
+    assert(pending_cache_remove(cache, 16));
+    pending_cache_destroy(cache);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
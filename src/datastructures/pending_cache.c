@@ -0,0 +1,90 @@
+/*****************************************************************************
+ * pending_cache.c                                                           *
+ *                                                                           *
+ * This file contains implementations for functions implementing a bounded   *
+ * cache of writes to sectors not yet classified, kept until the metadata    *
+ * that classifies them arrives.  A write is handed out once, on a take.     *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <stdlib.h>
+
+#include "pending_cache.h"
+
+struct pending_cache
+{
+    struct clock_cache* writes;
+};
+
+struct pending_cache* pending_cache_init(size_t budget)
+{
+    struct pending_cache* cache = (struct pending_cache*)
+                                  malloc(sizeof(struct pending_cache));
+
+    if (cache == NULL)
+        return NULL;
+
+    if ((cache->writes = clock_cache_init(budget)) == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void pending_cache_destroy(struct pending_cache* cache)
+{
+    if (cache == NULL)
+        return;
+
+    clock_cache_destroy(cache->writes);
+    free(cache);
+}
+
+void pending_cache_configure(struct pending_cache* cache, size_t budget)
+{
+    clock_cache_configure(cache->writes, budget);
+}
+
+int pending_cache_put(struct pending_cache* cache, uint64_t sector,
+                      const uint8_t* data, size_t len, bool pinned)
+{
+    return clock_cache_put(cache->writes, sector, data, len, pinned);
+}
+
+int pending_cache_take(struct pending_cache* cache, uint64_t sector,
+                       uint8_t* data, size_t* len)
+{
+    if (!clock_cache_take(cache->writes, sector, data, len))
+        *len = 0;
+
+    return EXIT_SUCCESS;
+}
+
+bool pending_cache_remove(struct pending_cache* cache, uint64_t sector)
+{
+    return clock_cache_remove(cache->writes, sector);
+}
+
+void pending_cache_get_stats(struct pending_cache* cache,
+                             struct clock_cache_stats* stats)
+{
+    clock_cache_get_stats(cache->writes, stats);
+}
@@ -0,0 +1,149 @@
+/*****************************************************************************
+ * sector_index-test.c                                                       *
+ *                                                                           *
+ * This file contains tests for the in-memory sector index.                  *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "color.h"
+#include "sector_index.h"
+
+#define TEST_SECTORS 4096
+#define TEST_STRIDE 8
+#define TEST_BLOCK 4096
+#define TEST_FILES 16
+#define TEST_UPDATES 20000
+
+struct sector_descriptor reference[TEST_SECTORS];
+
+void file_block(uint64_t sector, uint64_t file, uint64_t block,
+                struct sector_descriptor* desc)
+{
+    desc->type = SECTOR_PTR_FILE_DATA;
+    desc->id = file;
+    desc->start = block * TEST_BLOCK;
+    desc->end = desc->start + TEST_BLOCK;
+}
+
+void random_desc(uint64_t sector, struct sector_descriptor* desc)
+{
+    memset(desc, 0, sizeof(*desc));
+
+    switch (rand() % 4)
+    {
+        case 0:
+            desc->type = SECTOR_PTR_NONE;
+            break;
+        case 1:
+            desc->type = SECTOR_PTR_FILES;
+            desc->id = sector;
+            break;
+        case 2:
+            desc->type = SECTOR_PTR_EXTENT;
+            desc->id = rand() % TEST_FILES;
+            break;
+        default:
+            file_block(sector, rand() % TEST_FILES, rand() % 64, desc);
+            break;
+    }
+}
+
+void check_all(struct sector_index* index)
+{
+    struct sector_descriptor desc;
+    uint64_t i;
+    bool found;
+
+    for (i = 0; i < TEST_SECTORS; i++)
+    {
+        found = sector_index_lookup(index, i, &desc);
+        assert(found == (reference[i].type != SECTOR_PTR_NONE));
+        if (found)
+            assert(memcmp(&desc, &(reference[i]), sizeof(desc)) == 0);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    struct sector_index* index = sector_index_init();
+    struct sector_descriptor desc;
+    uint64_t i, sector;
+
+    fprintf_blue(stdout, "-- Sector Index Test Suite --\n");
+    assert(index != NULL);
+    memset(reference, 0, sizeof(reference));
+    srand(42);
+
+    fprintf_light_blue(stdout, "* test empty index\n");
+    assert(!sector_index_lookup(index, 0, &desc));
+
+    fprintf_light_blue(stdout, "* test bulk load of contiguous files\n");
+    for (i = 0; i < TEST_SECTORS / TEST_STRIDE; i++)
+    {
+        sector = i * TEST_STRIDE;
+        file_block(sector, i / 64, i % 64, &(reference[sector]));
+        /* load in reverse to exercise the sort */
+        sector = (TEST_SECTORS / TEST_STRIDE - 1 - i) * TEST_STRIDE;
+        file_block(sector, (sector / TEST_STRIDE) / 64,
+                   (sector / TEST_STRIDE) % 64, &desc);
+        assert(sector_index_set(index, sector, &desc) == EXIT_SUCCESS);
+    }
+    check_all(index);
+    assert(sector_index_runs(index) == (TEST_SECTORS / TEST_STRIDE) / 64);
+
+    fprintf_light_blue(stdout, "* test overwrite and remove inside a run\n");
+    file_block(64, 99, 0, &desc);
+    sector_index_set(index, 64, &desc);
+    reference[64] = desc;
+    sector_index_remove(index, 128);
+    memset(&(reference[128]), 0, sizeof(desc));
+    check_all(index);
+
+    fprintf_light_blue(stdout, "* test insert between strided blocks\n");
+    desc.type = SECTOR_PTR_DIRDATA;
+    desc.id = 3;
+    desc.start = desc.end = 0;
+    sector_index_set(index, 20, &desc);
+    reference[20] = desc;
+    check_all(index);
+
+    fprintf_light_blue(stdout, "* test random updates against reference\n");
+    for (i = 0; i < TEST_UPDATES; i++)
+    {
+        sector = rand() % TEST_SECTORS;
+        random_desc(sector, &desc);
+        sector_index_set(index, sector, &desc);
+        reference[sector] = desc;
+
+        if (i % 997 == 0)
+            check_all(index);
+    }
+    check_all(index);
+
+    sector_index_destroy(index);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
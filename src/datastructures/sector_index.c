@@ -0,0 +1,475 @@
+/*****************************************************************************
+ * sector_index.c                                                            *
+ *                                                                           *
+ * This file contains implementations for functions implementing an         *
+ * in-memory index from disk sectors to typed sector descriptors, stored as  *
+ * sorted strided runs so that large contiguous files cost a single entry.   *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sector_index.h"
+
+#define SECTOR_INDEX_INITIAL 1024
+
+/* block k of a run lives at sector + k * stride; its descriptor is desc with
+ * id advanced by k * id_step and [start, end) advanced by k * (end - start) */
+struct sector_run
+{
+    uint64_t sector;
+    uint64_t count;
+    uint64_t stride;
+    int64_t id_step;
+    struct sector_descriptor desc;
+};
+
+/* updates are staged and folded in on the next lookup, which turns the
+ * initial load into a single sort instead of many sorted inserts */
+struct sector_update
+{
+    uint64_t sector;
+    uint64_t seq;
+    struct sector_descriptor desc;
+};
+
+struct sector_index
+{
+    pthread_rwlock_t lock;
+    struct sector_run* runs;
+    size_t count;
+    size_t capacity;
+    struct sector_update* pending;
+    size_t pending_count;
+    size_t pending_capacity;
+    uint64_t seq;
+};
+
+static uint64_t __run_last(const struct sector_run* run)
+{
+    return run->sector + (run->count - 1) * run->stride;
+}
+
+static void __run_desc(const struct sector_run* run, uint64_t k,
+                       struct sector_descriptor* desc)
+{
+    uint64_t span = run->desc.end - run->desc.start;
+
+    *desc = run->desc;
+    desc->id += k * run->id_step;
+    desc->start += k * span;
+    desc->end += k * span;
+}
+
+static bool __desc_equal(const struct sector_descriptor* a,
+                         const struct sector_descriptor* b)
+{
+    return a->type == b->type && a->id == b->id && a->start == b->start &&
+           a->end == b->end;
+}
+
+/* can sector/desc become the next block of run */
+static bool __run_can_append(const struct sector_run* run, uint64_t sector,
+                             const struct sector_descriptor* desc)
+{
+    struct sector_descriptor next;
+    uint64_t span = run->desc.end - run->desc.start;
+
+    if (desc->type != run->desc.type || sector <= __run_last(run))
+        return false;
+
+    if (run->count > 1)
+    {
+        __run_desc(run, run->count, &next);
+        return sector == __run_last(run) + run->stride &&
+               __desc_equal(&next, desc);
+    }
+
+    /* the second block fixes the stride: same id, or id tracking sector */
+    return desc->start == run->desc.start + span &&
+           desc->end == run->desc.end + span &&
+           (desc->id == run->desc.id ||
+            desc->id - run->desc.id == sector - run->sector);
+}
+
+static int __reserve(struct sector_index* index)
+{
+    struct sector_run* runs;
+
+    if (index->count < index->capacity)
+        return EXIT_SUCCESS;
+
+    runs = (struct sector_run*) realloc(index->runs, 2 * index->capacity *
+                                                     sizeof(struct sector_run));
+    if (runs == NULL)
+        return EXIT_FAILURE;
+
+    index->runs = runs;
+    index->capacity *= 2;
+
+    return EXIT_SUCCESS;
+}
+
+static int __insert_run(struct sector_index* index, size_t pos,
+                        const struct sector_run* run)
+{
+    if (__reserve(index))
+        return EXIT_FAILURE;
+
+    memmove(&(index->runs[pos + 1]), &(index->runs[pos]),
+            (index->count - pos) * sizeof(struct sector_run));
+    index->runs[pos] = *run;
+    index->count++;
+
+    return EXIT_SUCCESS;
+}
+
+static void __delete_run(struct sector_index* index, size_t pos)
+{
+    memmove(&(index->runs[pos]), &(index->runs[pos + 1]),
+            (index->count - pos - 1) * sizeof(struct sector_run));
+    index->count--;
+}
+
+/* number of runs starting at or before sector */
+static size_t __upper_bound(struct sector_index* index, uint64_t sector)
+{
+    size_t lo = 0, hi = index->count, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+
+        if (index->runs[mid].sector <= sector)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* cut run i around sector: blocks before it stay, blocks after it move to a
+ * new run at i + 1, a block at sector itself is dropped */
+static int __split_run(struct sector_index* index, size_t i, uint64_t sector)
+{
+    struct sector_run* run = &(index->runs[i]);
+    struct sector_run right;
+    uint64_t before, after;
+
+    before = (sector - run->sector + run->stride - 1) / run->stride;
+    if (before > run->count)
+        before = run->count;
+
+    after = before;
+    if (after < run->count && run->sector + after * run->stride == sector)
+        after++;
+
+    right = *run;
+    right.sector = run->sector + after * run->stride;
+    right.count = run->count - after;
+    __run_desc(run, after, &(right.desc));
+
+    if (before == 0)
+    {
+        if (right.count)
+            *run = right;
+        else
+            __delete_run(index, i);
+        return EXIT_SUCCESS;
+    }
+
+    run->count = before;
+
+    if (right.count)
+        return __insert_run(index, i + 1, &right);
+
+    return EXIT_SUCCESS;
+}
+
+/* fold run i + 1 into run i if it continues it exactly */
+static void __try_merge(struct sector_index* index, size_t i)
+{
+    struct sector_run* a, *b;
+    uint64_t stride;
+    int64_t id_step;
+
+    if (i + 1 >= index->count)
+        return;
+
+    a = &(index->runs[i]);
+    b = &(index->runs[i + 1]);
+
+    if (!__run_can_append(a, b->sector, &(b->desc)))
+        return;
+
+    stride = a->count > 1 ? a->stride : b->sector - a->sector;
+    id_step = a->count > 1 ? a->id_step : (int64_t) (b->desc.id - a->desc.id);
+
+    if (b->count > 1 && (b->stride != stride || b->id_step != id_step))
+        return;
+
+    a->stride = stride;
+    a->id_step = id_step;
+    a->count += b->count;
+    __delete_run(index, i + 1);
+}
+
+static int __apply(struct sector_index* index, uint64_t sector,
+                   const struct sector_descriptor* desc)
+{
+    struct sector_run run;
+    size_t pos = __upper_bound(index, sector);
+
+    if (pos && sector <= __run_last(&(index->runs[pos - 1])))
+    {
+        if (__split_run(index, pos - 1, sector))
+            return EXIT_FAILURE;
+        pos = __upper_bound(index, sector);
+    }
+
+    if (desc->type == SECTOR_PTR_NONE)
+        return EXIT_SUCCESS;
+
+    run.sector = sector;
+    run.count = 1;
+    run.stride = 1;
+    run.id_step = 0;
+    run.desc = *desc;
+
+    if (__insert_run(index, pos, &run))
+        return EXIT_FAILURE;
+
+    __try_merge(index, pos);
+    if (pos)
+        __try_merge(index, pos - 1);
+
+    return EXIT_SUCCESS;
+}
+
+static int __update_compare(const void* a, const void* b)
+{
+    const struct sector_update* x = (const struct sector_update*) a;
+    const struct sector_update* y = (const struct sector_update*) b;
+
+    if (x->sector != y->sector)
+        return (x->sector > y->sector) - (x->sector < y->sector);
+
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/* caller holds the write lock */
+static int __flush_pending(struct sector_index* index)
+{
+    struct sector_update* update;
+    struct sector_run run;
+    size_t i;
+    int ret = EXIT_SUCCESS;
+
+    if (index->pending_count == 0)
+        return EXIT_SUCCESS;
+
+    if (index->count)
+    {
+        for (i = 0; i < index->pending_count; i++)
+        {
+            update = &(index->pending[i]);
+            if (__apply(index, update->sector, &(update->desc)))
+                ret = EXIT_FAILURE;
+        }
+
+        index->pending_count = 0;
+        return ret;
+    }
+
+    /* empty index: sort once and build runs by appending */
+    qsort(index->pending, index->pending_count, sizeof(struct sector_update),
+          __update_compare);
+
+    for (i = 0; i < index->pending_count; i++)
+    {
+        update = &(index->pending[i]);
+
+        /* last update to a sector wins */
+        if (i + 1 < index->pending_count &&
+            index->pending[i + 1].sector == update->sector)
+            continue;
+
+        if (update->desc.type == SECTOR_PTR_NONE)
+            continue;
+
+        run.sector = update->sector;
+        run.count = 1;
+        run.stride = 1;
+        run.id_step = 0;
+        run.desc = update->desc;
+
+        if (__insert_run(index, index->count, &run))
+        {
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        if (index->count > 1)
+            __try_merge(index, index->count - 2);
+    }
+
+    index->pending_count = 0;
+
+    return ret;
+}
+
+static int __stage(struct sector_index* index, uint64_t sector,
+                   const struct sector_descriptor* desc)
+{
+    struct sector_update* pending;
+
+    pthread_rwlock_wrlock(&(index->lock));
+
+    if (index->pending_count == index->pending_capacity)
+    {
+        pending = (struct sector_update*)
+                  realloc(index->pending, 2 * index->pending_capacity *
+                                          sizeof(struct sector_update));
+        if (pending == NULL)
+        {
+            pthread_rwlock_unlock(&(index->lock));
+            return EXIT_FAILURE;
+        }
+
+        index->pending = pending;
+        index->pending_capacity *= 2;
+    }
+
+    index->pending[index->pending_count].sector = sector;
+    index->pending[index->pending_count].seq = index->seq++;
+    index->pending[index->pending_count].desc = *desc;
+    index->pending_count++;
+
+    pthread_rwlock_unlock(&(index->lock));
+
+    return EXIT_SUCCESS;
+}
+
+struct sector_index* sector_index_init(void)
+{
+    struct sector_index* index = (struct sector_index*)
+                                 calloc(1, sizeof(struct sector_index));
+
+    if (index == NULL)
+        return NULL;
+
+    index->runs = (struct sector_run*) malloc(SECTOR_INDEX_INITIAL *
+                                              sizeof(struct sector_run));
+    index->pending = (struct sector_update*)
+                     malloc(SECTOR_INDEX_INITIAL *
+                            sizeof(struct sector_update));
+
+    if (index->runs == NULL || index->pending == NULL)
+    {
+        free(index->runs);
+        free(index->pending);
+        free(index);
+        return NULL;
+    }
+
+    index->capacity = SECTOR_INDEX_INITIAL;
+    index->pending_capacity = SECTOR_INDEX_INITIAL;
+    pthread_rwlock_init(&(index->lock), NULL);
+
+    return index;
+}
+
+void sector_index_destroy(struct sector_index* index)
+{
+    if (index)
+    {
+        pthread_rwlock_destroy(&(index->lock));
+        free(index->runs);
+        free(index->pending);
+        free(index);
+    }
+}
+
+int sector_index_set(struct sector_index* index, uint64_t sector,
+                     const struct sector_descriptor* desc)
+{
+    return __stage(index, sector, desc);
+}
+
+int sector_index_remove(struct sector_index* index, uint64_t sector)
+{
+    struct sector_descriptor none;
+
+    memset(&none, 0, sizeof(none));
+
+    return __stage(index, sector, &none);
+}
+
+bool sector_index_lookup(struct sector_index* index, uint64_t sector,
+                         struct sector_descriptor* desc)
+{
+    struct sector_run* run;
+    uint64_t k;
+    size_t pos;
+    bool found = false;
+
+    pthread_rwlock_rdlock(&(index->lock));
+
+    if (index->pending_count)
+    {
+        pthread_rwlock_unlock(&(index->lock));
+        pthread_rwlock_wrlock(&(index->lock));
+        __flush_pending(index);
+        pthread_rwlock_unlock(&(index->lock));
+        pthread_rwlock_rdlock(&(index->lock));
+    }
+
+    pos = __upper_bound(index, sector);
+
+    if (pos)
+    {
+        run = &(index->runs[pos - 1]);
+        k = sector - run->sector;
+
+        if (k % run->stride == 0 && k / run->stride < run->count)
+        {
+            __run_desc(run, k / run->stride, desc);
+            found = true;
+        }
+    }
+
+    pthread_rwlock_unlock(&(index->lock));
+
+    return found;
+}
+
+uint64_t sector_index_runs(struct sector_index* index)
+{
+    uint64_t runs;
+
+    pthread_rwlock_wrlock(&(index->lock));
+    __flush_pending(index);
+    runs = index->count;
+    pthread_rwlock_unlock(&(index->lock));
+
+    return runs;
+}
@@ -0,0 +1,68 @@
+/*****************************************************************************
+ * shadow_store-test.c                                                       *
+ *                                                                           *
+ * This file contains tests for the metadata block shadow store.             *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "color.h"
+#include "shadow_store.h"
+
+#define TEST_BLOCK_SIZE 4096
+
+int main(int argc, char* argv[])
+{
+    struct shadow_store* store;
+    struct clock_cache_stats stats;
+    uint8_t buf[TEST_BLOCK_SIZE] = { 0 };
+    size_t len;
+
+    fprintf_blue(stdout, "-- Shadow Store Test Suite --\n");
+
+    fprintf_light_blue(stdout, "* test a block stays after a diff\n");
+    store = shadow_store_init(2 * TEST_BLOCK_SIZE);
+    assert(store != NULL);
+    memset(buf, 'a', TEST_BLOCK_SIZE);
+    assert(shadow_store_put(store, 8, buf, TEST_BLOCK_SIZE) == EXIT_SUCCESS);
+    memset(buf, 0, TEST_BLOCK_SIZE);
+    len = TEST_BLOCK_SIZE;
+    assert(shadow_store_get(store, 8, buf, &len) && buf[0] == 'a');
+    len = TEST_BLOCK_SIZE;
+    assert(shadow_store_get(store, 8, buf, &len));
+    assert(shadow_store_remove(store, 8));
+
+    fprintf_light_blue(stdout, "* test no block is pinned\n");
+    assert(shadow_store_put(store, 16, buf, TEST_BLOCK_SIZE) == EXIT_SUCCESS);
+    assert(shadow_store_put(store, 24, buf, TEST_BLOCK_SIZE) == EXIT_SUCCESS);
+    assert(shadow_store_put(store, 32, buf, TEST_BLOCK_SIZE) == EXIT_SUCCESS);
+    shadow_store_get_stats(store, &stats);
+    assert(stats.pinned == 0 && stats.evictions == 1);
+    len = TEST_BLOCK_SIZE;
+    assert(!shadow_store_get(store, 16, buf, &len));
+    shadow_store_destroy(store);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
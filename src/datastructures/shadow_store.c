@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * shadow_store.c                                                            *
+ *                                                                           *
+ * This file contains implementations for functions keeping the last bytes   *
+ * seen for metadata blocks, so the inferencer can diff a new write against  *
+ * them without reading state back out of the kv store.  No block is         *
+ * pinned: one diffed often is kept by the CLOCK hand's second pass.         *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <stdlib.h>
+
+#include "shadow_store.h"
+
+struct shadow_store
+{
+    struct clock_cache* blocks;
+};
+
+struct shadow_store* shadow_store_init(size_t budget)
+{
+    struct shadow_store* store = (struct shadow_store*)
+                                 malloc(sizeof(struct shadow_store));
+
+    if (store == NULL)
+        return NULL;
+
+    if ((store->blocks = clock_cache_init(budget)) == NULL)
+    {
+        free(store);
+        return NULL;
+    }
+
+    return store;
+}
+
+void shadow_store_destroy(struct shadow_store* store)
+{
+    if (store == NULL)
+        return;
+
+    clock_cache_destroy(store->blocks);
+    free(store);
+}
+
+void shadow_store_configure(struct shadow_store* store, size_t budget)
+{
+    clock_cache_configure(store->blocks, budget);
+}
+
+int shadow_store_put(struct shadow_store* store, uint64_t key,
+                     const uint8_t* data, size_t len)
+{
+    return clock_cache_put(store->blocks, key, data, len, false);
+}
+
+bool shadow_store_get(struct shadow_store* store, uint64_t key,
+                      uint8_t* data, size_t* len)
+{
+    return clock_cache_get(store->blocks, key, data, len);
+}
+
+bool shadow_store_remove(struct shadow_store* store, uint64_t key)
+{
+    return clock_cache_remove(store->blocks, key);
+}
+
+void shadow_store_get_stats(struct shadow_store* store,
+                            struct clock_cache_stats* stats)
+{
+    clock_cache_get_stats(store->blocks, stats);
+}
@@ -0,0 +1,131 @@
+/*****************************************************************************
+ * shmring-test.c                                                            *
+ *                                                                           *
+ * This file contains tests for the shared-memory ring.                      *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "shmring.h"
+
+#define TEST_RECORDS 20000
+#define TEST_RING_SIZE 65536
+
+static size_t test_len(uint64_t i)
+{
+    return (i * 37) % 4096;
+}
+
+void producer(const char* name)
+{
+    struct shmring* ring = shmring_open(name, TEST_RING_SIZE);
+    uint8_t buf[4096];
+    uint64_t i;
+
+    assert(ring != NULL);
+    assert(!shmring_created(ring));
+
+    for (i = 0; i < TEST_RECORDS; i++)
+    {
+        memset(buf, (int) (i & 0xff), test_len(i));
+        assert(shmring_push(ring, (int64_t) i, buf, test_len(i)) ==
+               EXIT_SUCCESS);
+    }
+
+    shmring_shutdown(ring);
+    shmring_close(ring);
+}
+
+int main(int argc, char* argv[])
+{
+    struct shmring* ring;
+    char name[64];
+    int64_t tag;
+    uint8_t* data;
+    size_t len;
+    uint64_t i = 0, j;
+    pid_t pid;
+    int status;
+
+    fprintf_blue(stdout, "-- Shared-Memory Ring Test Suite --\n");
+
+    snprintf(name, 64, "gammaray-shmring-test-%d", (int) getpid());
+    ring = shmring_open(name, TEST_RING_SIZE);
+    assert(ring != NULL);
+    assert(shmring_created(ring));
+
+    fprintf_light_blue(stdout, "* test record too large\n");
+    assert(shmring_push(ring, 0, NULL, TEST_RING_SIZE) == EXIT_FAILURE);
+
+    fprintf_light_blue(stdout, "* test empty try_pop\n");
+    assert(shmring_try_pop(ring, &tag, &data, &len) == 0);
+
+    fprintf_light_blue(stdout, "* test producer/consumer across fork\n");
+    if ((pid = fork()) == 0)
+    {
+        producer(name);
+        exit(EXIT_SUCCESS);
+    }
+
+    while (shmring_pop(ring, &tag, &data, &len) == 1)
+    {
+        assert(tag == (int64_t) i);
+        assert(len == test_len(i));
+        for (j = 0; j < len; j++)
+            assert(data[j] == (i & 0xff));
+        free(data);
+        i++;
+    }
+
+    assert(i == TEST_RECORDS);
+    assert(shmring_is_shutdown(ring));
+    assert(shmring_used(ring) == 0);
+
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+    fprintf_light_blue(stdout, "* test reusing a stale ring\n");
+    /* left behind without an unlink, as after a crash */
+    shmring_close(ring);
+    ring = shmring_open(name, TEST_RING_SIZE);
+    assert(ring != NULL);
+    assert(shmring_created(ring));
+    assert(!shmring_is_shutdown(ring));
+    assert(shmring_try_pop(ring, &tag, &data, &len) == 0);
+    assert(shmring_push(ring, 7, (uint8_t*) "abc", 3) == EXIT_SUCCESS);
+    assert(shmring_pop(ring, &tag, &data, &len) == 1);
+    assert(tag == 7 && len == 3 && memcmp(data, "abc", 3) == 0);
+    free(data);
+
+    /* this handle took the stale ring over, so it removes the segment */
+    shmring_release(ring, name);
+    assert(shmring_unlink(name) == EXIT_FAILURE);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,431 @@
+/*****************************************************************************
+ * shmring.c                                                                 *
+ *                                                                           *
+ * This file contains implementations for functions implementing a named,    *
+ * memory-mapped single-producer single-consumer ring of variable-length     *
+ * records shared between processes on the same host.                        *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "shmring.h"
+#include "util.h"
+
+#define SHMRING_MAGIC 0x474e495248534d47LL
+#define SHMRING_NAME_MAX 256
+#define SHMRING_ALIGN 16
+#define SHMRING_CACHELINE 64
+
+#define SHMRING_RECORD_DATA 0x01
+#define SHMRING_RECORD_WRAP 0x02
+
+#define SHMRING_RESETTING 2 /* shutdown value while a stale ring is reused */
+
+/* positions are free-running byte counters, masked by size - 1 */
+struct shmring_header
+{
+    uint64_t magic;
+    uint64_t size;
+    uint64_t head __attribute__((aligned(SHMRING_CACHELINE)));
+    uint64_t tail __attribute__((aligned(SHMRING_CACHELINE)));
+    uint32_t producer_waiting __attribute__((aligned(SHMRING_CACHELINE)));
+    uint32_t shutdown;
+    sem_t items;
+    sem_t space;
+} __attribute__((aligned(SHMRING_CACHELINE)));
+
+struct shmring_record
+{
+    uint32_t len;
+    uint32_t flags;
+    int64_t tag;
+} __attribute__((packed));
+
+struct shmring
+{
+    struct shmring_header* hdr;
+    uint8_t* data;
+    size_t mapped;
+    bool created;
+};
+
+static uint64_t __shmring_record_size(size_t len)
+{
+    return (sizeof(struct shmring_record) + len + SHMRING_ALIGN - 1) &
+           ~((uint64_t) SHMRING_ALIGN - 1);
+}
+
+static int __shmring_name(const char* name, char* buf, size_t len)
+{
+    if (name == NULL || strlen(name) + 2 > len)
+        return EXIT_FAILURE;
+
+    snprintf(buf, len, "%s%s", name[0] == '/' ? "" : "/", name);
+
+    return EXIT_SUCCESS;
+}
+
+static int __sem_wait(sem_t* sem)
+{
+    while (sem_wait(sem))
+    {
+        if (errno != EINTR)
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void __shmring_reset(struct shmring_header* hdr)
+{
+    hdr->head = 0;
+    hdr->tail = 0;
+    hdr->producer_waiting = 0;
+    sem_init(&(hdr->items), 1, 0);
+    sem_init(&(hdr->space), 1, 0);
+}
+
+/* a segment left behind by a finished run is shut down and drained; its
+ * items semaphore still holds the shutdown post, so it is reset before use
+ * and the opener takes it over as creator */
+static bool __shmring_reclaim(struct shmring_header* hdr)
+{
+    uint32_t expected = 1;
+
+    if (__atomic_load_n(&(hdr->head), __ATOMIC_ACQUIRE) != hdr->tail)
+        return false;
+
+    if (!__atomic_compare_exchange_n(&(hdr->shutdown), &expected,
+                                     SHMRING_RESETTING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return false;
+
+    sem_destroy(&(hdr->items));
+    sem_destroy(&(hdr->space));
+    __shmring_reset(hdr);
+    __atomic_store_n(&(hdr->shutdown), 0, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+struct shmring* shmring_open(const char* name, uint64_t size)
+{
+    char path[SHMRING_NAME_MAX];
+    struct shmring* ring;
+    struct shmring_header* hdr;
+    struct stat st;
+    bool created = true;
+    void* map;
+    int fd;
+
+    if (__shmring_name(name, path, SHMRING_NAME_MAX))
+        return NULL;
+
+    /* round the data region down to a power of two */
+    size = ((uint64_t) 1) << highest_set_bit64(size);
+
+    if ((fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+    {
+        if (errno != EEXIST)
+            return NULL;
+
+        created = false;
+
+        if ((fd = shm_open(path, O_RDWR, 0600)) < 0)
+            return NULL;
+
+        /* creator may still be sizing the segment */
+        do
+        {
+            if (fstat(fd, &st))
+            {
+                close(fd);
+                return NULL;
+            }
+
+            if (st.st_size < sizeof(struct shmring_header))
+                usleep(1000);
+        } while (st.st_size < sizeof(struct shmring_header));
+
+        size = st.st_size - sizeof(struct shmring_header);
+    }
+    else if (ftruncate(fd, sizeof(struct shmring_header) + size))
+    {
+        close(fd);
+        shm_unlink(path);
+        return NULL;
+    }
+
+    map = mmap(NULL, sizeof(struct shmring_header) + size,
+               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    hdr = (struct shmring_header*) map;
+
+    if (created)
+    {
+        hdr->size = size;
+        hdr->shutdown = 0;
+        __shmring_reset(hdr);
+        __atomic_store_n(&(hdr->magic), SHMRING_MAGIC, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        while (__atomic_load_n(&(hdr->magic), __ATOMIC_ACQUIRE) !=
+               SHMRING_MAGIC)
+            usleep(1000);
+
+        created = __shmring_reclaim(hdr);
+
+        while (__atomic_load_n(&(hdr->shutdown), __ATOMIC_ACQUIRE) ==
+               SHMRING_RESETTING)
+            usleep(1000);
+    }
+
+    ring = (struct shmring*) malloc(sizeof(struct shmring));
+
+    if (ring == NULL)
+    {
+        munmap(map, sizeof(struct shmring_header) + size);
+        return NULL;
+    }
+
+    ring->hdr = hdr;
+    ring->data = ((uint8_t*) map) + sizeof(struct shmring_header);
+    ring->mapped = sizeof(struct shmring_header) + size;
+    ring->created = created;
+
+    return ring;
+}
+
+void shmring_close(struct shmring* ring)
+{
+    if (ring)
+    {
+        munmap(ring->hdr, ring->mapped);
+        free(ring);
+    }
+}
+
+bool shmring_created(struct shmring* ring)
+{
+    return ring->created;
+}
+
+int shmring_unlink(const char* name)
+{
+    char path[SHMRING_NAME_MAX];
+
+    if (__shmring_name(name, path, SHMRING_NAME_MAX))
+        return EXIT_FAILURE;
+
+    return shm_unlink(path) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* the side that created the segment removes it, so the next run with this
+ * name starts from a fresh ring; the other side may still be attached and
+ * keeps its mapping until it closes */
+void shmring_release(struct shmring* ring, const char* name)
+{
+    bool created;
+
+    if (ring == NULL)
+        return;
+
+    created = ring->created;
+    shmring_close(ring);
+
+    if (created)
+        shmring_unlink(name);
+}
+
+int shmring_push(struct shmring* ring, int64_t tag, const uint8_t* data,
+                 size_t len)
+{
+    struct shmring_header* hdr = ring->hdr;
+    struct shmring_record* record;
+    uint64_t head, tail, pos, needed, wrap = 0;
+    uint64_t rsize = __shmring_record_size(len);
+
+    /* guarantees progress: a record never exceeds half the ring */
+    if (rsize > hdr->size / 2 || len > UINT32_MAX)
+    {
+        fprintf_light_red(stderr, "shmring: record of %zu bytes too large "
+                                  "for ring.\n", len);
+        return EXIT_FAILURE;
+    }
+
+    head = hdr->head;
+    pos = head & (hdr->size - 1);
+
+    if (hdr->size - pos < rsize)
+        wrap = hdr->size - pos;
+
+    needed = wrap + rsize;
+
+    while (1)
+    {
+        tail = __atomic_load_n(&(hdr->tail), __ATOMIC_ACQUIRE);
+
+        if (hdr->size - (head - tail) >= needed)
+            break;
+
+        __atomic_store_n(&(hdr->producer_waiting), 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&(hdr->tail), __ATOMIC_SEQ_CST);
+
+        if (hdr->size - (head - tail) >= needed)
+            break;
+
+        if (__sem_wait(&(hdr->space)))
+            return EXIT_FAILURE;
+    }
+
+    if (wrap)
+    {
+        /* a header always fits since positions are 16-byte aligned */
+        record = (struct shmring_record*) &(ring->data[pos]);
+        record->len = 0;
+        record->flags = SHMRING_RECORD_WRAP;
+        record->tag = 0;
+        head += wrap;
+        pos = 0;
+    }
+
+    record = (struct shmring_record*) &(ring->data[pos]);
+    record->len = (uint32_t) len;
+    record->flags = SHMRING_RECORD_DATA;
+    record->tag = tag;
+    memcpy(&(ring->data[pos + sizeof(struct shmring_record)]), data, len);
+
+    __atomic_store_n(&(hdr->head), head + rsize, __ATOMIC_RELEASE);
+    sem_post(&(hdr->items));
+
+    return EXIT_SUCCESS;
+}
+
+static int __shmring_consume(struct shmring* ring, int64_t* tag,
+                             uint8_t** data, size_t* len)
+{
+    struct shmring_header* hdr = ring->hdr;
+    struct shmring_record* record;
+    uint64_t tail = hdr->tail, head, pos;
+
+    head = __atomic_load_n(&(hdr->head), __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return 0;
+
+    pos = tail & (hdr->size - 1);
+    record = (struct shmring_record*) &(ring->data[pos]);
+
+    if (record->flags == SHMRING_RECORD_WRAP)
+    {
+        tail += hdr->size - pos;
+        pos = 0;
+        record = (struct shmring_record*) &(ring->data[pos]);
+    }
+
+    *tag = record->tag;
+    *len = record->len;
+    *data = (uint8_t*) malloc(record->len ? record->len : 1);
+
+    if (*data == NULL)
+        return -1;
+
+    memcpy(*data, &(ring->data[pos + sizeof(struct shmring_record)]),
+           record->len);
+
+    tail += __shmring_record_size(record->len);
+    __atomic_store_n(&(hdr->tail), tail, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&(hdr->producer_waiting), 0, __ATOMIC_SEQ_CST))
+        sem_post(&(hdr->space));
+
+    return 1;
+}
+
+int shmring_pop(struct shmring* ring, int64_t* tag, uint8_t** data,
+                size_t* len)
+{
+    int ret;
+
+    while (1)
+    {
+        if (__sem_wait(&(ring->hdr->items)))
+            return -1;
+
+        if ((ret = __shmring_consume(ring, tag, data, len)))
+            return ret;
+
+        /* only the shutdown post arrives without a record */
+        if (__atomic_load_n(&(ring->hdr->shutdown), __ATOMIC_ACQUIRE))
+        {
+            sem_post(&(ring->hdr->items));
+            return 0;
+        }
+    }
+}
+
+int shmring_try_pop(struct shmring* ring, int64_t* tag, uint8_t** data,
+                    size_t* len)
+{
+    int ret;
+
+    if (sem_trywait(&(ring->hdr->items)))
+        return 0;
+
+    if ((ret = __shmring_consume(ring, tag, data, len)) == 0)
+        sem_post(&(ring->hdr->items));
+
+    return ret;
+}
+
+void shmring_shutdown(struct shmring* ring)
+{
+    __atomic_store_n(&(ring->hdr->shutdown), 1, __ATOMIC_RELEASE);
+    sem_post(&(ring->hdr->items));
+}
+
+bool shmring_is_shutdown(struct shmring* ring)
+{
+    return __atomic_load_n(&(ring->hdr->shutdown), __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE) ==
+           ring->hdr->tail;
+}
+
+uint64_t shmring_used(struct shmring* ring)
+{
+    return __atomic_load_n(&(ring->hdr->head), __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&(ring->hdr->tail), __ATOMIC_ACQUIRE);
+}
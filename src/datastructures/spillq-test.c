@@ -0,0 +1,130 @@
+/*****************************************************************************
+ * spillq-test.c                                                             *
+ *                                                                           *
+ * This file contains tests for the bounded spill queue.                     *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "spillq.h"
+
+#define TEST_RECORD_SIZE 512
+#define TEST_MEM_RECORDS 8
+#define TEST_DISK_RECORDS 16
+
+void push_records(struct spillq* queue, int64_t start, int64_t end)
+{
+    uint8_t buf[TEST_RECORD_SIZE];
+    int64_t i;
+
+    for (i = start; i < end; i++)
+    {
+        memset(buf, (int) (i & 0xff), TEST_RECORD_SIZE);
+        assert(spillq_push(queue, i, buf, TEST_RECORD_SIZE) == EXIT_SUCCESS);
+    }
+}
+
+void pop_records(struct spillq* queue, int64_t start, int64_t end)
+{
+    int64_t i, tag;
+    uint8_t* data;
+    size_t len, j;
+
+    for (i = start; i < end; i++)
+    {
+        assert(spillq_pop(queue, &tag, &data, &len) == 1);
+        assert(tag == i);
+        assert(len == TEST_RECORD_SIZE);
+        for (j = 0; j < len; j++)
+            assert(data[j] == (i & 0xff));
+        free(data);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    struct spillq* queue;
+    struct spillq_stats stats;
+    uint8_t buf[TEST_RECORD_SIZE] = { 0 };
+    char path[64];
+    int64_t tag;
+    uint8_t* data;
+    size_t len;
+
+    fprintf_blue(stdout, "-- Spill Queue Test Suite --\n");
+
+    fprintf_light_blue(stdout, "* test memory-only queue\n");
+    queue = spillq_init(TEST_MEM_RECORDS * TEST_RECORD_SIZE, NULL, 0);
+    assert(queue != NULL);
+    assert(spillq_empty(queue));
+    assert(spillq_pop(queue, &tag, &data, &len) == 0);
+    push_records(queue, 0, TEST_MEM_RECORDS);
+    assert(spillq_push(queue, -1, buf, TEST_RECORD_SIZE) == EXIT_FAILURE);
+    spillq_get_stats(queue, &stats);
+    assert(stats.depth == TEST_MEM_RECORDS);
+    assert(stats.drops == 1);
+    assert(stats.spilled_bytes == 0);
+    pop_records(queue, 0, TEST_MEM_RECORDS);
+    assert(spillq_empty(queue));
+    spillq_destroy(queue);
+
+    fprintf_light_blue(stdout, "* test spill to overflow log\n");
+    snprintf(path, 64, "/tmp/gammaray-spillq-test-%d", (int) getpid());
+    queue = spillq_init(TEST_MEM_RECORDS * TEST_RECORD_SIZE, path,
+                        TEST_DISK_RECORDS * (TEST_RECORD_SIZE + 16));
+    assert(queue != NULL);
+    assert(access(path, F_OK) != 0);
+    push_records(queue, 0, TEST_MEM_RECORDS + TEST_DISK_RECORDS);
+    assert(spillq_push(queue, -1, buf, TEST_RECORD_SIZE) == EXIT_FAILURE);
+    spillq_get_stats(queue, &stats);
+    assert(stats.depth == TEST_MEM_RECORDS + TEST_DISK_RECORDS);
+    assert(stats.mem_bytes == TEST_MEM_RECORDS * TEST_RECORD_SIZE);
+    assert(stats.disk_bytes == stats.spilled_bytes);
+    assert(stats.drops == 1);
+
+    fprintf_light_blue(stdout, "* test ordering across memory and log\n");
+    pop_records(queue, 0, TEST_MEM_RECORDS + 1);
+    /* memory has room again, but the log still holds older records */
+    push_records(queue, TEST_MEM_RECORDS + TEST_DISK_RECORDS,
+                 TEST_MEM_RECORDS + TEST_DISK_RECORDS + 1);
+    spillq_get_stats(queue, &stats);
+    assert(stats.mem_bytes == 0);
+    pop_records(queue, TEST_MEM_RECORDS + 1,
+                TEST_MEM_RECORDS + TEST_DISK_RECORDS + 1);
+    spillq_get_stats(queue, &stats);
+    assert(stats.disk_bytes == 0);
+    assert(spillq_empty(queue));
+
+    fprintf_light_blue(stdout, "* test log reuse after drain\n");
+    push_records(queue, 0, TEST_MEM_RECORDS + TEST_DISK_RECORDS);
+    pop_records(queue, 0, TEST_MEM_RECORDS + TEST_DISK_RECORDS);
+    spillq_get_stats(queue, &stats);
+    assert(stats.max_depth == TEST_MEM_RECORDS + TEST_DISK_RECORDS);
+    spillq_destroy(queue);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
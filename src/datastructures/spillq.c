@@ -0,0 +1,303 @@
+/*****************************************************************************
+ * spillq.c                                                                  *
+ *                                                                           *
+ * This file contains implementations for functions implementing a bounded  *
+ * FIFO of tagged variable-length records which holds records in memory up   *
+ * to a budget and then spills them to an on-disk overflow log.              *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "color.h"
+#include "spillq.h"
+#include "util.h"
+
+struct spillq_entry
+{
+    struct spillq_entry* next;
+    int64_t tag;
+    size_t len;
+    uint8_t* data;
+};
+
+struct spillq_log_record
+{
+    int64_t tag;
+    uint64_t len;
+} __attribute__((packed));
+
+/* memory entries are always older than any record in the log: once the log
+ * is non-empty every push goes to it until it has been read back in full */
+struct spillq
+{
+    pthread_mutex_t lock;
+    struct spillq_entry* head;
+    struct spillq_entry* tail;
+    size_t mem_budget;
+    int fd;
+    size_t disk_budget;
+    off_t read_off;
+    off_t write_off;
+    uint64_t disk_records;
+    struct spillq_stats stats;
+};
+
+static int __spillq_log_push(struct spillq* queue, int64_t tag,
+                             const uint8_t* data, size_t len)
+{
+    struct spillq_log_record record = { .tag = tag, .len = len };
+    size_t rlen = sizeof(record) + len;
+
+    if (queue->fd < 0 || queue->stats.disk_bytes + rlen > queue->disk_budget)
+        return EXIT_FAILURE;
+
+    if (pwrite(queue->fd, &record, sizeof(record), queue->write_off) !=
+        sizeof(record) ||
+        pwrite(queue->fd, data, len, queue->write_off + sizeof(record)) !=
+        (ssize_t) len)
+    {
+        fprintf_light_red(stderr, "spillq: failed writing overflow log.\n");
+        return EXIT_FAILURE;
+    }
+
+    queue->write_off += rlen;
+    queue->disk_records++;
+    queue->stats.disk_bytes += rlen;
+    queue->stats.spilled_bytes += rlen;
+
+    return EXIT_SUCCESS;
+}
+
+static int __spillq_log_pop(struct spillq* queue, int64_t* tag,
+                            uint8_t** data, size_t* len)
+{
+    struct spillq_log_record record;
+
+    if (pread(queue->fd, &record, sizeof(record), queue->read_off) !=
+        sizeof(record))
+        return -1;
+
+    *data = (uint8_t*) malloc(record.len ? record.len : 1);
+
+    if (*data == NULL)
+        return -1;
+
+    if (pread(queue->fd, *data, record.len,
+              queue->read_off + sizeof(record)) != (ssize_t) record.len)
+    {
+        free(*data);
+        *data = NULL;
+        return -1;
+    }
+
+    *tag = record.tag;
+    *len = record.len;
+
+    queue->read_off += sizeof(record) + record.len;
+    queue->disk_records--;
+    queue->stats.disk_bytes -= sizeof(record) + record.len;
+
+    /* fully drained: reclaim the log */
+    if (queue->disk_records == 0)
+    {
+        queue->read_off = 0;
+        queue->write_off = 0;
+        if (ftruncate(queue->fd, 0))
+            fprintf_light_red(stderr, "spillq: failed truncating overflow "
+                                      "log.\n");
+    }
+
+    return 1;
+}
+
+static struct spillq_entry* __spillq_entry_alloc(size_t len)
+{
+    struct spillq_entry* entry = (struct spillq_entry*)
+                                 malloc(sizeof(struct spillq_entry));
+
+    if (entry == NULL)
+        return NULL;
+
+    if ((entry->data = (uint8_t*) malloc(len ? len : 1)) == NULL)
+    {
+        free(entry);
+        return NULL;
+    }
+
+    return entry;
+}
+
+struct spillq* spillq_init(size_t mem_budget, const char* path,
+                           size_t disk_budget)
+{
+    struct spillq* queue = (struct spillq*) calloc(1, sizeof(struct spillq));
+
+    if (queue == NULL)
+        return NULL;
+
+    queue->mem_budget = mem_budget;
+    queue->disk_budget = disk_budget;
+    queue->fd = -1;
+
+    if (path && disk_budget)
+    {
+        if ((queue->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+        {
+            fprintf_light_red(stderr, "spillq: failed opening overflow log "
+                                      "'%s'.\n", path);
+            free(queue);
+            return NULL;
+        }
+
+        /* the log never outlives the process */
+        unlink(path);
+    }
+
+    pthread_mutex_init(&(queue->lock), NULL);
+
+    return queue;
+}
+
+void spillq_destroy(struct spillq* queue)
+{
+    struct spillq_entry* entry;
+
+    if (queue)
+    {
+        while (queue->head)
+        {
+            entry = queue->head;
+            queue->head = entry->next;
+            free(entry->data);
+            free(entry);
+        }
+
+        if (queue->fd >= 0)
+            close(queue->fd);
+
+        pthread_mutex_destroy(&(queue->lock));
+        free(queue);
+    }
+}
+
+int spillq_push(struct spillq* queue, int64_t tag, const uint8_t* data,
+                size_t len)
+{
+    struct spillq_entry* entry;
+    int ret = EXIT_SUCCESS;
+
+    pthread_mutex_lock(&(queue->lock));
+
+    if (queue->disk_records == 0 &&
+        queue->stats.mem_bytes + len <= queue->mem_budget &&
+        (entry = __spillq_entry_alloc(len)))
+    {
+        entry->next = NULL;
+        entry->tag = tag;
+        entry->len = len;
+        memcpy(entry->data, data, len);
+
+        if (queue->tail)
+            queue->tail->next = entry;
+        else
+            queue->head = entry;
+
+        queue->tail = entry;
+        queue->stats.mem_bytes += len;
+    }
+    else if (__spillq_log_push(queue, tag, data, len))
+    {
+        queue->stats.drops++;
+        queue->stats.dropped_bytes += len;
+        ret = EXIT_FAILURE;
+    }
+
+    if (ret == EXIT_SUCCESS)
+    {
+        queue->stats.depth++;
+        if (queue->stats.depth > queue->stats.max_depth)
+            queue->stats.max_depth = queue->stats.depth;
+    }
+
+    pthread_mutex_unlock(&(queue->lock));
+
+    return ret;
+}
+
+int spillq_pop(struct spillq* queue, int64_t* tag, uint8_t** data,
+               size_t* len)
+{
+    struct spillq_entry* entry;
+    int ret = 0;
+
+    pthread_mutex_lock(&(queue->lock));
+
+    if ((entry = queue->head))
+    {
+        queue->head = entry->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+
+        /* ownership of the data moves to the caller */
+        *tag = entry->tag;
+        *data = entry->data;
+        *len = entry->len;
+        queue->stats.mem_bytes -= entry->len;
+        ret = 1;
+
+        free(entry);
+    }
+    else if (queue->disk_records)
+    {
+        ret = __spillq_log_pop(queue, tag, data, len);
+    }
+
+    if (ret == 1)
+        queue->stats.depth--;
+
+    pthread_mutex_unlock(&(queue->lock));
+
+    return ret;
+}
+
+bool spillq_empty(struct spillq* queue)
+{
+    bool empty;
+
+    pthread_mutex_lock(&(queue->lock));
+    empty = queue->stats.depth == 0;
+    pthread_mutex_unlock(&(queue->lock));
+
+    return empty;
+}
+
+void spillq_get_stats(struct spillq* queue, struct spillq_stats* stats)
+{
+    pthread_mutex_lock(&(queue->lock));
+    *stats = queue->stats;
+    pthread_mutex_unlock(&(queue->lock));
+}
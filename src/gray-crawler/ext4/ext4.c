@@ -101,15 +101,6 @@ char* ext4_s_errors_LUT[] = {
                                 "EXT4_ERRORS_PANIC"
                             };
 
-struct ext4_dir_entry
-{
-    uint32_t inode;     /* 4 bytes */
-    uint16_t rec_len;   /* 6 bytes */
-    uint8_t name_len;   /* 7 bytes */
-    uint8_t file_type;  /* 8 bytes */
-    uint8_t name[255];  /* 263 bytes */
-} __attribute__((packed));
-
 int ext4_probe(int disk, struct fs* fs)
 {
     struct ext4_superblock* superblock;
@@ -38,6 +38,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#define GRAY_FS_DEFAULT_SPEC "4"
+#define GRAY_FS_SPEC_OPTION "--kv="
+
 /* constants maintained globally */
 static uint64_t partition_offset;
 static uint64_t block_size;
@@ -56,64 +59,38 @@ static int64_t gammarayfs_pathlookup(const char* path)
 static int gammarayfs_getattr(const char* path, struct stat* stbuf)
 {
     int64_t inode_num = gammarayfs_pathlookup(path);
-    uint64_t field;
-    size_t len2 = sizeof(field);
+    uint64_t size = 0, mode = 0, link_count = 0, uid = 0, gid = 0;
+    uint64_t atime = 0, mtime = 0, ctime = 0;
+    struct redis_hash_field fields[] = {
+        { "size", (uint8_t*) &size, sizeof(size) },
+        { "mode", (uint8_t*) &mode, sizeof(mode) },
+        { "link_count", (uint8_t*) &link_count, sizeof(link_count) },
+        { "uid", (uint8_t*) &uid, sizeof(uid) },
+        { "gid", (uint8_t*) &gid, sizeof(gid) },
+        { "atime", (uint8_t*) &atime, sizeof(atime) },
+        { "mtime", (uint8_t*) &mtime, sizeof(mtime) },
+        { "ctime", (uint8_t*) &ctime, sizeof(ctime) }
+    };
     
     if (inode_num < 0)
         return -ENOENT;
 
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "size",
-                             (uint8_t*) &field, &len2))
+    if (redis_hash_fields_get(handle, REDIS_FILE_KEY, inode_num, fields,
+                              sizeof(fields) / sizeof(fields[0])))
         return -ENOENT;
 
     memset(stbuf, 0, sizeof(struct stat));
-    stbuf->st_size = field;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "mode",
-                             (uint8_t*) &field, &len2))
-        return -ENOENT;
-    
-    stbuf->st_mode = field;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num,
-                             "link_count", (uint8_t*) &field, &len2))
-        return -ENOENT;
-
-    stbuf->st_nlink = field;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "uid",
-                             (uint8_t*) &field, &len2))
-        return -ENOENT;
-
-    stbuf->st_uid = field;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "gid",
-                             (uint8_t*) &field, &len2))
-        return -ENOENT;
-
-    stbuf->st_gid = field;
-
+    stbuf->st_size = size;
+    stbuf->st_mode = mode;
+    stbuf->st_nlink = link_count;
+    stbuf->st_uid = uid;
+    stbuf->st_gid = gid;
     stbuf->st_blksize = block_size;
     stbuf->st_blocks = (stbuf->st_size % 512) ? stbuf->st_size / 512 + 1 : 
                                                 stbuf->st_size / 512;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "atime",
-                             (uint8_t*) &field, &len2))
-        return -ENOENT;
-
-    stbuf->st_atime = field;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "mtime",
-                             (uint8_t*) &field, &len2))
-        return -ENOENT;
-
-    stbuf->st_mtime = field;
-
-    if (redis_hash_field_get(handle, REDIS_FILE_SECTOR_GET, inode_num, "ctime",
-                             (uint8_t*) &field, &len2))
-        return -ENOENT;
-
-    stbuf->st_ctime = field;
+    stbuf->st_atime = atime;
+    stbuf->st_mtime = mtime;
+    stbuf->st_ctime = ctime;
 
     return 0;
 }
@@ -135,44 +112,58 @@ static int gammarayfs_readlink(const char* path, char* buf, size_t bufsize)
     return 0;
 }
 
+struct readdir_state
+{
+    void* buf;
+    fuse_fill_dir_t filler;
+    int ret;
+};
+
+/* a dentry is its 8 byte inode number followed by the name */
+static bool gammarayfs_readdir_dentry(const struct redis_list_element* dentry,
+                                      void* arg)
+{
+    struct readdir_state* state = (struct readdir_state*) arg;
+
+    if (dentry->len > 8)
+        state->filler(state->buf, (const char*) &(dentry->data[8]), NULL, 0);
+
+    return true;
+}
+
+static bool gammarayfs_readdir_sector(const struct redis_list_element* sector,
+                                      void* arg)
+{
+    struct readdir_state* state = (struct readdir_state*) arg;
+
+    /* for every dentry in that sector */
+    if (redis_list_foreach(handle, REDIS_DIR_FILES_LGET,
+                           (uint64_t) sector->number,
+                           gammarayfs_readdir_dentry, state))
+    {
+        state->ret = -ENOENT;
+        return false;
+    }
+
+    return true;
+}
+
 static int gammarayfs_readdir(const char* path, void* buf,
                               fuse_fill_dir_t filler, off_t offset,
                               struct fuse_file_info* fi)
 {
     int64_t inode_num = gammarayfs_pathlookup(path);
-    uint64_t sector = 0, i = 0, j = 0;
-    uint8_t **slist = NULL, **dlist = NULL;
-    size_t slen = 0, dlen = 0;
+    struct readdir_state state = { buf, filler, 0 };
 
     if (inode_num < 0)
         return -ENOENT;
 
-    if (redis_list_get(handle, REDIS_FILE_SECTORS_LGET,
-                       inode_num, &slist, &slen))
-        return -ENOENT;
-
     /* for all folder sectors (length of folder on disk/positions) */
-    for (i = 0; i < slen; i++)
-    {
-        strtok((char*) (slist)[i], ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, &sector);
-
-        if (redis_list_get(handle, REDIS_DIR_FILES_LGET, sector,
-                           &dlist, &dlen))
-            return -ENOENT;
-
-        /* for every dentry in that sector */
-        for (j = 0; j < dlen; j++)
-        {
-            filler(buf, (const char*) &(dlist[j][8]), NULL, 0);
-        }
-
-        redis_free_list(dlist, dlen);
-    }
-
-    redis_free_list(slist, slen);
+    if (redis_list_foreach(handle, REDIS_FILE_SECTORS_LGET, inode_num,
+                           gammarayfs_readdir_sector, &state))
+        return -ENOENT;
 
-    return 0;
+    return state.ret;
 }
 
 static int gammarayfs_open(const char* path, struct fuse_file_info* fi)
@@ -188,15 +179,67 @@ static int gammarayfs_open(const char* path, struct fuse_file_info* fi)
     return 0;
 }
 
+struct read_state
+{
+    char* buf;
+    size_t size;
+    off_t offset;
+    uint64_t position;
+    int ret;
+};
+
+static bool gammarayfs_read_block(const struct redis_list_element* block,
+                                  void* arg)
+{
+    struct read_state* state = (struct read_state*) arg;
+    int64_t sector = block->number;
+    ssize_t readb = 0, toread = 0, ret = 0;
+
+    if (state->offset > 0)
+        toread = block_size - state->offset;
+    else
+        toread = block_size;
+
+    if (toread > state->size - state->position)
+        toread = state->size - state->position;
+
+    if (toread <= 0)
+        return false;
+
+    if (sector < 0)
+    {
+        memset(&(state->buf[state->position]), 0, toread);
+        readb += toread;
+    }
+    else
+    {
+        lseek(fd_disk, sector * 512 + state->offset, SEEK_SET);
+
+        while (readb < toread)
+        {
+            ret = read(fd_disk, &(state->buf[state->position]),
+                       toread - readb);
+            if (ret < 0)
+            {
+                state->ret = -EINVAL;
+                return false;
+            }
+            readb += ret;
+        }
+    }
+
+    state->offset = 0;
+    state->position += readb;
+
+    return true;
+}
+
 static int gammarayfs_read(const char* path, char* buf, size_t size,
                            off_t offset, struct fuse_file_info* fi)
 {
-    uint64_t inode_num = gammarayfs_pathlookup(path), position = 0,
-             i = 0, start = offset / block_size, end;
-    int64_t sector = 0;
-    uint8_t** list;
-    size_t len = 0;
-    ssize_t readb = 0, toread = 0, ret = 0;
+    uint64_t inode_num = gammarayfs_pathlookup(path),
+             start = offset / block_size, end;
+    struct read_state state = { buf, 0, 0, 0, 0 };
     struct stat st;
 
     if (gammarayfs_getattr(path, &st))
@@ -211,60 +254,43 @@ static int gammarayfs_read(const char* path, char* buf, size_t size,
     end = start + ((size + 4095) / 4096);
     offset %= block_size;
 
-    if (redis_list_get_var(handle, REDIS_FILE_SECTORS_LGET_VAR,
-                           inode_num, &list, &len, start, end))
-        return -ENOENT;
+    state.size = size;
+    state.offset = offset;
 
     /* loop through all blocks of file to size */
-    for (i = 0; i < len; i++)
-    {
-        strtok((char*) (list)[i], ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, &sector);
-        readb = 0;
-
-        if (offset > 0)
-            toread = block_size - offset;
-        else
-            toread = block_size;
-
-        if (toread > size - position)
-            toread =  size - position;
-
-        if (toread <= 0)
-            break;
+    if (redis_list_foreach_var(handle, REDIS_FILE_SECTORS_LGET_VAR,
+                               inode_num, start, end, gammarayfs_read_block,
+                               &state))
+        return -ENOENT;
 
-        if (sector < 0)
-        {
-            memset(&(buf[position]), 0, toread);
-            readb += toread;
-            goto readloop;
-        }
+    if (state.ret)
+        return state.ret;
 
-        lseek(fd_disk, sector * 512 + offset, SEEK_SET);
+    return state.position;
+}
 
-        while (readb < toread)
-        {
-            ret = read(fd_disk, (char*) &(buf[position]), toread - readb);
-            if (ret < 0)
-                return -EINVAL;
-            readb += ret;
-        }
+int main(int argc, char* argv[])
+{
+    const char* spec = GRAY_FS_DEFAULT_SPEC, *path;
+    size_t len = sizeof(uint64_t);
+    int i, j;
 
-readloop:
-        offset = 0;
-        position += readb;
+    /* --kv=<connection spec> is ours, every other argument goes to FUSE */
+    for (i = 1, j = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], GRAY_FS_SPEC_OPTION,
+                    strlen(GRAY_FS_SPEC_OPTION)) == 0)
+            spec = argv[i] + strlen(GRAY_FS_SPEC_OPTION);
+        else
+            argv[j++] = argv[i];
     }
 
-    redis_free_list(list, len);
+    argc = j;
+    path = argv[argc - 1];
 
-    return position;
-}
+    if ((handle = redis_init(spec, false)) == NULL)
+        return EXIT_FAILURE;
 
-int main(int argc, char* argv[])
-{
-    const char* path = argv[argc - 1];
-    size_t len = sizeof(uint64_t);
-    handle = redis_init("4", false);
     on_exit((void (*) (int, void *)) redis_shutdown, handle);
 
     fd_disk = open(path, O_RDONLY);
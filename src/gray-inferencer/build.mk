@@ -1,26 +1,38 @@
 bin_PROGRAMS       += bin/gray-ndb-queuer \
 					  bin/gray-inferencer
+check_PROGRAMS     += bin/test/deep_inspection-test
 noinst_LTLIBRARIES += lib/libqemucommon.la\
 					  lib/libredis.la 
 
 lib_libredis_la_SOURCES = src/gray-inferencer/redis_queue.c
 lib_libredis_la_LIBADD  = $(libdir)/libbitarray.la \
+						  $(libdir)/libkv_mem.la \
+						  $(libdir)/libmpscq.la \
+						  $(libdir)/libpending_cache.la \
+						  $(libdir)/libspillq.la \
 						  $(libdir)/libutil.la \
-						  -lhiredis
+						  -levent -lhiredis -lpthread -lrt
 lib_libredis_la_CFLAGS  = $(AM_CFLAGS) \
 						  -I/usr/include/hiredis
 
 lib_libqemucommon_la_SOURCES = src/gray-inferencer/deep_inspection.c \
 							   src/gray-inferencer/qemu_common.c
-lib_libqemucommon_la_LIBADD  = $(libdir)/libbson.la \
+lib_libqemucommon_la_LIBADD  = $(libdir)/liballoc_map.la \
+							   $(libdir)/libbitarray.la \
+							   $(libdir)/libbson.la \
 							   $(libdir)/libext4.la \
-							   $(libdir)/libntfs.la
+							   $(libdir)/libntfs.la \
+							   $(libdir)/libsector_index.la \
+							   $(libdir)/libshadow_store.la \
+							   $(libdir)/libutil.la
 
 bin_gray_ndb_queuer_SOURCES = src/gray-inferencer/gray-ndb-queuer.c
 bin_gray_ndb_queuer_LDADD   = $(libdir)/libbitarray.la \
+							  $(libdir)/libcoalesce.la \
 							  $(libdir)/libcolor.la \
 							  $(libdir)/libqemucommon.la \
 							  $(libdir)/libredis.la \
+							  $(libdir)/libshmring.la \
 							  $(libdir)/libutil.la \
 							  -lpthread
 
@@ -31,5 +43,14 @@ bin_gray_inferencer_LDADD   = $(libdir)/libbitarray.la \
 							  $(libdir)/libntfs.la \
 							  $(libdir)/libqemucommon.la \
 							  $(libdir)/libredis.la \
+							  $(libdir)/libshmring.la \
 							  $(libdir)/libutil.la \
 							  -lpthread
+
+bin_test_deep_inspection_test_SOURCES = src/gray-inferencer/deep_inspection-test.c
+bin_test_deep_inspection_test_LDADD   = $(libdir)/libbson.la \
+										$(libdir)/libcolor.la \
+										$(libdir)/libqemucommon.la \
+										$(libdir)/libredis.la \
+										$(libdir)/libutil.la \
+										-lpthread
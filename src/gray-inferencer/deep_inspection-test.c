@@ -0,0 +1,379 @@
+/*****************************************************************************
+ * deep_inspection-test.c                                                    *
+ *                                                                           *
+ * This file executes the deep inspection engine against an index loaded     *
+ * into the in-process store, to test how writes are classified as the       *
+ * file system changes underneath them.                                      *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bson.h"
+#include "color.h"
+#include "deep_inspection.h"
+#include "ext4.h"
+#include "log.h"
+#include "redis_queue.h"
+
+#define TEST_STORE "mem:4"
+#define TEST_BLOCK_SIZE 4096
+#define TEST_INODE_TABLE 2048 /* sector, holds inode 12 in its first block */
+#define TEST_FILE_OFFSET 2816 /* inode 12 within that block */
+#define TEST_DIRDATA 800      /* the root directory's only block */
+#define TEST_SUBDIRDATA 808   /* /d's only block */
+#define TEST_FILE_DATA 896    /* the first of /a's two blocks */
+#define TEST_UNMAPPED 4096    /* no block the index knows */
+#define TEST_ROOT_INODE 2
+#define TEST_FILE_INODE 12
+#define TEST_DIR_INODE 13
+#define TEST_NEW_INODE 14
+#define TEST_NEW_OFFSET 3328  /* inode 14 in the same table block */
+#define TEST_NEW_SIZE (2 * TEST_BLOCK_SIZE)
+#define DENTRY_NAME_MAX 255
+#define EXT4_FT_DIR 2
+
+void put_string(struct bson_info* bson, const char* key, const char* data)
+{
+    struct bson_kv value = { BSON_STRING, 0, strlen(data), key, data };
+
+    assert(bson_serialize(bson, &value) == EXIT_SUCCESS);
+}
+
+void put_int32(struct bson_info* bson, const char* key, int32_t data)
+{
+    struct bson_kv value = { BSON_INT32, 0, sizeof(data), key, &data };
+
+    assert(bson_serialize(bson, &value) == EXIT_SUCCESS);
+}
+
+void put_int64(struct bson_info* bson, const char* key, int64_t data)
+{
+    struct bson_kv value = { BSON_INT64, 0, sizeof(data), key, &data };
+
+    assert(bson_serialize(bson, &value) == EXIT_SUCCESS);
+}
+
+void put_bool(struct bson_info* bson, const char* key, bool data)
+{
+    struct bson_kv value = { BSON_BOOLEAN, 0, sizeof(data), key, &data };
+
+    assert(bson_serialize(bson, &value) == EXIT_SUCCESS);
+}
+
+void put_document(struct bson_info* bson, enum BSON_TYPE type,
+                   const char* key, struct bson_info* sub)
+{
+    struct bson_kv value = { type, 0, 0, key, sub };
+
+    assert(bson_finalize(sub) == EXIT_SUCCESS);
+    assert(bson_serialize(bson, &value) == EXIT_SUCCESS);
+    bson_cleanup(sub);
+}
+
+void write_document(int fd, struct bson_info* bson)
+{
+    assert(bson_finalize(bson) == EXIT_SUCCESS);
+    assert(bson_writef(bson, fd) == EXIT_SUCCESS);
+    bson_cleanup(bson);
+}
+
+/* one directory entry of the directory block at sector */
+void put_dentry(struct bson_info* bson, uint64_t sector, uint64_t inode,
+                const char* name)
+{
+    uint8_t dentry[sizeof(uint64_t) + DENTRY_NAME_MAX];
+    char key[32];
+    struct bson_kv value = { BSON_BINARY, BSON_BINARY_GENERIC,
+                             sizeof(inode) + strlen(name), key, dentry };
+
+    snprintf(key, sizeof(key), "%"PRIu64, sector);
+    memcpy(dentry, &inode, sizeof(inode));
+    memcpy(&(dentry[sizeof(inode)]), name, strlen(name));
+
+    assert(bson_serialize(bson, &value) == EXIT_SUCCESS);
+}
+
+/* the crawler's records for a root directory holding a file, /a, and an
+ * empty directory, /d */
+int write_index(void)
+{
+    char name[] = "/tmp/deep_inspection-test.XXXXXX";
+    struct bson_info* bson, *sub;
+    int fd;
+
+    assert((fd = mkstemp(name)) >= 0);
+    assert(unlink(name) == 0);
+
+    bson = bson_init();
+    put_string(bson, "type", "fs");
+    put_int32(bson, "pte_num", 0);
+    put_int64(bson, "superblock_sector", 2);
+    put_int64(bson, "superblock_offset", 1024);
+    put_int64(bson, "block_size", TEST_BLOCK_SIZE);
+    put_int64(bson, "blocks_per_group", 32768);
+    put_int64(bson, "inodes_per_group", 8192);
+    put_int64(bson, "inode_size", 256);
+    write_document(fd, bson);
+
+    bson = bson_init();
+    put_string(bson, "type", "bgd");
+    put_int64(bson, "inode_table_sector_start", TEST_INODE_TABLE);
+    write_document(fd, bson);
+
+    bson = bson_init();
+    put_string(bson, "type", "file");
+    put_int32(bson, "inode_num", TEST_ROOT_INODE);
+    put_string(bson, "path", "/");
+    put_bool(bson, "is_dir", true);
+    sub = bson_init();
+    put_dentry(sub, TEST_DIRDATA, TEST_FILE_INODE, "a");
+    put_dentry(sub, TEST_DIRDATA, TEST_DIR_INODE, "d");
+    put_document(bson, BSON_ARRAY, "files", sub);
+    write_document(fd, bson);
+
+    bson = bson_init();
+    put_string(bson, "type", "file");
+    put_int32(bson, "inode_num", TEST_DIR_INODE);
+    put_string(bson, "path", "/d");
+    put_bool(bson, "is_dir", true);
+    sub = bson_init();
+    put_dentry(sub, TEST_SUBDIRDATA, TEST_DIR_INODE, ".");
+    put_document(bson, BSON_ARRAY, "files", sub);
+    write_document(fd, bson);
+
+    bson = bson_init();
+    put_string(bson, "type", "file");
+    put_int32(bson, "inode_sector", TEST_INODE_TABLE);
+    put_int32(bson, "inode_num", TEST_FILE_INODE);
+    put_string(bson, "path", "/a");
+    put_int64(bson, "inode_offset", TEST_FILE_OFFSET);
+    put_int64(bson, "size", 2 * TEST_BLOCK_SIZE);
+    put_int64(bson, "mode", 0x81a4);
+    put_int64(bson, "link_count", 1);
+    sub = bson_init();
+    put_int32(sub, "0", TEST_FILE_DATA);
+    put_int32(sub, "1", TEST_FILE_DATA + TEST_BLOCK_SIZE / SECTOR_SIZE);
+    put_document(bson, BSON_ARRAY, "sectors", sub);
+    write_document(fd, bson);
+
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+
+    return fd;
+}
+
+/* whether a write of one block may run on a worker */
+bool sharded(struct super_info* superblock, struct kv_store* store,
+             uint64_t sector, uint8_t* block)
+{
+    struct qemu_bdrv_write write;
+    uint64_t key;
+
+    write.header.sector_num = sector;
+    write.header.nb_sectors = TEST_BLOCK_SIZE / SECTOR_SIZE;
+    write.data = block;
+
+    return qemu_write_shard(superblock, &write, store, &key);
+}
+
+/* a write of one block, which is either held or dispatched */
+bool held(struct super_info* superblock, struct kv_store* store,
+          uint64_t sector, uint8_t* block, uint64_t counter)
+{
+    struct qemu_bdrv_write write;
+    struct clock_cache_stats before, after;
+
+    write.header.sector_num = sector;
+    write.header.nb_sectors = TEST_BLOCK_SIZE / SECTOR_SIZE;
+    write.data = block;
+
+    redis_pending_stats(store, &before);
+    assert(qemu_deep_inspect(superblock, &write, store, counter, "test", 0,
+                             -1) == EXIT_SUCCESS);
+    redis_pending_stats(store, &after);
+
+    return after.entries > before.entries;
+}
+
+/* a directory's block with its . and .. entries and, unless name is NULL,
+ * one more entry */
+void dir_block(uint8_t* block, uint32_t self, const char* name,
+               uint32_t inode)
+{
+    struct ext4_dir_entry* dir;
+
+    memset(block, 0, TEST_BLOCK_SIZE);
+
+    dir = (struct ext4_dir_entry*) block;
+    dir->inode = self;
+    dir->rec_len = 12;
+    dir->name_len = 1;
+    dir->file_type = EXT4_FT_DIR;
+    dir->name[0] = '.';
+
+    dir = (struct ext4_dir_entry*) &(block[12]);
+    dir->inode = TEST_ROOT_INODE;
+    dir->rec_len = name ? 12 : TEST_BLOCK_SIZE - 12;
+    dir->name_len = 2;
+    dir->file_type = EXT4_FT_DIR;
+    dir->name[0] = '.';
+    dir->name[1] = '.';
+
+    if (name == NULL)
+        return;
+
+    dir = (struct ext4_dir_entry*) &(block[24]);
+    dir->inode = inode;
+    dir->rec_len = TEST_BLOCK_SIZE - 24;
+    dir->name_len = strlen(name);
+    dir->file_type = inode == TEST_DIR_INODE ? EXT4_FT_DIR : 1;
+    memcpy(dir->name, name, strlen(name));
+}
+
+/* the inode table block with /a's inode freed */
+void freed_inode(uint8_t* block)
+{
+    struct ext4_inode* inode = (struct ext4_inode*)
+                               &(block[TEST_FILE_OFFSET]);
+
+    memset(block, 0, TEST_BLOCK_SIZE);
+    inode->i_mode = 0x81a4;
+    inode->i_links_count = 0;
+}
+
+/* the inode table block with /a's inode freed and inode 14 allocated as a
+ * file whose first block is the one at sector */
+void new_inode(uint8_t* block, uint64_t sector)
+{
+    struct ext4_inode* inode = (struct ext4_inode*)
+                               &(block[TEST_NEW_OFFSET]);
+    struct ext4_extent_header* header = (struct ext4_extent_header*)
+                                        &(inode->i_block[0]);
+    struct ext4_extent* extent = (struct ext4_extent*) &(header[1]);
+
+    freed_inode(block);
+    inode->i_mode = 0x81a4;
+    inode->i_links_count = 1;
+    inode->i_size_lo = TEST_NEW_SIZE;
+    header->eh_magic = 0xf30a;
+    header->eh_entries = 1;
+    header->eh_max = 4;
+    extent->ee_len = 1;
+    extent->ee_start_lo = sector / (TEST_BLOCK_SIZE / SECTOR_SIZE);
+}
+
+uint64_t file_size(struct kv_store* store, uint64_t id)
+{
+    uint64_t size = 0;
+    size_t len = sizeof(size);
+
+    assert(redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, id, "size",
+                                (uint8_t*) &size, &len) == EXIT_SUCCESS);
+
+    return size;
+}
+
+uint64_t path_id(struct kv_store* store, const char* path)
+{
+    uint64_t id = UINT64_MAX;
+
+    assert(redis_path_get(store, (const uint8_t*) path, strlen(path), &id) ==
+           EXIT_SUCCESS);
+
+    return id;
+}
+
+int main(int argc, char* argv[])
+{
+    struct super_info superblock;
+    static uint8_t block[TEST_BLOCK_SIZE];
+    struct kv_store* store;
+    uint64_t id = UINT64_MAX, count = 0;
+    int fd;
+
+    fprintf_blue(stdout, "-- Deep Inspection Test Suite --\n");
+
+    log_set_level(LOG_LEVEL_ERROR);
+
+    fprintf_light_blue(stdout, "* test loading an index\n");
+    assert((store = redis_init(TEST_STORE, false)) != NULL);
+    fd = write_index();
+    assert(qemu_load_index(fd, store) == EXIT_SUCCESS);
+    close(fd);
+    assert(qemu_get_superinfo(store, &superblock, 0) == EXIT_SUCCESS);
+    assert(superblock.block_size == TEST_BLOCK_SIZE);
+    assert((id = path_id(store, "/a")) != UINT64_MAX);
+
+    fprintf_light_blue(stdout, "* test sharding writes\n");
+    assert(sharded(&superblock, store, TEST_FILE_DATA, block));
+    assert(!sharded(&superblock, store, TEST_INODE_TABLE, block));
+    assert(!sharded(&superblock, store, TEST_DIRDATA, block));
+    assert(!sharded(&superblock, store, TEST_UNMAPPED, block));
+
+    fprintf_light_blue(stdout, "* test writing a file's block\n");
+    memset(block, 'a', TEST_BLOCK_SIZE);
+    assert(!held(&superblock, store, TEST_FILE_DATA, block, 1));
+
+    fprintf_light_blue(stdout, "* test moving the file, old entry first\n");
+    dir_block(block, TEST_ROOT_INODE, "d", TEST_DIR_INODE);
+    assert(!held(&superblock, store, TEST_DIRDATA, block, 2));
+    assert(path_id(store, "/a") == UINT64_MAX);
+    memset(block, 'b', TEST_BLOCK_SIZE);
+    assert(!held(&superblock, store, TEST_FILE_DATA, block, 3));
+    dir_block(block, TEST_DIR_INODE, "a", TEST_FILE_INODE);
+    assert(!held(&superblock, store, TEST_SUBDIRDATA, block, 4));
+    assert(path_id(store, "/d/a") == id);
+    memset(block, 'c', TEST_BLOCK_SIZE);
+    assert(!held(&superblock, store, TEST_FILE_DATA, block, 5));
+
+    fprintf_light_blue(stdout, "* test deleting the file\n");
+    dir_block(block, TEST_DIR_INODE, NULL, 0);
+    assert(!held(&superblock, store, TEST_SUBDIRDATA, block, 6));
+    assert(path_id(store, "/d/a") == UINT64_MAX);
+    freed_inode(block);
+    assert(!held(&superblock, store, TEST_INODE_TABLE, block, 7));
+
+    fprintf_light_blue(stdout, "* test rewriting the released block\n");
+    memset(block, 'd', TEST_BLOCK_SIZE);
+    assert(held(&superblock, store, TEST_FILE_DATA, block, 8));
+
+    fprintf_light_blue(stdout, "* test creating a file, inode block first\n");
+    new_inode(block, TEST_UNMAPPED);
+    assert(!held(&superblock, store, TEST_INODE_TABLE, block, 9));
+    dir_block(block, TEST_DIR_INODE, "b", TEST_NEW_INODE);
+    assert(!held(&superblock, store, TEST_SUBDIRDATA, block, 10));
+    assert((id = path_id(store, "/d/b")) != UINT64_MAX);
+    assert(file_size(store, id) == TEST_NEW_SIZE);
+    assert(redis_list_len(store, REDIS_FILE_SECTORS_LLEN, id, &count) ==
+           EXIT_SUCCESS && count == 1);
+    memset(block, 'e', TEST_BLOCK_SIZE);
+    assert(!held(&superblock, store, TEST_UNMAPPED, block, 11));
+
+    redis_shutdown(0, store);
+
+    fprintf_green(stdout, "-- All tests passed --\n");
+
+    return EXIT_SUCCESS;
+}
@@ -32,12 +32,16 @@
 #include <unistd.h>
 
 #include "__bson.h"
+#include "alloc_map.h"
+#include "bitarray.h"
 #include "bson.h"
-#include "color.h"
 #include "deep_inspection.h"
 #include "ext4.h"
+#include "log.h"
 #include "ntfs.h"
 #include "redis_queue.h"
+#include "sector_index.h"
+#include "shadow_store.h"
 #include "util.h"
 
 #ifndef HOST_NAME_MAX
@@ -47,15 +51,278 @@
 #define FILE_DATA_WRITE "data"
 #define FILE_META_WRITE "metadata"
 #define VM_NAME_MAX 512
+#define LOOKUP_BATCH 256 /* blocks resolved per round trip */
 #define PATH_MAX 4096
+#define INODE_FETCH_FIELDS 11
+#define INODE_SHADOW_SLOTS 512 /* 64 KiB blocks of 128 byte inodes */
+#define INODE_SLOT_EMPTY UINT64_MAX
+#define DENTRY_HEADER 8 /* bytes of an ext4 dentry before its name */
+#define DENTRY_NAME_MAX 255
+#define EXT4_FT_DIR 2
+#define SHADOW_BLOCK_MAX 65536 /* largest ext4 block kept in the shadow */
+#define SHADOW_KEY(type, block) (((uint64_t) (block) << 4) | \
+                                 (uint64_t) (type))
+#define BITMAP_BLOCK 0 /* the start of a bgd:<id> pointer, which bitmap */
+#define BITMAP_INODE 1
+
+#define INODE_FIELD(fetch, field) { #field, (uint8_t*) &((fetch)->field), \
+                                    sizeof((fetch)->field) }
 
 #define STRINGIFY2(x) #x
 #define STRINGIFY(x) STRINGIFY2(x)
 
-#define D_PRINT64(val) { fprintf_light_yellow(stdout, "" \
-                         STRINGIFY(val)" : %"PRIu64"\n", val); }
-#define D_PRINT16(val) { fprintf_light_yellow(stdout, "" \
-                         STRINGIFY(val)" : %"PRIu32"\n", (uint32_t) val); }
+#define D_PRINT64(val) log_debug(STRINGIFY(val)" : %"PRIu64"\n", \
+                                 (uint64_t) val)
+#define D_PRINT16(val) log_debug(STRINGIFY(val)" : %"PRIu32"\n", \
+                                 (uint32_t) val)
+
+/* sector classification mirrored in memory once an index has been loaded;
+ * Redis stays the persistent copy and the fallback when this is NULL */
+static struct sector_index* sector_idx = NULL;
+
+/* each metadata block as last written, keyed by sector and pointer type,
+ * so a rewrite is diffed against its old bytes instead of fields read back
+ * out of Redis; a trailer per type carries what the diff needs besides */
+static struct shadow_store* shadow = NULL;
+
+/* sectors a bitmap has just marked in use, by block group, until the
+ * extent or directory entry mapping them arrives */
+static struct alloc_map* allocated = NULL;
+
+/* the metadata filter as loaded, so each region newly holding metadata is
+ * announced to the queuer once */
+static struct bitarray* md_filter = NULL;
+
+/* the calling thread's lookups, issued together and waited on once when set;
+ * otherwise every lookup blocks on its own round trip */
+static __thread struct kv_async* async_kv = NULL;
+
+/* field changes to one channel within one transaction, published as a
+ * single document with a 'changes' array */
+struct change_set
+{
+    struct change_set* next;
+    char* channel;
+    char* type;
+    uint64_t transaction;
+    uint64_t count;
+    struct bson_info* changes;
+};
+
+/* when set, field changes are gathered rather than each published alone */
+static bool aggregate = false;
+
+/* the calling thread's gathered changes, in order of first change, and how
+ * far its inspection has re-entered; the outermost call publishes them */
+static __thread struct change_set* change_sets = NULL;
+static __thread unsigned int inspect_depth = 0;
+
+/* records what sector src holds, in the local index when one is loaded and
+ * always as its packed sector:%d value */
+static int __descriptor_set(struct kv_store* store, uint64_t src,
+                            const struct sector_descriptor* desc)
+{
+    if (sector_idx)
+        sector_index_set(sector_idx, src, desc);
+
+    return redis_sector_set(store, src, desc);
+}
+
+static int __pointer_set(struct kv_store* store, int32_t type, uint64_t src,
+                         uint64_t id)
+{
+    struct sector_descriptor desc = { type, id, 0, 0 };
+
+    return __descriptor_set(store, src, &desc);
+}
+
+static int __file_data_pointer_set(struct kv_store* store, int64_t src,
+                                   uint64_t start, uint64_t end, uint64_t dst)
+{
+    struct sector_descriptor desc = { SECTOR_PTR_FILE_DATA, dst, start, end };
+
+    return __descriptor_set(store, (uint64_t) src, &desc);
+}
+
+/* a block group's block or inode bitmap, kind is BITMAP_BLOCK or
+ * BITMAP_INODE */
+static int __bitmap_pointer_set(struct kv_store* store, uint64_t src,
+                                uint64_t bgd, uint64_t kind)
+{
+    struct sector_descriptor desc = { SECTOR_PTR_BGD, bgd, kind, 0 };
+
+    return __descriptor_set(store, src, &desc);
+}
+
+/* tells the queuer the region holding sector now holds metadata; racing
+ * workers at worst announce a region twice */
+static void __metadata_hot(struct kv_store* store, uint64_t sector)
+{
+    uint64_t region = sector / REDIS_MD_REGION_SECTORS;
+
+    if (md_filter)
+    {
+        if (bitarray_get_bit(md_filter, region))
+            return;
+
+        bitarray_set_bit(md_filter, region);
+    }
+
+    log_debug("region %"PRIu64" now holds metadata\n", region);
+    redis_metadata_hot(store, region);
+}
+
+/* queues the metadata document at offset on loadlist listid */
+static int __load_record_add(struct kv_store* store, uint64_t listid,
+                             uint64_t offset)
+{
+    struct sector_descriptor desc = { SECTOR_PTR_LOAD, offset, 0, 0 };
+    struct sector_descriptor_packed packed;
+
+    redis_sector_pack(&desc, &packed);
+
+    return redis_binary_insert(store, REDIS_LOAD_LRECORDS_INSERT, listid,
+                               (const uint8_t*) &packed, sizeof(packed));
+}
+
+/* the shadow of block as a len byte copy followed by its trailer, or NULL on
+ * a miss; the block's length is stored last so a partial block never
+ * matches a full one */
+static uint8_t* __shadow_get(int32_t type, uint64_t block, size_t len,
+                             size_t max_trailer, size_t* trailer_len)
+{
+    size_t size = len + max_trailer + sizeof(uint64_t);
+    uint64_t stored;
+    uint8_t* old;
+
+    if (shadow == NULL || len > SHADOW_BLOCK_MAX ||
+        (old = (uint8_t*) malloc(size)) == NULL)
+        return NULL;
+
+    if (!shadow_store_get(shadow, SHADOW_KEY(type, block), old, &size) ||
+        size < len + sizeof(uint64_t))
+    {
+        free(old);
+        return NULL;
+    }
+
+    memcpy(&stored, &(old[size - sizeof(uint64_t)]), sizeof(stored));
+
+    if (stored != len)
+    {
+        free(old);
+        return NULL;
+    }
+
+    if (trailer_len)
+        *trailer_len = size - len - sizeof(uint64_t);
+
+    return old;
+}
+
+static void __shadow_put(int32_t type, uint64_t block, const uint8_t* write,
+                         size_t len, const void* trailer, size_t trailer_len)
+{
+    uint64_t stored = len;
+    uint8_t* entry;
+
+    if (shadow == NULL || len > SHADOW_BLOCK_MAX ||
+        (entry = (uint8_t*) malloc(len + trailer_len +
+                                   sizeof(uint64_t))) == NULL)
+        return;
+
+    memcpy(entry, write, len);
+
+    if (trailer_len)
+        memcpy(&(entry[len]), trailer, trailer_len);
+
+    memcpy(&(entry[len + trailer_len]), &stored, sizeof(stored));
+    shadow_store_put(shadow, SHADOW_KEY(type, block), entry,
+                     len + trailer_len + sizeof(uint64_t));
+    free(entry);
+}
+
+static void __shadow_drop(int32_t type, uint64_t block)
+{
+    if (shadow)
+        shadow_store_remove(shadow, SHADOW_KEY(type, block));
+}
+
+/* the ids of one list, in a single allocation */
+struct id_list
+{
+    uint64_t* ids;
+    size_t len;
+};
+
+/* one file of an inode table block, with everything its diff reads */
+struct inode_fetch
+{
+    uint64_t file;
+    char path[PATH_MAX];
+    uint64_t offset;
+    bool is_dir;
+    uint64_t size;
+    uint64_t mode;
+    uint64_t link_count;
+    uint64_t uid;
+    uint64_t gid;
+    uint64_t atime;
+    uint64_t mtime;
+    uint64_t ctime;
+    struct redis_hash_field fields[INODE_FETCH_FIELDS];
+    bool prefetched;
+    uint64_t file_len;
+    struct id_list extents;
+    int status;
+};
+
+void qemu_set_async(struct kv_async* async)
+{
+    async_kv = async;
+}
+
+void qemu_set_aggregate(bool enable)
+{
+    aggregate = enable;
+}
+
+void qemu_shadow_configure(size_t budget)
+{
+    if (shadow)
+        shadow_store_configure(shadow, budget);
+}
+
+void qemu_shadow_stats(struct clock_cache_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if (shadow)
+        shadow_store_get_stats(shadow, stats);
+}
+
+void qemu_alloc_stats(struct alloc_map_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if (allocated)
+        alloc_map_get_stats(allocated, stats);
+}
+
+/* gathers the numbers of a list of prefix:number elements */
+static bool __collect_ids(const struct redis_list_element* element, void* arg)
+{
+    struct id_list* list = (struct id_list*) arg;
+
+    if (list->ids == NULL &&
+        (list->ids = (uint64_t*) malloc(element->count * sizeof(uint64_t))) ==
+        NULL)
+        return false;
+
+    list->ids[list->len++] = (uint64_t) element->number;
+
+    return true;
+}
 
 /*** Pre-Definitions ***/
 char* construct_channel_name(char* vmname, char* path)
@@ -93,62 +360,61 @@ char* clone_cstring(char* cstring)
 
 int qemu_print_write(struct qemu_bdrv_write* write)
 {
-    fprintf_light_blue(stdout, "brdv_write event\n");
-    fprintf_yellow(stdout, "\tsector_num: %0."PRId64"\n",
-                           write->header.sector_num);
-    fprintf_yellow(stdout, "\tnb_sectors: %d\n",
-                           write->header.nb_sectors);
+    log_debug("brdv_write event\n");
+    log_debug("\tsector_num: %"PRId64"\n", write->header.sector_num);
+    log_debug("\tnb_sectors: %d\n",
+              write->header.nb_sectors);
     return 0;
 }
 
 void print_ext4_file(struct ext4_file* file)
 {
-    fprintf_light_cyan(stdout, "-- ext4 File --\n");
-    fprintf_yellow(stdout, "file->inode_sector == %"PRIu64"\n",
-                            file->inode_sector);
-    fprintf_yellow(stdout, "file->inode_offset == %"PRIu64"\n",
-                            file->inode_offset);
-    fprintf_yellow(stdout, "file->is_dir == %s\n",
-                            file->is_dir ? "true" : "false");
-    fprintf_yellow(stdout, "file->inode == %p\n", &(file->inode));
+    log_debug("-- ext4 File --\n");
+    log_debug("file->inode_sector == %"PRIu64"\n",
+               file->inode_sector);
+    log_debug("file->inode_offset == %"PRIu64"\n",
+               file->inode_offset);
+    log_debug("file->is_dir == %s\n",
+               file->is_dir ? "true" : "false");
+    log_debug("file->inode == %p\n", &(file->inode));
 }
 
 void print_ext4_bgd(struct ext4_bgd* bgd)
 {
-    fprintf_light_cyan(stdout, "-- ext4 BGD --\n");
-    fprintf_yellow(stdout, "bgd->bgd == %p\n", &(bgd->bgd));
-    fprintf_yellow(stdout, "bgd->sector == %"PRIu64"\n", bgd->sector);
-    fprintf_yellow(stdout, "bgd->block_bitmap_sector_start == %"PRIu64"\n",
-                            bgd->block_bitmap_sector_start);
-    fprintf_yellow(stdout, "bgd->block_bitmap_sector_end == %"PRIu64"\n",
-                            bgd->block_bitmap_sector_end);
-    fprintf_yellow(stdout, "bgd->inode_bitmap_sector_start == %"PRIu64"\n",
-                            bgd->inode_bitmap_sector_start);
-    fprintf_yellow(stdout, "bgd->inode_bitmap_sector_end == %"PRIu64"\n",
-                            bgd->inode_bitmap_sector_end);
-    fprintf_yellow(stdout, "bgd->inode_table_sector_start == %"PRIu64"\n",
-                            bgd->inode_table_sector_start);
-    fprintf_yellow(stdout, "bgd->inode_table_sector_end == %"PRIu64"\n",
-                            bgd->inode_table_sector_end);
+    log_debug("-- ext4 BGD --\n");
+    log_debug("bgd->bgd == %p\n", &(bgd->bgd));
+    log_debug("bgd->sector == %"PRIu64"\n", bgd->sector);
+    log_debug("bgd->block_bitmap_sector_start == %"PRIu64"\n",
+               bgd->block_bitmap_sector_start);
+    log_debug("bgd->block_bitmap_sector_end == %"PRIu64"\n",
+               bgd->block_bitmap_sector_end);
+    log_debug("bgd->inode_bitmap_sector_start == %"PRIu64"\n",
+               bgd->inode_bitmap_sector_start);
+    log_debug("bgd->inode_bitmap_sector_end == %"PRIu64"\n",
+               bgd->inode_bitmap_sector_end);
+    log_debug("bgd->inode_table_sector_start == %"PRIu64"\n",
+               bgd->inode_table_sector_start);
+    log_debug("bgd->inode_table_sector_end == %"PRIu64"\n",
+               bgd->inode_table_sector_end);
 }
 
 void print_ext4_fs(struct ext4_fs* fs)
 {
-    fprintf_light_cyan(stdout, "-- ext4 FS --\n");
-    fprintf_yellow(stdout, "fs->fs_type %"PRIu64"\n", fs->fs_type);
-    fprintf_yellow(stdout, "fs->mount_point %s\n", fs->mount_point);
-    fprintf_yellow(stdout, "fs->num_block_groups %"PRIu64"\n",
-                            fs->num_block_groups);
-    fprintf_yellow(stdout, "fs->num_files %"PRIu64"\n", fs->num_files);
+    log_debug("-- ext4 FS --\n");
+    log_debug("fs->fs_type %"PRIu64"\n", fs->fs_type);
+    log_debug("fs->mount_point %s\n", fs->mount_point);
+    log_debug("fs->num_block_groups %"PRIu64"\n",
+               fs->num_block_groups);
+    log_debug("fs->num_files %"PRIu64"\n", fs->num_files);
 }
 
 void print_mbr(struct mbr* mbr)
 {
-    fprintf_light_cyan(stdout, "-- MBR --\n");
-    fprintf_yellow(stdout, "mbr->gpt == %d\n", mbr->gpt);
-    fprintf_yellow(stdout, "mbr->sector == %"PRIu64"\n", mbr->sector);
-    fprintf_yellow(stdout, "mbr->active_partitions == %"PRIu64"\n",
-                            mbr->active_partitions);
+    log_debug("-- MBR --\n");
+    log_debug("mbr->gpt == %d\n", mbr->gpt);
+    log_debug("mbr->sector == %"PRIu64"\n", mbr->sector);
+    log_debug("mbr->active_partitions == %"PRIu64"\n",
+               mbr->active_partitions);
 }
 
 int qemu_print_sector_type(enum SECTOR_TYPE type)
@@ -156,39 +422,39 @@ int qemu_print_sector_type(enum SECTOR_TYPE type)
     switch(type)
     {
         case SECTOR_MBR:
-            fprintf_light_green(stdout, "Write to MBR detected.\n");
+            log_debug("Write to MBR detected.\n");
             return 0;
         case SECTOR_EXT2_SUPERBLOCK:
-            fprintf_light_green(stdout, "Write to ext4 superblock "
-                                        "detected.\n");
+            log_debug("Write to ext4 superblock "
+                      "detected.\n");
             return 0;
         case SECTOR_EXT2_BLOCK_GROUP_DESCRIPTOR:
-            fprintf_light_green(stdout, "Write to ext4 block group descriptor"
-                                        " detected.\n");
+            log_debug("Write to ext4 block group descriptor"
+                      " detected.\n");
             return 0;
         case SECTOR_EXT2_BLOCK_GROUP_BLOCKMAP:
-            fprintf_light_green(stdout, "Write to ext4 block group block map"
-                                        " detected.\n");
+            log_debug("Write to ext4 block group block map"
+                      " detected.\n");
             return 0;
         case SECTOR_EXT2_BLOCK_GROUP_INODEMAP:
-            fprintf_light_green(stdout, "Write to ext4 block group inode map"
-                                        " detected.\n");
+            log_debug("Write to ext4 block group inode map"
+                      " detected.\n");
             return 0;
         case SECTOR_EXT2_INODE:
-            fprintf_light_green(stdout, "Write to ext4 inode detected.\n");
+            log_debug("Write to ext4 inode detected.\n");
             return 0;
         case SECTOR_EXT2_DATA:
-            fprintf_light_green(stdout, "Write to ext4 data block "
-                                        "detected.\n");
+            log_debug("Write to ext4 data block "
+                      "detected.\n");
             return 0;
         case SECTOR_EXT2_PARTITION:
-            fprintf_light_green(stdout, "Write to ext4 partition detected.\n");
+            log_debug("Write to ext4 partition detected.\n");
             return 0;
         case SECTOR_EXT4_EXTENT:
-            fprintf_light_green(stdout, "Write to ext4 extents detected.\n");
+            log_debug("Write to ext4 extents detected.\n");
             return 0;
         case SECTOR_UNKNOWN:
-            fprintf_light_red(stdout, "Unknown sector type.\n");
+            log_debug("Unknown sector type.\n");
     }
 
     return -1;
@@ -200,12 +466,11 @@ int __emit_deleted_file(struct kv_store* store,  char* channel,
     struct bson_info* bson = bson_init();
     struct bson_kv val;
 
-    fprintf_light_blue(stdout, "DELETE[%.*s] in channel %s.\n", flen, file, 
-                                                                channel);
+    log_info("DELETE[%.*s] in channel %s.\n", (int) flen, file, channel);
 
     if (bson == NULL)
     {
-        fprintf_light_red(stderr, "Failed creating BSON handle. OOM?\n");
+        log_error("Failed creating BSON handle. OOM?\n");
         return EXIT_FAILURE;
     }
 
@@ -233,8 +498,8 @@ int __emit_deleted_file(struct kv_store* store,  char* channel,
 
     if (redis_publish(store, channel, bson->buffer, bson->position))
     {
-        fprintf_light_red(stderr, "Failure publishing "
-                                  "Redis message.\n");
+        log_error("Failure publishing "
+                  "Redis message.\n");
         return EXIT_FAILURE;
     }
 
@@ -249,12 +514,11 @@ int __emit_created_file(struct kv_store* store,  char* channel,
     struct bson_info* bson = bson_init();
     struct bson_kv val;
 
-    fprintf_light_blue(stdout, "CREATE[%.*s] in channel %s.\n",
-                               flen, file, channel);
+    log_info("CREATE[%.*s] in channel %s.\n", (int) flen, file, channel);
 
     if (bson == NULL)
     {
-        fprintf_light_red(stderr, "Failed creating BSON handle. OOM?\n");
+        log_error("Failed creating BSON handle. OOM?\n");
         return EXIT_FAILURE;
     }
 
@@ -282,8 +546,8 @@ int __emit_created_file(struct kv_store* store,  char* channel,
 
     if (redis_publish(store, channel, bson->buffer, bson->position))
     {
-        fprintf_light_red(stderr, "Failure publishing "
-                                  "Redis message.\n");
+        log_error("Failure publishing "
+                  "Redis message.\n");
         return EXIT_FAILURE;
     }
 
@@ -293,17 +557,18 @@ int __emit_created_file(struct kv_store* store,  char* channel,
 }
 
 int __emit_rename_file(struct kv_store* store,  char* channel,
-                       char* file, size_t flen, uint64_t transaction_id)
+                       char* file, size_t flen, char* new_file,
+                       size_t new_flen, uint64_t transaction_id)
 {
     struct bson_info* bson = bson_init();
     struct bson_kv val;
 
-    fprintf_light_blue(stdout, "CREATE[%.*s] in channel %s.\n",
-                               flen, file, channel);
+    log_info("RENAME[%.*s -> %.*s] in channel %s.\n", (int) flen, file,
+             (int) new_flen, new_file, channel);
 
     if (bson == NULL)
     {
-        fprintf_light_red(stderr, "Failed creating BSON handle. OOM?\n");
+        log_error("Failed creating BSON handle. OOM?\n");
         return EXIT_FAILURE;
     }
 
@@ -327,12 +592,19 @@ int __emit_rename_file(struct kv_store* store,  char* channel,
 
     bson_serialize(bson, &val);
 
+    val.type = BSON_STRING;
+    val.size = new_flen;
+    val.key = "to";
+    val.data = new_file;
+
+    bson_serialize(bson, &val);
+
     bson_finalize(bson);
 
     if (redis_publish(store, channel, bson->buffer, bson->position))
     {
-        fprintf_light_red(stderr, "Failure publishing "
-                                  "Redis message.\n");
+        log_error("Failure publishing "
+                  "Redis message.\n");
         return EXIT_FAILURE;
     }
 
@@ -341,76 +613,226 @@ int __emit_rename_file(struct kv_store* store,  char* channel,
     return EXIT_SUCCESS;
 }
 
-int __emit_field_update(struct kv_store* store, char* field, char* type,
-                        char* channel, enum BSON_TYPE bson_type, void* oldv,
-                        void* newv, uint64_t oldv_size, uint64_t newv_size, 
-                        uint64_t transaction_id, bool emit, bool print)
+/* the field, old and new values of one change */
+static void __serialize_change(struct bson_info* bson, char* field,
+                               enum BSON_TYPE bson_type, void* oldv,
+                               void* newv, uint64_t oldv_size,
+                               uint64_t newv_size)
 {
-    struct bson_info* bson = bson_init();
     struct bson_kv val;
 
-    if (print)
+    val.type = BSON_STRING;
+    val.size = strlen(field);
+    val.key = "field";
+    val.data = field;
+
+    bson_serialize(bson, &val);
+
+    val.type = bson_type;
+    val.subtype = BSON_BINARY_GENERIC;
+    val.key = "old";
+    val.data = oldv;
+    val.size = oldv_size;
+
+    bson_serialize(bson, &val);
+
+    val.type = bson_type;
+    val.subtype = BSON_BINARY_GENERIC;
+    val.key = "new";
+    val.data = newv;
+    val.size = newv_size;
+
+    bson_serialize(bson, &val);
+}
+
+static void __change_set_free(struct change_set* set)
+{
+    if (set->changes)
+        bson_cleanup(set->changes);
+
+    free(set->channel);
+    free(set->type);
+    free(set);
+}
+
+/* the set gathering changes to channel in transaction, started if new */
+static struct change_set* __change_set(char* channel, char* type,
+                                       uint64_t transaction)
+{
+    struct change_set** slot = &change_sets, *set;
+
+    for (; *slot; slot = &((*slot)->next))
     {
-        fprintf_light_red(stdout, "Field '%s' differs.\n", field);
+        set = *slot;
 
-        fprintf_light_magenta(stdout, "old:\t");
-        hexdump(oldv, oldv_size);
-        fprintf_light_magenta(stdout, "new:\t");
-        hexdump(newv, newv_size);
+        if (set->transaction == transaction &&
+            strcmp(set->channel, channel) == 0 &&
+            strcmp(set->type, type) == 0)
+            return set;
     }
 
-    if (bson == NULL)
+    if ((set = (struct change_set*) calloc(1, sizeof(struct change_set))) ==
+        NULL)
+        return NULL;
+
+    set->channel = clone_cstring(channel);
+    set->type = clone_cstring(type);
+    set->changes = bson_init();
+    set->transaction = transaction;
+
+    if (set->channel == NULL || set->type == NULL || set->changes == NULL)
+    {
+        __change_set_free(set);
+        return NULL;
+    }
+
+    *slot = set;
+
+    return set;
+}
+
+static int __gather_change(char* field, char* type, char* channel,
+                           enum BSON_TYPE bson_type, void* oldv, void* newv,
+                           uint64_t oldv_size, uint64_t newv_size,
+                           uint64_t transaction_id)
+{
+    struct change_set* set;
+    struct bson_info* change;
+    struct bson_kv val;
+    char key[32];
+
+    if ((set = __change_set(channel, type, transaction_id)) == NULL ||
+        (change = bson_init()) == NULL)
     {
-        fprintf_light_red(stderr, "Failed creating BSON handle. OOM?\n");
+        log_error("Failed creating BSON handle. OOM?\n");
         return EXIT_FAILURE;
     }
 
-    if (emit)
+    __serialize_change(change, field, bson_type, oldv, newv, oldv_size,
+                       newv_size);
+    bson_finalize(change);
+
+    snprintf(key, sizeof(key), "%"PRIu64, set->count++);
+    val.type = BSON_EMBEDDED_DOCUMENT;
+    val.key = key;
+    val.data = change;
+
+    bson_serialize(set->changes, &val);
+    bson_cleanup(change);
+
+    return EXIT_SUCCESS;
+}
+
+/* queues one document per gathered set on the pipeline and forgets them */
+static int __publish_changes(struct kv_store* store)
+{
+    struct change_set* set;
+    struct bson_info* bson;
+    struct bson_kv val;
+    int ret = EXIT_SUCCESS;
+
+    while ((set = change_sets))
     {
+        change_sets = set->next;
+
+        if ((bson = bson_init()) == NULL)
+        {
+            log_error("Failed creating BSON handle. OOM?\n");
+            __change_set_free(set);
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
         val.type = BSON_STRING;
-        val.size = strlen(type);
+        val.size = strlen(set->type);
         val.key = "type";
-        val.data = type;
+        val.data = set->type;
 
         bson_serialize(bson, &val);
 
         val.type = BSON_INT64;
         val.key = "transaction";
-        val.data = &(transaction_id);
+        val.data = &(set->transaction);
 
         bson_serialize(bson, &val);
 
-        val.type = BSON_STRING;
-        val.size = strlen(field);
-        val.key = "field";
-        val.data = field;
+        bson_finalize(set->changes);
+        val.type = BSON_ARRAY;
+        val.key = "changes";
+        val.data = set->changes;
 
         bson_serialize(bson, &val);
+        bson_finalize(bson);
 
-        val.type = bson_type;
-        val.subtype = BSON_BINARY_GENERIC;
-        val.key = "old";
-        val.data = oldv;
-        val.size = oldv_size;
+        if (redis_publish_pipelined(store, set->channel, bson->buffer,
+                                    bson->position))
+        {
+            log_error("Failure publishing "
+                      "Redis message.\n");
+            ret = EXIT_FAILURE;
+        }
 
-        bson_serialize(bson, &val);
+        bson_cleanup(bson);
+        __change_set_free(set);
+    }
 
-        val.type = bson_type;
-        val.subtype = BSON_BINARY_GENERIC;
-        val.key = "new";
-        val.data = newv;
-        val.size = newv_size;
+    return ret;
+}
 
-        bson_serialize(bson, &val);
+int __emit_field_update(struct kv_store* store, char* field, char* type,
+                        char* channel, enum BSON_TYPE bson_type, void* oldv,
+                        void* newv, uint64_t oldv_size, uint64_t newv_size, 
+                        uint64_t transaction_id, bool emit, bool print)
+{
+    struct bson_info* bson;
+    struct bson_kv val;
 
-        bson_finalize(bson);
+    if (print)
+    {
+        log_debug("Field '%s' differs.\n", field);
 
-        if (redis_publish(store, channel, bson->buffer, bson->position))
-        {
-            fprintf_light_red(stderr, "Failure publishing "
-                                      "Redis message.\n");
-            return EXIT_FAILURE;
-        }
+        log_debug("old:\t");
+        log_debug_hexdump(oldv, oldv_size);
+        log_debug("new:\t");
+        log_debug_hexdump(newv, newv_size);
+    }
+
+    if (!emit)
+        return EXIT_SUCCESS;
+
+    if (aggregate && inspect_depth)
+        return __gather_change(field, type, channel, bson_type, oldv, newv,
+                               oldv_size, newv_size, transaction_id);
+
+    if ((bson = bson_init()) == NULL)
+    {
+        log_error("Failed creating BSON handle. OOM?\n");
+        return EXIT_FAILURE;
+    }
+
+    val.type = BSON_STRING;
+    val.size = strlen(type);
+    val.key = "type";
+    val.data = type;
+
+    bson_serialize(bson, &val);
+
+    val.type = BSON_INT64;
+    val.key = "transaction";
+    val.data = &(transaction_id);
+
+    bson_serialize(bson, &val);
+
+    __serialize_change(bson, field, bson_type, oldv, newv, oldv_size,
+                       newv_size);
+    bson_finalize(bson);
+
+    if (redis_publish(store, channel, bson->buffer, bson->position))
+    {
+        log_error("Failure publishing "
+                  "Redis message.\n");
+        bson_cleanup(bson);
+        return EXIT_FAILURE;
     }
 
     bson_cleanup(bson);
@@ -429,199 +851,670 @@ int __reinspect_write(struct super_info* superblock, struct kv_store* store,
     write.header.sector_num = sector;
     write.data = buf;
 
-    if (redis_dequeue(store, sector, buf, &len))
-    {
-        fprintf_light_red(stdout, "Failed retrieving queued write [%"
-                                  PRIu64"]\n", sector);
+    if (redis_pending_take(store, sector, buf, &len))
+    {
+        log_error("Failed retrieving queued write [%"
+                  PRIu64"]\n", sector);
+        return EXIT_FAILURE;
+    }
+
+    if (len == 0)
+    {
+        log_debug("Empty write returned for [%"PRIu64"]\n",
+                  sector);
+        return EXIT_FAILURE;
+    }
+
+    log_debug("DEQUEUED!\n");
+    log_debug_hexdump(buf, len);
+
+    return qemu_deep_inspect(superblock, &write, store, write_counter, vmname,
+                             partition_offset, -1);
+}
+
+/* where inode's record lives: the block-aligned sector of its inode table
+ * block, which keys that block's files list, and its byte offset within the
+ * block, as the crawler records them */
+int __inode_location(struct kv_store* store, struct super_info* super,
+                     uint64_t inode, uint64_t* sector, uint64_t* offset)
+{
+    uint64_t block_group = (inode - 1) / super->inodes_per_group;
+    uint64_t position = (inode - 1) % super->inodes_per_group;
+    uint64_t inode_table_sector;
+    size_t len = sizeof(inode_table_sector);
+
+    log_debug("__inode_location\n");
+
+    if (redis_hash_field_get(store, REDIS_BGD_SECTOR_GET, block_group,
+                             "inode_table_sector_start",
+                             (uint8_t*) &inode_table_sector,
+                             &len) || len != sizeof(inode_table_sector))
+    {
+        log_error("Failed loading inode_table_sector_start"
+                  " for BGD:%"PRIu64"\n", block_group);
+        return EXIT_FAILURE;
+    }
+
+    position *= super->inode_size;
+    position += inode_table_sector * SECTOR_SIZE;
+
+    *sector = position / super->block_size *
+              (super->block_size / SECTOR_SIZE);
+    *offset = position % super->block_size;
+
+    D_PRINT64(inode);
+    D_PRINT64(block_group);
+    D_PRINT64(*sector);
+    D_PRINT64(*offset);
+
+    return EXIT_SUCCESS;
+}
+
+/* one named entry of a linear directory block, its name borrowed from the
+ * block it was parsed out of */
+struct dentry
+{
+    uint64_t inode;
+    uint8_t file_type;
+    uint8_t name_len;
+    const uint8_t* name;
+};
+
+/* everything a dentry change needs besides the entry itself */
+struct dentry_diff
+{
+    struct kv_store* store;
+    struct super_info* superblock;
+    uint64_t partition_offset;
+    uint64_t dirdata;
+    uint64_t write_counter;
+    char* vmname;
+    char* channel;
+    char path[PATH_MAX];
+    size_t path_len;
+};
+
+static int __dentry_name_cmp(const void* a, const void* b)
+{
+    const struct dentry* x = (const struct dentry*) a;
+    const struct dentry* y = (const struct dentry*) b;
+
+    if (x->name_len != y->name_len)
+        return x->name_len < y->name_len ? -1 : 1;
+
+    return memcmp(x->name, y->name, x->name_len);
+}
+
+static int __dentry_inode_cmp(const void* a, const void* b)
+{
+    const struct dentry* x = (const struct dentry*) a;
+    const struct dentry* y = (const struct dentry*) b;
+
+    if (x->inode != y->inode)
+        return x->inode < y->inode ? -1 : 1;
+
+    return __dentry_name_cmp(a, b);
+}
+
+/* the live entries of a linear directory block other than . and ..; parsing
+ * stops at the first record that does not fit, and an htree index node
+ * parses as a single unused record */
+static size_t __dentries_parse(const uint8_t* block, size_t len,
+                               struct dentry* entries)
+{
+    const struct ext4_dir_entry* dir;
+    size_t position = 0, count = 0;
+
+    while (position + DENTRY_HEADER <= len)
+    {
+        dir = (const struct ext4_dir_entry*) &(block[position]);
+
+        if (dir->rec_len < DENTRY_HEADER || position + dir->rec_len > len ||
+            DENTRY_HEADER + dir->name_len > dir->rec_len)
+            break;
+
+        position += dir->rec_len;
+
+        if (dir->inode == 0 || dir->name_len == 0 ||
+            (dir->name_len == 1 && dir->name[0] == '.') ||
+            (dir->name_len == 2 && dir->name[0] == '.' &&
+                                   dir->name[1] == '.'))
+            continue;
+
+        entries[count].inode = dir->inode;
+        entries[count].file_type = dir->file_type;
+        entries[count].name_len = dir->name_len;
+        entries[count].name = dir->name;
+        count++;
+    }
+
+    return count;
+}
+
+/* a block's old entries laid back out as a linear block from its dirlist,
+ * for when there is no shadow to diff against */
+struct dirlist_block
+{
+    uint8_t* block;
+    size_t len;
+    size_t position;
+};
+
+static bool __dirlist_dentry(const struct redis_list_element* element,
+                             void* arg)
+{
+    struct dirlist_block* state = (struct dirlist_block*) arg;
+    struct ext4_dir_entry* dir;
+    size_t name_len, rec_len;
+    uint64_t inode;
+
+    if (element->len <= sizeof(inode) ||
+        element->len - sizeof(inode) > DENTRY_NAME_MAX)
+        return true;
+
+    name_len = element->len - sizeof(inode);
+    rec_len = (DENTRY_HEADER + name_len + 3) & ~((size_t) 3);
+
+    if (state->position + rec_len > state->len)
+        return false;
+
+    memcpy(&inode, element->data, sizeof(inode));
+
+    dir = (struct ext4_dir_entry*) &(state->block[state->position]);
+    dir->inode = (uint32_t) inode;
+    dir->rec_len = (uint16_t) rec_len;
+    dir->name_len = (uint8_t) name_len;
+    dir->file_type = 0;
+    memcpy(dir->name, &(element->data[sizeof(inode)]), name_len);
+
+    state->position += rec_len;
+
+    return true;
+}
+
+/* the entry's path under the directory, and its dirlist element */
+static size_t __dentry_path(struct dentry_diff* diff,
+                            const struct dentry* entry, char* path)
+{
+    size_t len = diff->path_len;
+
+    if (len + 1 + entry->name_len >= PATH_MAX)
+        return 0;
+
+    memcpy(path, diff->path, len);
+
+    if (len > 1)
+        path[len++] = '/';
+
+    memcpy(&(path[len]), entry->name, entry->name_len);
+    len += entry->name_len;
+    path[len] = '\0';
+
+    return len;
+}
+
+static size_t __dentry_element(const struct dentry* entry, uint8_t* element)
+{
+    memcpy(element, &(entry->inode), sizeof(entry->inode));
+    memcpy(&(element[sizeof(entry->inode)]), entry->name, entry->name_len);
+
+    return sizeof(entry->inode) + entry->name_len;
+}
+
+/* the second half of a move between directory blocks: the record detached
+ * when the old entry went away takes the new name, with its blocks */
+static int __dentry_reattached(struct dentry_diff* diff,
+                               const struct dentry* entry, uint64_t id,
+                               char* path, size_t len)
+{
+    uint8_t element[sizeof(uint64_t) + DENTRY_NAME_MAX];
+    char old_path[PATH_MAX];
+    size_t old_len = sizeof(old_path) - 1;
+    uint64_t renamed = 0;
+
+    if (redis_hash_field_get(diff->store, REDIS_FILE_SECTOR_GET, id, "path",
+                             (uint8_t*) old_path, &old_len) ||
+        old_len == 0 ||
+        redis_file_rename(diff->store, id, (const uint8_t*) old_path,
+                          old_len, (const uint8_t*) path, len, &renamed))
+        return EXIT_FAILURE;
+
+    old_path[old_len] = '\0';
+    log_debug("reattached %"PRIu64" files\n", renamed);
+
+    redis_delete_key(diff->store, REDIS_DETACHED_DELETE, entry->inode);
+    redis_binary_insert(diff->store, REDIS_DIR_FILES_INSERT, diff->dirdata,
+                        element, __dentry_element(entry, element));
+
+    return __emit_rename_file(diff->store, diff->channel, old_path, old_len,
+                              path, len, diff->write_counter);
+}
+
+int __diff_inodes(uint8_t* write, struct kv_store* store,
+                  char* vmname, uint64_t write_counter,
+                  struct sector_descriptor* desc, size_t write_len,
+                  struct super_info* superblock, uint64_t partition_offset);
+
+static int __dentry_created(struct dentry_diff* diff,
+                            const struct dentry* entry)
+{
+    uint8_t element[sizeof(uint64_t) + DENTRY_NAME_MAX];
+    uint32_t inode_num = (uint32_t) entry->inode;
+    bool is_dir = entry->file_type == EXT4_FT_DIR;
+    uint64_t files, inode_offset, id;
+    struct sector_descriptor desc;
+    size_t block_len = diff->superblock->block_size;
+    char path[PATH_MAX];
+    uint8_t* block;
+    size_t len;
+    struct redis_hash_field fields[] = {
+        HASH_FIELD(inode_num),
+        HASH_FIELD(inode_offset),
+        HASH_FIELD(is_dir)
+    };
+
+    if ((len = __dentry_path(diff, entry, path)) == 0 ||
+        redis_file_detached(diff->store, entry->inode, &id))
+        return EXIT_FAILURE;
+
+    if (id != UINT64_MAX)
+        return __dentry_reattached(diff, entry, id, path, len);
+
+    if (__inode_location(diff->store, diff->superblock, entry->inode,
+                         &files, &inode_offset) ||
+        redis_file_create(diff->store, entry->inode, files,
+                          (const uint8_t*) path, len, fields,
+                          sizeof(fields) / sizeof(fields[0]), &id))
+        return EXIT_FAILURE;
+
+    /* the inode table block now indexes one more file than its slot map;
+     * if it was already diffed, its shadow is the only copy of the new
+     * inode, so the block is diffed again from it without a slot map */
+    __pointer_set(diff->store, SECTOR_PTR_FILES, files, files);
+    block = __shadow_get(SECTOR_PTR_FILES, files, block_len,
+                         INODE_SHADOW_SLOTS * sizeof(uint64_t), NULL);
+    __shadow_drop(SECTOR_PTR_FILES, files);
+
+    redis_binary_insert(diff->store, REDIS_DIR_FILES_INSERT, diff->dirdata,
+                        element, __dentry_element(entry, element));
+
+    if (block)
+    {
+        desc = (struct sector_descriptor) { SECTOR_PTR_FILES, files, 0, 0 };
+        __diff_inodes(block, diff->store, diff->vmname, diff->write_counter,
+                      &desc, block_len, diff->superblock,
+                      diff->partition_offset);
+        free(block);
+    }
+    else
+    {
+        /* otherwise the table block may have landed first and be waiting,
+         * it carries the file's size and extents */
+        __reinspect_write(diff->superblock, diff->store,
+                          diff->partition_offset, files, diff->write_counter,
+                          diff->vmname);
+    }
+
+    return __emit_created_file(diff->store, diff->channel, path, len,
+                               diff->write_counter);
+}
+
+/* the blocks a released file owned map to nothing now, forget everything
+ * this process still holds about them so their next write waits */
+static void __forget_blocks(struct super_info* superblock,
+                            const uint64_t* sectors, size_t count)
+{
+    uint64_t step = superblock->block_size / SECTOR_SIZE;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (sector_idx)
+            sector_index_remove(sector_idx, sectors[i]);
+
+        __shadow_drop(SECTOR_PTR_DIRDATA, sectors[i]);
+        __shadow_drop(SECTOR_PTR_EXTENT, sectors[i]);
+
+        if (allocated)
+            alloc_map_remove(allocated, sectors[i], sectors[i] + step);
+    }
+}
+
+/* the entry was the only name of an inode that is still linked: it is being
+ * moved to another directory block, whose new entry may not be written yet */
+static bool __dentry_moving(struct dentry_diff* diff, uint64_t inode,
+                            uint64_t id)
+{
+    uint64_t records = 0, link_count = 0;
+    size_t len = sizeof(link_count);
+
+    if (redis_list_len(diff->store, REDIS_INODE_LLEN, inode, &records) ||
+        records != 1)
+        return false;
+
+    if (redis_hash_field_get(diff->store, REDIS_FILE_SECTOR_GET, id,
+                             "link_count", (uint8_t*) &link_count, &len) ||
+        len != sizeof(link_count))
+        return false;
+
+    return link_count > 0;
+}
+
+static int __dentry_deleted(struct dentry_diff* diff,
+                            const struct dentry* entry)
+{
+    uint8_t element[sizeof(uint64_t) + DENTRY_NAME_MAX];
+    uint64_t files, inode_offset, id = UINT64_MAX;
+    uint64_t* sectors = NULL;
+    char path[PATH_MAX];
+    size_t len, nsectors = 0;
+    bool released;
+
+    if ((len = __dentry_path(diff, entry, path)) == 0 ||
+        redis_path_get(diff->store, (const uint8_t*) path, len, &id))
         return EXIT_FAILURE;
+
+    if (id != UINT64_MAX && __dentry_moving(diff, entry->inode, id))
+    {
+        /* kept whole until the inode is linked again or freed */
+        if (redis_file_detach(diff->store, id, entry->inode,
+                              (const uint8_t*) path, len))
+            return EXIT_FAILURE;
+
+        log_debug("Detached %s while its inode is linked.\n", path);
+
+        redis_binary_insert(diff->store, REDIS_DIR_FILES_REMOVE,
+                            diff->dirdata, element,
+                            __dentry_element(entry, element));
+
+        return EXIT_SUCCESS;
     }
 
-    if (len == 0)
+    if (id != UINT64_MAX)
     {
-        fprintf_light_red(stdout, "Empty write returned for [%"PRIu64"]\n",
-                                  sector);
-        return EXIT_FAILURE;
+        if (__inode_location(diff->store, diff->superblock, entry->inode,
+                             &files, &inode_offset) ||
+            redis_file_delete(diff->store, id, entry->inode, files,
+                              (const uint8_t*) path, len, &released,
+                              &sectors, &nsectors))
+            return EXIT_FAILURE;
+
+        __shadow_drop(SECTOR_PTR_FILES, files);
+        __forget_blocks(diff->superblock, sectors, nsectors);
+        free(sectors);
+    }
+    else
+    {
+        log_warn("Deleted dentry %s was never indexed.\n", path);
     }
 
-    fprintf_light_blue(stdout, "DEQUEUED!\n");
-    hexdump(buf, len);
+    redis_binary_insert(diff->store, REDIS_DIR_FILES_REMOVE, diff->dirdata,
+                        element, __dentry_element(entry, element));
 
-    return qemu_deep_inspect(superblock, &write, store, write_counter, vmname,
-                             partition_offset, -1);
+    return __emit_deleted_file(diff->store, diff->channel, path, len,
+                               diff->write_counter);
 }
 
-uint64_t __inode_sector(struct kv_store* store, struct super_info* super,
-                        uint64_t inode)
+static int __dentry_renamed(struct dentry_diff* diff,
+                            const struct dentry* old,
+                            const struct dentry* new)
 {
-    uint64_t block_group = (inode - 1) / super->inodes_per_group;
-    uint64_t inode_table_sector;
-    uint64_t inode_sector;
-    uint64_t inode_offset = (inode - 1) % super->inodes_per_group;
-    D_PRINT64(inode_offset);
-    inode_offset *= super->inode_size;
-    D_PRINT64(inode_offset);
-    size_t len = sizeof(inode_table_sector);
-    fprintf_light_red(stdout, "__inode_sector\n");
+    uint8_t element[sizeof(uint64_t) + DENTRY_NAME_MAX];
+    char path[PATH_MAX], new_path[PATH_MAX];
+    uint64_t id = UINT64_MAX, renamed = 0;
+    size_t len, new_len;
+
+    if ((len = __dentry_path(diff, old, path)) == 0 ||
+        (new_len = __dentry_path(diff, new, new_path)) == 0 ||
+        redis_path_get(diff->store, (const uint8_t*) path, len, &id))
+        return EXIT_FAILURE;
 
-    if (redis_hash_field_get(store, REDIS_BGD_SECTOR_GET, block_group,
-                             "inode_table_sector_start",
-                             (uint8_t*) &inode_table_sector,
-                             &len))
-    {
-        fprintf_light_red(stderr, "Failed loading inode_table_sector_start"
-                                  " for BGD:%"PRIu64"\n", block_group);
+    if (id != UINT64_MAX &&
+        redis_file_rename(diff->store, id, (const uint8_t*) path, len,
+                          (const uint8_t*) new_path, new_len, &renamed))
         return EXIT_FAILURE;
-    }
 
-    D_PRINT64(super->inodes_per_group);
-    D_PRINT64(inode);
-    D_PRINT64(block_group);
-    D_PRINT64(inode_offset);
-    D_PRINT64(inode_table_sector);
-    
-    inode_sector = (inode_table_sector * SECTOR_SIZE +
-                    inode_offset) / SECTOR_SIZE;
+    log_debug("renamed %"PRIu64" files\n", renamed);
+
+    redis_binary_insert(diff->store, REDIS_DIR_FILES_REMOVE, diff->dirdata,
+                        element, __dentry_element(old, element));
+    redis_binary_insert(diff->store, REDIS_DIR_FILES_INSERT, diff->dirdata,
+                        element, __dentry_element(new, element));
 
-    fprintf_light_white(stdout, "inode_sector: %"PRIu64"\n", inode_sector);
-  
-    return inode_sector;
+    return __emit_rename_file(diff->store, diff->channel, path, len,
+                              new_path, new_len, diff->write_counter);
 }
 
-uint64_t __inode_offset(struct kv_store* store, struct super_info* super,
-                        uint64_t inode)
+/* applies the entries only one side has: pairs sharing an inode number are
+ * renames, the rest deletes and creates, in that order so a name reused
+ * within the block ends up pointing at its new file */
+static int __dentries_apply(struct dentry_diff* diff,
+                            struct dentry* removed, size_t nremoved,
+                            struct dentry* added, size_t nadded)
 {
-    uint64_t block_group = (inode - 1) / super->inodes_per_group;
-    uint64_t inode_table_sector;
-    uint64_t inode_offset = (inode - 1) % super->inodes_per_group;
-    D_PRINT64(inode_offset);
-    inode_offset *= super->inode_size;
-    D_PRINT64(inode_offset);
-    size_t len = sizeof(inode_table_sector);
-    fprintf_light_red(stdout, "__inode_offset\n");
+    size_t i = 0, j = 0;
+    int ret = EXIT_SUCCESS;
 
-    if (redis_hash_field_get(store, REDIS_BGD_SECTOR_GET, block_group,
-                             "inode_table_sector_start",
-                             (uint8_t*) &inode_table_sector,
-                             &len))
+    qsort(removed, nremoved, sizeof(struct dentry), __dentry_inode_cmp);
+    qsort(added, nadded, sizeof(struct dentry), __dentry_inode_cmp);
+
+    while (i < nremoved && j < nadded)
     {
-        fprintf_light_red(stderr, "Failed loading inode_table_sector_start"
-                                  " for BGD:%"PRIu64"\n", block_group);
-        return EXIT_FAILURE;
+        if (removed[i].inode < added[j].inode)
+        {
+            i++;
+        }
+        else if (removed[i].inode > added[j].inode)
+        {
+            j++;
+        }
+        else
+        {
+            if (__dentry_renamed(diff, &(removed[i]), &(added[j])))
+                ret = EXIT_FAILURE;
+
+            removed[i++].inode = 0;
+            added[j++].inode = 0;
+        }
     }
 
-    inode_offset += inode_table_sector * SECTOR_SIZE;
-    inode_offset %= SECTOR_SIZE;
+    for (i = 0; i < nremoved; i++)
+        if (removed[i].inode && __dentry_deleted(diff, &(removed[i])))
+            ret = EXIT_FAILURE;
 
-    D_PRINT64(super->inodes_per_group);
-    D_PRINT64(inode);
-    D_PRINT64(block_group);
-    D_PRINT64(inode_offset);
-    D_PRINT64(inode_table_sector);
+    for (j = 0; j < nadded; j++)
+        if (added[j].inode && __dentry_created(diff, &(added[j])))
+            ret = EXIT_FAILURE;
 
-    return inode_offset;
+    return ret;
 }
 
+/* diffs a linear directory block against its shadow, or against its
+ * dirlist the first time it is seen; both sides are sorted by name and
+ * walked together once, so only changed entries touch Redis */
 int __diff_dir2(uint8_t* write, struct kv_store* store, 
                char* vmname, uint64_t write_counter,
-               char* pointer, size_t write_len, struct super_info* superblock,
-               uint64_t partition_offset)
+               struct sector_descriptor* desc, size_t write_len,
+               struct super_info* superblock, uint64_t partition_offset,
+               uint64_t block)
 {
-    uint64_t dir;
-    fprintf_light_white(stdout, "__diff_dir(), write_len == %zu\n", write_len);
-    fprintf_light_white(stdout, "operating on: %s\n", pointer);
+    uint64_t dirdata = desc->id, dir;
+    size_t max = write_len / (DENTRY_HEADER + 1) + 1;
+    struct dentry* olds = NULL, *news = NULL, *removed = NULL, *added = NULL;
+    struct dirlist_block state = { NULL, write_len, 0 };
+    size_t nold, nnew, nremoved = 0, nadded = 0, i = 0, j = 0, len;
+    struct dentry_diff diff = { store, superblock, partition_offset, dirdata,
+                                write_counter, vmname, NULL, { 0 }, 0 };
+    int ret = EXIT_FAILURE, cmp;
+    uint8_t* old;
+
+    log_debug("__diff_dir(), write_len == %zu\n", write_len);
+    log_debug("operating on: dirdata:%"PRIu64"\n", dirdata);
+
+    if ((old = __shadow_get(SECTOR_PTR_DIRDATA, block, write_len, 0, NULL)))
+    {
+        if (memcmp(old, write, write_len) == 0)
+        {
+            free(old);
+            return EXIT_SUCCESS;
+        }
+    }
+    else
+    {
+        if ((old = state.block = (uint8_t*) calloc(1, write_len)) == NULL)
+            return EXIT_FAILURE;
+
+        if (redis_list_foreach(store, REDIS_DIR_FILES_LGET, dirdata,
+                               __dirlist_dentry, &state))
+        {
+            log_error("Error getting dirlist:%"PRIu64" from Redis.\n",
+                      dirdata);
+            goto out;
+        }
+    }
+
+    if ((olds = (struct dentry*) malloc(max * sizeof(struct dentry))) ==
+        NULL ||
+        (news = (struct dentry*) malloc(max * sizeof(struct dentry))) ==
+        NULL ||
+        (removed = (struct dentry*) malloc(max * sizeof(struct dentry))) ==
+        NULL ||
+        (added = (struct dentry*) malloc(max * sizeof(struct dentry))) ==
+        NULL)
+        goto out;
+
+    nold = __dentries_parse(old, write_len, olds);
+    nnew = __dentries_parse(write, write_len, news);
 
-    strtok(pointer, ":");
-    pointer = strtok(NULL, ":");
+    qsort(olds, nold, sizeof(struct dentry), __dentry_name_cmp);
+    qsort(news, nnew, sizeof(struct dentry), __dentry_name_cmp);
 
-    if (pointer == NULL)
+    /* a name on both sides that changed inode is a delete and a create */
+    while (i < nold || j < nnew)
     {
-        fprintf_light_red(stderr, "Failed parsing dir pointer.\n");
-        return EXIT_FAILURE;
+        if (i == nold)
+            cmp = 1;
+        else if (j == nnew)
+            cmp = -1;
+        else
+            cmp = __dentry_name_cmp(&(olds[i]), &(news[j]));
+
+        if (cmp < 0)
+        {
+            removed[nremoved++] = olds[i++];
+        }
+        else if (cmp > 0)
+        {
+            added[nadded++] = news[j++];
+        }
+        else
+        {
+            if (olds[i].inode != news[j].inode)
+            {
+                removed[nremoved++] = olds[i];
+                added[nadded++] = news[j];
+            }
+
+            i++;
+            j++;
+        }
     }
 
-    sscanf(pointer, "%"SCNu64, &dir);
+    log_debug("%zu dentries removed, %zu added\n", nremoved, nadded);
 
-    return EXIT_SUCCESS;
+    if (nremoved || nadded)
+    {
+        len = sizeof(dir);
+
+        if (redis_hash_field_get(store, REDIS_DIR_SECTOR_GET, dirdata,
+                                 "file", (uint8_t*) &dir, &len) ||
+            len != sizeof(dir))
+        {
+            log_error("No directory for dirdata:%"PRIu64"\n", dirdata);
+            goto out;
+        }
+
+        len = sizeof(diff.path) - 1;
+
+        if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, dir, "path",
+                                 (uint8_t*) diff.path, &len))
+        {
+            log_error("No path for directory file:%"PRIu64"\n", dir);
+            goto out;
+        }
+
+        diff.path[len] = '\0';
+        diff.path_len = len;
+
+        if ((diff.channel = construct_channel_name(vmname, diff.path)) ==
+            NULL)
+            goto out;
+
+        if (__dentries_apply(&diff, removed, nremoved, added, nadded))
+            goto out;
+    }
+
+    ret = EXIT_SUCCESS;
+
+out:
+    /* a block only partly applied is diffed against its dirlist next time */
+    if (ret == EXIT_SUCCESS)
+        __shadow_put(SECTOR_PTR_DIRDATA, block, write, write_len, NULL, 0);
+    else
+        __shadow_drop(SECTOR_PTR_DIRDATA, block);
+
+    free(diff.channel);
+    free(added);
+    free(removed);
+    free(news);
+    free(olds);
+    free(old);
+    return ret;
 }
 
 int __emit_file_bytes(uint8_t* write, struct kv_store* store, 
                       char* vmname, uint64_t write_counter,
-                      char* pointer, size_t write_len, uint64_t sector)
+                      struct sector_descriptor* desc, size_t write_len,
+                      uint64_t sector)
 {
     struct bson_info* bson = bson_init();
     struct bson_kv val;
-    uint64_t start, end, file;
+    uint64_t start = desc->start, end = desc->end, file = desc->id;
     uint64_t fsize;
     size_t len = 4096;
     char path[len];
-    char* token, *channel_name;
-
-    fprintf_light_white(stdout, "__emit_file_bytes()\n");
-
-    strtok(pointer, ":");
-    token = strtok(NULL, ":");
-    if (token)
-    {
-        sscanf(token, "%"SCNu64, &start);
-    }
-    else
-    {
-        fprintf_light_red(stderr, "Failed tokenizing start.\n");
-        return EXIT_FAILURE;
-    }
-
-    strtok(NULL, ":");
-    token = strtok(NULL, ":");
-    if (token)
-    {
-        sscanf(token, "%"SCNu64, &end);
-    }
-    else
-    {
-        fprintf_light_red(stderr, "Failed tokenizing end.\n");
-        return EXIT_FAILURE;
-    }
+    char* channel_name;
 
-    strtok(NULL, ":");
-    token = strtok(NULL, ":");
-    if (token)
-    {
-        sscanf(token, "%"SCNu64, &file);
-    }
-    else
-    {
-        fprintf_light_red(stderr, "Failed tokenizing end.\n");
-        return EXIT_FAILURE;
-    }
+    log_debug("__emit_file_bytes()\n");
 
-    fprintf_light_white(stdout, "start: %"PRIu64
-                                " end: %"PRIu64
-                                " file: %"PRIu64"\n", start, end, file);
+    log_debug("start: %"PRIu64
+              " end: %"PRIu64
+              " file: %"PRIu64"\n", start, end, file);
 
     if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file, "path",
                              (uint8_t*) path, &len))
     {
-        fprintf_light_red(stderr, "Failed retrieving path for file:%"
-                                  PRIu64"\n", file);
+        log_error("Failed retrieving path for file:%"
+                  PRIu64"\n", file);
         return EXIT_FAILURE;
     }
 
     path[len] = '\0';
-    fprintf_light_white(stdout, "path: %s\n", path);
+    log_debug("path: %s\n", path);
 
     len = sizeof(fsize);
     if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file, "size",
                              (uint8_t*) &fsize, &len))
     {
-        fprintf_light_red(stderr, "Failed retrieving size for file:%"
-                                  PRIu64"\n", fsize);
+        log_error("Failed retrieving size for file:%"
+                  PRIu64"\n", fsize);
         return EXIT_FAILURE;
     }
 
     channel_name = construct_channel_name(vmname, path);
 
-    fprintf_light_white(stdout, "fsize: %"PRIu64"\n", fsize);
-    fprintf_light_white(stdout, "channel_name: %s\n", channel_name);
+    log_debug("fsize: %"PRIu64"\n", fsize);
+    log_debug("channel_name: %s\n", channel_name);
 
     /* get path, emit on chan */
 
@@ -648,12 +1541,12 @@ int __emit_file_bytes(uint8_t* write, struct kv_store* store,
     {
         write_len = fsize - start;
         /* keep this "last block" always around */
-        redis_enqueue_pipelined(store, sector, write, write_len);
+        redis_pending_put(store, sector, write, write_len, true);
     }
 
     if (end < fsize)
     {
-        redis_delqueue_pipelined(store, sector); 
+        redis_pending_remove(store, sector);
     }
     
     val.type = BSON_INT64;
@@ -671,45 +1564,73 @@ int __emit_file_bytes(uint8_t* write, struct kv_store* store,
 
     bson_finalize(bson);
 
-    fprintf_light_white(stdout, "publishing message\n");
+    log_debug("publishing message\n");
         
     if (redis_publish(store, channel_name, bson->buffer,
                       (size_t) bson->position))
     {
-        fprintf_light_red(stderr, "Failure publishing "
-                                  "Redis message.\n");
+        log_error("Failure publishing "
+                  "Redis message.\n");
         return -1;
     }
 
-    fprintf_light_white(stdout, "freeing channel\n");
+    log_debug("freeing channel\n");
     free(channel_name);
-    fprintf_light_white(stdout, "cleaning up bson\n");
+    log_debug("cleaning up bson\n");
     bson_cleanup(bson);
 
     return EXIT_SUCCESS;
 }
 
+/* count blocks from sector on were just mapped to file bytes from start:
+ * whatever of them waits pending is file data, published directly without
+ * another lookup, and none of them awaits a mapping any more */
+static void __resolve_pending(struct kv_store* store,
+                              struct super_info* superblock, uint64_t file,
+                              uint64_t sector, uint64_t start, uint64_t count,
+                              uint64_t write_counter, char* vmname)
+{
+    struct sector_descriptor desc = { SECTOR_PTR_FILE_DATA, file, 0, 0 };
+    uint64_t step = superblock->block_size / SECTOR_SIZE, i;
+    uint8_t buf[superblock->block_size];
+    size_t len;
+
+    for (i = 0; i < count; i++)
+    {
+        len = superblock->block_size;
+
+        if (redis_pending_take(store, sector + i * step, buf, &len) ||
+            len == 0)
+            continue;
+
+        log_debug("resolved pending write [%"PRIu64"]\n", sector + i * step);
+
+        desc.start = start + i * superblock->block_size;
+        desc.end = desc.start + superblock->block_size;
+        __emit_file_bytes(buf, store, vmname, write_counter, &desc, len,
+                          sector + i * step);
+    }
+
+    if (allocated)
+        alloc_map_remove(allocated, sector, sector + count * step);
+}
+
 int __diff_superblock_ntfs(uint8_t* write, struct kv_store* store, 
                       char* vmname, uint64_t write_counter, 
-                      char* pointer, size_t write_len)
+                      struct sector_descriptor* desc, size_t write_len)
 {
-    uint64_t fs = 0, superblock_offset = 0;
+    uint64_t fs = desc->id, superblock_offset = 0;
     size_t len = sizeof(struct ntfs_boot_file);
     struct ntfs_boot_file oldd, *old = &oldd;
-    fprintf_light_white(stdout, "__diff_superblock_ntfs()\n");
+    log_debug("__diff_superblock_ntfs()\n");
 
-    fprintf_light_white(stdout, "working on: %s\n", pointer);
-
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &fs);
-
-    fprintf_light_white(stdout, "pulling superblock: %"PRIu64"\n", fs);
+    log_debug("pulling superblock: %"PRIu64"\n", fs);
 
     if (redis_hash_field_get(store, REDIS_SUPERBLOCK_SECTOR_GET, fs,
                              "superblock", (uint8_t*) old, &len))
     {
-        fprintf_light_red(stderr, "Error getting superblock fs:%"
-                                  PRIu64"\n", fs);
+        log_error("Error getting superblock fs:%"
+                  PRIu64"\n", fs);
         return EXIT_FAILURE;
     }
 
@@ -718,57 +1639,83 @@ int __diff_superblock_ntfs(uint8_t* write, struct kv_store* store,
                              "superblock_offset", 
                              (uint8_t*) &superblock_offset, &len))
     {
-        fprintf_light_red(stderr, "Failed getting superblock_offset fs:%"
-                                  PRIu64"\n", fs);
+        log_error("Failed getting superblock_offset fs:%"
+                  PRIu64"\n", fs);
         return EXIT_FAILURE;
     }
 
-    fprintf_light_white(stdout, "superblock_offset: %"PRIu64"\n",
-                                superblock_offset);
+    log_debug("superblock_offset: %"PRIu64"\n",
+              superblock_offset);
 
     len = sizeof(struct ntfs_boot_file);
 
     return EXIT_SUCCESS;
 }
 
+/* the superblock fields the index tracks */
+static void __superblock_fields(struct ext4_superblock* super,
+                                uint64_t* block_size,
+                                int32_t* num_block_groups, int32_t* num_files)
+{
+    *block_size = ext4_block_size(*super);
+    *num_block_groups = (ext4_s_blocks_count(*super) +
+                        (super->s_blocks_per_group - 1)) /
+                        super->s_blocks_per_group;
+    *num_files = super->s_inodes_count -
+                 super->s_free_inodes_count -
+                 super->s_first_ino + 2;
+}
+
 int __diff_superblock(uint8_t* write, struct kv_store* store, 
                       char* vmname, uint64_t write_counter, 
-                      char* pointer, size_t write_len)
+                      struct sector_descriptor* desc, size_t write_len,
+                      struct super_info* superblock, uint64_t block)
 {
-    uint64_t fs = 0, superblock_offset = 0;
+    uint64_t fs = desc->id, superblock_offset = 0;
     struct ext4_superblock* new;
     uint64_t new_block_size, block_size;
     size_t len;
     int32_t new_num_files, num_files;
     int32_t new_num_block_groups, num_block_groups;
     char* channel = NULL;
+    uint8_t* old;
+
+    log_debug("__diff_superblock()\n");
 
-    fprintf_light_white(stdout, "__diff_superblock()\n");
-    fprintf_light_white(stdout, "working on: %s\n", pointer);
+    /* the shadow holds the old superblock, so nothing is read back */
+    if ((old = __shadow_get(SECTOR_PTR_FS, block, write_len, 0, NULL)))
+    {
+        superblock_offset = superblock->superblock_offset;
 
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &fs);
+        if (memcmp(old, write, write_len) == 0)
+        {
+            free(old);
+            return EXIT_SUCCESS;
+        }
 
-    fprintf_light_white(stdout, "pulling block_size: %"PRIu64"\n", fs);
+        __superblock_fields((struct ext4_superblock*)
+                            &(old[superblock_offset]),
+                            &block_size, &num_block_groups, &num_files);
+        free(old);
+    }
+    else
+    {
+        log_debug("pulling block_size: %"PRIu64"\n", fs);
 
-    GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, block_size, len);
-    GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, num_files, len);
-    GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, num_block_groups, len);
-    GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, superblock_offset, len);
+        GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, block_size, len);
+        GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, num_files, len);
+        GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, num_block_groups, len);
+        GET_FIELD(REDIS_SUPERBLOCK_SECTOR_GET, fs, superblock_offset, len);
+    }
 
-    fprintf_light_white(stdout, "superblock_offset: %"PRIu64"\n",
-                                superblock_offset);
+    log_debug("superblock_offset: %"PRIu64"\n",
+              superblock_offset);
 
     new = (struct ext4_superblock *) &(write[superblock_offset]);
     channel = construct_channel_name(vmname, "");
 
-    new_block_size = ext4_block_size(*new);
-    new_num_block_groups = (ext4_s_blocks_count(*new) +
-                           (new->s_blocks_per_group - 1)) /
-                           new->s_blocks_per_group;
-    new_num_files = new->s_inodes_count -
-                    new->s_free_inodes_count -
-                    new->s_first_ino + 2;
+    __superblock_fields(new, &new_block_size, &new_num_block_groups,
+                        &new_num_files);
 
     DIRECT_FIELD_COMPARE(block_size, "superblock.block_size", "metadata",
                          BSON_INT64);
@@ -783,71 +1730,128 @@ int __diff_superblock(uint8_t* write, struct kv_store* store,
     SET_FIELD(REDIS_SUPERBLOCK_SECTOR_INSERT, fs, num_block_groups, len);
     SET_FIELD(REDIS_SUPERBLOCK_SECTOR_INSERT, fs, num_files, len);
 
+    if (superblock_offset + sizeof(struct ext4_superblock) <= write_len)
+        __shadow_put(SECTOR_PTR_FS, block, write, write_len, NULL, 0);
+
     return EXIT_SUCCESS;
 }
 
 int __diff_mbr(uint8_t* write, struct kv_store* store,
-               const char* vmname, const char* pointer)
+               const char* vmname, struct sector_descriptor* desc)
 {
-    fprintf_light_white(stdout, "__diff_mbr()\n");
+    log_debug("__diff_mbr()\n");
     return EXIT_SUCCESS;
 }
 
+/* the sectors a block group descriptor points at */
+static void __bgd_sectors(struct ext4_block_group_descriptor* bgd,
+                          struct super_info* superblock, uint64_t offset,
+                          uint64_t* block_bitmap_sector_start,
+                          uint64_t* inode_bitmap_sector_start,
+                          uint64_t* inode_table_sector_start)
+{
+    *block_bitmap_sector_start = (ext4_bgd_block_bitmap(*bgd) *
+                                 superblock->block_size +
+                                 offset) /
+                                 SECTOR_SIZE;
+    *inode_bitmap_sector_start = (ext4_bgd_inode_bitmap(*bgd) *
+                                 superblock->block_size +
+                                 offset) /
+                                 SECTOR_SIZE;
+    *inode_table_sector_start = (ext4_bgd_inode_table(*bgd) *
+                                superblock->block_size +
+                                offset) /
+                                SECTOR_SIZE;
+}
+
 int __diff_bgds(uint8_t* write, struct kv_store* store,
-                char* vmname, uint64_t write_counter, char* pointer,
-                size_t write_len, struct super_info* superblock,
-                uint64_t offset)
+                char* vmname, uint64_t write_counter,
+                struct sector_descriptor* desc, size_t write_len,
+                struct super_info* superblock, uint64_t offset,
+                uint64_t block)
 {
-    uint64_t bgd = 0, lbgds = 0, i;
-    uint8_t** list;
-    size_t len;
+    uint64_t mask[BLOCK_DIFF_WORDS(SHADOW_BLOCK_MAX /
+                                   sizeof(struct ext4_block_group_descriptor))];
+    size_t nslots = write_len / sizeof(struct ext4_block_group_descriptor);
+    uint64_t bgd = 0, lbgds = desc->id, i;
+    struct id_list bgds = { NULL, 0 };
+    size_t len, trailer;
     struct ext4_block_group_descriptor* new;
     char* channel, *path = "";
     uint64_t block_bitmap_sector_start, new_block_bitmap_sector_start;
     uint64_t inode_bitmap_sector_start, new_inode_bitmap_sector_start;
     uint64_t inode_table_sector_start, new_inode_table_sector_start;
+    uint8_t* old;
+
+    log_debug("__diff_bgds()\n");
+    log_debug("pointer: lbgds:%"PRIu64"\n", lbgds);
+
+    /* the shadow's trailer is the block's bgd list, only descriptors whose
+     * bytes changed are compared */
+    if ((old = __shadow_get(SECTOR_PTR_BGDS, block, write_len,
+                            nslots * sizeof(uint64_t), &trailer)))
+    {
+        if (block_diff_mask(old, write, write_len,
+                            sizeof(struct ext4_block_group_descriptor),
+                            mask) == 0)
+        {
+            free(old);
+            return EXIT_SUCCESS;
+        }
 
-    fprintf_light_white(stdout, "__diff_bgds()\n");
-    fprintf_light_white(stdout, "pointer: %s\n", pointer);
+        bgds.len = trailer / sizeof(uint64_t);
 
-    // pull list
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &lbgds);
+        if ((bgds.ids = (uint64_t*) malloc(trailer + 1)) == NULL)
+        {
+            free(old);
+            return EXIT_FAILURE;
+        }
 
-    if (redis_list_get(store, REDIS_BGDS_LGET, lbgds, &list, &len))
+        memcpy(bgds.ids, &(old[write_len]), trailer);
+    }
+    else if (redis_list_foreach(store, REDIS_BGDS_LGET, lbgds, __collect_ids,
+                                &bgds))
     {
-        fprintf_light_red(stdout, "Error getting list of bgds from Redis.\n");
+        log_error("Error getting list of bgds from Redis.\n");
+        free(bgds.ids);
         return EXIT_FAILURE;
     }
 
-    fprintf_light_cyan(stdout, "loaded: %zu elements\n", len);
+    log_debug("loaded: %zu elements\n", bgds.len);
     channel = construct_channel_name(vmname, path);
-    fprintf_light_cyan(stdout, "channel: %s\n", channel);
+    log_debug("channel: %s\n", channel);
 
-    for (i = 0; i < len; i++)
+    for (i = 0; i < bgds.len && i < nslots; i++)
     {
-        strtok((char*) (list)[i], ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, &bgd);
+        bgd = bgds.ids[i];
 
-        GET_FIELD(REDIS_BGD_SECTOR_GET, bgd, block_bitmap_sector_start, len);
-        GET_FIELD(REDIS_BGD_SECTOR_GET, bgd, inode_bitmap_sector_start, len);
-        GET_FIELD(REDIS_BGD_SECTOR_GET, bgd, inode_table_sector_start, len);
+        if (old)
+        {
+            if ((mask[i / 64] & ((uint64_t) 1 << (i % 64))) == 0)
+                continue;
+
+            __bgd_sectors((struct ext4_block_group_descriptor *)
+                          &(old[i*sizeof(struct ext4_block_group_descriptor)]),
+                          superblock, offset, &block_bitmap_sector_start,
+                          &inode_bitmap_sector_start,
+                          &inode_table_sector_start);
+        }
+        else
+        {
+            GET_FIELD(REDIS_BGD_SECTOR_GET, bgd, block_bitmap_sector_start,
+                      len);
+            GET_FIELD(REDIS_BGD_SECTOR_GET, bgd, inode_bitmap_sector_start,
+                      len);
+            GET_FIELD(REDIS_BGD_SECTOR_GET, bgd, inode_table_sector_start,
+                      len);
+        }
 
         new = (struct ext4_block_group_descriptor *)
             &(write[i*sizeof(struct ext4_block_group_descriptor)]);
 
-        new_block_bitmap_sector_start = (ext4_bgd_block_bitmap(*new) *
-                                        superblock->block_size +
-                                        offset) /
-                                        SECTOR_SIZE;
-        new_inode_bitmap_sector_start = (ext4_bgd_inode_bitmap(*new) *
-                                        superblock->block_size +
-                                        offset) /
-                                        SECTOR_SIZE;
-        new_inode_table_sector_start = (ext4_bgd_inode_table(*new) *
-                                        superblock->block_size +
-                                        offset) /
-                                        SECTOR_SIZE;
+        __bgd_sectors(new, superblock, offset, &new_block_bitmap_sector_start,
+                      &new_inode_bitmap_sector_start,
+                      &new_inode_table_sector_start);
 
         DIRECT_FIELD_COMPARE(block_bitmap_sector_start,
                              "bgd.block_bitmap_sector_start", "metadata",
@@ -865,9 +1869,22 @@ int __diff_bgds(uint8_t* write, struct kv_store* store,
                   len);
         SET_FIELD(REDIS_BGD_SECTOR_INSERT, bgd, inode_table_sector_start,
                   len);
+
+        if (new_block_bitmap_sector_start != block_bitmap_sector_start)
+            __bitmap_pointer_set(store, new_block_bitmap_sector_start, bgd,
+                                 BITMAP_BLOCK);
+
+        if (new_inode_bitmap_sector_start != inode_bitmap_sector_start)
+            __bitmap_pointer_set(store, new_inode_bitmap_sector_start, bgd,
+                                 BITMAP_INODE);
     } 
 
-    redis_free_list(list, len);
+    if (bgds.len <= nslots)
+        __shadow_put(SECTOR_PTR_BGDS, block, write, write_len, bgds.ids,
+                     bgds.len * sizeof(uint64_t));
+
+    free(old);
+    free(bgds.ids);
     free(channel);
     return EXIT_SUCCESS;
 }
@@ -891,13 +1908,14 @@ int __ext4_new_extent_leaf_block(struct kv_store* store, uint64_t file,
         return EXIT_FAILURE;
     }
 
-    if (redis_reverse_pointer_set(store, REDIS_EXTENTS_SECTOR_INSERT,
+    if (__pointer_set(store, SECTOR_PTR_EXTENT,
                           sector,
-                          file))
+                          sector))
     {
         return EXIT_FAILURE;
     }
 
+    __metadata_hot(store, sector);
     __reinspect_write(superblock, store, partition_offset, sector,
                       write_counter, vmname);
 
@@ -915,13 +1933,14 @@ int __ext4_new_extent(struct kv_store* store, uint64_t file,
     sector /= SECTOR_SIZE;
     uint64_t sectors_per_block = superblock->block_size / SECTOR_SIZE;
     uint64_t i, counter = extent_new->ee_block * superblock->block_size;
+    uint64_t first = sector;
 
     for (i = 0; i < extent_new->ee_len; i++)
     {
         redis_reverse_pointer_set(store, REDIS_FILE_SECTORS_INSERT,
                                   file, 
                                   sector);
-        redis_reverse_file_data_pointer_set(store, 
+        __file_data_pointer_set(store, 
                                             sector,
                                             counter,
                                             counter + superblock->block_size,
@@ -930,30 +1949,33 @@ int __ext4_new_extent(struct kv_store* store, uint64_t file,
         D_PRINT64(extent_new->ee_block);
         D_PRINT64(file);
 
-        __reinspect_write(superblock, store, partition_offset,
-                          sector, write_counter,
-                          vmname);
-
         counter += superblock->block_size;        
         sector += sectors_per_block;
         
     }
 
+    __resolve_pending(store, superblock, file, first,
+                      extent_new->ee_block * superblock->block_size,
+                      extent_new->ee_len, write_counter, vmname);
+
     return EXIT_SUCCESS;
 }
 
-int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
-                        uint64_t write_counter, uint8_t* newb,
-                        uint64_t partition_offset,
-                        struct super_info* superblock)
+/* diffs an extent header against the file's old block count and extent
+ * block sectors */
+int __diff_ext4_extent_list(struct kv_store* store, char* vmname,
+                            uint64_t file, uint64_t write_counter,
+                            uint8_t* newb, uint64_t partition_offset,
+                            struct super_info* superblock,
+                            uint64_t old_file_len, const uint64_t* extents,
+                            size_t old_extent_len)
 {
     struct ext4_extent_header* hdr_new;
     struct ext4_extent_idx* idx_new;
     struct ext4_extent* extent_new;
     uint64_t new_entries = 0, new_counter = 0, extent_sector = 0;
-    uint64_t old_file_len = 0, old_extent_len = 0, i;
+    uint64_t i;
     uint64_t start = 0, end = 0;
-    uint8_t** extent_list;
 
     struct ext4_extent_header hdr_def = { .eh_magic = 0,
                                           .eh_entries = 0,
@@ -969,29 +1991,10 @@ int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
 
     new_entries = hdr_new->eh_entries;
 
-    fprintf_light_cyan(stdout, "__ext4_diff_extents()\n");
+    log_debug("__ext4_diff_extents()\n");
     D_PRINT16(hdr_new->eh_magic);
 
-    if (redis_list_len(store, REDIS_FILE_SECTORS_LLEN, file, &old_file_len))
-    {
-        return EXIT_FAILURE;
-    }
-
-    if (redis_list_get(store, REDIS_EXTENTS_LGET, file, &extent_list,
-                       &old_extent_len))
-    {
-        return EXIT_FAILURE;
-    }
-
-    uint64_t extents[old_extent_len];
-
-    for (i = 0; i < old_extent_len; i++)
-    {
-        strtok((char *) extent_list[i], ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, &(extents[i]));
-    }
-
-    fprintf_white(stdout, "got old_len == %"PRIu64"\n", old_file_len);
+    log_debug("got old_len == %"PRIu64"\n", old_file_len);
 
     while (new_entries)
     {
@@ -1003,9 +2006,9 @@ int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
 
             if ((extent_sector = ext4_extent_index_leaf(*idx_new)))
             {
-                fprintf_light_white(stdout, "found new extent position fs "
-                                            "block = %"PRIu64".\n",
-                                            extent_sector);
+                log_debug("found new extent position fs "
+                          "block = %"PRIu64".\n",
+                          extent_sector);
 
                 extent_sector *= superblock->block_size;
                 extent_sector += partition_offset;
@@ -1019,10 +2022,11 @@ int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
                     redis_reverse_pointer_set(store, REDIS_EXTENTS_INSERT,
                                           file,
                                           extent_sector);
-                    redis_reverse_pointer_set(store,
-                                              REDIS_EXTENTS_SECTOR_INSERT,
+                    __pointer_set(store,
+                                              SECTOR_PTR_EXTENT,
                                               extent_sector,
                                               extent_sector);
+                    __metadata_hot(store, extent_sector);
                     __reinspect_write(superblock, store, partition_offset,
                                       extent_sector, write_counter, vmname);
                 }
@@ -1046,14 +2050,14 @@ int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
             extent_new = (struct ext4_extent *)
                       &(newb[sizeof(struct ext4_extent_header) +
                              sizeof(struct ext4_extent) * new_counter]);
-            fprintf_light_white(stdout, "no depth potentially new\n");
+            log_debug("no depth potentially new\n");
             /* check if new data block */
             if (extent_new->ee_block < old_file_len)
             {
-                fprintf_light_white(stdout, "old start block: %"PRIu32"\n",
-                                            extent_new->ee_block);
-                fprintf_light_white(stdout, "number of blocks: %"PRIu16"\n",
-                                           extent_new->ee_len);
+                log_debug("old start block: %"PRIu32"\n",
+                          extent_new->ee_block);
+                log_debug("number of blocks: %"PRIu16"\n",
+                          extent_new->ee_len);
 
                 for (i = 0; i < extent_new->ee_len; i++)
                 {
@@ -1076,10 +2080,8 @@ int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
                             superblock->block_size;
                     end = start + superblock->block_size; 
 
-                    redis_reverse_file_data_pointer_set(store, extent_sector,
+                    __file_data_pointer_set(store, extent_sector,
                                                         start, end, file);
-                    __reinspect_write(superblock, store, partition_offset,
-                                      extent_sector, write_counter, vmname);
                 }
             }
             else
@@ -1109,24 +2111,58 @@ int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
                             superblock->block_size;
                     end = start + superblock->block_size; 
 
-                    redis_reverse_file_data_pointer_set(store, extent_sector,
+                    __file_data_pointer_set(store, extent_sector,
                                                         start, end, file);
-                    __reinspect_write(superblock, store, partition_offset,
-                                      extent_sector, write_counter, vmname);
                 }
             }
+
+            /* the data blocks landing before this extent did are waiting */
+            __resolve_pending(store, superblock, file,
+                              (ext4_extent_start(*extent_new) *
+                               superblock->block_size +
+                               partition_offset) / SECTOR_SIZE,
+                              extent_new->ee_block * superblock->block_size,
+                              extent_new->ee_len, write_counter, vmname);
         }
 
         new_entries--;
         new_counter++;
     }
 
-    redis_free_list(extent_list, old_extent_len);
     redis_flush_pipeline(store);
 
     return EXIT_SUCCESS; 
 }
 
+int __diff_ext4_extents(struct kv_store* store, char* vmname, uint64_t file,
+                        uint64_t write_counter, uint8_t* newb,
+                        uint64_t partition_offset,
+                        struct super_info* superblock)
+{
+    uint64_t old_file_len = 0;
+    struct id_list extents = { NULL, 0 };
+    int ret;
+
+    if (redis_list_len(store, REDIS_FILE_SECTORS_LLEN, file, &old_file_len))
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (redis_list_foreach(store, REDIS_EXTENTS_LGET, file, __collect_ids,
+                           &extents))
+    {
+        free(extents.ids);
+        return EXIT_FAILURE;
+    }
+
+    ret = __diff_ext4_extent_list(store, vmname, file, write_counter, newb,
+                                  partition_offset, superblock, old_file_len,
+                                  extents.ids, extents.len);
+    free(extents.ids);
+
+    return ret;
+}
+
 int __diff_data_ntfs(struct kv_store* store, struct ntfs_boot_file* bootf,
                      uint64_t partition_offset, uint8_t* data, uint64_t file)
 {
@@ -1138,35 +2174,35 @@ int __diff_data_ntfs(struct kv_store* store, struct ntfs_boot_file* bootf,
 
     if (ntfs_get_attribute(data, &sah, &data_offset, NTFS_DATA, ""))
     {
-        fprintf_light_red(stderr, "Failed getting NTFS_DATA attr.\n");
+        log_error("Failed getting NTFS_DATA attr.\n");
         return EXIT_FAILURE;
     }
 
     if (sah.attribute_type != 0x80 &&
         sah.attribute_type != 0xA0)
     {
-        fprintf_light_red(stderr, "Data handler, not a data attribute.\n");
+        log_error("Data handler, not a data attribute.\n");
         return EXIT_FAILURE;
     }
     
     if ((sah.flags & 0x0001) != 0x0000) /* check compressed */
     {
-        fprintf_light_red(stderr, "NTFS: Error no support for compressed files"
-                                  " yet.\n");
+        log_error("NTFS: Error no support for compressed files"
+                  " yet.\n");
         return EXIT_FAILURE;
     }
 
     if ((sah.flags & 0x4000) != 0x0000) /* check encrypted */
     {
-        fprintf_light_red(stderr, "NTFS: Error no support for encrypted files "
-                                  "yet.\n");
+        log_error("NTFS: Error no support for encrypted files "
+                  "yet.\n");
         return EXIT_FAILURE;
     }
 
     if ((sah.flags & 0x8000) != 0x0000) /* check sparse */
     {
-        fprintf_light_red(stderr, "NTFS: Error no support for sparse files "
-                                  "yet.\n");
+        log_error("NTFS: Error no support for sparse files "
+                  "yet.\n");
         return EXIT_FAILURE;
     }
 
@@ -1186,21 +2222,21 @@ int __diff_data_ntfs(struct kv_store* store, struct ntfs_boot_file* bootf,
               ntfs_parse_data_run(data, &data_offset, &run_length, &run_lcn) &&
               real_size > 0)
         {
-            fprintf_light_blue(stderr, "got a sequence %d\n", counter++);
+            log_debug("got a sequence %"PRIu64"\n", counter++);
             run_length_bytes = run_length *
                                bootf->bytes_per_sector *
                                bootf->sectors_per_cluster;
-            fprintf_light_red(stderr, "prev_lcn: %"PRIx64"\n", prev_lcn);
-            fprintf_light_red(stderr, "run_lcn: %"PRIx64" (%"PRId64")\n",
-                                      run_lcn, run_lcn);
-            fprintf_light_red(stderr, "prev_lcn + run_lcn: %"PRIx64"\n",
-                                       prev_lcn + run_lcn);
+            log_debug("prev_lcn: %"PRIx64"\n", prev_lcn);
+            log_debug("run_lcn: %"PRIx64" (%"PRId64")\n",
+                      run_lcn, run_lcn);
+            log_debug("prev_lcn + run_lcn: %"PRIx64"\n",
+                      prev_lcn + run_lcn);
             run_lcn_bytes = ntfs_lcn_to_offset(bootf, partition_offset,
                                                prev_lcn + run_lcn);
-            fprintf_light_blue(stderr, "run_lcn_bytes: %"PRIx64
-                                       " run_length_bytes: %"PRIx64"\n",
-                                       run_lcn_bytes,
-                                       run_length_bytes);
+            log_debug("run_lcn_bytes: %"PRIx64
+                      " run_length_bytes: %"PRIx64"\n",
+                      run_lcn_bytes,
+                      run_length_bytes);
 
             assert(prev_lcn + run_lcn >= 0);
             assert(prev_lcn + run_lcn < 26214400);
@@ -1233,66 +2269,53 @@ int __diff_data_ntfs(struct kv_store* store, struct ntfs_boot_file* bootf,
 }
 
 int __diff_inodes_ntfs(uint8_t* write, struct kv_store* store,
-                  char* vmname, uint64_t write_counter, char* pointer,
-                  size_t write_len, struct ntfs_boot_file* bootf,
-                  uint64_t partition_offset)
+                  char* vmname, uint64_t write_counter,
+                  struct sector_descriptor* desc, size_t write_len,
+                  struct ntfs_boot_file* bootf, uint64_t partition_offset)
 {
-    uint64_t file = 0, lfiles = 0, i, offset;
-    uint8_t** list;
-    size_t len = 0, len2 = 4096;
+    uint64_t file = 0, lfiles = desc->id, i, offset;
+    struct id_list files = { NULL, 0 };
+    size_t len2 = 4096;
     uint8_t *new, is_dir;
     char path[len2];
     
-    fprintf_light_white(stdout, "__diff_inodes_ntfs()\n");
-    fprintf_light_white(stdout, "pointer: %s\n", pointer);
-
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &lfiles);
+    log_debug("__diff_inodes_ntfs()\n");
+    log_debug("pointer: lfiles:%"PRIu64"\n", lfiles);
 
-    if (redis_list_get(store, REDIS_FILES_LGET, lfiles, &list, &len))
+    if (redis_list_foreach(store, REDIS_FILES_LGET, lfiles, __collect_ids,
+                           &files))
     {
-        fprintf_light_red(stdout, "Error getting list of files from Redis.\n");
+        log_error("Error getting list of files from Redis.\n");
+        free(files.ids);
         return EXIT_FAILURE;
     }
 
-    fprintf_light_white(stdout, "got inodes: %zd\n", len);
+    log_debug("got inodes: %zd\n", files.len);
 
-    for (i = 0; i < len; i++)
+    for (i = 0; i < files.len; i++)
     {
-        len2 = 4096;
-        strtok((char*) (list)[i], ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, &file);
-        fprintf(stdout, "getting path: %"PRIu64"\n", file);
+        file = files.ids[i];
+        log_debug("getting path: %"PRIu64"\n", file);
 
-        if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file, "path",
-                                 (uint8_t*) path, &len2))
-        {
-            fprintf_light_red(stdout, "Error getting path for file %"PRIu64
-                                      "from Redis.\n", file);
-            return EXIT_FAILURE;
-        }
+        struct redis_hash_field fields[] = {
+            { "path", (uint8_t*) path, sizeof(path) - 1 },
+            HASH_FIELD(is_dir),
+            { "inode_offset", (uint8_t*) &offset, sizeof(offset) }
+        };
 
-        path[len2] = '\0';
+        is_dir = 0;
 
-        len2 = sizeof(is_dir);
-        if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file, "is_dir",
-                                 &is_dir, &len2)) 
+        if (redis_hash_fields_get(store, REDIS_FILE_KEY, file, fields,
+                                  sizeof(fields) / sizeof(fields[0])) ||
+            fields[2].len != sizeof(offset))
         {
-
-            fprintf_light_red(stdout, "Error getting is_dir for file %"PRIu64
-                                      "from Redis.\n", file);
+            log_error("Error getting record for file %"PRIu64
+                      "from Redis.\n", file);
+            free(files.ids);
             return EXIT_FAILURE;
         }
 
-
-        len2 = sizeof(offset);
-        if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file,
-                                 "inode_offset", (uint8_t*) &offset, &len2))
-        {
-            fprintf_light_red(stdout, "Error getting offset for file %"PRIu64
-                                      "from Redis.\n", file);
-            return EXIT_FAILURE;
-        }
+        path[fields[0].len] = '\0';
 
         new = &(write[offset]);
 
@@ -1305,27 +2328,181 @@ int __diff_inodes_ntfs(uint8_t* write, struct kv_store* store,
         if (redis_hash_field_set(store, REDIS_FILE_SECTOR_INSERT, file,
                                  "inode", (uint8_t*) new, len2))
         {
-            fprintf_light_red(stdout, "Error getting offset for file %"PRIu64
-                                      "from Redis.\n", file);
+            log_error("Error getting offset for file %"PRIu64
+                      "from Redis.\n", file);
+            free(files.ids);
             return EXIT_FAILURE;
         }
     }
 
-    redis_free_list(list, len);
-    fprintf_light_cyan(stdout, "loaded: %zu elements\n", len);
-    return EXIT_SUCCESS;
+    free(files.ids);
+    log_debug("loaded: %zu elements\n", files.len);
+    return EXIT_SUCCESS;
+}
+
+static void __fetch_done(int status, void* arg)
+{
+    if (status)
+        ((struct inode_fetch*) arg)->status = EXIT_FAILURE;
+}
+
+/* queues the file's record, and its extent lists before knowing whether the
+ * new inode even has an extent tree; with async lookups off only the record
+ * is fetched, there and then */
+static int __fetch_inode(struct kv_store* store, struct inode_fetch* fetch)
+{
+    struct redis_hash_field fields[] = {
+        { "path", (uint8_t*) fetch->path, sizeof(fetch->path) - 1 },
+        { "inode_offset", (uint8_t*) &(fetch->offset),
+          sizeof(fetch->offset) },
+        INODE_FIELD(fetch, is_dir),
+        INODE_FIELD(fetch, size),
+        INODE_FIELD(fetch, mode),
+        INODE_FIELD(fetch, link_count),
+        INODE_FIELD(fetch, uid),
+        INODE_FIELD(fetch, gid),
+        INODE_FIELD(fetch, atime),
+        INODE_FIELD(fetch, mtime),
+        INODE_FIELD(fetch, ctime)
+    };
+
+    memcpy(fetch->fields, fields, sizeof(fields));
+
+    if (async_kv == NULL)
+        return fetch->status = redis_hash_fields_get(store, REDIS_FILE_KEY,
+                                                     fetch->file,
+                                                     fetch->fields,
+                                                     INODE_FETCH_FIELDS);
+
+    fetch->prefetched = true;
+
+    if (redis_async_hash_fields_get(async_kv, REDIS_FILE_KEY, fetch->file,
+                                    fetch->fields, INODE_FETCH_FIELDS,
+                                    __fetch_done, fetch) ||
+        redis_async_list_len(async_kv, REDIS_FILE_SECTORS_LLEN, fetch->file,
+                             &(fetch->file_len), __fetch_done, fetch) ||
+        redis_async_list_foreach(async_kv, REDIS_EXTENTS_LGET, fetch->file,
+                                 __collect_ids, &(fetch->extents),
+                                 __fetch_done, fetch))
+        fetch->status = EXIT_FAILURE;
+
+    return fetch->status;
+}
+
+/* narrows files to those indexed at inode slots that changed since the
+ * block was last seen, filling in slots; false when the block has no shadow
+ * to diff against */
+static bool __inode_shadow_diff(uint64_t block, const uint8_t* write,
+                                size_t len, size_t inode_size,
+                                uint64_t* slots, struct id_list* files)
+{
+    uint64_t mask[BLOCK_DIFF_WORDS(INODE_SHADOW_SLOTS)];
+    size_t nslots = len / inode_size, trailer, changed, i;
+    uint8_t* old;
+
+    if (nslots == 0 || nslots > INODE_SHADOW_SLOTS || len % inode_size)
+        return false;
+
+    if ((old = __shadow_get(SECTOR_PTR_FILES, block, len,
+                            nslots * sizeof(uint64_t), &trailer)) == NULL)
+        return false;
+
+    if (trailer != nslots * sizeof(uint64_t))
+    {
+        free(old);
+        return false;
+    }
+
+    memcpy(slots, &(old[len]), nslots * sizeof(uint64_t));
+    changed = block_diff_mask(old, write, len, inode_size, mask);
+    free(old);
+
+    log_debug("%zu of %zu inode slots changed\n", changed, nslots);
+
+    if (changed &&
+        (files->ids = (uint64_t*) malloc(changed * sizeof(uint64_t))) == NULL)
+        return false;
+
+    for (i = 0; i < nslots; i++)
+    {
+        if ((mask[i / 64] & ((uint64_t) 1 << (i % 64))) &&
+            slots[i] != INODE_SLOT_EMPTY)
+            files->ids[files->len++] = slots[i];
+    }
+
+    return true;
+}
+
+static void __inode_shadow_put(uint64_t block, const uint8_t* write,
+                               size_t len, size_t inode_size,
+                               const uint64_t* slots)
+{
+    size_t nslots = len / inode_size;
+
+    if (nslots == 0 || nslots > INODE_SHADOW_SLOTS || len % inode_size)
+        return;
+
+    __shadow_put(SECTOR_PTR_FILES, block, write, len, slots,
+                 nslots * sizeof(uint64_t));
+}
+
+/* a detached file's inode lost its last link: the entry that went away was
+ * deleted rather than moved, and is announced on its old directory's
+ * channel now; false if file was not detached */
+static bool __detached_release(struct kv_store* store,
+                               struct super_info* superblock, char* vmname,
+                               uint64_t write_counter, uint64_t file,
+                               uint64_t files, char* path)
+{
+    uint64_t inode_num = 0, id, *sectors = NULL;
+    size_t len = sizeof(inode_num), nsectors = 0;
+    char parent[PATH_MAX], *slash, *channel;
+    bool released;
+
+    if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file,
+                             "inode_num", (uint8_t*) &inode_num, &len) ||
+        len == 0 ||
+        redis_file_detached(store, inode_num, &id) || id != file)
+        return false;
+
+    if (redis_file_delete(store, file, inode_num, files,
+                          (const uint8_t*) path, strlen(path), &released,
+                          &sectors, &nsectors))
+        return false;
+
+    __forget_blocks(superblock, sectors, nsectors);
+    free(sectors);
+
+    redis_delete_key(store, REDIS_DETACHED_DELETE, inode_num);
+
+    strncpy(parent, path, sizeof(parent) - 1);
+    parent[sizeof(parent) - 1] = '\0';
+
+    if ((slash = strrchr(parent, '/')) != NULL)
+        slash[slash == parent ? 1 : 0] = '\0';
+
+    if ((channel = construct_channel_name(vmname, parent)) != NULL)
+    {
+        __emit_deleted_file(store, channel, path, strlen(path),
+                            write_counter);
+        free(channel);
+    }
+
+    return true;
 }
 
 int __diff_inodes(uint8_t* write, struct kv_store* store,
-                  char* vmname, uint64_t write_counter, char* pointer,
-                  size_t write_len, struct super_info* superblock,
-                  uint64_t partition_offset)
+                  char* vmname, uint64_t write_counter,
+                  struct sector_descriptor* desc, size_t write_len,
+                  struct super_info* superblock, uint64_t partition_offset)
 {
-    uint64_t file = 0, lfiles = 0, i, offset, last_sector;
-    uint8_t** list;
-    size_t len = 0, len2 = 4096;
+    uint64_t file = 0, lfiles = desc->id, i, offset, last_sector;
+    uint64_t slots[INODE_SHADOW_SLOTS];
+    struct id_list files = { NULL, 0 };
     struct ext4_inode* new;
-    char* channel = NULL, path[len2];
+    struct inode_fetch* fetches;
+    char* channel = NULL, *path;
+    int ret = EXIT_SUCCESS;
     bool is_dir, new_is_dir;
     uint64_t size, new_size;
     uint64_t mode, new_mode;
@@ -1336,54 +2513,89 @@ int __diff_inodes(uint8_t* write, struct kv_store* store,
     uint64_t ctime, new_ctime;
     uint64_t mtime, new_mtime;
     
-    fprintf_light_white(stdout, "__diff_inodes()\n");
-    fprintf_light_white(stdout, "pointer: %s\n", pointer);
+    log_debug("__diff_inodes()\n");
+    log_debug("pointer: lfiles:%"PRIu64"\n", lfiles);
+
+    /* without a shadow every indexed file is diffed, and its slot learned */
+    if (!__inode_shadow_diff(lfiles, write, write_len,
+                             superblock->inode_size, slots, &files))
+    {
+        for (i = 0; i < INODE_SHADOW_SLOTS; i++)
+            slots[i] = INODE_SLOT_EMPTY;
+
+        if (redis_list_foreach(store, REDIS_FILES_LGET, lfiles,
+                               __collect_ids, &files))
+        {
+            log_error("Error getting list of bgds from Redis.\n");
+            free(files.ids);
+            return EXIT_FAILURE;
+        }
+    }
 
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &lfiles);
+    if (files.len == 0)
+    {
+        __inode_shadow_put(lfiles, write, write_len, superblock->inode_size,
+                           slots);
+        free(files.ids);
+        return EXIT_SUCCESS;
+    }
 
-    if (redis_list_get(store, REDIS_FILES_LGET, lfiles, &list, &len))
+    if ((fetches = (struct inode_fetch*)
+                   calloc(files.len, sizeof(struct inode_fetch))) == NULL)
     {
-        fprintf_light_red(stdout, "Error getting list of bgds from Redis.\n");
+        free(files.ids);
         return EXIT_FAILURE;
     }
 
-    for (i = 0; i < len; i++)
+    /* every file's lookups are in flight before the first one is diffed */
+    for (i = 0; i < files.len; i++)
     {
-        len2 = 4096;
-        strtok((char*) (list)[i], ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, &file);
+        fetches[i].file = files.ids[i];
 
-        if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file, "path",
-                                 (uint8_t*) path, &len2))
-        {
-            fprintf_light_red(stdout, "Error getting path for file %"PRIu64
-                                      "from Redis.\n", file);
-            return EXIT_FAILURE;
-        }
+        if (async_kv)
+            __fetch_inode(store, &(fetches[i]));
+    }
+
+    if (async_kv && redis_async_wait(async_kv))
+        log_error("Error waiting on inode lookups.\n");
+
+    for (i = 0; i < files.len; i++)
+    {
+        struct redis_hash_field updates[INODE_FETCH_FIELDS];
+        size_t nupdates = 0;
+
+        if (!async_kv)
+            __fetch_inode(store, &(fetches[i]));
 
-        path[len2] = '\0';
+        file = fetches[i].file;
 
-        len2 = sizeof(offset);
-        if (redis_hash_field_get(store, REDIS_FILE_SECTOR_GET, file,
-                                 "inode_offset", (uint8_t*) &offset, &len2))
+        if (fetches[i].status ||
+            fetches[i].fields[1].len != sizeof(offset))
         {
-            fprintf_light_red(stdout, "Error getting offset for file %"PRIu64
-                                      "from Redis.\n", file);
-            return EXIT_FAILURE;
+            log_error("Error getting record for file %"PRIu64
+                      "from Redis.\n", file);
+            ret = EXIT_FAILURE;
+            break;
         }
 
+        path = fetches[i].path;
+        path[fetches[i].fields[0].len] = '\0';
         channel = construct_channel_name(vmname, path);
 
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, is_dir, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, size, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, mode, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, link_count, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, uid, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, gid, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, atime, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, mtime, len2);
-        GET_FIELD(REDIS_FILE_SECTOR_GET, file, ctime, len2);
+        offset = fetches[i].offset;
+        is_dir = fetches[i].is_dir;
+
+        if (offset / superblock->inode_size < INODE_SHADOW_SLOTS)
+            slots[offset / superblock->inode_size] = file;
+
+        size = fetches[i].size;
+        mode = fetches[i].mode;
+        link_count = fetches[i].link_count;
+        uid = fetches[i].uid;
+        gid = fetches[i].gid;
+        atime = fetches[i].atime;
+        mtime = fetches[i].mtime;
+        ctime = fetches[i].ctime;
 
         new = (struct ext4_inode*) &(write[offset]);
 
@@ -1408,41 +2620,68 @@ int __diff_inodes(uint8_t* write, struct kv_store* store,
         DIRECT_FIELD_COMPARE(mtime, "file.mtime", "metadata", BSON_INT64);
         DIRECT_FIELD_COMPARE(ctime, "file.ctime", "metadata", BSON_INT64);
 
-        fprintf_light_white(stdout, "Checking inode for file '%s', offset %"
-                                    PRIu64"\n", path, offset);
-        fprintf_light_cyan(stdout, "channel: %s\n", channel);
+        log_debug("Checking inode for file '%s', offset %"
+                  PRIu64"\n", path, offset);
+        log_debug("channel: %s\n", channel);
+
+        HASH_FIELD_UPDATE(updates, nupdates, is_dir);
+        HASH_FIELD_UPDATE(updates, nupdates, size);
+        HASH_FIELD_UPDATE(updates, nupdates, mode);
+        HASH_FIELD_UPDATE(updates, nupdates, link_count);
+        HASH_FIELD_UPDATE(updates, nupdates, uid);
+        HASH_FIELD_UPDATE(updates, nupdates, gid);
+        HASH_FIELD_UPDATE(updates, nupdates, atime);
+        HASH_FIELD_UPDATE(updates, nupdates, mtime);
+        HASH_FIELD_UPDATE(updates, nupdates, ctime);
+
+        /* and one HMSET for whatever changed */
+        if (redis_hash_fields_set(store, REDIS_FILE_KEY, file, updates,
+                                  nupdates))
+            log_error("Error updating record for file %"
+                      PRIu64"\n", file);
+
+        if (new_link_count == 0 && link_count != 0 &&
+            __detached_release(store, superblock, vmname, write_counter,
+                               file, lfiles, path))
+        {
+            if (offset / superblock->inode_size < INODE_SHADOW_SLOTS)
+                slots[offset / superblock->inode_size] = INODE_SLOT_EMPTY;
 
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, is_dir, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, size, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, mode, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, link_count, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, uid, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, gid, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, atime, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, mtime, len2);
-        SET_FIELD(REDIS_FILE_SECTOR_INSERT, file, ctime, len2);
+            free(channel);
+            continue;
+        }
 
         if (((new->i_mode & 0x8000) == 0x8000 ||
              (new->i_mode & 0x4000) == 0x4000) &&
             !((new->i_mode & 0x6000) == 0x6000 ||
               (new->i_mode & 0xa000) == 0xa000))
         {
-            __diff_ext4_extents(store, vmname, file, write_counter, 
-                                (uint8_t *) &(new->i_block[0]),
-                                partition_offset, superblock);
+            if (fetches[i].prefetched)
+                __diff_ext4_extent_list(store, vmname, file, write_counter,
+                                        (uint8_t *) &(new->i_block[0]),
+                                        partition_offset, superblock,
+                                        fetches[i].file_len,
+                                        fetches[i].extents.ids,
+                                        fetches[i].extents.len);
+            else
+                __diff_ext4_extents(store, vmname, file, write_counter, 
+                                    (uint8_t *) &(new->i_block[0]),
+                                    partition_offset, superblock);
         }
 
         if (size < new_size)
         {
             if (redis_last_file_sector(store, file, &last_sector))
             {
-                fprintf_light_red(stdout, "Error getting offset for file %"
-                                          PRIu64"from Redis.\n", file);
-                return EXIT_FAILURE;
+                log_error("Error getting offset for file %"
+                          PRIu64"from Redis.\n", file);
+                free(channel);
+                ret = EXIT_FAILURE;
+                break;
             }
-            fprintf_light_white(stdout, "Size mismatch. Checking for last "
-                                        "block\n %"PRIu64" %"PRIu64" %"PRIu64,
-                                        size, new_size, last_sector);
+            log_debug("Size mismatch. Checking for last "
+                      "block\n %"PRIu64" %"PRIu64" %"PRIu64,
+                      size, new_size, last_sector);
 
             __reinspect_write(superblock, store, partition_offset, last_sector,
                               write_counter, vmname);
@@ -1451,89 +2690,349 @@ int __diff_inodes(uint8_t* write, struct kv_store* store,
         free(channel);
     }
 
-    redis_free_list(list, len);
-    fprintf_light_cyan(stdout, "loaded: %zu elements\n", len);
-    return EXIT_SUCCESS;
+    for (i = 0; i < files.len; i++)
+        free(fetches[i].extents.ids);
+
+    /* a block only partly diffed is diffed in full next time */
+    if (ret == EXIT_SUCCESS)
+        __inode_shadow_put(lfiles, write, write_len, superblock->inode_size,
+                           slots);
+    else
+        __shadow_drop(SECTOR_PTR_FILES, lfiles);
+
+    free(fetches);
+    free(files.ids);
+    log_debug("loaded: %zu elements\n", files.len);
+    return ret;
+}
+
+/* 1 for a bit newly set, -1 for one cleared and 0 if unchanged; ext4
+ * bitmaps count from each byte's least significant bit */
+static int __bit_change(const uint8_t* old, const uint8_t* new, uint64_t bit)
+{
+    return ((new[bit / 8] >> (bit % 8)) & 1) -
+           ((old[bit / 8] >> (bit % 8)) & 1);
+}
+
+/* blocks [first, end) of group bgd were allocated, or freed */
+static void __bitmap_blocks(struct super_info* superblock,
+                            uint64_t partition_offset, uint64_t bgd,
+                            uint64_t first, uint64_t end, bool set)
+{
+    /* block 0 is the boot block's on 1 KiB block file systems */
+    uint64_t base = bgd * superblock->blocks_per_group +
+                    (superblock->block_size == 1024 ? 1 : 0);
+    uint64_t start = ((base + first) * superblock->block_size +
+                      partition_offset) / SECTOR_SIZE;
+    uint64_t stop = ((base + end) * superblock->block_size +
+                     partition_offset) / SECTOR_SIZE;
+
+    log_debug("bgd:%"PRIu64" blocks [%"PRIu64", %"PRIu64") %s\n", bgd,
+              base + first, base + end, set ? "allocated" : "freed");
+
+    if (set)
+        alloc_map_add(allocated, bgd, start, stop);
+    else
+        alloc_map_remove(allocated, start, stop);
+}
+
+/* inodes [first, end) of group bgd were allocated: their inode table
+ * blocks hold metadata a directory entry has yet to map */
+static void __bitmap_inodes(struct kv_store* store,
+                            struct super_info* superblock, uint64_t bgd,
+                            uint64_t first, uint64_t end)
+{
+    uint64_t base = bgd * superblock->inodes_per_group + 1;
+    uint64_t step = superblock->block_size / SECTOR_SIZE;
+    uint64_t start, stop, offset, region;
+
+    log_debug("bgd:%"PRIu64" inodes [%"PRIu64", %"PRIu64") allocated\n",
+              bgd, base + first, base + end);
+
+    if (__inode_location(store, superblock, base + first, &start, &offset) ||
+        __inode_location(store, superblock, base + end - 1, &stop, &offset))
+        return;
+
+    stop += step;
+    alloc_map_add(allocated, bgd, start, stop);
+
+    for (region = start / REDIS_MD_REGION_SECTORS;
+         region <= (stop - 1) / REDIS_MD_REGION_SECTORS; region++)
+        __metadata_hot(store, region * REDIS_MD_REGION_SECTORS);
 }
 
+/* diffs a block or inode bitmap against its shadow, so blocks and inodes
+ * are known to be in use before the metadata mapping them lands; the first
+ * sighting of a bitmap only becomes its shadow */
 int __diff_bitmap(uint8_t* write, struct kv_store* store,
-                  const char* vmname, const char* pointer)
+                  const char* vmname, struct sector_descriptor* desc,
+                  size_t write_len, struct super_info* superblock,
+                  uint64_t partition_offset, uint64_t block)
 {
-    fprintf_light_white(stdout, "__diff_bitmap()\n");
+    bool inodes = desc->start == BITMAP_INODE;
+    uint64_t bgd = desc->id, nbits, i, end;
+    uint8_t* old;
+    int change;
+
+    log_debug("__diff_bitmap()\n");
+    log_debug("pointer: bgd:%"PRIu64" %s bitmap\n", bgd,
+              inodes ? "inode" : "block");
+
+    nbits = inodes ? superblock->inodes_per_group :
+                     superblock->blocks_per_group;
+
+    if (nbits > write_len * 8)
+        nbits = write_len * 8;
+
+    if ((old = __shadow_get(SECTOR_PTR_BGD, block, write_len, 0, NULL)) ==
+        NULL || allocated == NULL)
+    {
+        free(old);
+        __shadow_put(SECTOR_PTR_BGD, block, write, write_len, NULL, 0);
+        return EXIT_SUCCESS;
+    }
+
+    /* runs of one kind of change, whole unchanged bytes skipped */
+    for (i = 0; i < nbits; i = end)
+    {
+        if (old[i / 8] == write[i / 8])
+        {
+            end = (i / 8 + 1) * 8;
+            continue;
+        }
+
+        change = __bit_change(old, write, i);
+
+        for (end = i + 1;
+             end < nbits && __bit_change(old, write, end) == change; end++);
+
+        if (change && inodes)
+        {
+            if (change > 0)
+                __bitmap_inodes(store, superblock, bgd, i, end);
+        }
+        else if (change)
+        {
+            __bitmap_blocks(superblock, partition_offset, bgd, i, end,
+                            change > 0);
+        }
+    }
+
+    __shadow_put(SECTOR_PTR_BGD, block, write, write_len, NULL, 0);
+    free(old);
+
     return EXIT_SUCCESS;
 }
 
 int __diff_extent_tree(uint8_t* write, struct kv_store* store,
-                       char* vmname, char* pointer,
+                       char* vmname, struct sector_descriptor* desc,
                        uint64_t write_counter, size_t write_len,
                        struct super_info* superblock,
-                       uint64_t partition_offset)
-{
-    size_t len2 = sizeof(uint64_t);
-    uint64_t id, file;
-    struct ext4_extent_header def = { .eh_magic = 0,
-                                      .eh_entries = 0,
-                                      .eh_max = 0,
-                                      .eh_depth = 0,
-                                      .eh_generation = 0
-                                    };
-
-    memset(&def, 0, sizeof(def));
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &id);
-
-    fprintf_light_white(stdout, "__diff_extent_tree()\n");
+                       uint64_t partition_offset, uint64_t block)
+{
+    size_t len2 = sizeof(uint64_t), trailer;
+    uint64_t id = desc->id, file;
+    uint8_t* old;
+
+    log_debug("__diff_extent_tree()\n");
     D_PRINT64(id);
+
+    /* the shadow's trailer is the owning file, an unchanged block costs no
+     * round trips at all */
+    if ((old = __shadow_get(SECTOR_PTR_EXTENT, block, write_len,
+                            sizeof(file), &trailer)) &&
+        trailer == sizeof(file))
+    {
+        memcpy(&file, &(old[write_len]), sizeof(file));
+
+        if (memcmp(old, write, write_len) == 0)
+        {
+            free(old);
+            return EXIT_SUCCESS;
+        }
+    }
     /* load old extent block file id */
-    if (redis_hash_field_get(store, REDIS_EXTENT_SECTOR_GET, id, "file",
-                             (uint8_t*) &file, &len2))
+    else if (redis_hash_field_get(store, REDIS_EXTENT_SECTOR_GET, id, "file",
+                                  (uint8_t*) &file, &len2))
     {
-        fprintf_light_red(stderr, "No old index?\n");
+        log_error("No old index?\n");
+        free(old);
+        return EXIT_FAILURE;
     }
 
-    __diff_ext4_extents(store, vmname, file, write_counter, write,
-                        partition_offset, superblock);
+    free(old);
+
+    if (__diff_ext4_extents(store, vmname, file, write_counter, write,
+                            partition_offset, superblock) == EXIT_SUCCESS)
+        __shadow_put(SECTOR_PTR_EXTENT, block, write, write_len, &file,
+                     sizeof(file));
+    else
+        __shadow_drop(SECTOR_PTR_EXTENT, block);
 
     return EXIT_SUCCESS;
 }
 
 
+/* one dispatched block; handlers take what they need from here so the
+ * pointer type indexes a table instead of a switch */
+struct dispatch_args
+{
+    uint8_t* data;
+    struct kv_store* store;
+    char* vmname;
+    uint64_t write_counter;
+    struct sector_descriptor* desc;
+    size_t len;
+    struct super_info* superblock;
+    struct ntfs_boot_file* bootf;
+    uint64_t partition_offset;
+    uint64_t sector;
+    int metadata;
+    struct qemu_bdrv_write* write;
+};
+
+typedef void (*dispatch_handler)(struct dispatch_args* args);
+
+/* the first sector of the dispatched block, which keys its shadow; sector
+ * is where the write started */
+static uint64_t __dispatch_block(struct dispatch_args* args)
+{
+    return args->write->header.sector_num +
+           (uint64_t) (args->data - args->write->data) / SECTOR_SIZE;
+}
+
+int __load(uint64_t offset, int metadata, struct kv_store* store);
+int __load_list(uint64_t listid, int metadata, struct kv_store* store);
+
+static void __dispatch_file_data(struct dispatch_args* args)
+{
+    __emit_file_bytes(args->data, args->store, args->vmname,
+                      args->write_counter, args->desc, args->len,
+                      args->sector);
+}
+
+static void __dispatch_fs(struct dispatch_args* args)
+{
+    __diff_superblock(args->data, args->store, args->vmname,
+                      args->write_counter, args->desc, args->len,
+                      args->superblock, __dispatch_block(args));
+}
+
+static void __dispatch_mbr(struct dispatch_args* args)
+{
+    __diff_mbr(args->data, args->store, args->vmname, args->desc);
+}
+
+static void __dispatch_bgds(struct dispatch_args* args)
+{
+    __diff_bgds(args->data, args->store, args->vmname, args->write_counter,
+                args->desc, args->len, args->superblock,
+                args->partition_offset, __dispatch_block(args));
+}
+
+static void __dispatch_files(struct dispatch_args* args)
+{
+    __diff_inodes(args->data, args->store, args->vmname,
+                  args->write_counter, args->desc, args->len,
+                  args->superblock, args->partition_offset);
+}
+
+static void __dispatch_bgd(struct dispatch_args* args)
+{
+    __diff_bitmap(args->data, args->store, args->vmname, args->desc,
+                  args->len, args->superblock, args->partition_offset,
+                  __dispatch_block(args));
+}
+
+static void __dispatch_extent(struct dispatch_args* args)
+{
+    __diff_extent_tree(args->data, args->store, args->vmname, args->desc,
+                       args->write_counter, args->len, args->superblock,
+                       args->partition_offset, __dispatch_block(args));
+}
+
+static void __dispatch_dirdata(struct dispatch_args* args)
+{
+    __diff_dir2(args->data, args->store, args->vmname, args->write_counter,
+                args->desc, args->len, args->superblock,
+                args->partition_offset, __dispatch_block(args));
+}
+
+/* lazily loaded metadata: load it, then inspect the write again */
+static void __dispatch_loadlist(struct dispatch_args* args)
+{
+    __load_list(args->desc->id, args->metadata, args->store);
+    qemu_deep_inspect(args->superblock, args->write, args->store,
+                      args->write_counter, args->vmname,
+                      args->partition_offset, args->metadata);
+}
+
+static void __dispatch_load(struct dispatch_args* args)
+{
+    __load(args->desc->id, args->metadata, args->store);
+    qemu_deep_inspect(args->superblock, args->write, args->store,
+                      args->write_counter, args->vmname,
+                      args->partition_offset, args->metadata);
+}
+
+static void __dispatch_fs_ntfs(struct dispatch_args* args)
+{
+    __diff_superblock_ntfs(args->data, args->store, args->vmname,
+                           args->write_counter, args->desc, args->len);
+}
+
+static void __dispatch_files_ntfs(struct dispatch_args* args)
+{
+    __diff_inodes_ntfs(args->data, args->store, args->vmname,
+                       args->write_counter, args->desc, args->len,
+                       args->bootf, args->partition_offset);
+}
+
+static const dispatch_handler ext4_handlers[SECTOR_PTR_MAX] = {
+    [SECTOR_PTR_FILE_DATA] = __dispatch_file_data,
+    [SECTOR_PTR_FS] = __dispatch_fs,
+    [SECTOR_PTR_MBR] = __dispatch_mbr,
+    [SECTOR_PTR_BGDS] = __dispatch_bgds,
+    [SECTOR_PTR_FILES] = __dispatch_files,
+    [SECTOR_PTR_BGD] = __dispatch_bgd,
+    [SECTOR_PTR_EXTENT] = __dispatch_extent,
+    [SECTOR_PTR_DIRDATA] = __dispatch_dirdata,
+    [SECTOR_PTR_LOADLIST] = __dispatch_loadlist,
+    [SECTOR_PTR_LOAD] = __dispatch_load
+};
+
+static const dispatch_handler ntfs_handlers[SECTOR_PTR_MAX] = {
+    [SECTOR_PTR_FILE_DATA] = __dispatch_file_data,
+    [SECTOR_PTR_FS] = __dispatch_fs_ntfs,
+    [SECTOR_PTR_FILES] = __dispatch_files_ntfs
+};
+
 int __qemu_dispatch_write_ntfs(uint8_t* data,
                           struct kv_store* store, char* vmname,
                           uint64_t write_counter,
-                          char* pointer, size_t len,
+                          struct sector_descriptor* desc, size_t len,
                           struct ntfs_boot_file* bootf,
                           uint64_t partition_offset,
                           uint64_t sector)
 {
+    struct dispatch_args args = { data, store, vmname, write_counter, desc,
+                                  len, NULL, bootf, partition_offset, sector,
+                                  -1, NULL };
+
     D_PRINT64(partition_offset);
-    fprintf_light_blue(stdout, "ntfs_dispatch pointer: %s\n", pointer);
-    if (strncmp(pointer, "start", strlen("start")) == 0)
-        __emit_file_bytes(data, store, vmname, write_counter, pointer, len,
-                          sector);
-    else if(strncmp(pointer, "fs", strlen("fs")) == 0)
-        __diff_superblock_ntfs(data, store, vmname, write_counter, pointer,
-                               len);
-    //else if(strncmp(pointer, "mbr", strlen("mbr")) == 0)
-    //    __diff_mbr(data, store, vmname, pointer);
-    //else if(strncmp(pointer, "lbgds", strlen("lbgds")) == 0)
-    //    __diff_bgds(data, store, vmname, write_counter, pointer, len);
-    else if(strncmp(pointer, "lfiles", strlen("lfiles")) == 0)
-        __diff_inodes_ntfs(data, store, vmname, write_counter, pointer, len,
-                           bootf, partition_offset);
-    //else if(strncmp(pointer, "bgd", strlen("bgd")) == 0)
-    //    __diff_bitmap(data, store, vmname, pointer);
-    //else if(strncmp(pointer, "extent", strlen("extent")) == 0)
-        //__diff_extent_tree(data, store, vmname, pointer, write_counter, len, 
-        //                   super, partition_offset);
-    //else if(strncmp(pointer, "dirdata", strlen("dirdata")) == 0)
-    //    __diff_dir2_ntfs(data, store, vmname, write_counter, pointer, len,
-    //                super, partition_offset);
-    else
+    log_debug("ntfs_dispatch type: %"PRId32" id: %"PRIu64
+              "\n", desc->type, desc->id);
+
+    if (desc->type < 0 || desc->type >= SECTOR_PTR_MAX ||
+        ntfs_handlers[desc->type] == NULL)
     {
-        fprintf_light_red(stderr, "Redis returned unknown sector type [%s]\n",
-                                                                      pointer);
+        log_error("Unhandled NTFS sector type [%"PRId32
+                  "]\n", desc->type);
+        return EXIT_SUCCESS;
     }
+
+    ntfs_handlers[desc->type](&args);
+
     return EXIT_SUCCESS;
 }
 
@@ -1541,28 +3040,23 @@ int qemu_load_document(struct kv_store* store, struct bson_info* bson,
                        bool load_lazy, uint64_t* bgdcounter,
                        uint64_t* fcounter);
 
-int __load(char* pointer, int metadata, struct kv_store* store)
+int __load(uint64_t offset, int metadata, struct kv_store* store)
 {
     struct bson_info* bson = bson_init();
-    off64_t offset;
-
-    fprintf_light_blue(stdout, "-- lazy loading file data --\n");
 
-    /* get file offset from strtok */
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &offset);
+    log_debug("-- lazy loading file data --\n");
 
     /* lseek */
     if (lseek64(metadata, offset, SEEK_SET) == (off64_t) -1)
     {
-        fprintf(stderr, "ERROR: couldn't seek during MD load.\n");
+        log_error("ERROR: couldn't seek during MD load.\n");
         return EXIT_FAILURE;
     }
 
     /* bson_readf */
     if (bson_readf(bson, metadata) != 1)
     {
-        fprintf_light_red(stderr, "ERROR: couldn't read BSON document.\n");
+        log_error("ERROR: couldn't read BSON document.\n");
         exit(EXIT_FAILURE);
         return EXIT_FAILURE;
     }
@@ -1570,7 +3064,7 @@ int __load(char* pointer, int metadata, struct kv_store* store)
     /* load document */
     if (qemu_load_document(store, bson, true, NULL, NULL))
     {
-        fprintf_light_red(stderr, "ERROR: couldn't load document.\n");
+        log_error("ERROR: couldn't load document.\n");
     }
 
     bson_cleanup(bson);
@@ -1579,28 +3073,35 @@ int __load(char* pointer, int metadata, struct kv_store* store)
     return EXIT_SUCCESS;
 }
 
-int __load_list(char* pointer, int metadata, struct kv_store* store)
+struct load_list
 {
-    uint64_t listid, i;
-    uint8_t** list;
-    size_t len;
+    struct kv_store* store;
+    int metadata;
+};
 
-    fprintf_light_blue(stdout, "-- lazy loading inode table block --\n");
+static bool __load_element(const struct redis_list_element* element,
+                           void* arg)
+{
+    struct load_list* load = (struct load_list*) arg;
+    struct sector_descriptor desc;
 
-    /* get list number */
-    strtok(pointer, ":");
-    sscanf(strtok(NULL, ":"), "%"SCNu64, &listid);
+    if (redis_sector_unpack(element->data, element->len, &desc) ==
+        EXIT_SUCCESS &&
+        desc.type == SECTOR_PTR_LOAD)
+        __load(desc.id, load->metadata, load->store);
 
-    /*  pull loadlist */
-    redis_list_get(store, REDIS_GET_LRECORDS, listid, &list, &len);
+    return true;
+}
 
-    /* for each entry __load */
-    for (i = 0; i < len; i++)
-    {
-        __load((char*) list[i], metadata, store);
-    }
+int __load_list(uint64_t listid, int metadata, struct kv_store* store)
+{
+    struct load_list load = { store, metadata };
 
-    redis_free_list(list, len);
+    log_debug("-- lazy loading inode table block --\n");
+
+    /*  pull loadlist, then __load each entry */
+    redis_list_foreach(store, REDIS_GET_LRECORDS, listid, __load_element,
+                       &load);
 
     return EXIT_SUCCESS;
 }
@@ -1608,215 +3109,250 @@ int __load_list(char* pointer, int metadata, struct kv_store* store)
 int __qemu_dispatch_write(uint8_t* data,
                           struct kv_store* store, char* vmname,
                           uint64_t write_counter,
-                          char* pointer, size_t len,
+                          struct sector_descriptor* desc, size_t len,
                           struct super_info* superblock,
                           uint64_t partition_offset,
                           uint64_t sector,
                           int metadata,
                           struct qemu_bdrv_write* write)
 {
+    struct dispatch_args args = { data, store, vmname, write_counter, desc,
+                                  len, superblock, NULL, partition_offset,
+                                  sector, metadata, write };
+
     D_PRINT64(partition_offset);
-    fprintf_light_blue(stdout, "pointer: %s\n", pointer);
-    if (strncmp(pointer, "start", strlen("start")) == 0)
-        __emit_file_bytes(data, store, vmname, write_counter, pointer, len,
-                          sector);
-    else if(strncmp(pointer, "fs", strlen("fs")) == 0)
-        __diff_superblock(data, store, vmname, write_counter, pointer, len);
-    else if(strncmp(pointer, "mbr", strlen("mbr")) == 0)
-        __diff_mbr(data, store, vmname, pointer);
-    else if(strncmp(pointer, "lbgds", strlen("lbgds")) == 0)
-        __diff_bgds(data, store, vmname, write_counter, pointer, len,
-                    superblock, partition_offset);
-    else if(strncmp(pointer, "lfiles", strlen("lfiles")) == 0)
-        __diff_inodes(data, store, vmname, write_counter, pointer, len,
-                      superblock, partition_offset);
-    else if(strncmp(pointer, "bgd", strlen("bgd")) == 0)
-        __diff_bitmap(data, store, vmname, pointer);
-    else if(strncmp(pointer, "extent", strlen("extent")) == 0)
-        __diff_extent_tree(data, store, vmname, pointer, write_counter, len, 
-                           superblock, partition_offset);
-    else if(strncmp(pointer, "dirdata", strlen("dirdata")) == 0)
-        __diff_dir2(data, store, vmname, write_counter, pointer, len,
-                    superblock, partition_offset);
-    else if(strncmp(pointer, "loadlist", strlen("loadlist")) == 0)
-    {
-        __load_list(pointer, metadata, store);
-        qemu_deep_inspect(superblock, write, store, write_counter,
-                          vmname, partition_offset, metadata);
-    }
-    else if(strncmp(pointer, "load", strlen("load")) == 0)
-    {
-        __load(pointer, metadata, store);
-        qemu_deep_inspect(superblock, write, store, write_counter,
-                          vmname, partition_offset, metadata);
-    }
-    else
+    log_debug("pointer type: %"PRId32" id: %"PRIu64"\n",
+              desc->type, desc->id);
+
+    if (desc->type < 0 || desc->type >= SECTOR_PTR_MAX ||
+        ext4_handlers[desc->type] == NULL)
     {
-        fprintf_light_red(stderr, "Redis returned unknown sector type [%s]\n",
-                                                                      pointer);
+        log_error("Unknown sector type [%"PRId32"]\n",
+                  desc->type);
+        return EXIT_SUCCESS;
     }
+
+    ext4_handlers[desc->type](&args);
+
     return EXIT_SUCCESS;
 }
 
+static size_t __block_len(struct qemu_bdrv_write* write, uint64_t sector,
+                          uint64_t block_size)
+{
+    if ((write->header.nb_sectors - sector) * SECTOR_SIZE < block_size)
+        return (write->header.nb_sectors - sector) * SECTOR_SIZE;
+
+    return block_size;
+}
+
+/* resolves the sector descriptors of up to LOOKUP_BATCH blocks starting at
+ * sector offset i of the write, from the local index when one is loaded and
+ * otherwise in a single round trip; unmapped blocks get SECTOR_PTR_NONE */
+static size_t __lookup_blocks(struct kv_store* store,
+                              struct qemu_bdrv_write* write, uint64_t i,
+                              uint64_t block_size,
+                              struct sector_descriptor* descs)
+{
+    uint64_t sectors[LOOKUP_BATCH];
+    uint64_t step = block_size / SECTOR_SIZE;
+    size_t count, j;
+
+    for (count = 0; count < LOOKUP_BATCH &&
+                    i + count * step < write->header.nb_sectors; count++)
+        sectors[count] = write->header.sector_num + i + count * step;
+
+    if (sector_idx)
+    {
+        for (j = 0; j < count; j++)
+            if (!sector_index_lookup(sector_idx, sectors[j], &(descs[j])))
+                descs[j].type = SECTOR_PTR_NONE;
+
+        return count;
+    }
+
+    if (redis_sector_lookup_multi(store, sectors, count, descs))
+    {
+        log_error("Error doing sector lookup.\n");
+
+        for (j = 0; j < count; j++)
+            descs[j].type = SECTOR_PTR_NONE;
+    }
+
+    return count;
+}
+
 int qemu_deep_inspect_ntfs(struct ntfs_boot_file* bootf,
                       struct qemu_bdrv_write* write,
                       struct kv_store* store, uint64_t write_counter,
                       char* vmname, uint64_t partition_offset)
 {
-    uint64_t i;
-    uint8_t result[1024];
-    size_t len = 1024;
+    uint64_t i, j, offset;
     uint64_t block_size = ntfs_cluster_size(bootf);
-    uint64_t size = 0;
-    uint8_t* data;
+    struct sector_descriptor descs[LOOKUP_BATCH];
+    size_t count, size;
 
-    for (i = 0; i < write->header.nb_sectors; i += block_size / SECTOR_SIZE)
+    for (i = 0; i < write->header.nb_sectors;
+         i += count * (block_size / SECTOR_SIZE))
     {
-        len = 1024;
-        if (redis_sector_lookup(store, write->header.sector_num + i,
-            result, &len))
-        {
-            fprintf_light_red(stderr, "Error doing sector lookup.\n");
-            if ((write->header.nb_sectors - i) * SECTOR_SIZE < block_size)
-            {
-                size = (write->header.nb_sectors - i) * SECTOR_SIZE;
-            }
-            else
-            {
-                size = block_size;
-            }
-
-            redis_enqueue_pipelined(store, write->header.sector_num + i,
-                                    &(write->data[i*SECTOR_SIZE]),
-                                    size);
-            continue;
-        } 
+        count = __lookup_blocks(store, write, i, block_size, descs);
 
-        if (len)
+        for (j = 0; j < count; j++)
         {
-            result[len] = 0;
-            data = &(write->data[i*SECTOR_SIZE]);
+            offset = i + j * (block_size / SECTOR_SIZE);
+            size = __block_len(write, offset, block_size);
 
-            if ((write->header.nb_sectors - i) * SECTOR_SIZE < block_size)
+            if (descs[j].type == SECTOR_PTR_NONE)
             {
-                size = (write->header.nb_sectors - i)* SECTOR_SIZE;
-            }
-            else
-            {
-                size = block_size;
+                log_error("Returned sector lookup empty.\n");
+                redis_pending_put(store, write->header.sector_num + offset,
+                                  &(write->data[offset * SECTOR_SIZE]), size,
+                                  false);
+                return EXIT_FAILURE;
             }
 
             D_PRINT64(partition_offset);
-            __qemu_dispatch_write_ntfs(data, store, vmname, write_counter,
-                                       (char *) result, (size_t) size, bootf,
+            __qemu_dispatch_write_ntfs(&(write->data[offset * SECTOR_SIZE]),
+                                       store, vmname, write_counter,
+                                       &(descs[j]), size, bootf,
                                        partition_offset,
                                        write->header.sector_num);
         }
-        else
-        {
-            fprintf_light_red(stderr, "Returned sector lookup empty.\n");
-            if ((write->header.nb_sectors - i) * SECTOR_SIZE < block_size)
-            {
-                size = (write->header.nb_sectors - i) * SECTOR_SIZE;
-            }
-            else
-            {
-                size = block_size;
-            }
-
-            redis_enqueue_pipelined(store, write->header.sector_num + i,
-                                    &(write->data[i*SECTOR_SIZE]),
-                                    size);
-            return EXIT_FAILURE;
-        }
     }
 
     return EXIT_SUCCESS;
 }
 
+/* whether any of descs [from, count) is still unmapped */
+static bool __any_unmapped(struct sector_descriptor* descs, size_t from,
+                           size_t count)
+{
+    for (; from < count; from++)
+        if (descs[from].type == SECTOR_PTR_NONE)
+            return true;
+
+    return false;
+}
+
 int qemu_deep_inspect(struct super_info* superblock,
                       struct qemu_bdrv_write* write,
                       struct kv_store* store, uint64_t write_counter,
                       char* vmname, uint64_t partition_offset, int metadata)
 {
-    uint64_t i;
-    uint8_t result[1024];
-    size_t len = 1024;
-    uint64_t size = 0;
-    uint8_t* data;
+    uint64_t i, j, offset, next;
+    uint64_t step = superblock->block_size / SECTOR_SIZE;
+    struct sector_descriptor descs[LOOKUP_BATCH];
+    size_t count, size;
 
-    for (i = 0; i < write->header.nb_sectors; i +=
-                                          superblock->block_size / SECTOR_SIZE)
+    inspect_depth++;
+
+    for (i = 0; i < write->header.nb_sectors; i = next)
     {
-        len = 1024;
-        if (redis_sector_lookup(store, write->header.sector_num + i,
-            result, &len))
+        count = __lookup_blocks(store, write, i, superblock->block_size,
+                                descs);
+        next = i + count * step;
+
+        for (j = 0; j < count; j++)
         {
-            fprintf_light_red(stdout, "Error doing sector lookup.\n");
-            if ((write->header.nb_sectors - i) * SECTOR_SIZE <
-                superblock->block_size)
+            offset = i + j * step;
+            size = __block_len(write, offset, superblock->block_size);
+
+            if (descs[j].type != SECTOR_PTR_NONE)
             {
-                size = (write->header.nb_sectors - i) * SECTOR_SIZE;
+                log_debug("Returned sector lookup, now "
+                          "dispatching.\n");
+                D_PRINT64(partition_offset);
+                __qemu_dispatch_write(&(write->data[offset * SECTOR_SIZE]),
+                                      store, vmname, write_counter,
+                                      &(descs[j]), size, superblock,
+                                      partition_offset,
+                                      write->header.sector_num, metadata,
+                                      write);
+
+                /* metadata may have just mapped later blocks of this write;
+                 * file data never does, so only then are the blocks still
+                 * unmapped resolved again, together in one batch */
+                if (descs[j].type != SECTOR_PTR_FILE_DATA &&
+                    __any_unmapped(descs, j + 1, count))
+                {
+                    next = offset + step;
+                    break;
+                }
             }
             else
             {
-                size = superblock->block_size;
+                log_debug("Returned sector lookup empty.\n");
+                log_debug("enqueueing() %"PRIu64"\n",
+                          write->header.sector_num + offset);
+
+                /* a block its bitmap just allocated is about to be mapped,
+                 * keep it over ones that may never be */
+                redis_pending_put(store, write->header.sector_num + offset,
+                                  &(write->data[offset * SECTOR_SIZE]), size,
+                                  allocated &&
+                                  alloc_map_lookup(allocated,
+                                                   write->header.sector_num +
+                                                   offset, NULL));
             }
+        }
+    }
 
-            redis_enqueue_pipelined(store, write->header.sector_num + i,
-                                    &(write->data[i*SECTOR_SIZE]),
-                                    size);
-            continue;
-        } 
+    /* re-inspected blocks return here; only the write that started it all
+     * publishes what they gathered */
+    if (--inspect_depth == 0 && change_sets)
+        __publish_changes(store);
 
-        if (len)
-        {
-            fprintf_light_red(stdout, "Returned sector lookup, now "
-                                      "dispatching.\n");
-            result[len] = 0;
-            data = &(write->data[i*SECTOR_SIZE]);
+    redis_flush_pipeline(store);
 
-            if ((write->header.nb_sectors - i) * SECTOR_SIZE <
-                superblock->block_size)
-            {
-                size = (write->header.nb_sectors - i)* SECTOR_SIZE;
-            }
-            else
-            {
-                size = superblock->block_size;
-            }
+    return EXIT_SUCCESS;
+}
 
-            D_PRINT64(partition_offset);
-            __qemu_dispatch_write(data, store, vmname, write_counter,
-                                  (char *) result, (size_t) size, superblock,
-                                  partition_offset, write->header.sector_num,
-                                  metadata,
-                                  write);
-        }
-        else
-        {
-            fprintf_light_red(stdout, "Returned sector lookup empty.\n");
-            if ((write->header.nb_sectors - i) * SECTOR_SIZE <
-                superblock->block_size)
-            {
-                size = (write->header.nb_sectors - i) * SECTOR_SIZE;
-            }
-            else
-            {
-                size = superblock->block_size;
-            }
-            fprintf_light_red(stdout, "enqueueing() %"PRIu64"\n",
-                                      write->header.sector_num + i);
+/* objects a worker may own outright.  Inode table and extent blocks set the
+ * size and mapping that file data is emitted against, and a directory
+ * block's entry changes create and release other blocks' files, so they are
+ * shared metadata like everything else and wait for every worker to go
+ * idle */
+static bool __shardable(int32_t type)
+{
+    return type == SECTOR_PTR_FILE_DATA;
+}
+
+bool qemu_write_shard(struct super_info* superblock,
+                      struct qemu_bdrv_write* write, struct kv_store* store,
+                      uint64_t* key)
+{
+    uint64_t i, j;
+    uint64_t step = superblock->block_size / SECTOR_SIZE;
+    struct sector_descriptor descs[LOOKUP_BATCH], owner;
+    size_t count;
+    bool found = false;
+
+    memset(&owner, 0, sizeof(owner));
+
+    for (i = 0; i < write->header.nb_sectors; i += count * step)
+    {
+        count = __lookup_blocks(store, write, i, superblock->block_size,
+                                descs);
 
-            redis_enqueue_pipelined(store, write->header.sector_num + i,
-                                    &(write->data[i*SECTOR_SIZE]),
-                                    size);
+        for (j = 0; j < count; j++)
+        {
+            /* shared metadata, a write spanning two objects, or a block
+             * whose mapping metadata may still be in flight on another
+             * worker, which would take it from pending before it is put */
+            if (descs[j].type == SECTOR_PTR_NONE ||
+                !__shardable(descs[j].type) ||
+                (found && (descs[j].type != owner.type ||
+                           descs[j].id != owner.id)))
+                return false;
+
+            owner = descs[j];
+            found = true;
         }
     }
 
-    redis_flush_pipeline(store);
+    *key = (owner.id * 0x9e3779b97f4a7c15ULL) ^ (uint64_t) owner.type;
 
-    return EXIT_SUCCESS;
+    return true;
 }
 
 int qemu_get_superinfo(struct kv_store* store,
@@ -1854,7 +3390,7 @@ int qemu_get_bootf(struct kv_store* store,
                              fs_id, "superblock", (uint8_t*) bootf,
                              &len))
     {
-        fprintf_light_red(stderr, "Error retrieving superblock\n");
+        log_error("Error retrieving superblock\n");
         return EXIT_FAILURE;
     }
 
@@ -1872,7 +3408,7 @@ int qemu_get_pt_offset(struct kv_store* store,
                              pt_id, "first_sector_lba",
                              (uint8_t*) &sector_offset, &len))
     {
-        fprintf_light_red(stderr, "Error retrieving first_sector_lba\n");
+        log_error("Error retrieving first_sector_lba\n");
         return EXIT_FAILURE;
     }
 
@@ -1881,26 +3417,32 @@ int qemu_get_pt_offset(struct kv_store* store,
     return EXIT_SUCCESS;
 }
 
-enum SECTOR_TYPE __sector_type(const char* str)
-{
-    if (strncmp(str, "start", strlen("start")) == 0 ||
-        strncmp(str, "dirdata", strlen("dirdata")) == 0)
-        return SECTOR_EXT2_DATA;
-    else if(strncmp(str, "fs", strlen("fs")) == 0)
-        return SECTOR_EXT2_SUPERBLOCK;
-    else if(strncmp(str, "mbr", strlen("mbr")) == 0)
-        return SECTOR_MBR;
-    else if(strncmp(str, "lbgds", strlen("lbgds")) == 0)
-        return SECTOR_EXT2_BLOCK_GROUP_DESCRIPTOR;
-    else if(strncmp(str, "lfiles", strlen("lfiles")) == 0)
-        return SECTOR_EXT2_INODE;
-    else if(strncmp(str, "bgd", strlen("bgd")) == 0)
-        return SECTOR_EXT2_BLOCK_GROUP_BLOCKMAP |
-               SECTOR_EXT2_BLOCK_GROUP_INODEMAP;
-    else if(strncmp(str, "lextents", strlen("lextents")) == 0)
-        return SECTOR_EXT4_EXTENT;
-    fprintf_light_red(stderr, "Redis returned unknown sector type [%s]\n",
-                                                                    str);
+enum SECTOR_TYPE __sector_type(int32_t type)
+{
+    switch (type)
+    {
+        case SECTOR_PTR_FILE_DATA:
+        case SECTOR_PTR_DIRDATA:
+            return SECTOR_EXT2_DATA;
+        case SECTOR_PTR_FS:
+            return SECTOR_EXT2_SUPERBLOCK;
+        case SECTOR_PTR_MBR:
+            return SECTOR_MBR;
+        case SECTOR_PTR_BGDS:
+            return SECTOR_EXT2_BLOCK_GROUP_DESCRIPTOR;
+        case SECTOR_PTR_FILES:
+            return SECTOR_EXT2_INODE;
+        case SECTOR_PTR_BGD:
+            return SECTOR_EXT2_BLOCK_GROUP_BLOCKMAP |
+                   SECTOR_EXT2_BLOCK_GROUP_INODEMAP;
+        case SECTOR_PTR_EXTENT:
+            return SECTOR_EXT4_EXTENT;
+        default:
+            break;
+    }
+
+    log_error("Redis returned unknown sector type [%"PRId32
+              "]\n", type);
     return SECTOR_UNKNOWN;
 }
 
@@ -1908,32 +3450,21 @@ enum SECTOR_TYPE qemu_infer_ntfs_sector_type(struct ntfs_boot_file* bootf,
                                         struct qemu_bdrv_write* write,
                                         struct kv_store* store)
 {
-    uint64_t i;
-    uint8_t result[1024];
-    size_t len = 1024;
-    uint64_t block_size = ntfs_cluster_size(bootf);
+    struct sector_descriptor desc;
 
-    for (i = 0; i < write->header.nb_sectors; i += block_size / SECTOR_SIZE)
-    {
-        if (redis_sector_lookup(store, write->header.sector_num + i,
-            result, &len))
-        {
-            fprintf_light_red(stderr, "Error doing sector lookup.\n");
-            return SECTOR_UNKNOWN;
-        } 
+    if (write->header.nb_sectors <= 0)
+        return SECTOR_UNKNOWN;
 
-        if (len)
-        {
-            result[len] = 0;
-            return __sector_type((const char*) result);
-        }
-        else
-        {
-            return SECTOR_UNKNOWN;
-        }
+    if (redis_sector_lookup(store, write->header.sector_num, &desc))
+    {
+        log_error("Error doing sector lookup.\n");
+        return SECTOR_UNKNOWN;
     }
 
-    return SECTOR_UNKNOWN;
+    if (desc.type == SECTOR_PTR_NONE)
+        return SECTOR_UNKNOWN;
+
+    return __sector_type(desc.type);
 }
 
 int __deserialize_mbr(struct bson_info* bson, struct kv_store* store,
@@ -1945,7 +3476,7 @@ int __deserialize_mbr(struct bson_info* bson, struct kv_store* store,
     {
         if (strcmp(value1.key, "sector") == 0)
         {
-            if (redis_reverse_pointer_set(store, REDIS_MBR_INSERT,
+            if (__pointer_set(store, SECTOR_PTR_MBR,
                                       (uint64_t) *((uint32_t *) value1.data),
                                       id))
                 return EXIT_FAILURE;
@@ -1971,7 +3502,7 @@ int __deserialize_partition(struct bson_info* bson, struct kv_store* store,
     {
         if (strcmp(value1.key, "superblock_sector") == 0)
         {
-            if (redis_reverse_pointer_set(store, REDIS_SUPERBLOCK_INSERT,
+            if (__pointer_set(store, SECTOR_PTR_FS,
                                       (uint64_t) *((uint32_t *) value1.data),
                                       id))
                 return EXIT_FAILURE;
@@ -1997,7 +3528,7 @@ int __deserialize_fs(struct bson_info* bson, struct kv_store* store,
     {
         if (strcmp(value1.key, "superblock_sector") == 0)
         { 
-            if (redis_reverse_pointer_set(store, REDIS_SUPERBLOCK_INSERT,
+            if (__pointer_set(store, SECTOR_PTR_FS,
                                           *((uint64_t*) value1.data), id))
                 return EXIT_FAILURE;
         }             
@@ -2028,7 +3559,7 @@ int __deserialize_bgd(struct bson_info* bson, struct kv_store* store,
                                       id))
                 return EXIT_FAILURE;
 
-            if (redis_reverse_pointer_set(store, REDIS_BGDS_SECTOR_INSERT,
+            if (__pointer_set(store, SECTOR_PTR_BGDS,
                                       (uint64_t) *((uint32_t *) value1.data),
                                       (uint64_t) *((uint32_t *) value1.data)))
                 return EXIT_FAILURE;
@@ -2039,6 +3570,16 @@ int __deserialize_bgd(struct bson_info* bson, struct kv_store* store,
                                  value1.key, (const uint8_t*) value1.data,
                                  (size_t) value1.size))
                 return EXIT_FAILURE;
+
+            if (strcmp(value1.key, "block_bitmap_sector_start") == 0 &&
+                __bitmap_pointer_set(store, *((uint64_t *) value1.data), id,
+                                     BITMAP_BLOCK))
+                return EXIT_FAILURE;
+
+            if (strcmp(value1.key, "inode_bitmap_sector_start") == 0 &&
+                __bitmap_pointer_set(store, *((uint64_t *) value1.data), id,
+                                     BITMAP_INODE))
+                return EXIT_FAILURE;
         }
     }
 
@@ -2055,14 +3596,18 @@ int __deserialize_bitarray(struct bson_info* bson, struct kv_store* store)
         {
             if (redis_metadata_set(store, value1.data, value1.size))
             {
-                fprintf_light_red(stderr, "Error setting metadata field.\n");
+                log_error("Error setting metadata field.\n");
                 return EXIT_FAILURE;
             }
+
+            bitarray_destroy(md_filter);
+            md_filter = bitarray_init_data((uint8_t*) value1.data,
+                                           (uint64_t) value1.size * 8);
         }
         else
         {
-            fprintf_light_red(stderr, "Unkown field for metadata filter: %s\n",
-                                                                   value1.key);
+            log_error("Unkown field for metadata filter: %s\n",
+                      value1.key);
             return EXIT_FAILURE;
         }
     }
@@ -2084,12 +3629,11 @@ int __deserialize_file_lazy(struct super_info* super,
         if (strcmp(value1.key, "inode_sector") == 0)
         {
             inode_sector = (uint64_t) *((uint32_t *) value1.data);
-            if (redis_reverse_pointer_set(store, REDIS_LOAD_LRECORDS_INSERT,
-                                      inode_sector,
-                                      (uint64_t) bson->f_offset))
+            if (__load_record_add(store, inode_sector,
+                                  (uint64_t) bson->f_offset))
                 return EXIT_FAILURE;
 
-            if (redis_reverse_pointer_set(store, REDIS_LOAD_LRECORDS,
+            if (__pointer_set(store, SECTOR_PTR_LOADLIST,
                                           inode_sector, inode_sector))
                 return EXIT_FAILURE;
         }
@@ -2109,7 +3653,7 @@ int __deserialize_file_lazy(struct super_info* super,
             {
                 sscanf((const char*) value1.key, "%"SCNu64, &sector);
 
-                if (redis_reverse_pointer_set(store, REDIS_LOAD_LRECORDS,
+                if (__pointer_set(store, SECTOR_PTR_LOADLIST,
                                       sector,
                                       inode_sector))
                 {
@@ -2137,7 +3681,7 @@ int __deserialize_file_lazy(struct super_info* super,
 
             while (bson_deserialize(bson2, &value1, &value2) == 1)
             {
-                redis_reverse_pointer_set(store, REDIS_LOAD_LRECORDS,
+                __pointer_set(store, SECTOR_PTR_LOADLIST,
                                        (int64_t) *((int32_t *) value1.data),
                                        inode_sector);
             }
@@ -2161,7 +3705,7 @@ int __deserialize_file_lazy(struct super_info* super,
             {
                 sscanf((const char*) value1.key, "%"SCNu64, &sector);
 
-                if (redis_reverse_pointer_set(store, REDIS_LOAD_LRECORDS,
+                if (__pointer_set(store, SECTOR_PTR_LOADLIST,
                                       sector,
                                       inode_sector))
                 {
@@ -2195,7 +3739,11 @@ int __deserialize_file(struct super_info* super,
                                       id))
                 return EXIT_FAILURE;
 
-            if (redis_reverse_pointer_set(store, REDIS_FILES_SECTOR_INSERT,
+            /* the block's slot map no longer covers every file on it */
+            __shadow_drop(SECTOR_PTR_FILES,
+                          (uint64_t) *((uint32_t *) value1.data));
+
+            if (__pointer_set(store, SECTOR_PTR_FILES,
                                       (uint64_t) *((uint32_t *) value1.data),
                                       (uint64_t) *((uint32_t *) value1.data)))
                 return EXIT_FAILURE;
@@ -2244,7 +3792,7 @@ int __deserialize_file(struct super_info* super,
                     return EXIT_FAILURE;
                 }
 
-                if (redis_reverse_pointer_set(store, REDIS_DIR_INSERT,
+                if (__pointer_set(store, SECTOR_PTR_DIRDATA,
                                       sector,
                                       sector))
                 {
@@ -2276,7 +3824,7 @@ int __deserialize_file(struct super_info* super,
                 redis_reverse_pointer_set(store, REDIS_FILE_SECTORS_INSERT,
                                        id, 
                                        (int64_t) *((int32_t *) value1.data));
-                redis_reverse_file_data_pointer_set(store, 
+                __file_data_pointer_set(store, 
                         (int64_t) *((int32_t*)value1.data),
                         counter, counter + block_size, id);
                 counter += block_size; 
@@ -2317,8 +3865,8 @@ int __deserialize_file(struct super_info* super,
                     return EXIT_FAILURE;
                 }
 
-                if (redis_reverse_pointer_set(store,
-                                              REDIS_EXTENTS_SECTOR_INSERT,
+                if (__pointer_set(store,
+                                              SECTOR_PTR_EXTENT,
                                               sector,
                                               sector))
                 {
@@ -2366,7 +3914,7 @@ int qemu_load_document(struct kv_store* store, struct bson_info* bson,
     
     if (strcmp(value1.key, "type") != 0)
     {
-        fprintf_light_red(stderr, "Document missing 'type' field.\n");
+        log_error("Document missing 'type' field.\n");
         return EXIT_FAILURE;
     }
 
@@ -2383,15 +3931,15 @@ int qemu_load_document(struct kv_store* store, struct bson_info* bson,
     }
     else if (strcmp(value1.data, "fs") == 0)
     {
-        fprintf_light_yellow(stdout, "-- Deserializing a fs record --\n");
+        log_debug("-- Deserializing a fs record --\n");
 
         if (bson_deserialize(bson, &value1, &value2) != 1)
             return EXIT_FAILURE;
         
         if (strcmp(value1.key, "pte_num") != 0)
         {
-            fprintf_light_red(stderr, "fs missing 'pte_num' "
-                                      "field.\n");
+            log_error("fs missing 'pte_num' "
+                      "field.\n");
             return EXIT_FAILURE;
         }
 
@@ -2400,15 +3948,15 @@ int qemu_load_document(struct kv_store* store, struct bson_info* bson,
     }
     else if (strcmp(value1.data, "partition") == 0)
     {
-        fprintf_light_yellow(stdout, "-- Deserializing a partition "
-                                     "record --\n");
+        log_debug("-- Deserializing a partition "
+                  "record --\n");
         if (bson_deserialize(bson, &value1, &value2) != 1)
             return EXIT_FAILURE;
         
         if (strcmp(value1.key, "pte_num") != 0)
         {
-            fprintf_light_red(stderr, "Partition missing 'pte_num' "
-                                      "field.\n");
+            log_error("Partition missing 'pte_num' "
+                      "field.\n");
             return EXIT_FAILURE;
         }
 
@@ -2417,20 +3965,20 @@ int qemu_load_document(struct kv_store* store, struct bson_info* bson,
     }
     else if (strcmp(value1.data, "mbr") == 0)
     {
-        fprintf_light_yellow(stdout, "-- Deserializing a mbr record --\n");
+        log_debug("-- Deserializing a mbr record --\n");
         if (__deserialize_mbr(bson, store, (uint64_t) 0))
             return EXIT_FAILURE;
     }
     else if (strcmp(value1.data, "metadata_filter") == 0)
     {
-        fprintf_light_yellow(stdout, "-- Deserializing a bitarray record "
-                                     "--\n");
+        log_debug("-- Deserializing a bitarray record "
+                  "--\n");
         if (__deserialize_bitarray(bson, store))
             return EXIT_FAILURE;
     }
     else
     {
-        fprintf_light_red(stderr, "Unhandled type: %s\n", value1.data);
+        log_error("Unhandled type: %s\n", (const char*) value1.data);
         return EXIT_FAILURE;
     }
 
@@ -2447,16 +3995,37 @@ int qemu_load_index(int index, struct kv_store* store)
     struct bson_info* bson = bson_init();
     uint64_t file_counter = 0, bgd_counter = 0;
 
+    if (sector_idx == NULL && (sector_idx = sector_index_init()) == NULL)
+    {
+        log_error("Failed allocating sector index, lookups "
+                  "will go to redis.\n");
+    }
+
+    if (shadow == NULL &&
+        (shadow = shadow_store_init(SHADOW_STORE_DEFAULT_BUDGET)) == NULL)
+    {
+        log_error("Failed allocating metadata shadows, every metadata "
+                  "write will be diffed against Redis.\n");
+    }
+
+    if (allocated == NULL &&
+        (allocated = alloc_map_init(ALLOC_MAP_DEFAULT_RANGES)) == NULL)
+    {
+        log_error("Failed allocating the allocation map, bitmaps "
+                  "will not be diffed.\n");
+    }
+
     while (bson_readf(bson, index) == 1)
     {
         qemu_load_document(store, bson, true, &bgd_counter, &file_counter);
     }
 
-    fprintf_light_yellow(stdout, "-- Deserialized %"PRIu64" bgd's --\n",
-                                 bgd_counter);
+    log_info("-- Deserialized %"PRIu64" bgd's --\n", bgd_counter);
+    log_info("-- Deserialized %"PRIu64" file's --\n", file_counter);
 
-    fprintf_light_yellow(stdout, "-- Deserialized %"PRIu64" file's --\n",
-                                 file_counter);
+    if (sector_idx)
+        log_info("-- Indexed sectors in %"PRIu64" runs --\n",
+                 sector_index_runs(sector_idx));
 
     redis_set_fcounter(store, file_counter);
     redis_flush_pipeline(store);
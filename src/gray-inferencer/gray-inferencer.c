@@ -27,6 +27,7 @@
 
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,58 +36,368 @@
 #include <unistd.h>
 
 #include "color.h"
+#include "log.h"
 #include "util.h"
 #include "deep_inspection.h"
 #include "redis_queue.h"
+#include "shmring.h"
 
 #define SECTOR_SIZE 512 
+#define WORKER_QUEUE 1024 /* writes buffered per worker */
 
-int read_loop(struct kv_store* store, char* vmname, int index)
+#define USAGE "Usage: %s [-a] [-t] [-r <shared ring name>] [-j <workers>] " \
+              "[-p <pending cache MiB>] [-s <shadow cache MiB>] " \
+              "<disk index file> <kv spec> <vmname>\n"
+
+struct inference
 {
-    struct timeval start, end;
-    uint64_t write_counter = 0, partition_offset, time = 0;
-    struct qemu_bdrv_write write;
     struct super_info super_info;
+    uint64_t partition_offset;
+    char* vmname;
+    int index;
+    bool async;
+};
+
+struct work_item
+{
+    struct qemu_bdrv_write write;
+    uint64_t seq;
+};
+
+/* one shard: writes resolving to the same object always land on the same
+ * worker and are inspected in arrival order; the store gives each worker
+ * thread its own connection */
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct work_item items[WORKER_QUEUE];
+    size_t head;
+    size_t count;
+    bool busy;
+    bool shutdown;
+    struct kv_store* store;
+    struct inference* inference;
+};
+
+void print_pending_stats(struct kv_store* handle)
+{
+    struct clock_cache_stats stats;
+
+    redis_pending_stats(handle, &stats);
+    fprintf(stderr, "Pending writes: %"PRIu64" [%"PRIu64" bytes, %"PRIu64
+                    " last blocks], %"PRIu64" hits, %"PRIu64" misses, %"
+                    PRIu64" evictions [%"PRIu64" bytes, %"PRIu64" last "
+                    "blocks], %"PRIu64" rejected.\n",
+                    stats.entries, stats.bytes, stats.pinned, stats.hits,
+                    stats.misses, stats.evictions, stats.evicted_bytes,
+                    stats.pinned_evictions, stats.rejected);
+}
+
+void print_shadow_stats()
+{
+    struct clock_cache_stats stats;
+
+    qemu_shadow_stats(&stats);
+    fprintf(stderr, "Metadata shadows: %"PRIu64" [%"PRIu64" bytes], %"
+                    PRIu64" hits, %"PRIu64" misses, %"PRIu64" evictions [%"
+                    PRIu64" bytes], %"PRIu64" rejected.\n",
+                    stats.entries, stats.bytes, stats.hits, stats.misses,
+                    stats.evictions, stats.evicted_bytes, stats.rejected);
+}
+
+void print_alloc_stats()
+{
+    struct alloc_map_stats stats;
+
+    qemu_alloc_stats(&stats);
+    fprintf(stderr, "Newly allocated: %"PRIu64" ranges [%"PRIu64" sectors], %"
+                    PRIu64" sectors recorded, %"PRIu64" mapped or freed, %"
+                    PRIu64" ranges rejected.\n",
+                    stats.ranges, stats.sectors, stats.added, stats.removed,
+                    stats.rejected);
+}
+
+int dequeue_ring_write(struct shmring* ring, struct qemu_bdrv_write* write,
+                       bool block)
+{
+    int64_t sector;
+    size_t len;
+    int ret;
+
+    ret = block ? shmring_pop(ring, &sector, &(write->data), &len) :
+                  shmring_try_pop(ring, &sector, &(write->data), &len);
+
+    if (ret != 1)
+    {
+        write->data = NULL;
+        return EXIT_FAILURE;
+    }
+
+    write->header.sector_num = sector;
+    write->header.nb_sectors = len / SECTOR_SIZE;
+
+    return EXIT_SUCCESS;
+}
+
+/* blocks for at least one write, then takes whatever else is queued */
+int dequeue_writes(struct kv_store* store, struct shmring* ring,
+                   struct qemu_bdrv_write* writes, size_t max, size_t* count)
+{
+    if (ring == NULL)
+        return redis_async_write_dequeue_batch(store, writes, max, count);
+
+    *count = 0;
+
+    if (dequeue_ring_write(ring, &(writes[0]), true))
+        return EXIT_FAILURE;
+
+    for (*count = 1; *count < max; (*count)++)
+    {
+        if (dequeue_ring_write(ring, &(writes[*count]), false))
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void inspect_write(struct inference* inference, struct kv_store* store,
+                   struct qemu_bdrv_write* write, uint64_t seq)
+{
+    struct timeval start, end;
     char pretty_time[32];
+
+    qemu_print_write(write);
+    gettimeofday(&start, NULL);
+    qemu_deep_inspect(&(inference->super_info), write, store, seq,
+                      inference->vmname, inference->partition_offset,
+                      inference->index);
+    gettimeofday(&end, NULL);
+    pretty_print_microseconds(diff_time(start, end), pretty_time, 32);
+    log_debug("[%"PRIu64"] write inference in %s.\n", seq, pretty_time);
+    if (write->data)
+        free(write->data);
+}
+
+/* this thread's independent lookups go out together on an event loop of its
+ * own; without one they each block */
+struct kv_async* async_start(struct inference* inference,
+                             struct kv_store* store)
+{
+    struct kv_async* async;
+
+    if (!inference->async)
+        return NULL;
+
+    if ((async = redis_async_open(store)) == NULL)
+        fprintf_light_red(stderr, "Failed opening async lookups, falling "
+                                  "back to blocking.\n");
+
+    qemu_set_async(async);
+
+    return async;
+}
+
+void async_stop(struct kv_async* async)
+{
+    qemu_set_async(NULL);
+    redis_async_close(async);
+}
+
+void* worker_thread(void* arg)
+{
+    struct worker* worker = (struct worker*) arg;
+    struct kv_async* async = async_start(worker->inference, worker->store);
+    struct work_item item;
+
+    pthread_mutex_lock(&(worker->lock));
+
+    while (1)
+    {
+        while (worker->count == 0 && !worker->shutdown)
+            pthread_cond_wait(&(worker->cond), &(worker->lock));
+
+        if (worker->count == 0)
+            break;
+
+        item = worker->items[worker->head];
+        worker->head = (worker->head + 1) % WORKER_QUEUE;
+        worker->count--;
+        worker->busy = true;
+        pthread_cond_broadcast(&(worker->cond));
+        pthread_mutex_unlock(&(worker->lock));
+
+        inspect_write(worker->inference, worker->store, &(item.write),
+                      item.seq);
+
+        pthread_mutex_lock(&(worker->lock));
+        worker->busy = false;
+        pthread_cond_broadcast(&(worker->cond));
+    }
+
+    pthread_mutex_unlock(&(worker->lock));
+    async_stop(async);
+    redis_flush_pipeline(worker->store);
+
+    return NULL;
+}
+
+void worker_push(struct worker* worker, struct qemu_bdrv_write* write,
+                 uint64_t seq)
+{
+    pthread_mutex_lock(&(worker->lock));
+
+    while (worker->count == WORKER_QUEUE)
+        pthread_cond_wait(&(worker->cond), &(worker->lock));
+
+    worker->items[(worker->head + worker->count) % WORKER_QUEUE].write =
+        *write;
+    worker->items[(worker->head + worker->count) % WORKER_QUEUE].seq = seq;
+    worker->count++;
+    pthread_cond_broadcast(&(worker->cond));
+    pthread_mutex_unlock(&(worker->lock));
+}
+
+/* serializing lane: wait until every shard is idle */
+void workers_drain(struct worker* workers, size_t nworkers)
+{
+    size_t i;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        pthread_mutex_lock(&(workers[i].lock));
+
+        while (workers[i].count || workers[i].busy)
+            pthread_cond_wait(&(workers[i].cond), &(workers[i].lock));
+
+        pthread_mutex_unlock(&(workers[i].lock));
+    }
+}
+
+void workers_stop(struct worker* workers, size_t nworkers)
+{
+    size_t i;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        pthread_mutex_lock(&(workers[i].lock));
+        workers[i].shutdown = true;
+        pthread_cond_broadcast(&(workers[i].cond));
+        pthread_mutex_unlock(&(workers[i].lock));
+    }
+
+    for (i = 0; i < nworkers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        pthread_cond_destroy(&(workers[i].cond));
+        pthread_mutex_destroy(&(workers[i].lock));
+    }
+
+    free(workers);
+}
+
+struct worker* workers_start(struct inference* inference,
+                             struct kv_store* store, size_t nworkers)
+{
+    struct worker* workers = (struct worker*)
+                             calloc(nworkers, sizeof(struct worker));
+    size_t i;
+
+    if (workers == NULL)
+        return NULL;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        workers[i].inference = inference;
+        workers[i].store = store;
+        pthread_mutex_init(&(workers[i].lock), NULL);
+        pthread_cond_init(&(workers[i].cond), NULL);
+
+        if (pthread_create(&(workers[i].thread), NULL, worker_thread,
+                           &(workers[i])))
+        {
+            fprintf_light_red(stderr, "Failed starting worker %zu.\n", i);
+            pthread_cond_destroy(&(workers[i].cond));
+            pthread_mutex_destroy(&(workers[i].lock));
+            workers_stop(workers, i);
+            return NULL;
+        }
+    }
+
+    return workers;
+}
+
+int read_loop(struct kv_store* store, struct shmring* ring, char* vmname,
+              int index, size_t nworkers, bool async_lookups)
+{
+    struct inference inference;
+    struct worker* workers = NULL;
+    struct kv_async* async;
+    uint64_t write_counter = 0, key;
+    struct qemu_bdrv_write writes[REDIS_DEFAULT_DEQUEUE_BATCH];
+    size_t count, i;
+
+    inference.vmname = vmname;
+    inference.index = index;
+    inference.async = async_lookups;
     
-    if (qemu_get_superinfo(store, &super_info, (uint64_t) 0))
+    if (qemu_get_superinfo(store, &(inference.super_info), (uint64_t) 0))
     {
         fprintf_light_red(stderr, "Failed getting superblock.\n");
         return EXIT_FAILURE;
     }
 
-    if (qemu_get_pt_offset(store, &partition_offset, (uint64_t) 0))
+    if (qemu_get_pt_offset(store, &(inference.partition_offset),
+                           (uint64_t) 0))
     {
         fprintf_light_red(stderr, "Failed getting partition offset.\n");
         return EXIT_FAILURE;
     }
 
-    while (1)
+    if (nworkers > 1 &&
+        (workers = workers_start(&inference, store, nworkers)) == NULL)
     {
-        write.data = NULL;
+        fprintf_light_red(stderr, "Failed starting inference workers.\n");
+        return EXIT_FAILURE;
+    }
 
-        if (redis_async_write_dequeue(store, &write))
+    async = async_start(&inference, store);
+
+    while (1)
+    {
+        if (dequeue_writes(store, ring, writes, REDIS_DEFAULT_DEQUEUE_BATCH,
+                           &count))
         {
-            fprintf_light_red(stderr, "Redis dequeue failure.\n"
+            fprintf_light_red(stderr, "Write dequeue failure.\n"
                                       "Shutting down\n");
-            if (write.data)
-                free(write.data);
-            return EXIT_SUCCESS;
+            break;
         }
 
-        qemu_print_write(&write);
-        gettimeofday(&start, NULL);
-        qemu_deep_inspect(&super_info, &write, store, write_counter++, vmname,
-                          partition_offset, index);
-        gettimeofday(&end, NULL);
-        time = diff_time(start, end);
-        pretty_print_microseconds(time, pretty_time, 32);
-        fprintf_cyan(stdout, "[%"PRIu64"] write inference in %s.\n",
-                             write_counter, pretty_time);
-        if (write.data)
-            free(write.data);
+        /* the whole batch is inspected before the queue is touched again,
+         * write_counter orders all writes regardless of which shard ran it */
+        for (i = 0; i < count; i++)
+        {
+            if (workers && qemu_write_shard(&(inference.super_info),
+                                            &(writes[i]), store, &key))
+            {
+                worker_push(&(workers[key % nworkers]), &(writes[i]),
+                            write_counter++);
+                continue;
+            }
+
+            if (workers)
+                workers_drain(workers, nworkers);
+
+            inspect_write(&inference, store, &(writes[i]), write_counter++);
+        }
     }
 
+    if (workers)
+        workers_stop(workers, nworkers);
+
+    async_stop(async);
+
     fprintf(stdout, "Processed: %"PRIu64" writes.\n", write_counter);
 
     return EXIT_SUCCESS;
@@ -95,10 +406,14 @@ int read_loop(struct kv_store* store, char* vmname, int index)
 /* main thread of execution */
 int main(int argc, char* args[])
 {
-    int ret = EXIT_SUCCESS;
+    int ret = EXIT_SUCCESS, opt;
     uint64_t time;
-    char* index, *db, *vmname;
+    char* index, *db, *vmname, *ring_name = NULL;
+    size_t nworkers = 1, pending = PENDING_CACHE_DEFAULT_BUDGET;
+    size_t shadow = SHADOW_STORE_DEFAULT_BUDGET;
+    bool async = false, aggregate = false;
     int indexf;
+    struct shmring* ring = NULL;
     struct timeval start, end;
     char pretty_micros[32];
 
@@ -107,16 +422,48 @@ int main(int argc, char* args[])
                          "<wolf@cs.cmu.edu>\n");
     redis_print_version();
 
-    if (argc < 4)
+    while ((opt = getopt(argc, args, "atr:j:p:s:")) != -1)
     {
-        fprintf_light_red(stderr, "Usage: %s <disk index file> " 
-                                  " <redis db num> <vmname>\n", args[0]);
+        switch (opt)
+        {
+            case 'a':
+                async = true;
+                break;
+            case 't':
+                aggregate = true;
+                break;
+            case 'r':
+                ring_name = optarg;
+                break;
+            case 'j':
+                nworkers = strtoul(optarg, NULL, 10);
+                if (nworkers == 0)
+                {
+                    fprintf_light_red(stderr, USAGE, args[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                pending = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 's':
+                shadow = strtoull(optarg, NULL, 10) << 20;
+                break;
+            default:
+                fprintf_light_red(stderr, USAGE, args[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind < 3)
+    {
+        fprintf_light_red(stderr, USAGE, args[0]);
         return EXIT_FAILURE;
     }
 
-    index = args[1];
-    db = args[2];
-    vmname = args[3];
+    index = args[optind];
+    db = args[optind + 1];
+    vmname = args[optind + 2];
 
     fprintf_cyan(stdout, "%s: loading index: %s\n\n", vmname, index);
 
@@ -139,6 +486,7 @@ int main(int argc, char* args[])
     }
     
     on_exit((void (*) (int, void *)) redis_shutdown, handle);
+    redis_pending_configure(handle, pending);
 
     gettimeofday(&start, NULL);
     if (qemu_load_index(indexf, handle))
@@ -149,19 +497,41 @@ int main(int argc, char* args[])
     gettimeofday(&end, NULL);
     time = diff_time(start, end);
 
+    qemu_shadow_configure(shadow);
+    qemu_set_aggregate(aggregate);
+
     redis_flush_pipeline(handle);
 
+    if (ring_name)
+    {
+        fprintf_cyan(stdout, "%s: attaching to shared ring: %s\n\n", vmname,
+                             ring_name);
+        ring = shmring_open(ring_name, SHMRING_DEFAULT_SIZE);
+        if (ring == NULL)
+        {
+            fprintf_light_red(stderr, "Failed attaching to shared ring.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
     gettimeofday(&start, NULL);
-    ret = read_loop(handle, vmname, indexf);
+    ret = read_loop(handle, ring, vmname, indexf, nworkers, async);
     gettimeofday(&end, NULL);
 
     check_syscall(close(indexf));
+
+    shmring_release(ring, ring_name);
+
     pretty_print_microseconds(time, pretty_micros, 32);
     fprintf_light_red(stderr, "load_index time: %s.\n", pretty_micros);
 
     pretty_print_microseconds(diff_time(start, end), pretty_micros, 32);
     fprintf_light_red(stderr, "read_loop time: %s.\n", pretty_micros);
 
+    print_pending_stats(handle);
+    print_shadow_stats();
+    print_alloc_stats();
+
     redis_flush_pipeline(handle);
 
     return ret;
@@ -24,198 +24,841 @@
  *****************************************************************************/
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "bitarray.h"
+#include "coalesce.h"
 #include "color.h"
 #include "deep_inspection.h"
+#include "log.h"
 #include "redis_queue.h"
 #include "qemu_common.h"
+#include "shmring.h"
 #include "util.h"
 
-int read_loop(int fd, struct kv_store* handle, struct bitarray* bits)
+#define USAGE "Usage: %s [-r <shared ring name>] [-m <spill memory MiB>]" \
+              " [-s <spill log file> -d <spill log MiB>]" \
+              " [-w <coalescing window ms> [-b <coalescing window KiB>]]" \
+              " <index file> <stream file> <kv spec>\n" \
+              "       %s -M [-p <pipelines>] [-m ...] [-w ... [-b ...]]" \
+              " <index file> <stream> <kv spec> ...\n"
+
+#define STREAM_UNIX_PREFIX "unix:"
+#define MAX_EVENTS 64
+#define MD_HOT_INTERVAL 100000 /* microseconds between metadata filter polls */
+
+void print_spill_stats(struct kv_store* handle)
+{
+    struct spillq_stats stats;
+
+    redis_spill_stats(handle, &stats);
+    fprintf_light_red(stderr, "Spill queue: depth %"PRIu64" (max %"PRIu64
+                              "), %"PRIu64" bytes spilled to log, %"PRIu64
+                              " writes dropped [%"PRIu64" bytes].\n",
+                              stats.depth, stats.max_depth,
+                              stats.spilled_bytes, stats.drops,
+                              stats.dropped_bytes);
+}
+
+void print_flush_stats(struct kv_store* handle)
+{
+    struct redis_flush_stats stats;
+
+    redis_flush_stats(handle, &stats);
+    fprintf(stderr, "Pipeline: depth %"PRIu64" [%"PRIu64" bytes], %"PRIu64
+                    " flushes, latency last %"PRIu64" us, max %"PRIu64
+                    " us, mean %"PRIu64" us.\n",
+                    stats.depth, stats.bytes, stats.flushes,
+                    stats.last_latency, stats.max_latency,
+                    stats.flushes ? stats.total_latency / stats.flushes : 0);
+}
+
+struct write_sink
+{
+    struct kv_store* handle;
+    struct shmring* ring;
+    struct bitarray* bits;
+    char db[KV_SPEC_DB_MAX];
+    struct timeval md_polled;
+};
+
+/* one guest's write stream in multi-stream mode, the db of its connection
+ * spec tags the VM and selects its queue on whichever shared pipeline it is
+ * assigned; the pipelines connect to the first guests' endpoints */
+struct vm_stream
+{
+    char* name;
+    int fd;
+    int listen_fd;
+    struct qemu_stream* stream;
+    struct coalescer* window;
+    struct write_sink sink;
+    uint64_t counter;
+};
+
+int emit_write(void* ctx, struct qemu_bdrv_write* write)
+{
+    struct write_sink* sink = (struct write_sink*) ctx;
+    size_t len = ((size_t) write->header.nb_sectors) * SECTOR_SIZE;
+
+    if (sink->ring)
+    {
+        if (shmring_push(sink->ring, write->header.sector_num, write->data,
+                         len))
+        {
+            log_warn("\tshared ring push failed: dropping write\n");
+            return EXIT_FAILURE;
+        }
+    }
+    /* the mountain of things i still regret ! */
+    else if (redis_async_write_enqueue_db(sink->handle, sink->bits, sink->db,
+                                          write->header.sector_num,
+                                          write->data, len))
+    {
+        log_warn("\tspill budget exhausted: dropping write\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void flush_window(struct coalescer* window, struct write_sink* sink)
 {
     struct timeval start, end;
-    uint8_t buf[QEMU_HEADER_SIZE];
-    int64_t total = 0, read_ret = 0;
+    struct coalesce_stats stats;
+
+    gettimeofday(&start, NULL);
+    coalesce_flush(window, emit_write, sink);
+    gettimeofday(&end, NULL);
+    coalesce_get_stats(window, &stats);
+    log_debug("coalescing window flushed in %"PRIu64" microseconds "
+              "[%"PRIu64" writes in, %"PRIu64" writes out]\n",
+              diff_time(start, end), stats.writes_in, stats.writes_out);
+}
+
+/* regions the inferencer has since found new metadata in, from new extent
+ * blocks or inode table blocks, stop being spilled with file data */
+void poll_md_hot(struct write_sink* sink)
+{
+    struct timeval now;
+    uint64_t drained;
+
+    if (sink->handle == NULL)
+        return;
+
+    gettimeofday(&now, NULL);
+
+    if (diff_time(sink->md_polled, now) < MD_HOT_INTERVAL)
+        return;
+
+    sink->md_polled = now;
+
+    if (redis_metadata_hot_drain(sink->handle, sink->db, sink->bits,
+                                 &drained))
+        log_warn("\tfailed polling metadata filter updates\n");
+    else if (drained)
+        log_debug("%"PRIu64" regions newly marked as metadata\n", drained);
+}
+
+/* hands every complete write buffered in stream on to the sink */
+int consume_writes(struct qemu_stream* stream, struct write_sink* sink,
+                   struct coalescer* window, uint64_t* batch,
+                   uint64_t* batch_bytes)
+{
     struct qemu_bdrv_write write;
-    size_t len = QEMU_HEADER_SIZE;
-    uint64_t counter = 0;
+    int parsed;
+
+    poll_md_hot(sink);
+
+    /* payloads are handed over in place, no per-write copy */
+    while ((parsed = qemu_stream_parse(stream, &write)) == 1)
+    {
+        if (window == NULL)
+        {
+            emit_write(sink, &write);
+        }
+        else if (coalesce_add(window, &write))
+        {
+            /* out of memory, keep ordering and pass this one through */
+            flush_window(window, sink);
+            emit_write(sink, &write);
+        }
+        else if (coalesce_ready(window))
+        {
+            flush_window(window, sink);
+        }
+
+        (*batch)++;
+        *batch_bytes += write.header.nb_sectors * SECTOR_SIZE;
+    }
+
+    return parsed < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int read_loop(int fd, struct write_sink* sink, struct coalescer* window)
+{
+    struct timeval start, end;
+    struct qemu_stream* stream;
+    int64_t read_ret = 0, remaining;
+    uint64_t counter = 0, batch = 0, batch_bytes = 0;
+    int ret = EXIT_SUCCESS;
 
-    write.data = (uint8_t*) malloc(4096);
+    stream = qemu_stream_init(fd, QEMU_STREAM_DEFAULT_BUFSIZE);
 
-    if (write.data == NULL)
+    if (stream == NULL)
     {
-        fprintf_light_red(stderr, "Failed initial alloc for write.data.\n");
+        fprintf_light_red(stderr, "Failed initial alloc for stream "
+                                  "buffer.\n");
         return EXIT_FAILURE;
     }
 
     while (1)
     {
-        gettimeofday(&start, NULL);
-
-        read_ret = read(fd, buf, QEMU_HEADER_SIZE);
-        total = read_ret;
-
-        while (read_ret > 0 && total < QEMU_HEADER_SIZE)
+        /* an idle stream must not hold a window open past its deadline */
+        if (window && (remaining = coalesce_remaining(window)) >= 0)
         {
-            read_ret = read(fd, &buf[total], QEMU_HEADER_SIZE - total);
-            total += read_ret;
+            if (qemu_stream_wait(stream, (int) ((remaining + 999) / 1000))
+                == 0)
+            {
+                flush_window(window, sink);
+                continue;
+            }
         }
 
+        /* one large read() may carry many writes */
+        read_ret = qemu_stream_fill(stream);
+
         /* check for EOF */
         if (read_ret == 0)
         {
-            fprintf_light_red(stderr, "Total read: %"PRId64".\n", total);
+            if (qemu_stream_buffered(stream))
+            {
+                fprintf_light_red(stderr, "Stream ended while reading "
+                                          "sector data.\n");
+                ret = EXIT_FAILURE;
+                break;
+            }
+
+            fprintf_light_red(stderr, "Total writes: %"PRIu64".\n",
+                                      counter);
             fprintf_light_red(stderr, "Reading from stream failed, assuming "
                                       "teardown.\n");
-            return EXIT_SUCCESS;
+            break;
         }
 
         if (read_ret < 0)
         {
             fprintf_light_red(stderr, "Unknown fatal error occurred, 0 bytes"
                                        "read from stream.\n");
-            return EXIT_FAILURE;
+            ret = EXIT_FAILURE;
+            break;
         }
 
-        qemu_parse_header(buf, &write);
-        len = write.header.nb_sectors * SECTOR_SIZE;
-        write.data = (uint8_t*) realloc(write.data, len);
+        gettimeofday(&start, NULL);
+        batch = 0;
+        batch_bytes = 0;
 
-        if (write.data == NULL)
+        if (consume_writes(stream, sink, window, &batch, &batch_bytes))
         {
-            fprintf_light_red(stderr, "realloc() failed, assuming OOM.\n");
-            fprintf_light_red(stderr, "tried allocating: %d bytes\n",
-                                      write.header.nb_sectors*SECTOR_SIZE);
-            return EXIT_FAILURE;
+            ret = EXIT_FAILURE;
+            break;
         }
 
-        read_ret  = read(fd, (uint8_t*) write.data,
-                         write.header.nb_sectors*SECTOR_SIZE);
-        total = read_ret;
+        if (batch == 0)
+            continue;
 
-        while (read_ret > 0 && total < write.header.nb_sectors*SECTOR_SIZE)
+        gettimeofday(&end, NULL);
+        log_debug("[%"PRIu64"]read_loop batch of %"PRIu64" writes "
+                  "finished in %"PRIu64" microseconds [%"PRIu64
+                  " bytes]\n", counter, batch,
+                  diff_time(start, end), batch_bytes);
+        counter += batch;
+    }
+
+    if (window)
+        flush_window(window, sink);
+
+    if (sink->handle)
+    {
+        print_spill_stats(sink->handle);
+        print_flush_stats(sink->handle);
+    }
+
+    qemu_stream_destroy(stream);
+
+    if (sink->ring)
+        shmring_shutdown(sink->ring);
+
+    return ret;
+}
+
+int load_md_filter(char* index, struct bitarray** bits)
+{
+    int indexf;
+
+    fprintf_cyan(stdout, "Loading MD filter from: %s\n\n", index);
+    indexf = open(index, O_RDONLY | O_NOATIME); 
+
+    if (indexf < 0)
+    {
+        fprintf_light_red(stderr, "Error opening index file to get MD "
+                                  "filter.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (qemu_load_md_filter(indexf, bits))
+    {
+        fprintf_light_red(stderr, "Error getting MD filter from BSON file.\n");
+        *bits = bitarray_init(5242880);
+        if (*bits)
+            bitarray_set_all(*bits);
+    }
+
+    check_syscall(close(indexf));
+
+    if (*bits == NULL)
+    {
+        fprintf_light_red(stderr, "Bitarray is NULL!\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* epoll only takes FIFOs, sockets and character devices; the fd is made
+ * non-blocking so one idle or half-written stream cannot stall the rest */
+int set_pollable(char* spec, int fd)
+{
+    struct stat st;
+    int flags;
+
+    if (fstat(fd, &st))
+    {
+        fprintf_light_red(stderr, "Error inspecting stream: %s\n", spec);
+        return EXIT_FAILURE;
+    }
+
+    if (!S_ISFIFO(st.st_mode) && !S_ISSOCK(st.st_mode) &&
+        !S_ISCHR(st.st_mode))
+    {
+        fprintf_light_red(stderr, "%s is not a FIFO, socket or pipe; -M "
+                                  "cannot poll it.\n", spec);
+        return EXIT_FAILURE;
+    }
+
+    if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+    {
+        fprintf_light_red(stderr, "Error making stream non-blocking: %s\n",
+                                  spec);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* a stream is "-" for stdin, unix:<path> for a socket to listen on, or a
+ * file or FIFO path; sockets are connected later so *fd is left at -1.
+ * pollable streams (-M) are opened non-blocking and must suit epoll */
+int open_source(char* spec, int* fd, int* listen_fd, bool pollable)
+{
+    struct sockaddr_un addr;
+
+    *fd = -1;
+    *listen_fd = -1;
+
+    fprintf_cyan(stdout, "Attaching to stream: %s\n\n", spec);
+
+    if (strcmp(spec, "-") == 0)
+    {
+        *fd = STDIN_FILENO;
+        return pollable ? set_pollable(spec, *fd) : EXIT_SUCCESS;
+    }
+
+    if (strncmp(spec, STREAM_UNIX_PREFIX, strlen(STREAM_UNIX_PREFIX)))
+    {
+        /* O_NONBLOCK also keeps a FIFO open from waiting for its writer */
+        *fd = open(spec, pollable ? O_RDONLY | O_NONBLOCK : O_RDONLY);
+        if (*fd == -1)
         {
-            read_ret  = read(fd, (uint8_t*) &write.data[total],
-                             write.header.nb_sectors*SECTOR_SIZE - total);
-            total += read_ret;
+            fprintf_light_red(stderr, "Error opening stream file. "
+                                      "Does it exist?\n");
+            return EXIT_FAILURE;
         }
 
-        if (read_ret <= 0)
+        if (pollable && set_pollable(spec, *fd))
         {
-            fprintf_light_red(stderr, "Stream ended while reading sector "
-                                      "data.\n");
+            close(*fd);
+            *fd = -1;
             return EXIT_FAILURE;
         }
 
-        /* the mountain of things i still regret ! */
-        if (redis_async_write_enqueue(handle, bits, write.header.sector_num,
-                                  write.data, len))
-            fprintf_light_red(stderr, "\tqueue would block: dropping write\n");
+        return EXIT_SUCCESS;
+    }
 
-        gettimeofday(&end, NULL);
-        fprintf(stderr, "[%"PRIu64"]read_loop finished in %"PRIu64
-                        " microseconds [%d bytes]\n", counter++,
-                        diff_time(start, end),
-                        write.header.nb_sectors*SECTOR_SIZE);
+    spec += strlen(STREAM_UNIX_PREFIX);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(spec) >= sizeof(addr.sun_path))
+    {
+        fprintf_light_red(stderr, "Socket path too long: %s\n", spec);
+        return EXIT_FAILURE;
     }
 
-    if (write.data)
-        free(write.data);
+    strcpy(addr.sun_path, spec);
+    unlink(spec);
 
-    if (bits)
-        bitarray_destroy(bits);
+    if ((*listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(*listen_fd, (struct sockaddr*) &addr, sizeof(addr)) ||
+        listen(*listen_fd, 1))
+    {
+        fprintf_light_red(stderr, "Error listening on socket: %s\n", spec);
+        if (*listen_fd >= 0)
+            close(*listen_fd);
+        *listen_fd = -1;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
 
-/* main thread of execution */
-int main(int argc, char* args[])
+void close_vm_stream(int epfd, struct vm_stream* vm)
 {
-    int fd;
-    char* index, *db, *stream;
-    int indexf;
-    struct bitarray* bits;
+    if (vm->window)
+        flush_window(vm->window, &(vm->sink));
 
-    fprintf_blue(stdout, "gammaray Async Queuer -- "
-                         "By: Wolfgang Richter "
-                         "<wolf@cs.cmu.edu>\n");
-    redis_print_version();
+    if (vm->stream && qemu_stream_buffered(vm->stream))
+        fprintf_light_red(stderr, "[%s] Stream ended while reading sector "
+                                  "data.\n", vm->name);
+
+    fprintf_light_red(stderr, "[%s] Total writes: %"PRIu64".\n", vm->name,
+                              vm->counter);
 
-    if (argc < 4)
+    if (vm->fd >= 0)
     {
-        fprintf_light_red(stderr, "Usage: %s <index file> <stream file>"
-                                  " <redis db num>\n", args[0]);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, vm->fd, NULL);
+        if (vm->fd != STDIN_FILENO)
+            close(vm->fd);
+        vm->fd = -1;
+    }
+
+    if (vm->listen_fd >= 0)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, vm->listen_fd, NULL);
+        close(vm->listen_fd);
+        vm->listen_fd = -1;
+    }
+
+    qemu_stream_destroy(vm->stream);
+    vm->stream = NULL;
+}
+
+/* first connection on a listening socket becomes the VM's stream */
+int accept_vm_stream(int epfd, struct vm_stream* vm)
+{
+    struct epoll_event event;
+
+    if ((vm->fd = accept(vm->listen_fd, NULL, NULL)) < 0 ||
+        set_pollable(vm->name, vm->fd))
         return EXIT_FAILURE;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, vm->listen_fd, NULL);
+    close(vm->listen_fd);
+    vm->listen_fd = -1;
+
+    vm->stream = qemu_stream_init(vm->fd, QEMU_STREAM_DEFAULT_BUFSIZE);
+
+    if (vm->stream == NULL)
+        return EXIT_FAILURE;
+
+    event.events = EPOLLIN;
+    event.data.ptr = vm;
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, vm->fd, &event) ? EXIT_FAILURE :
+                                                            EXIT_SUCCESS;
+}
+
+/* one thread multiplexes every VM; per-stream state is just its buffer and
+ * optional coalescing window */
+int multi_read_loop(int epfd, struct vm_stream* vms, size_t nvms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct vm_stream* vm;
+    uint64_t batch, batch_bytes;
+    int64_t remaining;
+    size_t active = nvms, i;
+    ssize_t readb;
+    int timeout, n, j;
+
+    while (active)
+    {
+        /* wake for the earliest coalescing deadline */
+        timeout = -1;
+
+        for (i = 0; i < nvms; i++)
+        {
+            if (vms[i].window &&
+                (remaining = coalesce_remaining(vms[i].window)) >= 0 &&
+                (timeout < 0 || (remaining + 999) / 1000 < timeout))
+                timeout = (int) ((remaining + 999) / 1000);
+        }
+
+        if ((n = epoll_wait(epfd, events, MAX_EVENTS, timeout)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            fprintf_light_red(stderr, "epoll_wait failed.\n");
+            return EXIT_FAILURE;
+        }
+
+        for (j = 0; j < n; j++)
+        {
+            vm = (struct vm_stream*) events[j].data.ptr;
+
+            if (vm->fd < 0)
+            {
+                if (accept_vm_stream(epfd, vm))
+                {
+                    fprintf_light_red(stderr, "[%s] Failed accepting "
+                                              "stream.\n", vm->name);
+                    close_vm_stream(epfd, vm);
+                    active--;
+                }
+                continue;
+            }
+
+            batch = 0;
+            batch_bytes = 0;
+
+            readb = qemu_stream_fill(vm->stream);
+
+            /* a wakeup with nothing to read is not the end of the stream */
+            if (readb < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                continue;
+
+            if (readb <= 0 ||
+                consume_writes(vm->stream, &(vm->sink), vm->window, &batch,
+                               &batch_bytes))
+            {
+                vm->counter += batch;
+                close_vm_stream(epfd, vm);
+                active--;
+                continue;
+            }
+
+            vm->counter += batch;
+        }
+
+        for (i = 0; i < nvms; i++)
+        {
+            if (vms[i].window && coalesce_ready(vms[i].window))
+                flush_window(vms[i].window, &(vms[i].sink));
+        }
     }
 
-    index = args[1];
-    stream = args[2];
-    db = args[3];
+    return EXIT_SUCCESS;
+}
 
-    /* ----------------- hiredis ----------------- */
-    struct kv_store* handle = redis_init(db, true);
-    if (handle == NULL)
+int multi_main(char* args[], size_t nargs, size_t npipes, size_t spill_mem,
+               char* spill_path, size_t spill_disk, uint64_t window_ms,
+               uint64_t window_bytes)
+{
+    struct kv_store** handles;
+    struct vm_stream* vms;
+    struct kv_spec spec;
+    struct epoll_event event;
+    size_t nvms = nargs / 3, i;
+    int epfd, ret = EXIT_FAILURE;
+
+    if (npipes > nvms)
+        npipes = nvms;
+
+    handles = (struct kv_store**) calloc(npipes, sizeof(struct kv_store*));
+    vms = (struct vm_stream*) calloc(nvms, sizeof(struct vm_stream));
+
+    if (handles == NULL || vms == NULL || (epfd = epoll_create1(0)) < 0)
     {
-        fprintf_light_red(stderr, "Failed getting Redis context "
-                                  "(connection failure?).\n");
+        fprintf_light_red(stderr, "Failed allocating stream state.\n");
+        free(handles);
+        free(vms);
         return EXIT_FAILURE;
     }
 
-    fprintf_cyan(stdout, "Loading MD filter from: %s\n\n", index);
-    indexf = open(index, O_RDONLY | O_NOATIME); 
+    for (i = 0; i < nvms; i++)
+    {
+        vms[i].fd = -1;
+        vms[i].listen_fd = -1;
+    }
 
-    if (indexf < 0)
+    /* ----------------- hiredis ----------------- */
+    for (i = 0; i < npipes; i++)
     {
-        fprintf_light_red(stderr, "Error opening index file to get MD "
-                                  "filter.\n");
-        return EXIT_FAILURE;
+        handles[i] = redis_init(args[i * 3 + 2], true);
+        if (handles[i] == NULL)
+        {
+            fprintf_light_red(stderr, "Failed getting Redis context "
+                                      "(connection failure?).\n");
+            break;
+        }
+
+        if (redis_spill_configure(handles[i], spill_mem, spill_path,
+                                  spill_disk))
+        {
+            fprintf_light_red(stderr, "Failed configuring spill queue.\n");
+            break;
+        }
     }
 
-    if (qemu_load_md_filter(indexf, &bits))
+    if (i < npipes)
+        nvms = 0;
+
+    for (i = 0; i < nvms; i++)
     {
-        fprintf_light_red(stderr, "Error getting MD filter from BSON file.\n");
-        bits = bitarray_init(5242880);
-        bitarray_set_all(bits);
+        vms[i].name = args[i * 3 + 1];
+        vms[i].sink.handle = handles[i % npipes];
+        if (kv_spec_parse(args[i * 3 + 2], &spec))
+        {
+            fprintf_light_red(stderr, "Bad connection spec: %s\n",
+                                      args[i * 3 + 2]);
+            break;
+        }
+
+        strcpy(vms[i].sink.db, spec.db);
+
+        if (load_md_filter(args[i * 3], &(vms[i].sink.bits)) ||
+            open_source(args[i * 3 + 1], &(vms[i].fd), &(vms[i].listen_fd),
+                        true))
+            break;
+
+        if (vms[i].fd >= 0 &&
+            (vms[i].stream = qemu_stream_init(vms[i].fd,
+                                              QEMU_STREAM_DEFAULT_BUFSIZE))
+            == NULL)
+        {
+            fprintf_light_red(stderr, "Failed initial alloc for stream "
+                                      "buffer.\n");
+            break;
+        }
+
+        if (window_ms &&
+            (vms[i].window = coalesce_init(window_ms * 1000, window_bytes))
+            == NULL)
+        {
+            fprintf_light_red(stderr, "Failed allocating coalescing "
+                                      "window.\n");
+            break;
+        }
+
+        event.events = EPOLLIN;
+        event.data.ptr = &(vms[i]);
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, vms[i].fd >= 0 ? vms[i].fd :
+                                                            vms[i].listen_fd,
+                      &event))
+        {
+            fprintf_light_red(stderr, "Failed polling stream: %s\n",
+                                      vms[i].name);
+            break;
+        }
+
+        fprintf_cyan(stdout, "VM db %s: stream %s on pipeline %zu\n\n",
+                             vms[i].sink.db, vms[i].name, i % npipes);
     }
 
-    if (bits == NULL)
+    if (nvms && i == nvms)
+        ret = multi_read_loop(epfd, vms, nvms);
+
+    for (i = 0; i < nargs / 3; i++)
     {
-        fprintf_light_red(stderr, "Bitarray is NULL!\n");
+        if (vms[i].stream || vms[i].fd >= 0 || vms[i].listen_fd >= 0)
+            close_vm_stream(epfd, &(vms[i]));
+        coalesce_destroy(vms[i].window);
+        if (vms[i].sink.bits)
+            bitarray_destroy(vms[i].sink.bits);
+    }
+
+    for (i = 0; i < npipes; i++)
+    {
+        if (handles[i])
+        {
+            print_spill_stats(handles[i]);
+            print_flush_stats(handles[i]);
+            redis_shutdown(0, handles[i]);
+        }
+    }
+
+    close(epfd);
+    free(handles);
+    free(vms);
+
+    return ret;
+}
+
+/* main thread of execution */
+int main(int argc, char* args[])
+{
+    int fd, listen_fd, opt, ret;
+    char* index, *db, *stream, *ring_name = NULL, *spill_path = NULL;
+    size_t spill_mem = SPILLQ_DEFAULT_MEM_BUDGET, spill_disk = 0;
+    size_t npipes = 1;
+    uint64_t window_ms = 0, window_bytes = COALESCE_DEFAULT_BYTES;
+    struct coalescer* window = NULL;
+    struct write_sink sink;
+    bool multi = false;
+    struct bitarray* bits;
+    struct kv_store* handle = NULL;
+    struct shmring* ring = NULL;
+    struct kv_spec spec;
+
+    fprintf_blue(stdout, "gammaray Async Queuer -- "
+                         "By: Wolfgang Richter "
+                         "<wolf@cs.cmu.edu>\n");
+    redis_print_version();
+
+    while ((opt = getopt(argc, args, "r:m:s:d:w:b:Mp:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'M':
+                multi = true;
+                break;
+            case 'p':
+                npipes = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                ring_name = optarg;
+                break;
+            case 'm':
+                spill_mem = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 's':
+                spill_path = optarg;
+                break;
+            case 'd':
+                spill_disk = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'w':
+                window_ms = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                window_bytes = strtoull(optarg, NULL, 10) << 10;
+                break;
+            default:
+                fprintf_light_red(stderr, USAGE, args[0], args[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind < 3 ||
+        (multi && ((argc - optind) % 3 || ring_name || npipes == 0)))
+    {
+        fprintf_light_red(stderr, USAGE, args[0], args[0]);
         return EXIT_FAILURE;
     }
 
-    check_syscall(close(indexf));
+    if (multi)
+        return multi_main(&(args[optind]), argc - optind, npipes, spill_mem,
+                          spill_path, spill_disk, window_ms, window_bytes);
 
-    fprintf_cyan(stdout, "Attaching to stream: %s\n\n", stream);
+    index = args[optind];
+    stream = args[optind + 1];
+    db = args[optind + 2];
 
-    on_exit((void (*) (int, void *)) redis_shutdown, handle);
+    if (kv_spec_parse(db, &spec))
+    {
+        fprintf_light_red(stderr, "Bad connection spec: %s\n", db);
+        return EXIT_FAILURE;
+    }
 
-    if (strcmp(stream, "-") != 0)
+    if (ring_name)
     {
-        fd = open(stream, O_RDONLY);
+        /* ----------------- shared ring ----------------- */
+        fprintf_cyan(stdout, "Attaching to shared ring: %s\n\n", ring_name);
+        ring = shmring_open(ring_name, SHMRING_DEFAULT_SIZE);
+        if (ring == NULL)
+        {
+            fprintf_light_red(stderr, "Failed attaching to shared ring.\n");
+            return EXIT_FAILURE;
+        }
     }
     else
     {
-        fd = STDIN_FILENO;
+        /* ----------------- hiredis ----------------- */
+        handle = redis_init(db, true);
+        if (handle == NULL)
+        {
+            fprintf_light_red(stderr, "Failed getting Redis context "
+                                      "(connection failure?).\n");
+            return EXIT_FAILURE;
+        }
+
+        if (redis_spill_configure(handle, spill_mem, spill_path, spill_disk))
+        {
+            fprintf_light_red(stderr, "Failed configuring spill queue.\n");
+            return EXIT_FAILURE;
+        }
+
+        on_exit((void (*) (int, void *)) redis_shutdown, handle);
     }
-    
-    if (fd == -1)
-    {
-        fprintf_light_red(stderr, "Error opening stream file. "
-                                  "Does it exist?\n");
+
+    if (load_md_filter(index, &bits))
+        return EXIT_FAILURE;
+
+    if (open_source(stream, &fd, &listen_fd, false))
         return EXIT_FAILURE;
+
+    /* a single socket stream simply waits for its one connection */
+    if (listen_fd >= 0)
+    {
+        fd = accept(listen_fd, NULL, NULL);
+        close(listen_fd);
+
+        if (fd < 0)
+        {
+            fprintf_light_red(stderr, "Error accepting stream connection.\n");
+            return EXIT_FAILURE;
+        }
     }
 
-    read_loop(fd, handle, bits);
+    if (window_ms)
+    {
+        fprintf_cyan(stdout, "Coalescing writes over %"PRIu64" ms / %"PRIu64
+                             " byte windows\n\n", window_ms, window_bytes);
+        window = coalesce_init(window_ms * 1000, window_bytes);
+        if (window == NULL)
+        {
+            fprintf_light_red(stderr, "Failed allocating coalescing "
+                                      "window.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    sink.handle = handle;
+    sink.ring = ring;
+    sink.bits = bits;
+    strcpy(sink.db, spec.db);
+    timerclear(&(sink.md_polled));
+
+    ret = read_loop(fd, &sink, window);
     close(fd);
-    return EXIT_SUCCESS;
+
+    coalesce_destroy(window);
+    bitarray_destroy(bits);
+
+    shmring_release(ring, ring_name);
+
+    return ret;
 }
@@ -22,13 +22,16 @@
  *   See the License for the specific language governing permissions and     *
  *   limitations under the License.                                          *
  *****************************************************************************/
+#include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "qemu_common.h"
 
 #include "bson.h"
-#include "color.h"
+#include "log.h"
 
 int qemu_load_md_filter(int index, struct bitarray** bits)
 {
@@ -42,26 +45,26 @@ int qemu_load_md_filter(int index, struct bitarray** bits)
         
         if (strcmp(value1.key, "type") != 0)
         {
-            fprintf_light_red(stderr, "Document missing 'type' field.\n");
+            log_error("Document missing 'type' field.\n");
             break;
         }
        
         if (strcmp(value1.data, "metadata_filter") == 0)
         {
-            fprintf_light_yellow(stdout, "-- Deserializing a bitarray record "
-                                         "--\n");
+            log_debug("-- Deserializing a bitarray record --\n");
             if (bson_deserialize(bson, &value1, &value2) != 1)
                 return EXIT_FAILURE;
 
             if (strcmp(value1.key, "bitarray") == 0)
             {
+                /* the serialized size is in bytes, the length in bits */
                 *bits = bitarray_init_data((uint8_t*) value1.data,
-                                           value1.size);
+                                           (uint64_t) value1.size * 8);
                 return EXIT_SUCCESS;
             }
             else
             {
-                fprintf_light_red(stderr, "Unexpected field in MD record.\n");
+                log_error("Unexpected field in MD record.\n");
                 break;
             }
         }
@@ -74,3 +77,180 @@ void qemu_parse_header(uint8_t* event_stream, struct qemu_bdrv_write* write)
 {
     write->header = *((struct qemu_bdrv_write_header*) event_stream);
 }
+
+/* records handed out by qemu_stream_parse() point directly into buf, they
+ * stay valid until the next call to qemu_stream_fill() */
+struct qemu_stream
+{
+    int fd;
+    uint8_t* buf;
+    size_t size;
+    size_t start;
+    size_t end;
+    size_t need;
+};
+
+struct qemu_stream* qemu_stream_init(int fd, size_t bufsize)
+{
+    struct qemu_stream* stream = (struct qemu_stream*)
+                                 malloc(sizeof(struct qemu_stream));
+
+    if (stream == NULL)
+        return NULL;
+
+    if (bufsize < QEMU_HEADER_SIZE)
+        bufsize = QEMU_STREAM_DEFAULT_BUFSIZE;
+
+    stream->buf = (uint8_t*) malloc(bufsize);
+
+    if (stream->buf == NULL)
+    {
+        free(stream);
+        return NULL;
+    }
+
+    stream->fd = fd;
+    stream->size = bufsize;
+    stream->start = 0;
+    stream->end = 0;
+    stream->need = QEMU_HEADER_SIZE;
+
+    return stream;
+}
+
+ssize_t qemu_stream_fill(struct qemu_stream* stream)
+{
+    ssize_t ret;
+    uint8_t* buf;
+    size_t len = stream->end - stream->start;
+
+    /* only the partial record at the tail is ever moved */
+    if (stream->start)
+    {
+        if (len)
+            memmove(stream->buf, &(stream->buf[stream->start]), len);
+        stream->start = 0;
+        stream->end = len;
+    }
+
+    /* a single record larger than the whole buffer */
+    if (stream->need > stream->size)
+    {
+        buf = (uint8_t*) realloc(stream->buf, stream->need);
+
+        if (buf == NULL)
+        {
+            log_error("realloc() failed growing stream buffer to %zu "
+                      "bytes.\n", stream->need);
+            return -1;
+        }
+
+        stream->buf = buf;
+        stream->size = stream->need;
+    }
+
+    do
+    {
+        ret = read(stream->fd, &(stream->buf[stream->end]),
+                   stream->size - stream->end);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0)
+        stream->end += ret;
+
+    return ret;
+}
+
+int qemu_stream_wait(struct qemu_stream* stream, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = stream->fd, .events = POLLIN };
+    int ret;
+
+    do
+    {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -1 : (ret > 0);
+}
+
+int qemu_stream_parse(struct qemu_stream* stream,
+                      struct qemu_bdrv_write* write)
+{
+    size_t len = stream->end - stream->start;
+    size_t data_len;
+
+    if (len < QEMU_HEADER_SIZE)
+    {
+        stream->need = QEMU_HEADER_SIZE;
+        return 0;
+    }
+
+    qemu_parse_header(&(stream->buf[stream->start]), write);
+
+    if (write->header.nb_sectors <= 0 ||
+        ((size_t) write->header.nb_sectors) * SECTOR_SIZE >
+        QEMU_STREAM_MAX_WRITE)
+    {
+        log_error("Corrupt write header in stream (nb_sectors = %d).\n",
+                  write->header.nb_sectors);
+        return -1;
+    }
+
+    data_len = ((size_t) write->header.nb_sectors) * SECTOR_SIZE;
+
+    if (len < QEMU_HEADER_SIZE + data_len)
+    {
+        stream->need = QEMU_HEADER_SIZE + data_len;
+        return 0;
+    }
+
+    write->data = &(stream->buf[stream->start + QEMU_HEADER_SIZE]);
+    stream->start += QEMU_HEADER_SIZE + data_len;
+    stream->need = QEMU_HEADER_SIZE;
+
+    return 1;
+}
+
+int qemu_stream_next(struct qemu_stream* stream,
+                     struct qemu_bdrv_write* write)
+{
+    int ret;
+    ssize_t readb;
+
+    while ((ret = qemu_stream_parse(stream, write)) == 0)
+    {
+        readb = qemu_stream_fill(stream);
+
+        if (readb == 0)
+        {
+            if (stream->end - stream->start)
+            {
+                log_error("Stream ended with %zu bytes of a partial "
+                          "write.\n", stream->end - stream->start);
+                return -1;
+            }
+            return 0;
+        }
+
+        if (readb < 0)
+            return -1;
+    }
+
+    return ret;
+}
+
+size_t qemu_stream_buffered(struct qemu_stream* stream)
+{
+    return stream->end - stream->start;
+}
+
+void qemu_stream_destroy(struct qemu_stream* stream)
+{
+    if (stream)
+    {
+        if (stream->buf)
+            free(stream->buf);
+        free(stream);
+    }
+}
@@ -27,843 +27,2850 @@
 #include <pthread.h>
 #undef __USE_GNU
 #include <semaphore.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <event2/event.h>
+
 #include "hiredis.h"
+#include "async.h"
+#include "adapters/libevent.h"
 
+#include "kv_mem.h"
+#include "log.h"
+#include "mpscq.h"
+#include "pending_cache.h"
 #include "redis_queue.h"
+#include "spillq.h"
 #include "util.h"
 
-#define REDIS_DEFAULT_TIMEOUT 30 /* seconds; 5 minute */
-#define REDIS_DEFAULT_FLUSH_TICK 5 /* seconds; 5 */
-#define REDIS_DEFAULT_PIPELINED 16384 /* unitless; 16384 (4096*16384=64MB) */
-#define REDIS_DEFAULT_BYTES 262144000 /* bytes; 250 MiB */
+#define REDIS_DEFAULT_QUEUED_BYTES 262144000 /* bytes; 250 MiB to I/O thread */
+#define REDIS_FLUSH_MAX_AGE 100000 /* microseconds; a pipeline never idle */
+#define REDIS_FLUSH_IDLE_TICK 1000000 /* microseconds; nothing outstanding */
+#define REDIS_DB_MAX KV_SPEC_DB_MAX
+#define REDIS_SPILL_SELECT INT64_MIN /* spilled db switch, data is the db */
+#define REDIS_SPILL_WAIT 1000 /* microseconds; metadata behind a spill */
 
 #define REDIS_MD_FILTER_SET "SET metadata_filter %b"
 #define REDIS_MD_FILTER_GET "GET metadata_filter"
-#define REDIS_MD_FILTER_SETBIT "SETBIT metadata_filter %"PRIu64
+#define REDIS_MD_FILTER_SETBIT "SETBIT metadata_filter %"PRIu64" 1"
 #define REDIS_MD_FILTER_GETBIT "GETBIT metadata_filter %"PRIu64
+#define REDIS_MD_HOT_PUSH "RPUSH metadata_hot %"PRIu64
+#define REDIS_MD_HOT_GET "LRANGE metadata_hot 0 %d"
+#define REDIS_MD_HOT_TRIM "LTRIM metadata_hot %zu -1"
 
 #define REDIS_SECTOR_GET "GET sector:%"PRIu64
+#define REDIS_SECTOR_KEY "sector:%"PRIu64
+#define REDIS_SECTOR_KEY_MAX 32
+#define REDIS_HASH_KEY_MAX 64
 
-#define REDIS_DATA_INSERT "SET sector:%"PRIu64" "\
-                          "start:%"PRIu64":"\
-                          "end:%"PRIu64":"\
-                          "file:%"PRIu64
+#define REDIS_SECTOR_SET "SET sector:%"PRIu64" %b"
 
-#define REDIS_ENQUEUE_WRITE "SETEX qsector:%"PRIu64" %d %b"
-#define REDIS_DEQUEUE_WRITE "GET qsector:%"PRIu64
-#define REDIS_DEL_WRITE "DEL qsector:%"PRIu64
 
 #define REDIS_PUBLISH "PUBLISH %s %b"
 
+#define REDIS_ASYNC_QUEUE_KEY "writequeue"
+
+/* server-side scripts: each is loaded once per store and run by digest, so
+ * a compound update costs one round trip and is applied atomically */
+#define REDIS_SCRIPT_LOAD "SCRIPT LOAD %s"
+#define REDIS_SCRIPT_SHA_LEN 40
+#define REDIS_SCRIPT_ARGS_MAX (2 * REDIS_HASH_FIELDS_MAX + 8)
+#define REDIS_NOSCRIPT "NOSCRIPT"
+#define REDIS_ID_MAX 21 /* decimal uint64_t and NUL */
+
+enum REDIS_SCRIPT
+{
+    REDIS_SCRIPT_POP_BATCH,
+    REDIS_SCRIPT_FILE_CREATE,
+    REDIS_SCRIPT_FILE_DELETE,
+    REDIS_SCRIPT_FILE_RENAME,
+    REDIS_SCRIPT_MAX
+};
+
+/* pops up to ARGV[1] complete (sector, data) pairs from the old end of the
+ * write queue; a trailing unpaired sector is left for the next call */
+#define REDIS_ASYNC_QUEUE_POP_BATCH_SCRIPT \
+    "local n = tonumber(ARGV[1]) * 2 " \
+    "local len = redis.call('LLEN', KEYS[1]) " \
+    "len = len - (len % 2) " \
+    "if len > n then len = n end " \
+    "if len == 0 then return {} end " \
+    "local items = redis.call('LRANGE', KEYS[1], -len, -1) " \
+    "redis.call('LTRIM', KEYS[1], 0, -len - 1) " \
+    "return items"
+
+/* ARGV: inode number, files list id, path, then field/value pairs; the new
+ * file id is returned */
+#define REDIS_FILE_CREATE_SCRIPT \
+    "local id = redis.call('INCR', 'fcounter') " \
+    "local file = 'file:' .. id " \
+    "redis.call('HMSET', file, 'path', ARGV[3], unpack(ARGV, 4)) " \
+    "redis.call('RPUSH', 'files:' .. ARGV[2], file) " \
+    "redis.call('RPUSH', 'inode:' .. ARGV[1], file) " \
+    "redis.call('SET', 'path:' .. ARGV[3], id) " \
+    "return id"
+
+/* ARGV: file id, inode number, files list id, path; the file's blocks and
+ * extents are released only with its last link.  The first element returned
+ * is 1 if they were, the sectors whose descriptors went with them follow.
+ * Sector values are packed descriptors, 1 and 8 are SECTOR_PTR_FILE_DATA and
+ * SECTOR_PTR_DIRDATA */
+#define REDIS_FILE_DELETE_SCRIPT \
+    "local id = ARGV[1] " \
+    "local file = 'file:' .. id " \
+    "local inode = 'inode:' .. ARGV[2] " \
+    "local released = { 0 } " \
+    "redis.call('LREM', inode, 0, file) " \
+    "redis.call('LREM', 'files:' .. ARGV[3], 0, file) " \
+    "if redis.call('GET', 'path:' .. ARGV[4]) == id then " \
+    "  redis.call('DEL', 'path:' .. ARGV[4]) " \
+    "end " \
+    "if redis.call('LLEN', inode) == 0 then " \
+    "  released[1] = 1 " \
+    "  local owner = tonumber(id) " \
+    "  for _, sector in ipairs(redis.call('LRANGE', 'filesectors:' .. id, " \
+    "                                     0, -1)) do " \
+    "    local target = redis.call('GET', sector) " \
+    "    if target and #target == 28 then " \
+    "      local kind, object = struct.unpack('<i4I8', target) " \
+    "      if kind == 8 then " \
+    "        redis.call('DEL', sector, 'dirdata:' .. object, " \
+    "                   'dirlist:' .. object) " \
+    "        table.insert(released, tonumber(string.sub(sector, 8))) " \
+    "      elseif kind == 1 and object == owner then " \
+    "        redis.call('DEL', sector) " \
+    "        table.insert(released, tonumber(string.sub(sector, 8))) " \
+    "      end " \
+    "    end " \
+    "  end " \
+    "  for _, extent in ipairs(redis.call('LRANGE', 'extents:' .. id, " \
+    "                                     0, -1)) do " \
+    "    redis.call('DEL', extent, 'sector:' .. string.sub(extent, 8)) " \
+    "    table.insert(released, tonumber(string.sub(extent, 8))) " \
+    "  end " \
+    "end " \
+    "redis.call('DEL', file, 'filesectors:' .. id, 'extents:' .. id) " \
+    "return released"
+
+/* ARGV: file id, old path, new path; a directory's subtree, found through
+ * its dirlist entries (raw inode number then name), moves along with it and
+ * the number of files renamed is returned */
+#define REDIS_FILE_RENAME_SCRIPT \
+    "local old, new = ARGV[2], ARGV[3] " \
+    "local stack, seen, renamed = { ARGV[1] }, {}, 0 " \
+    "while #stack > 0 do " \
+    "  local id = table.remove(stack) " \
+    "  local file = 'file:' .. id " \
+    "  local fields = redis.call('HMGET', file, 'path', 'is_dir') " \
+    "  local path = fields[1] " \
+    "  if not seen[id] and path and string.sub(path, 1, #old) == old and " \
+    "     (#path == #old or string.sub(path, #old + 1, #old + 1) == '/') " \
+    "  then " \
+    "    local moved = new .. string.sub(path, #old + 1) " \
+    "    seen[id] = true " \
+    "    renamed = renamed + 1 " \
+    "    redis.call('HSET', file, 'path', moved) " \
+    "    if redis.call('GET', 'path:' .. path) == id then " \
+    "      redis.call('DEL', 'path:' .. path) " \
+    "    end " \
+    "    redis.call('SET', 'path:' .. moved, id) " \
+    "    if fields[2] and string.byte(fields[2]) == 1 then " \
+    "      for _, sector in ipairs(redis.call('LRANGE', 'filesectors:' .. " \
+    "                                         id, 0, -1)) do " \
+    "        for _, dentry in ipairs(redis.call('LRANGE', 'dirlist:' .. " \
+    "                                           string.sub(sector, 8), " \
+    "                                           0, -1)) do " \
+    "          local name = string.sub(dentry, 9) " \
+    "          if name ~= '.' and name ~= '..' then " \
+    "            local inode = struct.unpack('<I8', dentry) " \
+    "            for _, child in ipairs(redis.call('LRANGE', 'inode:' .. " \
+    "                                              inode, 0, -1)) do " \
+    "              table.insert(stack, string.sub(child, 6)) " \
+    "            end " \
+    "          end " \
+    "        end " \
+    "      end " \
+    "    end " \
+    "  end " \
+    "end " \
+    "return renamed"
+
 #define REDIS_FCOUNTER "INCR fcounter"
 #define REDIS_FCOUNTER_SET "SET fcounter %"PRIu64
 
+/* the file scripts' steps as plain commands, for the embedded engine */
+#define REDIS_FILE_PATH_SET "HSET file:%"PRIu64" path %b"
+#define REDIS_FILE_PATH_FIELDS "HMGET file:%"PRIu64" path is_dir"
+#define REDIS_FILE_RECORD_DELETE "DEL file:%"PRIu64" filesectors:%"PRIu64 \
+                                 " extents:%"PRIu64
+#define REDIS_INODE_REMOVE "LREM inode:%"PRIu64" 0 file:%"PRIu64
+#define REDIS_FILES_REMOVE "LREM files:%"PRIu64" 0 file:%"PRIu64
+#define REDIS_PATH_DELETE "DEL path:%b"
+#define REDIS_KEY_GET "GET %b"
+#define REDIS_KEY_DELETE "DEL %b"
+#define REDIS_DIR_DELETE "DEL %b dirdata:%"PRIu64" dirlist:%"PRIu64
+#define REDIS_EXTENT_DELETE "DEL %b sector:%b"
+#define REDIS_DIR_FILES_LGET_KEY "LRANGE dirlist:%b 0 -1"
+#define REDIS_EXTENT_PREFIX "extent:"
+#define REDIS_SECTOR_PREFIX "sector:"
+
 /***** Helper Functions, not exposed *****/
-struct thread_job
+struct kv_conn;
+
+static const char* redis_scripts[REDIS_SCRIPT_MAX] = {
+    REDIS_ASYNC_QUEUE_POP_BATCH_SCRIPT,
+    REDIS_FILE_CREATE_SCRIPT,
+    REDIS_FILE_DELETE_SCRIPT,
+    REDIS_FILE_RENAME_SCRIPT
+};
+
+/* the transport underneath every redis_* call; commands are formatted and
+ * replies parsed by hiredis for both backends */
+struct kv_backend
 {
-    struct kv_store* handle;
-    uint64_t cmds_to_process;
+    int (*vappend)(struct kv_conn* conn, const char* fmt, va_list ap);
+    int (*append_argv)(struct kv_conn* conn, int argc, const char** argv,
+                       const size_t* argvlen);
+    int (*get_reply)(struct kv_conn* conn, void** reply);
+    void (*close)(struct kv_conn* conn);
 };
 
-struct kv_store
+/* a connection belongs to the thread that opened it; only redis_shutdown
+ * touches another thread's connection, once that thread is done with it */
+struct kv_conn
 {
+    struct kv_conn* next;
+    const struct kv_backend* backend;
     redisContext* connection;
+    struct kv_mem* mem;
+    int mem_db;
+    redisReader* reader;
     uint64_t outstanding_pipelined_cmds;
     size_t outstanding_bytes;
-    pthread_mutex_t flush_lock;
-    pthread_mutex_t conn_lock;
-    pthread_mutex_t cmd_lock;
+    struct timeval oldest; /* when the oldest outstanding command went out */
+    char selected[REDIS_DB_MAX];
+};
+
+/* an asynchronous write on its way to the I/O thread */
+struct kv_write
+{
+    struct mpscq_node node;
+    int64_t sector;
+    uint8_t* data;
+    size_t len;
+    char db[REDIS_DB_MAX];
+};
+
+/* synchronous calls run on a per-thread connection from the pool, so
+ * threads sharing a store never wait on each other; asynchronous writes
+ * are handed to the I/O thread through a lock-free queue and only the I/O
+ * thread ever waits on their replies */
+struct kv_store
+{
+    const struct kv_backend* backend;
+    struct kv_spec spec;
+    pthread_key_t conn_key;
+    pthread_mutex_t pool_lock;
+    struct kv_conn* pool;
+    struct mpscq* writes;
+    sem_t pending;
+    uint64_t queued_bytes;
+    uint64_t spilled;
+    pthread_mutex_t spill_lock;
+    struct spillq* spill;
+    char spill_db[REDIS_DB_MAX];
+    struct kv_conn* io;
+    pthread_t io_thread;
+    bool io_running;
     bool shutdown;
-    sem_t thread_counter;
+    uint64_t max_cmds;
+    uint64_t max_bytes;
+    uint64_t deadline;
+    struct redis_flush_stats stats;
+    char scripts[REDIS_SCRIPT_MAX][REDIS_SCRIPT_SHA_LEN + 1];
+    struct pending_cache* pending_writes;
 };
 
-int check_redis_return(struct kv_store* handle, redisReply* reply)
+/* lookups from one thread issued back to back on their own connection and
+ * completed by callbacks from its event loop; without a connection (the
+ * embedded engine, or after a disconnect) each completes as it is issued */
+struct kv_async
 {
-    if (reply == NULL || ((int64_t) reply) == REDIS_ERR)
-    {
-        switch(handle->connection->err)
-        {
-            case REDIS_ERR_IO:
-                break;
-            case REDIS_ERR_EOF:
-                break;
-            case REDIS_ERR_PROTOCOL:
-                break;
-            case REDIS_ERR_OTHER:
-                break;
-            default:
-                break;
-        };
-        return EXIT_FAILURE;
-    }
-    
-    freeReplyObject(reply);
-    return EXIT_SUCCESS;
-}
+    struct kv_store* store;
+    struct event_base* eb;
+    redisAsyncContext* context;
+    uint64_t outstanding;
+};
 
-int redis_select(struct kv_store* handle, char* db)
+enum KV_ASYNC_REQUEST
 {
-    redisReply* reply;
-    reply = redisCommand(handle->connection, "SELECT %s", db);
-    return check_redis_return(handle, reply);
-}
+    KV_ASYNC_FIELDS,
+    KV_ASYNC_FOREACH,
+    KV_ASYNC_INTEGER
+};
 
-int redis_flush_pipeline(struct kv_store* handle)
+struct kv_async_request
 {
-    redisReply* reply;
+    struct kv_async* async;
+    enum KV_ASYNC_REQUEST type;
+    struct redis_hash_field* fields;
+    size_t count;
+    redis_list_callback each;
+    void* each_arg;
+    uint64_t* integer;
+    redis_async_callback callback;
+    void* arg;
+};
 
-    while (handle->outstanding_pipelined_cmds)
-    {
-        redisGetReply(handle->connection, (void**) &reply);
-        if(check_redis_return(handle, reply))
-        {
-            return EXIT_FAILURE;
-        }
-        handle->outstanding_pipelined_cmds--;
-    }
+/* one embedded engine per process, shared by every connection opened on it */
+static struct kv_mem* mem_engine = NULL;
+static uint64_t mem_engine_refs = 0;
+static pthread_mutex_t mem_engine_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    return EXIT_SUCCESS;
+int redis_backend_vappend(struct kv_conn* conn, const char* fmt, va_list ap)
+{
+    return redisvAppendCommand(conn->connection, fmt, ap);
 }
 
-void* redis_flush_thread_pipeline(void* data)
+int redis_backend_append_argv(struct kv_conn* conn, int argc,
+                              const char** argv, const size_t* argvlen)
 {
-    struct thread_job* job = (struct thread_job*) data;
-    redisReply* reply;
-    struct timeval start, end;
-    pthread_mutex_lock(&(job->handle->flush_lock));
-    gettimeofday(&start, NULL);
+    return redisAppendCommandArgv(conn->connection, argc, argv, argvlen);
+}
 
-    while (job->cmds_to_process)
-    {
-        pthread_mutex_lock(&(job->handle->conn_lock));
-        redisGetReply(job->handle->connection, (void**) &reply);
-        if(check_redis_return(job->handle, reply))
-        {
-            fprintf(stderr, "ERROR FLUSHING\n");
-            //pthread_mutex_unlock(&(job->handle->flush_lock));
-            assert(false);
-        }
-        pthread_mutex_unlock(&(job->handle->conn_lock));
-        job->cmds_to_process--;
-    }
-    gettimeofday(&end, NULL);
-    fprintf(stderr, "redis_flush_pipeline finished in %"PRIu64
-                        " microseconds\n",
-                        diff_time(start, end));
-    sem_wait(&(job->handle->thread_counter));
-    pthread_mutex_unlock(&(job->handle->flush_lock));
-    free(job);
+int redis_backend_get_reply(struct kv_conn* conn, void** reply)
+{
+    return redisGetReply(conn->connection, reply);
+}
 
-    return EXIT_SUCCESS;
+void redis_backend_close(struct kv_conn* conn)
+{
+    if (conn->connection)
+        redisFree(conn->connection);
 }
 
-void * redis_periodic_flusher(void* data)
+/* commands run as soon as they are appended, the reader then holds their
+ * replies until the caller collects them */
+int mem_backend_execute(struct kv_conn* conn, char* cmd, int len)
 {
-    struct thread_job* job = NULL;
+    uint8_t* reply;
+    size_t reply_len;
+    int ret = REDIS_ERR;
 
-    while (!(((struct kv_store *) data)->shutdown))
+    if (len < 0)
+        return REDIS_ERR;
+
+    if (kv_mem_execute(conn->mem, &(conn->mem_db), (uint8_t*) cmd, len,
+                       &reply, &reply_len) == EXIT_SUCCESS)
     {
-        fprintf(stderr, "PERIODIC FLUSHER RUNNING.\n");
-        sleep(REDIS_DEFAULT_FLUSH_TICK);
-        job = (struct thread_job*) malloc(sizeof(struct thread_job));
-        job->handle = (struct kv_store*) data;
+        ret = redisReaderFeed(conn->reader, (char*) reply, reply_len);
+        free(reply);
+    }
 
-        pthread_mutex_lock(&(job->handle->cmd_lock));
-        job->cmds_to_process = job->handle->outstanding_pipelined_cmds;
-        job->handle->outstanding_pipelined_cmds = 0;
-        pthread_mutex_unlock(&(job->handle->cmd_lock));
+    free(cmd);
 
-        sem_post(&(job->handle->thread_counter));
+    return ret;
+}
 
-        redis_flush_thread_pipeline(job);
-    }
+int mem_backend_vappend(struct kv_conn* conn, const char* fmt, va_list ap)
+{
+    char* cmd = NULL;
+    int len = redisvFormatCommand(&cmd, fmt, ap);
 
-    return EXIT_SUCCESS;
+    return mem_backend_execute(conn, cmd, len);
 }
 
-/***** Core API *****/
-void redis_print_version()
+int mem_backend_append_argv(struct kv_conn* conn, int argc,
+                            const char** argv, const size_t* argvlen)
 {
-    fprintf(stdout, "Current libhiredis version is %d.%d.%d\n", HIREDIS_MAJOR,
-                                                                HIREDIS_MINOR,
-                                                                HIREDIS_PATCH);
+    char* cmd = NULL;
+    int len = redisFormatCommandArgv(&cmd, argc, argv, argvlen);
+
+    return mem_backend_execute(conn, cmd, len);
 }
 
-struct kv_store* redis_init(char* db, bool background_flush)
+int mem_backend_get_reply(struct kv_conn* conn, void** reply)
 {
-    struct timeval timeout = { 1, 500000 };
-    struct kv_store* handle = (struct kv_store*)
-                              malloc(sizeof(struct kv_store));
-    pthread_t thread;
+    *reply = NULL;
 
-    if (handle)
-    {
-        handle->connection = redisConnectWithTimeout("127.0.0.1",
-                                                     6379, timeout);
-        if (handle->connection->err)
-        {
-            redisFree(handle->connection);
-            free(handle);
-            return NULL;
-        }
+    if (redisReaderGetReply(conn->reader, reply) != REDIS_OK ||
+        *reply == NULL)
+        return REDIS_ERR;
 
-       if (redis_select(handle, db))
-       {
-           redisFree(handle->connection);
-           free(handle);
-           return NULL;
-       }
+    return REDIS_OK;
+}
 
-        handle->outstanding_pipelined_cmds = 0;
-        handle->shutdown = false;
-        pthread_mutex_init(&(handle->flush_lock), NULL);
-        pthread_mutex_init(&(handle->conn_lock), NULL);
-        pthread_mutex_init(&(handle->cmd_lock), NULL);
-        sem_init(&(handle->thread_counter), 0, 0);
+void mem_backend_close(struct kv_conn* conn)
+{
+    if (conn->reader)
+        redisReaderFree(conn->reader);
 
-        if (background_flush)
-            pthread_create(&thread, NULL, redis_periodic_flusher, handle);
-    }
+    if (conn->mem == NULL)
+        return;
 
+    pthread_mutex_lock(&mem_engine_lock);
 
-    return handle;
+    if (--mem_engine_refs == 0)
+    {
+        kv_mem_save(mem_engine);
+        kv_mem_destroy(mem_engine);
+        mem_engine = NULL;
+    }
+
+    pthread_mutex_unlock(&mem_engine_lock);
 }
 
-int redis_enqueue_pipelined(struct kv_store* handle, uint64_t sector_num,
-                            const uint8_t* data, size_t len)
+static const struct kv_backend redis_backend = {
+    redis_backend_vappend,
+    redis_backend_append_argv,
+    redis_backend_get_reply,
+    redis_backend_close
+};
+
+static const struct kv_backend mem_backend = {
+    mem_backend_vappend,
+    mem_backend_append_argv,
+    mem_backend_get_reply,
+    mem_backend_close
+};
+
+int mem_backend_open(struct kv_conn* conn, const char* path)
 {
-    redisAppendCommand(handle->connection, REDIS_ENQUEUE_WRITE,
-                                           sector_num,
-                                           REDIS_DEFAULT_TIMEOUT,
-                                           data, len);
-    handle->outstanding_pipelined_cmds++;
+    pthread_mutex_lock(&mem_engine_lock);
+
+    if (mem_engine == NULL)
+        mem_engine = kv_mem_init(path);
+
+    if (mem_engine)
+        mem_engine_refs++;
+
+    conn->mem = mem_engine;
+    pthread_mutex_unlock(&mem_engine_lock);
+
+    if (conn->mem == NULL)
+        return EXIT_FAILURE;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
+    if ((conn->reader = redisReaderCreate()) == NULL)
     {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
+        mem_backend_close(conn);
+        return EXIT_FAILURE;
     }
+
     return EXIT_SUCCESS;
 }
 
-int redis_publish(struct kv_store* handle, char* channel, uint8_t* data,
-                  size_t len)
+int check_redis_return(struct kv_store* handle, redisReply* reply)
 {
-    redisReply* reply;
-    reply = redisCommand(handle->connection, REDIS_PUBLISH, channel, data,
-                                                                     len);
-    return check_redis_return(handle, reply);
+    if (reply == NULL || ((int64_t) reply) == REDIS_ERR)
+        return EXIT_FAILURE;
+    
+    freeReplyObject(reply);
+    return EXIT_SUCCESS;
 }
 
-int redis_dequeue(struct kv_store* handle, uint64_t sector_num, uint8_t* data,
-                  size_t* len)
+/* accounts for one more pipelined command awaiting its reply */
+void conn_pending(struct kv_conn* conn, size_t bytes)
 {
-    redisReply* reply;
-    reply = redisCommand(handle->connection, REDIS_DEQUEUE_WRITE, sector_num);
-    if (reply->type == REDIS_REPLY_STRING &&
-        reply->len > 0 &&
-        reply->len <= *len)
-    {
-        memcpy(data, reply->str, reply->len);
-        *len = reply->len;
-    }
-    else
-    {
-        *len = 0;
-    }
+    if (conn->outstanding_pipelined_cmds++ == 0)
+        gettimeofday(&(conn->oldest), NULL);
 
-    check_redis_return(handle, reply);
+    conn->outstanding_bytes += bytes;
+}
+
+/* appends one pipelined command, its reply is collected by conn_flush */
+int conn_append(struct kv_conn* conn, const char* fmt, ...)
+{
+    va_list ap;
+    int ret;
 
-    reply = redisCommand(handle->connection, REDIS_DEL_WRITE, sector_num);
+    va_start(ap, fmt);
+    ret = conn->backend->vappend(conn, fmt, ap);
+    va_end(ap);
 
-    return check_redis_return(handle, reply);
+    if (ret == REDIS_OK)
+        conn_pending(conn, 0);
+
+    return ret;
 }
 
-int redis_delqueue_pipelined(struct kv_store* handle, uint64_t sector_num)
+int conn_flush(struct kv_conn* conn)
 {
-    redisAppendCommand(handle->connection, REDIS_DEL_WRITE, sector_num);
-    handle->outstanding_pipelined_cmds++;
+    redisReply* reply;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
+    while (conn->outstanding_pipelined_cmds)
     {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
+        if (conn->backend->get_reply(conn, (void**) &reply) != REDIS_OK)
+            reply = NULL;
+
+        conn->outstanding_pipelined_cmds--;
+
+        if (check_redis_return(NULL, reply))
+            return EXIT_FAILURE;
     }
+
+    conn->outstanding_bytes = 0;
+
     return EXIT_SUCCESS;
 }
 
-int redis_reverse_pointer_set(struct kv_store* handle, const char* fmt,
-                              uint64_t src, int64_t dst)
+void* conn_command(struct kv_conn* conn, const char* fmt, ...)
 {
-    redisAppendCommand(handle->connection, fmt,
-                                           src,
-                                           dst);
-    handle->outstanding_pipelined_cmds++;
+    void* reply = NULL;
+    va_list ap;
+    int ret;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
-    {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
-    }
-    return EXIT_SUCCESS;
+    conn_flush(conn);
+
+    va_start(ap, fmt);
+    ret = conn->backend->vappend(conn, fmt, ap);
+    va_end(ap);
+
+    if (ret != REDIS_OK || conn->backend->get_reply(conn, &reply) != REDIS_OK)
+        return NULL;
+
+    return reply;
 }
 
-int redis_hash_field_set(struct kv_store* handle, const char* fmt,
-                         uint64_t src, const char* field, const uint8_t* data,
-                         size_t len)
+void conn_close(struct kv_conn* conn)
 {
-    redisAppendCommand(handle->connection, fmt,
-                                           src,
-                                           field,
-                                           data,
-                                           len);
-    handle->outstanding_pipelined_cmds++;
-
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
-    {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
-    }
-    return EXIT_SUCCESS;
+    conn_flush(conn);
+    conn->backend->close(conn);
+    free(conn);
 }
 
-int redis_hash_field_get(struct kv_store* handle, const char* fmt,
-                         uint64_t src, const char* field, uint8_t* data,
-                         size_t* len)
+struct kv_conn* conn_open(struct kv_store* handle)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, fmt, src, field);
-    if (reply->type == REDIS_REPLY_STRING &&
-        reply->len > 0 &&
-        reply->len <= *len)
+    struct timeval timeout = { 1, 500000 };
+    struct kv_conn* conn = (struct kv_conn*) calloc(1, sizeof(struct kv_conn));
+
+    if (conn == NULL)
+        return NULL;
+
+    conn->backend = handle->backend;
+
+    if (conn->backend == &mem_backend)
     {
-        memcpy(data, reply->str, reply->len);
-        *len = reply->len;
+        if (mem_backend_open(conn, handle->spec.address[0] ?
+                                   handle->spec.address : NULL))
+        {
+            free(conn);
+            return NULL;
+        }
     }
     else
     {
-        fprintf(stdout, "reply->len = %d len = %zu\n", reply->len, *len);
-        *len = 0;
+        if (handle->spec.transport == KV_SPEC_UNIX)
+            conn->connection = redisConnectUnixWithTimeout(
+                                                handle->spec.address, timeout);
+        else
+            conn->connection = redisConnectWithTimeout(handle->spec.address,
+                                                       handle->spec.port,
+                                                       timeout);
+
+        if (conn->connection == NULL || conn->connection->err)
+        {
+            if (conn->connection)
+                redisFree(conn->connection);
+            free(conn);
+            return NULL;
+        }
     }
 
-    return check_redis_return(handle, reply);
-}
+    strcpy(conn->selected, handle->spec.db);
 
-int redis_last_file_sector(struct kv_store* handle, uint64_t id, 
-                           uint64_t* sector)
-{
-    uint8_t data[64];
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection,
-                         REDIS_FILE_SECTORS_LAST_SECTOR, id);
-    if (reply->type == REDIS_REPLY_STRING &&
-        reply->len > 0 &&
-        reply->len <= 64)
+    if (check_redis_return(handle, conn_command(conn, "SELECT %s",
+                                                handle->spec.db)))
     {
-        memcpy(data, reply->str, reply->len);
-        strtok((char *) data, ":");
-        sscanf(strtok(NULL, ":"), "%"SCNu64, sector);
+        conn->backend->close(conn);
+        free(conn);
+        return NULL;
     }
 
-    return check_redis_return(handle, reply);
+    return conn;
 }
 
-int redis_sector_lookup(struct kv_store* handle, uint64_t src,
-                        uint8_t* data, size_t* len)
+/* the calling thread's connection, opened on first use */
+struct kv_conn* kv_thread_conn(struct kv_store* handle)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, REDIS_SECTOR_GET, src);
-    if (reply->type == REDIS_REPLY_STRING &&
-        reply->len > 0 &&
-        reply->len <= *len)
-    {
-        memcpy(data, reply->str, reply->len);
-        *len = reply->len;
-    }
-    else
+    struct kv_conn* conn = pthread_getspecific(handle->conn_key);
+
+    if (conn)
+        return conn;
+
+    if ((conn = conn_open(handle)) == NULL)
     {
-        *len = 0;
+        log_error("Failed opening a connection for this thread.\n");
+        return NULL;
     }
 
-    return check_redis_return(handle, reply);
+    pthread_mutex_lock(&(handle->pool_lock));
+    conn->next = handle->pool;
+    handle->pool = conn;
+    pthread_mutex_unlock(&(handle->pool_lock));
+
+    pthread_setspecific(handle->conn_key, conn);
+
+    return conn;
 }
 
-int redis_list_len(struct kv_store* handle, char* fmt, uint64_t src,
-                   uint64_t* len)
+/* either cap reached: no more commands go out before replies come back */
+bool conn_full(struct kv_store* handle, struct kv_conn* conn)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, fmt, src);
-    if (reply->type == REDIS_REPLY_INTEGER)
-    {
-        *len = reply->integer;
-    }
-    else
-    {
-        *len = 0;
-    }
-
-    return check_redis_return(handle, reply);
+    return conn->outstanding_pipelined_cmds >=
+           __atomic_load_n(&(handle->max_cmds), __ATOMIC_RELAXED) ||
+           conn->outstanding_bytes >=
+           __atomic_load_n(&(handle->max_bytes), __ATOMIC_RELAXED);
 }
 
-int redis_list_set(struct kv_store* handle, char* fmt, uint64_t src,
-                   uint64_t index, int64_t value)
+/* pipelined commands on the calling thread's connection, flushed when the
+ * pipeline is full */
+int kv_pipelined(struct kv_store* handle, struct kv_conn* conn, int ret,
+                 size_t bytes)
 {
-    redisAppendCommand(handle->connection, fmt,
-                                           src,
-                                           index,
-                                           value);
-    handle->outstanding_pipelined_cmds++;
+    if (ret != REDIS_OK)
+        return ret;
+
+    conn_pending(conn, bytes);
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
+    if (conn_full(handle, conn))
     {
-        if (redis_flush_pipeline(handle))
+        if (conn_flush(conn))
         {
             assert(false);
         }
     }
-    return EXIT_SUCCESS;
+
+    return REDIS_OK;
 }
 
-int redis_binary_insert(struct kv_store* handle, const char* fmt,
-                        uint64_t src, const uint8_t* data, size_t len)
+int kv_append_command(struct kv_store* handle, const char* fmt, ...)
 {
-    redisAppendCommand(handle->connection, fmt,
-                                           src,
-                                           data,
-                                           len);
-    handle->outstanding_pipelined_cmds++;
+    struct kv_conn* conn = kv_thread_conn(handle);
+    va_list ap;
+    int ret;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
-    {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
-    }
-    return EXIT_SUCCESS;
+    if (conn == NULL)
+        return REDIS_ERR;
+
+    va_start(ap, fmt);
+    ret = conn->backend->vappend(conn, fmt, ap);
+    va_end(ap);
+
+    return kv_pipelined(handle, conn, ret, 0);
 }
 
-int redis_reverse_file_data_pointer_set(struct kv_store* handle,
-                                        int64_t src, uint64_t start,
-                                        uint64_t end, uint64_t dst)
+int kv_append_command_argv(struct kv_store* handle, int argc,
+                           const char** argv, const size_t* argvlen)
 {
-    redisAppendCommand(handle->connection, REDIS_DATA_INSERT,
-                                           src,
-                                           start,
-                                           end,
-                                           dst);
-    handle->outstanding_pipelined_cmds++;
+    struct kv_conn* conn = kv_thread_conn(handle);
+    size_t bytes = 0;
+    int i;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
-    {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
-    }
-    return EXIT_SUCCESS;
+    if (conn == NULL)
+        return REDIS_ERR;
+
+    for (i = 0; i < argc; i++)
+        bytes += argvlen[i];
+
+    return kv_pipelined(handle, conn,
+                        conn->backend->append_argv(conn, argc, argv, argvlen),
+                        bytes);
 }
 
-int redis_path_set(struct kv_store* handle, const uint8_t* path, size_t len,
-                   uint64_t id)
+/* a synchronous command; pipelined replies are collected first so the
+ * reply returned is this command's */
+void* kv_command(struct kv_store* handle, const char* fmt, ...)
 {
-    redisAppendCommand(handle->connection, REDIS_PATH_SET, path, len, id);
-    handle->outstanding_pipelined_cmds++;
+    struct kv_conn* conn = kv_thread_conn(handle);
+    void* reply = NULL;
+    va_list ap;
+    int ret;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
-    {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
-    }
-    return EXIT_SUCCESS;
+    if (conn == NULL)
+        return NULL;
+
+    conn_flush(conn);
+
+    va_start(ap, fmt);
+    ret = conn->backend->vappend(conn, fmt, ap);
+    va_end(ap);
+
+    if (ret != REDIS_OK || conn->backend->get_reply(conn, &reply) != REDIS_OK)
+        return NULL;
+
+    return reply;
 }
 
-int redis_path_get(struct kv_store* handle, const uint8_t* path, size_t len,
-                   uint64_t* id)
+void* kv_command_argv(struct kv_store* handle, int argc, const char** argv,
+                      const size_t* argvlen)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, REDIS_PATH_GET, path, len);
+    struct kv_conn* conn = kv_thread_conn(handle);
+    void* reply = NULL;
+
+    if (conn == NULL)
+        return NULL;
+
+    conn_flush(conn);
+
+    if (conn->backend->append_argv(conn, argc, argv, argvlen) != REDIS_OK ||
+        conn->backend->get_reply(conn, &reply) != REDIS_OK)
+        return NULL;
+
+    return reply;
+}
+
+/* preloads every script; a backend without scripting leaves the digests
+ * empty and each call then goes out as EVAL, which it rejects as well */
+void redis_scripts_load(struct kv_store* handle)
+{
+    redisReply* reply;
+    int i;
+
+    for (i = 0; i < REDIS_SCRIPT_MAX; i++)
+    {
+        reply = kv_command(handle, REDIS_SCRIPT_LOAD, redis_scripts[i]);
+
+        if (reply && reply->type == REDIS_REPLY_STRING &&
+            reply->len == REDIS_SCRIPT_SHA_LEN)
+            memcpy(handle->scripts[i], reply->str, REDIS_SCRIPT_SHA_LEN);
+
+        if (reply)
+            freeReplyObject(reply);
+    }
+}
+
+/* EVALSHA with the preloaded digest; a server that has lost its script
+ * cache (restart, SCRIPT FLUSH) answers NOSCRIPT and the source is sent
+ * instead, which caches it again */
+redisReply* redis_script_call(struct kv_store* handle,
+                              enum REDIS_SCRIPT script, int nkeys, int argc,
+                              const char** argv, const size_t* argvlen)
+{
+    const char* cmd[REDIS_SCRIPT_ARGS_MAX + 3];
+    size_t cmdlen[REDIS_SCRIPT_ARGS_MAX + 3];
+    char keys[REDIS_ID_MAX];
+    redisReply* reply;
+
+    if (argc > REDIS_SCRIPT_ARGS_MAX)
+        return NULL;
+
+    cmd[2] = keys;
+    cmdlen[2] = snprintf(keys, sizeof(keys), "%d", nkeys);
+    memcpy(&(cmd[3]), argv, argc * sizeof(const char*));
+    memcpy(&(cmdlen[3]), argvlen, argc * sizeof(size_t));
+
+    if (handle->scripts[script][0])
+    {
+        cmd[0] = "EVALSHA";
+        cmdlen[0] = strlen(cmd[0]);
+        cmd[1] = handle->scripts[script];
+        cmdlen[1] = REDIS_SCRIPT_SHA_LEN;
+
+        reply = kv_command_argv(handle, argc + 3, cmd, cmdlen);
+
+        if (reply == NULL || reply->type != REDIS_REPLY_ERROR ||
+            strncmp(reply->str, REDIS_NOSCRIPT, strlen(REDIS_NOSCRIPT)))
+            return reply;
+
+        freeReplyObject(reply);
+    }
+
+    cmd[0] = "EVAL";
+    cmdlen[0] = strlen(cmd[0]);
+    cmd[1] = redis_scripts[script];
+    cmdlen[1] = strlen(cmd[1]);
+
+    return kv_command_argv(handle, argc + 3, cmd, cmdlen);
+}
+
+/* an integer script result, anything else is a failure */
+int redis_script_integer(redisReply* reply, int64_t* result)
+{
+    if (reply == NULL)
+        return EXIT_FAILURE;
+
+    if (reply->type != REDIS_REPLY_INTEGER)
+    {
+        if (reply->type == REDIS_REPLY_ERROR)
+            log_error("Script failed: %s\n", reply->str);
+        freeReplyObject(reply);
+        return EXIT_FAILURE;
+    }
+
+    *result = reply->integer;
+    freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
+}
+
+/* HMGET of count fields; key must hold REDIS_HASH_KEY_MAX bytes */
+int redis_fields_argv(const char* key_fmt, uint64_t src,
+                      const struct redis_hash_field* fields, size_t count,
+                      char* key, const char** argv, size_t* argvlen)
+{
+    size_t i;
+
+    if (count == 0 || count > REDIS_HASH_FIELDS_MAX)
+        return EXIT_FAILURE;
+
+    argv[0] = "HMGET";
+    argvlen[0] = strlen(argv[0]);
+    argv[1] = key;
+    argvlen[1] = snprintf(key, REDIS_HASH_KEY_MAX, key_fmt, src);
+
+    for (i = 0; i < count; i++)
+    {
+        argv[i + 2] = fields[i].name;
+        argvlen[i + 2] = strlen(fields[i].name);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* copies an HMGET reply out, the reply stays the caller's */
+int redis_reply_fields(redisReply* reply, struct redis_hash_field* fields,
+                       size_t count)
+{
+    size_t i;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY ||
+        reply->elements != count)
+        return EXIT_FAILURE;
+
+    for (i = 0; i < count; i++)
+    {
+        if (reply->element[i]->type == REDIS_REPLY_STRING &&
+            reply->element[i]->len > 0 &&
+            reply->element[i]->len <= fields[i].len)
+        {
+            memcpy(fields[i].data, reply->element[i]->str,
+                   reply->element[i]->len);
+            fields[i].len = reply->element[i]->len;
+        }
+        else
+        {
+            fields[i].len = 0;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* the number after the first ':' of a prefix:number element, as callers
+ * used to split them with strtok and sscanf */
+bool redis_parse_number(const uint8_t* data, size_t len, int64_t* number)
+{
+    const uint8_t* colon = memchr(data, ':', len);
+    bool negative = false;
+    uint64_t value = 0;
+    size_t i;
+
+    if (colon == NULL)
+        return false;
+
+    i = colon - data + 1;
+
+    if (i < len && data[i] == '-')
+    {
+        negative = true;
+        i++;
+    }
+
+    if (i == len)
+        return false;
+
+    for (; i < len; i++)
+    {
+        if (data[i] < '0' || data[i] > '9')
+            return false;
+
+        value = value * 10 + (data[i] - '0');
+    }
+
+    *number = negative ? -((int64_t) value) : (int64_t) value;
+
+    return true;
+}
+
+/* hands each element of an array reply to callback in place */
+int redis_reply_foreach(redisReply* reply, redis_list_callback callback,
+                        void* arg)
+{
+    struct redis_list_element element;
+    size_t i;
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+        return EXIT_FAILURE;
+
+    element.count = reply->elements;
+
+    for (i = 0; i < reply->elements; i++)
+    {
+        if (reply->element[i]->type != REDIS_REPLY_STRING)
+            return EXIT_FAILURE;
+
+        element.data = (const uint8_t*) reply->element[i]->str;
+        element.len = reply->element[i]->len;
+        element.index = i;
+        element.number = 0;
+        element.has_number = redis_parse_number(element.data, element.len,
+                                                &(element.number));
+
+        if (!callback(&element, arg))
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+struct kv_async_request* redis_async_request(struct kv_async* async,
+                                             enum KV_ASYNC_REQUEST type,
+                                             redis_async_callback callback,
+                                             void* arg)
+{
+    struct kv_async_request* request = (struct kv_async_request*)
+                                       calloc(1, sizeof(*request));
+
+    if (request == NULL)
+        return NULL;
+
+    request->async = async;
+    request->type = type;
+    request->callback = callback;
+    request->arg = arg;
+
+    return request;
+}
+
+/* copies the reply into the caller's storage, then hands over the status */
+void redis_async_complete(struct kv_async_request* request, redisReply* reply)
+{
+    int status = EXIT_FAILURE;
+
+    switch (request->type)
+    {
+        case KV_ASYNC_FIELDS:
+            status = redis_reply_fields(reply, request->fields,
+                                        request->count);
+            break;
+        case KV_ASYNC_FOREACH:
+            status = redis_reply_foreach(reply, request->each,
+                                         request->each_arg);
+            break;
+        case KV_ASYNC_INTEGER:
+            if (reply && reply->type == REDIS_REPLY_INTEGER)
+            {
+                *(request->integer) = reply->integer;
+                status = EXIT_SUCCESS;
+            }
+            break;
+    }
+
+    request->async->outstanding--;
+
+    if (request->callback)
+        request->callback(status, request->arg);
+
+    free(request);
+}
+
+/* hiredis frees the reply once this returns; a NULL reply means the
+ * connection went away with the request still outstanding */
+void redis_async_reply(redisAsyncContext* context, void* reply, void* data)
+{
+    redis_async_complete((struct kv_async_request*) data,
+                         (redisReply*) reply);
+}
+
+void redis_async_disconnect(const redisAsyncContext* context, int status)
+{
+    struct kv_async* async = (struct kv_async*) context->data;
+
+    if (status != REDIS_OK)
+        log_error("Lost async kv connection (%s), lookups will "
+                  "block.\n", context->errstr);
+
+    async->context = NULL;
+}
+
+/* the thread's pipelined writes are flushed first so lookups see them; with
+ * no connection the lookup runs on the thread's blocking one instead */
+int redis_async_issue(struct kv_async_request* request, const char* fmt,
+                      uint64_t src)
+{
+    struct kv_async* async = request->async;
+    redisReply* reply;
+
+    async->outstanding++;
+
+    if (async->context)
+    {
+        redis_flush_pipeline(async->store);
+
+        if (redisAsyncCommand(async->context, redis_async_reply, request,
+                              fmt, src) == REDIS_OK)
+            return EXIT_SUCCESS;
+    }
+
+    reply = kv_command(async->store, fmt, src);
+    redis_async_complete(request, reply);
+
+    if (reply)
+        freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
+}
+
+int redis_async_issue_argv(struct kv_async_request* request, int argc,
+                           const char** argv, const size_t* argvlen)
+{
+    struct kv_async* async = request->async;
+    redisReply* reply;
+
+    async->outstanding++;
+
+    if (async->context)
+    {
+        redis_flush_pipeline(async->store);
+
+        if (redisAsyncCommandArgv(async->context, redis_async_reply, request,
+                                  argc, argv, argvlen) == REDIS_OK)
+            return EXIT_SUCCESS;
+    }
+
+    reply = kv_command_argv(async->store, argc, argv, argvlen);
+    redis_async_complete(request, reply);
+
+    if (reply)
+        freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
+}
+
+int redis_select(struct kv_store* handle, char* db)
+{
+    struct kv_conn* conn = kv_thread_conn(handle);
+
+    if (conn == NULL ||
+        check_redis_return(handle, kv_command(handle, "SELECT %s", db)))
+        return EXIT_FAILURE;
+
+    snprintf(conn->selected, REDIS_DB_MAX, "%s", db);
+
+    return EXIT_SUCCESS;
+}
+
+void redis_pipeline_select(struct kv_conn* conn, const char* db)
+{
+    if (strcmp(conn->selected, db) == 0)
+        return;
+
+    conn_append(conn, "SELECT %s", db);
+    snprintf(conn->selected, REDIS_DB_MAX, "%s", db);
+}
+
+void redis_pipeline_write(struct kv_conn* conn, const char* db,
+                          int64_t sector, const uint8_t* data, size_t len)
+{
+    redis_pipeline_select(conn, db);
+    conn_append(conn, REDIS_ASYNC_QUEUE_PUSH, &sector, sizeof(sector));
+    conn_append(conn, REDIS_ASYNC_QUEUE_PUSH, data, len);
+    conn->outstanding_bytes += sizeof(sector) + len;
+}
+
+/* I/O thread only; latency is measured from the oldest command flushed */
+void redis_io_flush(struct kv_store* handle)
+{
+    struct timeval now;
+    uint64_t latency;
+
+    if (handle->io->outstanding_pipelined_cmds == 0)
+        return;
+
+    if (conn_flush(handle->io))
+        log_error("ERROR FLUSHING\n");
+
+    gettimeofday(&now, NULL);
+    latency = diff_time(handle->io->oldest, now);
+
+    __atomic_add_fetch(&(handle->stats.flushes), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(handle->stats.total_latency), latency,
+                       __ATOMIC_RELAXED);
+    __atomic_store_n(&(handle->stats.last_latency), latency,
+                     __ATOMIC_RELAXED);
+
+    if (latency > handle->stats.max_latency)
+        __atomic_store_n(&(handle->stats.max_latency), latency,
+                         __ATOMIC_RELAXED);
+}
+
+/* spilled writes are replayed into the db that was current when they were
+ * spilled, a marker record precedes each run of writes for one db; caller
+ * holds spill_lock */
+int redis_spill_push(struct kv_store* handle, const char* db, int64_t sector,
+                     uint8_t* data, size_t len)
+{
+    if (spillq_empty(handle->spill) || strcmp(handle->spill_db, db))
+    {
+        if (spillq_push(handle->spill, REDIS_SPILL_SELECT, (uint8_t*) db,
+                        strlen(db)))
+            return EXIT_FAILURE;
+
+        __atomic_add_fetch(&(handle->spilled), 1, __ATOMIC_RELEASE);
+        snprintf(handle->spill_db, REDIS_DB_MAX, "%s", db);
+    }
+
+    if (spillq_push(handle->spill, sector, data, len))
+        return EXIT_FAILURE;
+
+    __atomic_add_fetch(&(handle->spilled), 1, __ATOMIC_RELEASE);
+
+    return EXIT_SUCCESS;
+}
+
+/* I/O thread only; how long to wait for more writes before flushing: the
+ * latency deadline while anything is outstanding, bounded so a pipeline
+ * that never goes idle is still flushed within REDIS_FLUSH_MAX_AGE */
+uint64_t redis_io_wait(struct kv_store* handle)
+{
+    uint64_t deadline = __atomic_load_n(&(handle->deadline), __ATOMIC_RELAXED);
+    uint64_t max_age = deadline > REDIS_FLUSH_MAX_AGE ? deadline :
+                                                        REDIS_FLUSH_MAX_AGE;
+    struct timeval now;
+    uint64_t age;
+
+    if (handle->io->outstanding_pipelined_cmds == 0)
+        return REDIS_FLUSH_IDLE_TICK;
+
+    gettimeofday(&now, NULL);
+    age = diff_time(handle->io->oldest, now);
+
+    if (age >= max_age)
+        return 0;
+
+    return age + deadline > max_age ? max_age - age : deadline;
+}
+
+/* I/O thread only; full or overdue, checked as writes stream in so a busy
+ * queue cannot hold back replies */
+bool redis_io_due(struct kv_store* handle)
+{
+    return conn_full(handle, handle->io) || redis_io_wait(handle) == 0;
+}
+
+/* I/O thread only */
+void redis_queue_drain(struct kv_store* handle)
+{
+    struct mpscq_node* node;
+    struct kv_write* write;
+
+    while ((node = mpscq_pop(handle->writes)))
+    {
+        write = (struct kv_write*) node;
+        redis_pipeline_write(handle->io, write->db, write->sector,
+                             write->data, write->len);
+
+        if (redis_io_due(handle))
+            redis_io_flush(handle);
+
+        __atomic_sub_fetch(&(handle->queued_bytes), write->len,
+                           __ATOMIC_RELEASE);
+        free(write);
+    }
+}
+
+/* I/O thread only; whatever a producer queued before it started spilling
+ * is already in the write queue and goes out first */
+void redis_spill_drain(struct kv_store* handle)
+{
+    char db[REDIS_DB_MAX];
+    int64_t sector;
+    uint8_t* data;
+    size_t len;
+    int ret;
+
+    while (__atomic_load_n(&(handle->spilled), __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&(handle->spill_lock));
+        ret = spillq_pop(handle->spill, &sector, &data, &len);
+        pthread_mutex_unlock(&(handle->spill_lock));
+
+        if (ret != 1)
+            break;
+
+        redis_queue_drain(handle);
+
+        if (sector == REDIS_SPILL_SELECT)
+        {
+            len = len < REDIS_DB_MAX ? len : REDIS_DB_MAX - 1;
+            memcpy(db, data, len);
+            db[len] = 0;
+            redis_pipeline_select(handle->io, db);
+        }
+        else
+        {
+            redis_pipeline_write(handle->io, handle->io->selected, sector,
+                                 data, len);
+
+            if (redis_io_due(handle))
+                redis_io_flush(handle);
+        }
+
+        free(data);
+        __atomic_sub_fetch(&(handle->spilled), 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* owns handle->io: appends queued writes as they arrive, and collects their
+ * replies once the queue has been idle for the latency deadline, the
+ * oldest command is overdue, or the pipeline is full */
+void* redis_io_thread(void* data)
+{
+    struct kv_store* handle = (struct kv_store*) data;
+    struct timespec deadline;
+    uint64_t wait;
+    bool idle;
+
+    while (true)
+    {
+        wait = redis_io_wait(handle);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait / 1000000;
+        deadline.tv_nsec += (wait % 1000000) * 1000;
+
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        idle = wait == 0 ||
+               sem_timedwait(&(handle->pending), &deadline) != 0;
+
+        while (sem_trywait(&(handle->pending)) == 0);
+
+        redis_queue_drain(handle);
+        redis_spill_drain(handle);
+
+        if (idle || redis_io_due(handle))
+            redis_io_flush(handle);
+
+        __atomic_store_n(&(handle->stats.depth),
+                         handle->io->outstanding_pipelined_cmds,
+                         __ATOMIC_RELAXED);
+        __atomic_store_n(&(handle->stats.bytes),
+                         handle->io->outstanding_bytes, __ATOMIC_RELAXED);
+
+        if (__atomic_load_n(&(handle->shutdown), __ATOMIC_ACQUIRE) &&
+            mpscq_empty(handle->writes) &&
+            __atomic_load_n(&(handle->spilled), __ATOMIC_ACQUIRE) == 0)
+            break;
+    }
+
+    redis_io_flush(handle);
+
+    return NULL;
+}
+
+/***** Core API *****/
+void redis_print_version()
+{
+    log_info("Current libhiredis version is %d.%d.%d\n", HIREDIS_MAJOR,
+                                                        HIREDIS_MINOR,
+                                                        HIREDIS_PATCH);
+}
+
+void redis_destroy(struct kv_store* handle)
+{
+    struct kv_conn* conn;
+
+    while ((conn = handle->pool))
+    {
+        handle->pool = conn->next;
+        conn_close(conn);
+    }
+
+    if (handle->io)
+        conn_close(handle->io);
+
+    if (handle->writes)
+        mpscq_destroy(handle->writes);
+
+    if (handle->spill)
+        spillq_destroy(handle->spill);
+
+    pending_cache_destroy(handle->pending_writes);
+
+    pthread_key_delete(handle->conn_key);
+    pthread_mutex_destroy(&(handle->pool_lock));
+    pthread_mutex_destroy(&(handle->spill_lock));
+    sem_destroy(&(handle->pending));
+    free(handle);
+}
+
+struct kv_store* redis_init(const char* spec, bool background_flush)
+{
+    struct kv_store* handle = (struct kv_store*)
+                              calloc(1, sizeof(struct kv_store));
+
+    if (handle == NULL)
+        return NULL;
+
+    if (kv_spec_parse(spec, &(handle->spec)))
+    {
+        log_error("Bad connection spec: %s\n", spec);
+        free(handle);
+        return NULL;
+    }
+
+    handle->backend = handle->spec.transport == KV_SPEC_MEM ? &mem_backend :
+                                                              &redis_backend;
+    handle->max_cmds = REDIS_DEFAULT_PIPELINED;
+    handle->max_bytes = REDIS_DEFAULT_PIPELINED_BYTES;
+    handle->deadline = REDIS_DEFAULT_FLUSH_DEADLINE;
+
+    pthread_key_create(&(handle->conn_key), NULL);
+    pthread_mutex_init(&(handle->pool_lock), NULL);
+    pthread_mutex_init(&(handle->spill_lock), NULL);
+    sem_init(&(handle->pending), 0, 0);
+
+    /* connect eagerly so a bad db or dead server fails here */
+    if (kv_thread_conn(handle) == NULL ||
+        (handle->writes = mpscq_init()) == NULL ||
+        (handle->spill = spillq_init(SPILLQ_DEFAULT_MEM_BUDGET, NULL,
+                                     0)) == NULL ||
+        (handle->pending_writes =
+         pending_cache_init(PENDING_CACHE_DEFAULT_BUDGET)) == NULL)
+    {
+        redis_destroy(handle);
+        return NULL;
+    }
+
+    redis_scripts_load(handle);
+
+    if (background_flush)
+    {
+        if ((handle->io = conn_open(handle)) == NULL ||
+            pthread_create(&(handle->io_thread), NULL, redis_io_thread,
+                           handle))
+        {
+            redis_destroy(handle);
+            return NULL;
+        }
+
+        handle->io_running = true;
+    }
+
+    return handle;
+}
+
+int redis_flush_pipeline(struct kv_store* handle)
+{
+    struct kv_conn* conn = kv_thread_conn(handle);
+
+    if (conn == NULL)
+        return EXIT_FAILURE;
+
+    return conn_flush(conn);
+}
+
+int redis_pending_put(struct kv_store* handle, uint64_t sector_num,
+                      const uint8_t* data, size_t len, bool pinned)
+{
+    return pending_cache_put(handle->pending_writes, sector_num, data, len,
+                             pinned);
+}
+
+int redis_publish(struct kv_store* handle, char* channel, uint8_t* data,
+                  size_t len)
+{
+    redisReply* reply;
+    reply = kv_command(handle, REDIS_PUBLISH, channel, data,
+                       len);
+    return check_redis_return(handle, reply);
+}
+
+int redis_publish_pipelined(struct kv_store* handle, char* channel,
+                            uint8_t* data, size_t len)
+{
+    kv_append_command(handle, REDIS_PUBLISH, channel, data, len);
+    return EXIT_SUCCESS;
+}
+
+int redis_pending_take(struct kv_store* handle, uint64_t sector_num,
+                       uint8_t* data, size_t* len)
+{
+    return pending_cache_take(handle->pending_writes, sector_num, data, len);
+}
+
+int redis_pending_remove(struct kv_store* handle, uint64_t sector_num)
+{
+    pending_cache_remove(handle->pending_writes, sector_num);
+    return EXIT_SUCCESS;
+}
+
+int redis_reverse_pointer_set(struct kv_store* handle, const char* fmt,
+                              uint64_t src, int64_t dst)
+{
+    kv_append_command(handle, fmt,
+                      src,
+                      dst);
+    return EXIT_SUCCESS;
+}
+
+int redis_hash_field_set(struct kv_store* handle, const char* fmt,
+                         uint64_t src, const char* field, const uint8_t* data,
+                         size_t len)
+{
+    kv_append_command(handle, fmt,
+                      src,
+                      field,
+                      data,
+                      len);
+    return EXIT_SUCCESS;
+}
+
+int redis_hash_field_get(struct kv_store* handle, const char* fmt,
+                         uint64_t src, const char* field, uint8_t* data,
+                         size_t* len)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, fmt, src, field);
+    if (reply->type == REDIS_REPLY_STRING &&
+        reply->len > 0 &&
+        reply->len <= *len)
+    {
+        memcpy(data, reply->str, reply->len);
+        *len = reply->len;
+    }
+    else
+    {
+        log_debug("reply->len = %d len = %zu\n", reply->len, *len);
+        *len = 0;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+/* fetches every field of one hash with a single HMGET; fields[i].len is
+ * the capacity on entry and the stored length, 0 if unset, on return */
+int redis_hash_fields_get(struct kv_store* handle, const char* key_fmt,
+                          uint64_t src, struct redis_hash_field* fields,
+                          size_t count)
+{
+    const char* argv[REDIS_HASH_FIELDS_MAX + 2];
+    size_t argvlen[REDIS_HASH_FIELDS_MAX + 2];
+    char key[REDIS_HASH_KEY_MAX];
+    redisReply* reply;
+
+    if (redis_fields_argv(key_fmt, src, fields, count, key, argv, argvlen))
+        return EXIT_FAILURE;
+
+    redis_flush_pipeline(handle);
+    reply = kv_command_argv(handle, (int) count + 2, argv, argvlen);
+
+    if (redis_reply_fields(reply, fields, count))
+    {
+        if (reply)
+            freeReplyObject(reply);
+        return EXIT_FAILURE;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+/* pipelines one HMSET writing every field */
+int redis_hash_fields_set(struct kv_store* handle, const char* key_fmt,
+                          uint64_t src, const struct redis_hash_field* fields,
+                          size_t count)
+{
+    const char* argv[2 * REDIS_HASH_FIELDS_MAX + 2];
+    size_t argvlen[2 * REDIS_HASH_FIELDS_MAX + 2];
+    char key[REDIS_HASH_KEY_MAX];
+    size_t i;
+
+    if (count == 0)
+        return EXIT_SUCCESS;
+
+    if (count > REDIS_HASH_FIELDS_MAX)
+        return EXIT_FAILURE;
+
+    argv[0] = "HMSET";
+    argvlen[0] = strlen(argv[0]);
+    argv[1] = key;
+    argvlen[1] = snprintf(key, sizeof(key), key_fmt, src);
+
+    for (i = 0; i < count; i++)
+    {
+        argv[2 * i + 2] = fields[i].name;
+        argvlen[2 * i + 2] = strlen(fields[i].name);
+        argv[2 * i + 3] = (const char*) fields[i].data;
+        argvlen[2 * i + 3] = fields[i].len;
+    }
+
+    kv_append_command_argv(handle, (int) (2 * count + 2), argv, argvlen);
+    return EXIT_SUCCESS;
+}
+
+int redis_last_file_sector(struct kv_store* handle, uint64_t id, 
+                           uint64_t* sector)
+{
+    char* saveptr;
+    uint8_t data[64];
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle,
+                       REDIS_FILE_SECTORS_LAST_SECTOR, id);
+    if (reply->type == REDIS_REPLY_STRING &&
+        reply->len > 0 &&
+        reply->len <= 64)
+    {
+        memcpy(data, reply->str, reply->len);
+        strtok_r((char *) data, ":", &saveptr);
+        sscanf(strtok_r(NULL, ":", &saveptr), "%"SCNu64, sector);
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_sector_lookup(struct kv_store* handle, uint64_t sector,
+                        struct sector_descriptor* desc)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, REDIS_SECTOR_GET, sector);
+    if (reply->type != REDIS_REPLY_STRING ||
+        redis_sector_unpack((const uint8_t*) reply->str,
+                            (size_t) reply->len, desc))
+    {
+        memset(desc, 0, sizeof(*desc));
+        desc->type = SECTOR_PTR_NONE;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_sector_lookup_multi(struct kv_store* handle, const uint64_t* sectors,
+                              size_t count, struct sector_descriptor* descs)
+{
+    redisReply* reply = NULL;
+    const char** argv;
+    size_t* argvlen;
+    char* keys;
+    size_t i;
+
+    if (count == 0)
+        return EXIT_SUCCESS;
+
+    argv = (const char**) malloc((count + 1) * sizeof(char*));
+    argvlen = (size_t*) malloc((count + 1) * sizeof(size_t));
+    keys = (char*) malloc(count * REDIS_SECTOR_KEY_MAX);
+
+    if (argv && argvlen && keys)
+    {
+        argv[0] = "MGET";
+        argvlen[0] = strlen(argv[0]);
+
+        for (i = 0; i < count; i++)
+        {
+            argv[i + 1] = &(keys[i * REDIS_SECTOR_KEY_MAX]);
+            argvlen[i + 1] = snprintf(&(keys[i * REDIS_SECTOR_KEY_MAX]),
+                                      REDIS_SECTOR_KEY_MAX, REDIS_SECTOR_KEY,
+                                      sectors[i]);
+        }
+
+        redis_flush_pipeline(handle);
+        reply = kv_command_argv(handle, (int) count + 1, argv,
+                                argvlen);
+    }
+
+    free(argv);
+    free(argvlen);
+    free(keys);
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY ||
+        reply->elements != count)
+    {
+        if (reply)
+            freeReplyObject(reply);
+        return EXIT_FAILURE;
+    }
+
+    /* missing or malformed values leave the sector unmapped */
+    for (i = 0; i < count; i++)
+    {
+        if (reply->element[i]->type != REDIS_REPLY_STRING ||
+            redis_sector_unpack((const uint8_t*) reply->element[i]->str,
+                                (size_t) reply->element[i]->len,
+                                &(descs[i])))
+        {
+            memset(&(descs[i]), 0, sizeof(descs[i]));
+            descs[i].type = SECTOR_PTR_NONE;
+        }
+    }
+
+    freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
+}
+
+int redis_list_len(struct kv_store* handle, char* fmt, uint64_t src,
+                   uint64_t* len)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, fmt, src);
+    if (reply->type == REDIS_REPLY_INTEGER)
+    {
+        *len = reply->integer;
+    }
+    else
+    {
+        *len = 0;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_list_set(struct kv_store* handle, char* fmt, uint64_t src,
+                   uint64_t index, int64_t value)
+{
+    kv_append_command(handle, fmt,
+                      src,
+                      index,
+                      value);
+    return EXIT_SUCCESS;
+}
+
+int redis_binary_insert(struct kv_store* handle, const char* fmt,
+                        uint64_t src, const uint8_t* data, size_t len)
+{
+    kv_append_command(handle, fmt,
+                      src,
+                      data,
+                      len);
+    return EXIT_SUCCESS;
+}
+
+void redis_sector_pack(const struct sector_descriptor* desc,
+                       struct sector_descriptor_packed* packed)
+{
+    packed->type = desc->type;
+    packed->id = desc->id;
+    packed->start = desc->start;
+    packed->end = desc->end;
+}
+
+int redis_sector_unpack(const uint8_t* data, size_t len,
+                        struct sector_descriptor* desc)
+{
+    struct sector_descriptor_packed packed;
+
+    if (len != sizeof(packed))
+        return EXIT_FAILURE;
+
+    memcpy(&packed, data, sizeof(packed));
+
+    if (packed.type <= SECTOR_PTR_NONE || packed.type >= SECTOR_PTR_MAX)
+        return EXIT_FAILURE;
+
+    desc->type = packed.type;
+    desc->id = packed.id;
+    desc->start = packed.start;
+    desc->end = packed.end;
+
+    return EXIT_SUCCESS;
+}
+
+int redis_sector_set(struct kv_store* handle, uint64_t sector,
+                     const struct sector_descriptor* desc)
+{
+    struct sector_descriptor_packed packed;
+
+    redis_sector_pack(desc, &packed);
+    kv_append_command(handle, REDIS_SECTOR_SET,
+                      sector,
+                      (const uint8_t*) &packed,
+                      sizeof(packed));
+    return EXIT_SUCCESS;
+}
+
+int redis_path_set(struct kv_store* handle, const uint8_t* path, size_t len,
+                   uint64_t id)
+{
+    kv_append_command(handle, REDIS_PATH_SET, path, len, id);
+    return EXIT_SUCCESS;
+}
+
+int redis_path_get(struct kv_store* handle, const uint8_t* path, size_t len,
+                   uint64_t* id)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, REDIS_PATH_GET, path, len);
+
+    if (reply->type == REDIS_REPLY_STRING &&
+        reply->len > 0)
+    {
+        sscanf(reply->str, "%"SCNu64, id);
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_metadata_set(struct kv_store* handle, const uint8_t* data,
+                       size_t len)
+{
+    kv_append_command(handle, REDIS_MD_FILTER_SET, data, len);
+    return EXIT_SUCCESS;
+}
+
+int redis_metadata_get(struct kv_store* handle, uint8_t** data,
+                       size_t* len)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, REDIS_MD_FILTER_GET);
 
     if (reply->type == REDIS_REPLY_STRING &&
         reply->len > 0)
     {
-        sscanf(reply->str, "%"SCNu64, id);
+        *data = (uint8_t*) malloc(reply->len);
+        memcpy(*data, reply->str, reply->len);
+        *len = reply->len;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+/* region newly holds metadata: the stored filter keeps the crawler's
+ * LSB-first bit order, where SETBIT counts from each byte's MSB */
+int redis_metadata_hot(struct kv_store* handle, uint64_t region)
+{
+    kv_append_command(handle, REDIS_MD_FILTER_SETBIT,
+                      (region & ~((uint64_t) 7)) | (7 - (region & 7)));
+    kv_append_command(handle, REDIS_MD_HOT_PUSH, region);
+    return EXIT_SUCCESS;
+}
+
+/* sets the regions queued by redis_metadata_hot in db; only what was read
+ * is trimmed, so a region pushed in between waits for the next call */
+int redis_metadata_hot_drain(struct kv_store* handle, const char* db,
+                             struct bitarray* bits, uint64_t* drained)
+{
+    struct kv_conn* conn = kv_thread_conn(handle);
+    redisReply* reply;
+    size_t i, count;
+
+    *drained = 0;
+
+    if (conn == NULL)
+        return EXIT_FAILURE;
+
+    redis_pipeline_select(conn, db);
+    reply = kv_command(handle, REDIS_MD_HOT_GET, REDIS_MD_HOT_BATCH - 1);
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY)
+    {
+        check_redis_return(handle, reply);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < reply->elements; i++)
+    {
+        if (reply->element[i]->type == REDIS_REPLY_STRING)
+            bitarray_set_bit(bits, strtoull(reply->element[i]->str, NULL,
+                                            10));
+    }
+
+    count = reply->elements;
+    freeReplyObject(reply);
+
+    if (count == 0)
+        return EXIT_SUCCESS;
+
+    *drained = count;
+
+    return check_redis_return(handle, kv_command(handle, REDIS_MD_HOT_TRIM,
+                                                 count));
+}
+
+int redis_get_fcounter(struct kv_store* handle, uint64_t* counter)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, REDIS_FCOUNTER);
+
+    if (reply->type == REDIS_REPLY_INTEGER)
+    {
+        *counter = reply->integer;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_set_fcounter(struct kv_store* handle, uint64_t counter)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, REDIS_FCOUNTER_SET, counter);
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_list_foreach(struct kv_store* handle, char* fmt, uint64_t src,
+                       redis_list_callback callback, void* arg)
+{
+    redisReply* reply;
+    int ret;
+
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, fmt, src);
+    ret = redis_reply_foreach(reply, callback, arg);
+
+    if (reply)
+        freeReplyObject(reply);
+
+    return ret;
+}
+
+int redis_list_foreach_var(struct kv_store* handle, char* fmt, uint64_t src,
+                           int64_t start, int64_t end,
+                           redis_list_callback callback, void* arg)
+{
+    redisReply* reply;
+    int ret;
+
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, fmt, src, start, end);
+    ret = redis_reply_foreach(reply, callback, arg);
+
+    if (reply)
+        freeReplyObject(reply);
+
+    return ret;
+}
+
+int redis_async_write_enqueue(struct kv_store* handle, struct bitarray* bits,
+                              int64_t sector, uint8_t* data, size_t len)
+{
+    return redis_async_write_enqueue_db(handle, bits, handle->spec.db, sector,
+                                        data, len);
+}
+
+int redis_async_write_enqueue_db(struct kv_store* handle,
+                                 struct bitarray* bits, const char* db,
+                                 int64_t sector, uint8_t* data, size_t len)
+{
+    struct kv_conn* conn;
+    struct kv_write* write;
+    bool metadata = bitarray_get_bit(bits,
+                                     sector / REDIS_MD_REGION_SECTORS);
+    int ret;
+
+    if (!handle->io_running)
+    {
+        if ((conn = kv_thread_conn(handle)) == NULL)
+            return EXIT_FAILURE;
+
+        redis_pipeline_write(conn, db, sector, data, len);
+
+        if (conn_full(handle, conn) && conn_flush(conn))
+            log_error("ERROR FLUSHING\n");
+
+        return EXIT_SUCCESS;
+    }
+
+    /* file data past the byte budget goes to the spill queue, and once
+     * anything is spilled file data follows it there to keep its order;
+     * metadata must not be reordered behind spilled data so it waits */
+    while (__atomic_load_n(&(handle->spilled), __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&(handle->queued_bytes), __ATOMIC_ACQUIRE) + len >
+           REDIS_DEFAULT_QUEUED_BYTES)
+    {
+        if (metadata)
+        {
+            sem_post(&(handle->pending));
+            usleep(REDIS_SPILL_WAIT);
+            continue;
+        }
+
+        pthread_mutex_lock(&(handle->spill_lock));
+        ret = redis_spill_push(handle, db, sector, data, len);
+        pthread_mutex_unlock(&(handle->spill_lock));
+        sem_post(&(handle->pending));
+        return ret;
+    }
+
+    write = (struct kv_write*) malloc(sizeof(struct kv_write) + len);
+
+    if (write == NULL)
+        return EXIT_FAILURE;
+
+    write->sector = sector;
+    write->data = (uint8_t*) (write + 1);
+    write->len = len;
+    memcpy(write->data, data, len);
+    snprintf(write->db, REDIS_DB_MAX, "%s", db);
+
+    __atomic_add_fetch(&(handle->queued_bytes), len, __ATOMIC_RELEASE);
+    mpscq_push(handle->writes, &(write->node));
+    sem_post(&(handle->pending));
+
+    return EXIT_SUCCESS;
+}
+
+int redis_async_write_dequeue(struct kv_store* handle,
+                              struct qemu_bdrv_write* write)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+
+    /* get sector number */
+    reply = kv_command(handle, REDIS_ASYNC_QUEUE_POP);
+
+    if (reply->type == REDIS_REPLY_ARRAY &&
+        reply->elements == 2 &&
+        reply->element[1]->type == REDIS_REPLY_STRING &&
+        reply->element[1]->len == sizeof(write->header.sector_num))
+    {
+        memcpy((uint8_t*) &(write->header.sector_num),
+               reply->element[1]->str, reply->element[1]->len);
+    }
+    else
+    {
+        log_error("Error len: %d\n", reply->element[1]->len);
+        write->header.sector_num = -1;
+        exit(1);
+        return EXIT_FAILURE;
+    }
+
+    check_redis_return(handle, reply);
+
+    /* get write data */
+    reply = kv_command(handle, REDIS_ASYNC_QUEUE_POP);
+
+    if (reply->type == REDIS_REPLY_ARRAY &&
+        reply->elements == 2)
+    {
+        write->data = NULL;
+        write->data = malloc(reply->element[1]->len);
+        if (write->data)
+        {
+            memcpy(write->data, reply->element[1]->str,
+                                reply->element[1]->len);
+            write->header.nb_sectors = reply->element[1]->len / SECTOR_SIZE;
+        }
+        else
+        {
+            write->header.nb_sectors = 0;
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        log_error("Error second part of array.\n");
+        write->header.nb_sectors = 0;
+        write->data = NULL;
+        exit(1);
+        return EXIT_FAILURE;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_async_write_dequeue_batch(struct kv_store* handle,
+                                    struct qemu_bdrv_write* writes,
+                                    size_t max, size_t* count)
+{
+    redisReply* reply, *sector, *data;
+    const char* argv[2];
+    size_t argvlen[2];
+    char count_arg[REDIS_ID_MAX];
+    size_t i;
+
+    *count = 0;
+    redis_flush_pipeline(handle);
+
+    argv[0] = REDIS_ASYNC_QUEUE_KEY;
+    argvlen[0] = strlen(argv[0]);
+    argv[1] = count_arg;
+    argvlen[1] = snprintf(count_arg, sizeof(count_arg), "%zu", max);
+
+    reply = redis_script_call(handle, REDIS_SCRIPT_POP_BATCH, 1, 2, argv,
+                              argvlen);
+
+    if (reply == NULL || (reply->type != REDIS_REPLY_ARRAY &&
+                          reply->type != REDIS_REPLY_ERROR) ||
+        reply->elements % 2)
+    {
+        log_error("Batch dequeue failed.\n");
+        if (reply)
+            freeReplyObject(reply);
+        return EXIT_FAILURE;
+    }
+
+    /* nothing queued, or no scripting (embedded backend): block for the next
+     * single write */
+    if (reply->type == REDIS_REPLY_ERROR || reply->elements == 0)
+    {
+        freeReplyObject(reply);
+        if (redis_async_write_dequeue(handle, &(writes[0])))
+            return EXIT_FAILURE;
+        *count = 1;
+        return EXIT_SUCCESS;
+    }
+
+    /* LRANGE order is newest first, the oldest pair sits at the end */
+    for (i = reply->elements; i > 0; i -= 2)
+    {
+        sector = reply->element[i - 1];
+        data = reply->element[i - 2];
+
+        if (sector->type != REDIS_REPLY_STRING ||
+            sector->len != sizeof(writes[*count].header.sector_num) ||
+            data->type != REDIS_REPLY_STRING)
+        {
+            log_error("Malformed write in batch dequeue.\n");
+            break;
+        }
+
+        memcpy((uint8_t*) &(writes[*count].header.sector_num), sector->str,
+               sector->len);
+        writes[*count].data = malloc(data->len);
+
+        if (writes[*count].data == NULL)
+            break;
+
+        memcpy(writes[*count].data, data->str, data->len);
+        writes[*count].header.nb_sectors = data->len / SECTOR_SIZE;
+        (*count)++;
+    }
+
+    if (i > 0)
+    {
+        for (i = 0; i < *count; i++)
+            free(writes[i].data);
+        *count = 0;
+        freeReplyObject(reply);
+        return EXIT_FAILURE;
+    }
+
+    freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
+}
+
+int redis_set_add(struct kv_store* handle, char* fmt, uint64_t id)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, fmt, id);
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_set_remove(struct kv_store* handle, char* fmt, uint64_t id,
+                     uint64_t* result)
+{
+    redisReply* reply;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, fmt, id);
+
+    if (reply->type == REDIS_REPLY_INTEGER)
+    {
+        *result = (uint64_t) reply->integer;
+    }
+    else
+    {
+        *result = 0;
+    }
+
+    return check_redis_return(handle, reply);
+}
+
+int redis_set_reset(struct kv_store* handle)
+{
+    redisReply* reply;
+    redisReply* reply2;
+    redis_flush_pipeline(handle);
+    reply = kv_command(handle, REDIS_RESET_CREATED);
+    reply2 = kv_command(handle, REDIS_RESET_DELETED);
+
+    return check_redis_return(handle, reply) ||
+           check_redis_return(handle, reply2);
+}
+
+int redis_delete_key(struct kv_store* handle, char* fmt, uint64_t id)
+{
+    kv_append_command(handle, fmt, id);
+    return EXIT_SUCCESS;
+}
+
+void redis_shutdown(int exit_value, struct kv_store* handle)
+{
+    if (handle)
+    {
+        /* the I/O thread exits once everything queued is written */
+        if (handle->io_running)
+        {
+            __atomic_store_n(&(handle->shutdown), true, __ATOMIC_RELEASE);
+            sem_post(&(handle->pending));
+            pthread_join(handle->io_thread, NULL);
+        }
+
+        redis_destroy(handle);
+    }
+}
+
+int redis_spill_configure(struct kv_store* handle, size_t mem_budget,
+                          const char* path, size_t disk_budget)
+{
+    struct spillq* spill, *old;
+    int64_t sector;
+    uint8_t* data;
+    size_t len;
+
+    if ((spill = spillq_init(mem_budget, path, disk_budget)) == NULL)
+        return EXIT_FAILURE;
+
+    /* records already spilled move over in order */
+    pthread_mutex_lock(&(handle->spill_lock));
+    old = handle->spill;
+
+    while (spillq_pop(old, &sector, &data, &len) == 1)
+    {
+        if (spillq_push(spill, sector, data, len))
+            __atomic_sub_fetch(&(handle->spilled), 1, __ATOMIC_RELEASE);
+        free(data);
+    }
+
+    handle->spill = spill;
+    pthread_mutex_unlock(&(handle->spill_lock));
+
+    spillq_destroy(old);
+
+    return EXIT_SUCCESS;
+}
+
+void redis_spill_stats(struct kv_store* handle, struct spillq_stats* stats)
+{
+    pthread_mutex_lock(&(handle->spill_lock));
+    spillq_get_stats(handle->spill, stats);
+    pthread_mutex_unlock(&(handle->spill_lock));
+}
+
+void redis_pending_configure(struct kv_store* handle, size_t budget)
+{
+    pending_cache_configure(handle->pending_writes, budget);
+}
+
+void redis_pending_stats(struct kv_store* handle,
+                         struct clock_cache_stats* stats)
+{
+    pending_cache_get_stats(handle->pending_writes, stats);
+}
+
+int redis_flush_configure(struct kv_store* handle, uint64_t max_cmds,
+                          size_t max_bytes, uint64_t deadline)
+{
+    if (max_cmds == 0 || max_bytes == 0 || deadline == 0)
+        return EXIT_FAILURE;
+
+    __atomic_store_n(&(handle->max_cmds), max_cmds, __ATOMIC_RELAXED);
+    __atomic_store_n(&(handle->max_bytes), max_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&(handle->deadline), deadline, __ATOMIC_RELAXED);
+
+    return EXIT_SUCCESS;
+}
+
+void redis_flush_stats(struct kv_store* handle, struct redis_flush_stats* stats)
+{
+    stats->depth = __atomic_load_n(&(handle->stats.depth), __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&(handle->stats.bytes), __ATOMIC_RELAXED);
+    stats->queued_bytes = __atomic_load_n(&(handle->queued_bytes),
+                                          __ATOMIC_RELAXED);
+    stats->flushes = __atomic_load_n(&(handle->stats.flushes),
+                                     __ATOMIC_RELAXED);
+    stats->last_latency = __atomic_load_n(&(handle->stats.last_latency),
+                                          __ATOMIC_RELAXED);
+    stats->max_latency = __atomic_load_n(&(handle->stats.max_latency),
+                                         __ATOMIC_RELAXED);
+    stats->total_latency = __atomic_load_n(&(handle->stats.total_latency),
+                                           __ATOMIC_RELAXED);
+}
+
+/* the embedded engine runs no scripts, so there each file script's steps go
+ * out as plain commands; they are not atomic, which is safe because only the
+ * inferencer's serialized metadata lane changes file records */
+int redis_file_create_plain(struct kv_store* handle, uint64_t inode_num,
+                            uint64_t files_id, const uint8_t* path,
+                            size_t len, const struct redis_hash_field* fields,
+                            size_t count, uint64_t* id)
+{
+    const char* argv[2 * REDIS_HASH_FIELDS_MAX + 4];
+    size_t argvlen[2 * REDIS_HASH_FIELDS_MAX + 4];
+    char key[REDIS_HASH_KEY_MAX];
+    int64_t result;
+    size_t i;
+
+    if (redis_script_integer(kv_command(handle, REDIS_FCOUNTER), &result))
+        return EXIT_FAILURE;
+
+    *id = (uint64_t) result;
+
+    argv[0] = "HMSET";
+    argvlen[0] = strlen(argv[0]);
+    argv[1] = key;
+    argvlen[1] = snprintf(key, sizeof(key), REDIS_FILE_KEY, *id);
+    argv[2] = "path";
+    argvlen[2] = strlen(argv[2]);
+    argv[3] = (const char*) path;
+    argvlen[3] = len;
+
+    for (i = 0; i < count; i++)
+    {
+        argv[2 * i + 4] = fields[i].name;
+        argvlen[2 * i + 4] = strlen(fields[i].name);
+        argv[2 * i + 5] = (const char*) fields[i].data;
+        argvlen[2 * i + 5] = fields[i].len;
     }
 
-    return check_redis_return(handle, reply);
+    if (check_redis_return(handle, kv_command_argv(handle,
+                                                   (int) (2 * count + 4),
+                                                   argv, argvlen)) ||
+        check_redis_return(handle, kv_command(handle, REDIS_FILES_INSERT,
+                                              files_id, *id)) ||
+        check_redis_return(handle, kv_command(handle, REDIS_INODE_INSERT,
+                                              inode_num, *id)) ||
+        check_redis_return(handle, kv_command(handle, REDIS_PATH_SET, path,
+                                              len, *id)))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
 }
 
-int redis_metadata_set(struct kv_store* handle, const uint8_t* data,
-                       size_t len)
+/* appends id to a growable array of file ids or sectors */
+int redis_ids_push(uint64_t** ids, size_t* count, size_t* capacity,
+                   uint64_t id)
 {
-    redisAppendCommand(handle->connection, REDIS_MD_FILTER_SET, data, len);
-    handle->outstanding_pipelined_cmds++;
+    uint64_t* grown;
 
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
+    if (*count == *capacity)
     {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
+        *capacity = *capacity ? 2 * *capacity : 16;
+        grown = (uint64_t*) realloc(*ids, *capacity * sizeof(uint64_t));
+
+        if (grown == NULL)
+            return EXIT_FAILURE;
+
+        *ids = grown;
     }
+
+    (*ids)[(*count)++] = id;
+
     return EXIT_SUCCESS;
 }
 
-int redis_metadata_get(struct kv_store* handle, uint8_t** data,
-                       size_t* len)
+/* drops path:<path> only while it still names file id */
+int redis_path_drop(struct kv_store* handle, const uint8_t* path, size_t len,
+                    uint64_t id)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, REDIS_MD_FILTER_GET);
+    uint64_t current = 0;
 
-    if (reply->type == REDIS_REPLY_STRING &&
-        reply->len > 0)
+    if (redis_path_get(handle, path, len, &current))
+        return EXIT_FAILURE;
+
+    if (current != id)
+        return EXIT_SUCCESS;
+
+    return check_redis_return(handle, kv_command(handle, REDIS_PATH_DELETE,
+                                                 path, len));
+}
+
+/* releases the blocks a file's filesectors list still owns: directory
+ * blocks with their entries, and data blocks the file still holds */
+int redis_file_sectors_release(struct kv_store* handle, uint64_t id,
+                               uint64_t** sectors, size_t* count,
+                               size_t* capacity)
+{
+    struct sector_descriptor desc;
+    redisReply* reply, *target, *sector;
+    int64_t number;
+    bool drop;
+    size_t i;
+
+    if ((reply = kv_command(handle, REDIS_FILE_SECTORS_LGET, id)) == NULL)
+        return EXIT_FAILURE;
+
+    for (i = 0; reply->type == REDIS_REPLY_ARRAY && i < reply->elements; i++)
     {
-        *data = (uint8_t*) malloc(reply->len);
-        memcpy(*data, reply->str, reply->len);
-        *len = reply->len;
+        sector = reply->element[i];
+        target = kv_command(handle, REDIS_KEY_GET, sector->str,
+                            (size_t) sector->len);
+
+        drop = false;
+
+        if (target && target->type == REDIS_REPLY_STRING &&
+            redis_sector_unpack((const uint8_t*) target->str, target->len,
+                                &desc) == EXIT_SUCCESS)
+        {
+            if (desc.type == SECTOR_PTR_DIRDATA)
+                drop = check_redis_return(handle,
+                                          kv_command(handle, REDIS_DIR_DELETE,
+                                                     sector->str,
+                                                     (size_t) sector->len,
+                                                     desc.id, desc.id)) ==
+                       EXIT_SUCCESS;
+            else if (desc.type == SECTOR_PTR_FILE_DATA && desc.id == id)
+                drop = check_redis_return(handle,
+                                          kv_command(handle, REDIS_KEY_DELETE,
+                                                     sector->str,
+                                                     (size_t) sector->len)) ==
+                       EXIT_SUCCESS;
+        }
+
+        if (drop && redis_parse_number((const uint8_t*) sector->str,
+                                       sector->len, &number))
+            redis_ids_push(sectors, count, capacity, (uint64_t) number);
+
+        if (target)
+            freeReplyObject(target);
     }
 
-    return check_redis_return(handle, reply);
+    freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
 }
 
-int redis_get_fcounter(struct kv_store* handle, uint64_t* counter)
+/* deletes each of a file's extents with the sector that points at it */
+int redis_file_extents_release(struct kv_store* handle, uint64_t id,
+                               uint64_t** sectors, size_t* count,
+                               size_t* capacity)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, REDIS_FCOUNTER);
+    redisReply* reply, *extent;
+    size_t prefix = strlen(REDIS_EXTENT_PREFIX), i;
+    int64_t number;
 
-    if (reply->type == REDIS_REPLY_INTEGER)
+    if ((reply = kv_command(handle, REDIS_EXTENTS_LGET, id)) == NULL)
+        return EXIT_FAILURE;
+
+    for (i = 0; reply->type == REDIS_REPLY_ARRAY && i < reply->elements; i++)
     {
-        *counter = reply->integer;
+        extent = reply->element[i];
+
+        if (extent->type != REDIS_REPLY_STRING || extent->len < prefix)
+            continue;
+
+        if (check_redis_return(handle,
+                               kv_command(handle, REDIS_EXTENT_DELETE,
+                                          extent->str, (size_t) extent->len,
+                                          &(extent->str[prefix]),
+                                          extent->len - prefix)) ==
+            EXIT_SUCCESS &&
+            redis_parse_number((const uint8_t*) extent->str, extent->len,
+                               &number))
+            redis_ids_push(sectors, count, capacity, (uint64_t) number);
     }
 
-    return check_redis_return(handle, reply);
+    freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
 }
 
-int redis_set_fcounter(struct kv_store* handle, uint64_t counter)
+int redis_file_delete_plain(struct kv_store* handle, uint64_t id,
+                            uint64_t inode_num, uint64_t files_id,
+                            const uint8_t* path, size_t len, bool* released,
+                            uint64_t** sectors, size_t* count)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, REDIS_FCOUNTER_SET, counter);
+    uint64_t links = 0;
+    size_t capacity = 0;
+
+    if (check_redis_return(handle, kv_command(handle, REDIS_INODE_REMOVE,
+                                              inode_num, id)) ||
+        check_redis_return(handle, kv_command(handle, REDIS_FILES_REMOVE,
+                                              files_id, id)) ||
+        redis_path_drop(handle, path, len, id) ||
+        redis_list_len(handle, REDIS_INODE_LLEN, inode_num, &links))
+        return EXIT_FAILURE;
 
-    return check_redis_return(handle, reply);
+    *released = links == 0;
+
+    if (*released &&
+        (redis_file_sectors_release(handle, id, sectors, count, &capacity) ||
+         redis_file_extents_release(handle, id, sectors, count, &capacity)))
+        return EXIT_FAILURE;
+
+    return check_redis_return(handle, kv_command(handle,
+                                                 REDIS_FILE_RECORD_DELETE,
+                                                 id, id, id));
 }
 
-int redis_list_get(struct kv_store* handle, char* fmt, uint64_t src,
-                   uint8_t** result[], size_t* len)
+/* pushes the file ids linked from the entries of a directory block, skipping
+ * . and .. */
+int redis_dir_children(struct kv_store* handle, const char* sector,
+                       size_t len, uint64_t** stack, size_t* depth,
+                       size_t* capacity)
 {
-    uint64_t i;
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, fmt, src);
+    size_t prefix = strlen(REDIS_SECTOR_PREFIX), i, j;
+    redisReply* dentries, *files, *dentry;
+    uint64_t inode;
+    int64_t child;
+    int ret = EXIT_SUCCESS;
+
+    if (len < prefix || (dentries = kv_command(handle,
+                                               REDIS_DIR_FILES_LGET_KEY,
+                                               &(sector[prefix]),
+                                               len - prefix)) == NULL)
+        return EXIT_FAILURE;
 
-    if (reply->type == REDIS_REPLY_ARRAY)
+    for (i = 0; dentries->type == REDIS_REPLY_ARRAY &&
+                i < dentries->elements && ret == EXIT_SUCCESS; i++)
     {
-        *len = reply->elements;
-        *result = malloc(sizeof(uint8_t*) * (*len));
-
-        if (*result == NULL)
-            return EXIT_FAILURE;
+        dentry = dentries->element[i];
 
-        for (i = 0; i < *len; i++)
-        {
-            if (reply->element[i]->type != REDIS_REPLY_STRING)
-            {
-                check_redis_return(handle, reply);
-                free(*result);
-                *result = NULL;
-                return EXIT_FAILURE;
-            }
+        if (dentry->type != REDIS_REPLY_STRING ||
+            dentry->len <= (int) sizeof(inode) ||
+            (dentry->len == sizeof(inode) + 1 &&
+             dentry->str[sizeof(inode)] == '.') ||
+            (dentry->len == sizeof(inode) + 2 &&
+             memcmp(&(dentry->str[sizeof(inode)]), "..", 2) == 0))
+            continue;
 
-            (*result)[i] = (uint8_t*) malloc(reply->element[i]->len + 1);
+        memcpy(&inode, dentry->str, sizeof(inode));
 
-            memcpy((*result)[i], reply->element[i]->str,
-                   (size_t) reply->element[i]->len);
+        if ((files = kv_command(handle, REDIS_INODE_LGET, inode)) == NULL)
+        {
+            ret = EXIT_FAILURE;
+            break;
+        }
 
-            (*result)[i][reply->element[i]->len] = 0;
+        for (j = 0; files->type == REDIS_REPLY_ARRAY && j < files->elements;
+             j++)
+        {
+            if (files->element[j]->type == REDIS_REPLY_STRING &&
+                redis_parse_number((const uint8_t*) files->element[j]->str,
+                                   files->element[j]->len, &child) &&
+                redis_ids_push(stack, depth, capacity, (uint64_t) child))
+                ret = EXIT_FAILURE;
         }
+
+        freeReplyObject(files);
     }
 
-    return check_redis_return(handle, reply);
+    freeReplyObject(dentries);
+
+    return ret;
 }
 
-int redis_list_get_var(struct kv_store* handle, char* fmt, uint64_t src,
-                       uint8_t** result[], size_t* len, int64_t start,
-                       int64_t end)
+/* renames one file found under old_path, queueing a directory's children */
+int redis_file_move(struct kv_store* handle, uint64_t id,
+                    const uint8_t* old_path, size_t old_len,
+                    const uint8_t* new_path, size_t new_len,
+                    uint64_t** stack, size_t* depth, size_t* capacity,
+                    bool* moved)
 {
-    uint64_t i;
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, fmt, src, start, end);
+    redisReply* fields, *sectors, *path, *is_dir;
+    uint8_t* target;
+    size_t target_len, i;
+    int ret = EXIT_SUCCESS;
 
-    if (reply->type == REDIS_REPLY_ARRAY)
+    *moved = false;
+
+    if ((fields = kv_command(handle, REDIS_FILE_PATH_FIELDS, id)) == NULL)
+        return EXIT_FAILURE;
+
+    if (fields->type != REDIS_REPLY_ARRAY || fields->elements != 2)
     {
-        *len = reply->elements;
-        *result = malloc(sizeof(uint8_t*) * (*len));
+        freeReplyObject(fields);
+        return EXIT_FAILURE;
+    }
 
-        if (*result == NULL)
-            return EXIT_FAILURE;
+    path = fields->element[0];
+    is_dir = fields->element[1];
 
-        for (i = 0; i < *len; i++)
-        {
-            if (reply->element[i]->type != REDIS_REPLY_STRING)
-            {
-                check_redis_return(handle, reply);
-                free(*result);
-                *result = NULL;
-                return EXIT_FAILURE;
-            }
+    if (path->type != REDIS_REPLY_STRING || (size_t) path->len < old_len ||
+        memcmp(path->str, old_path, old_len) ||
+        ((size_t) path->len != old_len && path->str[old_len] != '/'))
+    {
+        freeReplyObject(fields);
+        return EXIT_SUCCESS;
+    }
+
+    target_len = new_len + path->len - old_len;
 
-            (*result)[i] = (uint8_t*) malloc(reply->len + 1);
+    if ((target = (uint8_t*) malloc(target_len ? target_len : 1)) == NULL)
+    {
+        freeReplyObject(fields);
+        return EXIT_FAILURE;
+    }
 
-            memcpy((*result)[i], reply->element[i]->str,
-                   (size_t) reply->element[i]->len);
+    memcpy(target, new_path, new_len);
+    memcpy(&(target[new_len]), &(path->str[old_len]), path->len - old_len);
 
-            (*result)[i][reply->element[i]->len] = 0;
-        }
+    if (check_redis_return(handle, kv_command(handle, REDIS_FILE_PATH_SET, id,
+                                              target, target_len)) ||
+        redis_path_drop(handle, (const uint8_t*) path->str, path->len, id) ||
+        check_redis_return(handle, kv_command(handle, REDIS_PATH_SET, target,
+                                              target_len, id)))
+        ret = EXIT_FAILURE;
+
+    *moved = ret == EXIT_SUCCESS;
+    free(target);
+
+    if (ret == EXIT_SUCCESS && is_dir->type == REDIS_REPLY_STRING &&
+        is_dir->len > 0 && is_dir->str[0] == 1)
+    {
+        if ((sectors = kv_command(handle, REDIS_FILE_SECTORS_LGET, id)) ==
+            NULL)
+            ret = EXIT_FAILURE;
+
+        for (i = 0; sectors && sectors->type == REDIS_REPLY_ARRAY &&
+                    i < sectors->elements && ret == EXIT_SUCCESS; i++)
+            ret = redis_dir_children(handle, sectors->element[i]->str,
+                                     sectors->element[i]->len, stack, depth,
+                                     capacity);
+
+        if (sectors)
+            freeReplyObject(sectors);
     }
 
-    return check_redis_return(handle, reply);
+    freeReplyObject(fields);
+
+    return ret;
 }
 
-void redis_free_list(uint8_t* list[], size_t len)
+int redis_file_rename_plain(struct kv_store* handle, uint64_t id,
+                            const uint8_t* old_path, size_t old_len,
+                            const uint8_t* new_path, size_t new_len,
+                            uint64_t* renamed)
 {
-    size_t i;
+    uint64_t* stack = NULL, *seen = NULL;
+    size_t depth = 0, stack_cap = 0, nseen = 0, seen_cap = 0, i;
+    bool moved;
+    int ret = redis_ids_push(&stack, &depth, &stack_cap, id);
 
-    if (list)
+    *renamed = 0;
+
+    while (ret == EXIT_SUCCESS && depth > 0)
     {
-        for (i = 0; i < len; i++)
+        id = stack[--depth];
+
+        for (i = 0; i < nseen && seen[i] != id; i++);
+
+        if (i < nseen)
+            continue;
+
+        if ((ret = redis_file_move(handle, id, old_path, old_len, new_path,
+                                   new_len, &stack, &depth, &stack_cap,
+                                   &moved)) == EXIT_SUCCESS && moved)
         {
-            if (list[i])
-                free(list[i]);
+            ret = redis_ids_push(&seen, &nseen, &seen_cap, id);
+            (*renamed)++;
         }
-        free(list);
     }
+
+    free(stack);
+    free(seen);
+
+    return ret;
 }
 
-int redis_async_write_enqueue(struct kv_store* handle, struct bitarray* bits,
-                              int64_t sector, uint8_t* data, size_t len)
+int redis_file_create(struct kv_store* handle, uint64_t inode_num,
+                      uint64_t files_id, const uint8_t* path, size_t len,
+                      const struct redis_hash_field* fields, size_t count,
+                      uint64_t* id)
 {
-    struct thread_job* job;
-    pthread_t thread;
+    const char* argv[2 * REDIS_HASH_FIELDS_MAX + 3];
+    size_t argvlen[2 * REDIS_HASH_FIELDS_MAX + 3];
+    char inode[REDIS_ID_MAX], files[REDIS_ID_MAX];
+    int64_t result;
+    size_t i;
 
-    if (pthread_mutex_trylock(&(handle->conn_lock)))
-    {
-        if (!bitarray_get_bit(bits, sector / 4096))
-            return EXIT_FAILURE;
-        else
-            pthread_mutex_lock(&(handle->conn_lock));
-    }
+    if (count > REDIS_HASH_FIELDS_MAX)
+        return EXIT_FAILURE;
 
-    if (pthread_mutex_trylock(&(handle->cmd_lock)))
-    {
-        if (!bitarray_get_bit(bits, sector / 4096))
-        {
-            pthread_mutex_unlock(&(handle->conn_lock));
-            return EXIT_FAILURE;
-        }
-        else
-            pthread_mutex_lock(&(handle->cmd_lock));
-    }
-
-    redisAppendCommand(handle->connection, REDIS_ASYNC_QUEUE_PUSH,
-                                           &sector,
-                                           sizeof(sector));
-    redisAppendCommand(handle->connection, REDIS_ASYNC_QUEUE_PUSH,
-                                           data,
-                                           len);
-    pthread_mutex_unlock(&(handle->conn_lock));
-
-    handle->outstanding_pipelined_cmds++;
-    handle->outstanding_bytes += sizeof(sector);
-    handle->outstanding_pipelined_cmds++;
-    handle->outstanding_bytes += len;
-
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED ||
-        handle->outstanding_bytes > REDIS_DEFAULT_BYTES)
-    {
-        job = (struct thread_job*) malloc(sizeof(struct thread_job));
-        job->handle = handle;
-        job->cmds_to_process = handle->outstanding_pipelined_cmds;
-        handle->outstanding_pipelined_cmds = 0;
-        pthread_mutex_unlock(&(handle->cmd_lock));
-        sem_post(&(handle->thread_counter));
-        if (pthread_create(&thread, NULL, redis_flush_thread_pipeline, job))
-        {
-            assert(false);
-        }
-        handle->outstanding_bytes = 0;
-    }
-    else
+    if (handle->backend == &mem_backend)
+        return redis_file_create_plain(handle, inode_num, files_id, path, len,
+                                       fields, count, id);
+
+    argv[0] = inode;
+    argvlen[0] = snprintf(inode, sizeof(inode), "%"PRIu64, inode_num);
+    argv[1] = files;
+    argvlen[1] = snprintf(files, sizeof(files), "%"PRIu64, files_id);
+    argv[2] = (const char*) path;
+    argvlen[2] = len;
+
+    for (i = 0; i < count; i++)
     {
-        pthread_mutex_unlock(&(handle->cmd_lock));
+        argv[2 * i + 3] = fields[i].name;
+        argvlen[2 * i + 3] = strlen(fields[i].name);
+        argv[2 * i + 4] = (const char*) fields[i].data;
+        argvlen[2 * i + 4] = fields[i].len;
     }
 
+    if (redis_script_integer(redis_script_call(handle,
+                                               REDIS_SCRIPT_FILE_CREATE, 0,
+                                               (int) (2 * count + 3), argv,
+                                               argvlen), &result))
+        return EXIT_FAILURE;
+
+    *id = (uint64_t) result;
+
     return EXIT_SUCCESS;
 }
 
-int redis_async_write_dequeue(struct kv_store* handle,
-                              struct qemu_bdrv_write* write)
+int redis_file_delete(struct kv_store* handle, uint64_t id,
+                      uint64_t inode_num, uint64_t files_id,
+                      const uint8_t* path, size_t len, bool* released,
+                      uint64_t** sectors, size_t* count)
 {
+    const char* argv[4];
+    size_t argvlen[4];
+    char file[REDIS_ID_MAX], inode[REDIS_ID_MAX], files[REDIS_ID_MAX];
     redisReply* reply;
-    redis_flush_pipeline(handle);
+    size_t i;
 
-    /* get sector number */
-    reply = redisCommand(handle->connection, REDIS_ASYNC_QUEUE_POP);
+    *sectors = NULL;
+    *count = 0;
 
-    if (reply->type == REDIS_REPLY_ARRAY &&
-        reply->elements == 2 &&
-        reply->element[1]->type == REDIS_REPLY_STRING &&
-        reply->element[1]->len == sizeof(write->header.sector_num))
-    {
-        memcpy((uint8_t*) &(write->header.sector_num),
-               reply->element[1]->str, reply->element[1]->len);
-    }
-    else
+    if (handle->backend == &mem_backend)
+        return redis_file_delete_plain(handle, id, inode_num, files_id, path,
+                                       len, released, sectors, count);
+
+    argv[0] = file;
+    argvlen[0] = snprintf(file, sizeof(file), "%"PRIu64, id);
+    argv[1] = inode;
+    argvlen[1] = snprintf(inode, sizeof(inode), "%"PRIu64, inode_num);
+    argv[2] = files;
+    argvlen[2] = snprintf(files, sizeof(files), "%"PRIu64, files_id);
+    argv[3] = (const char*) path;
+    argvlen[3] = len;
+
+    reply = redis_script_call(handle, REDIS_SCRIPT_FILE_DELETE, 0, 4, argv,
+                              argvlen);
+
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY ||
+        reply->elements == 0 ||
+        reply->element[0]->type != REDIS_REPLY_INTEGER)
     {
-        fprintf(stdout, "Error len: %d\n", reply->element[1]->len);
-        write->header.sector_num = -1;
-        exit(1);
+        if (reply && reply->type == REDIS_REPLY_ERROR)
+            log_error("Script failed: %s\n", reply->str);
+        if (reply)
+            freeReplyObject(reply);
         return EXIT_FAILURE;
     }
 
-    check_redis_return(handle, reply);
-
-    /* get write data */
-    reply = redisCommand(handle->connection, REDIS_ASYNC_QUEUE_POP);
+    *released = reply->element[0]->integer != 0;
 
-    if (reply->type == REDIS_REPLY_ARRAY &&
-        reply->elements == 2)
+    if (reply->elements > 1 &&
+        (*sectors = (uint64_t*) malloc((reply->elements - 1) *
+                                       sizeof(uint64_t))) == NULL)
     {
-        write->data = NULL;
-        write->data = malloc(reply->element[1]->len);
-        if (write->data)
-        {
-            memcpy(write->data, reply->element[1]->str,
-                                reply->element[1]->len);
-            write->header.nb_sectors = reply->element[1]->len / SECTOR_SIZE;
-        }
-        else
-        {
-            write->header.nb_sectors = 0;
-            return EXIT_FAILURE;
-        }
+        freeReplyObject(reply);
+        return EXIT_FAILURE;
     }
-    else
+
+    for (i = 1; i < reply->elements; i++)
     {
-        fprintf(stderr, "Error second part of array.\n");
-        write->header.nb_sectors = 0;
-        write->data = NULL;
-        exit(1);
-        return EXIT_FAILURE;
+        if (reply->element[i]->type == REDIS_REPLY_INTEGER)
+            (*sectors)[(*count)++] = (uint64_t) reply->element[i]->integer;
     }
 
-    return check_redis_return(handle, reply);
+    freeReplyObject(reply);
+
+    return EXIT_SUCCESS;
 }
 
-int redis_set_add(struct kv_store* handle, char* fmt, uint64_t id)
+int redis_file_rename(struct kv_store* handle, uint64_t id,
+                      const uint8_t* old_path, size_t old_len,
+                      const uint8_t* new_path, size_t new_len,
+                      uint64_t* renamed)
+{
+    const char* argv[3];
+    size_t argvlen[3];
+    char file[REDIS_ID_MAX];
+    int64_t result;
+
+    if (handle->backend == &mem_backend)
+        return redis_file_rename_plain(handle, id, old_path, old_len,
+                                       new_path, new_len, renamed);
+
+    argv[0] = file;
+    argvlen[0] = snprintf(file, sizeof(file), "%"PRIu64, id);
+    argv[1] = (const char*) old_path;
+    argvlen[1] = old_len;
+    argv[2] = (const char*) new_path;
+    argvlen[2] = new_len;
+
+    if (redis_script_integer(redis_script_call(handle,
+                                               REDIS_SCRIPT_FILE_RENAME, 0, 3,
+                                               argv, argvlen), &result))
+        return EXIT_FAILURE;
+
+    *renamed = (uint64_t) result;
+
+    return EXIT_SUCCESS;
+}
+
+int redis_file_detach(struct kv_store* handle, uint64_t id,
+                      uint64_t inode_num, const uint8_t* path, size_t len)
+{
+    if (redis_path_drop(handle, path, len, id))
+        return EXIT_FAILURE;
+
+    return check_redis_return(handle, kv_command(handle, REDIS_DETACHED_SET,
+                                                 inode_num, id));
+}
+
+int redis_file_detached(struct kv_store* handle, uint64_t inode_num,
+                        uint64_t* id)
 {
     redisReply* reply;
+
+    *id = UINT64_MAX;
     redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, fmt, id);
+
+    if ((reply = kv_command(handle, REDIS_DETACHED_GET, inode_num)) == NULL)
+        return EXIT_FAILURE;
+
+    if (reply->type == REDIS_REPLY_STRING && reply->len > 0)
+        sscanf(reply->str, "%"SCNu64, id);
 
     return check_redis_return(handle, reply);
 }
 
-int redis_set_remove(struct kv_store* handle, char* fmt, uint64_t id,
-                     uint64_t* result)
+struct kv_async* redis_async_open(struct kv_store* handle)
 {
-    redisReply* reply;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, fmt, id);
+    struct kv_async* async = (struct kv_async*)
+                             calloc(1, sizeof(struct kv_async));
 
-    if (reply->type == REDIS_REPLY_INTEGER)
+    if (async == NULL)
+        return NULL;
+
+    async->store = handle;
+
+    if (handle->backend == &mem_backend)
+        return async;
+
+    if ((async->eb = event_base_new()) == NULL)
     {
-        *result = (uint64_t) reply->integer;
+        free(async);
+        return NULL;
     }
+
+    if (handle->spec.transport == KV_SPEC_UNIX)
+        async->context = redisAsyncConnectUnix(handle->spec.address);
     else
+        async->context = redisAsyncConnect(handle->spec.address,
+                                           handle->spec.port);
+
+    if (async->context)
+        async->context->data = async;
+
+    if (async->context == NULL || async->context->err ||
+        redisLibeventAttach(async->context, async->eb) != REDIS_OK ||
+        redisAsyncSetDisconnectCallback(async->context,
+                                        redis_async_disconnect) != REDIS_OK ||
+        redisAsyncCommand(async->context, NULL, NULL, "SELECT %s",
+                          handle->spec.db) != REDIS_OK)
     {
-        *result = 0;
+        log_error("Failed opening async kv connection.\n");
+        if (async->context)
+            redisAsyncFree(async->context);
+        event_base_free(async->eb);
+        free(async);
+        return NULL;
     }
 
-    return check_redis_return(handle, reply);
+    return async;
 }
 
-int redis_set_reset(struct kv_store* handle)
+void redis_async_close(struct kv_async* async)
 {
-    redisReply* reply;
-    redisReply* reply2;
-    redis_flush_pipeline(handle);
-    reply = redisCommand(handle->connection, REDIS_RESET_CREATED);
-    reply2 = redisCommand(handle->connection, REDIS_RESET_DELETED);
+    if (async == NULL)
+        return;
 
-    return check_redis_return(handle, reply) ||
-           check_redis_return(handle, reply2);
+    redis_async_wait(async);
+
+    if (async->context)
+        redisAsyncFree(async->context);
+
+    if (async->eb)
+        event_base_free(async->eb);
+
+    free(async);
 }
 
-int redis_delete_key(struct kv_store* handle, char* fmt, uint64_t id)
+/* runs the event loop until every lookup issued so far has completed */
+int redis_async_wait(struct kv_async* async)
 {
-    redisAppendCommand(handle->connection, fmt, id);
-    handle->outstanding_pipelined_cmds++;
-
-    if (handle->outstanding_pipelined_cmds >= REDIS_DEFAULT_PIPELINED)
+    while (async->outstanding && async->context)
     {
-        if (redis_flush_pipeline(handle))
-        {
-            assert(false);
-        }
+        if (event_base_loop(async->eb, EVLOOP_ONCE) < 0)
+            return EXIT_FAILURE;
     }
-    return EXIT_SUCCESS;
+
+    return async->outstanding ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-void redis_shutdown(int exit_value, struct kv_store* handle)
+int redis_async_hash_fields_get(struct kv_async* async, const char* key_fmt,
+                                uint64_t src, struct redis_hash_field* fields,
+                                size_t count, redis_async_callback callback,
+                                void* arg)
 {
-    int outstanding = 0;
+    const char* argv[REDIS_HASH_FIELDS_MAX + 2];
+    size_t argvlen[REDIS_HASH_FIELDS_MAX + 2];
+    char key[REDIS_HASH_KEY_MAX];
+    struct kv_async_request* request;
 
-    if (handle)
-    {
-        /* wait for all threads */
-        handle->shutdown = true;
-        sem_getvalue(&(handle->thread_counter), &outstanding);
-        while (outstanding != 0)
-        {
-            fprintf(stderr, "waiting for threads: %d\n", outstanding);
-            sem_getvalue(&(handle->thread_counter), &outstanding);
-            sleep(1);
-        }
+    if (redis_fields_argv(key_fmt, src, fields, count, key, argv, argvlen))
+        return EXIT_FAILURE;
 
-        redis_flush_pipeline(handle);
+    if ((request = redis_async_request(async, KV_ASYNC_FIELDS, callback,
+                                       arg)) == NULL)
+        return EXIT_FAILURE;
 
-        if (handle->connection)
-        {
-            redisFree(handle->connection);
-        }
+    request->fields = fields;
+    request->count = count;
 
-        pthread_mutex_destroy(&(handle->flush_lock));
-        pthread_mutex_destroy(&(handle->conn_lock));
-        pthread_mutex_destroy(&(handle->cmd_lock));
-        sem_destroy(&(handle->thread_counter));
-        free(handle);
-    }
+    return redis_async_issue_argv(request, (int) count + 2, argv, argvlen);
+}
+
+int redis_async_list_foreach(struct kv_async* async, char* fmt, uint64_t src,
+                             redis_list_callback each, void* each_arg,
+                             redis_async_callback callback, void* arg)
+{
+    struct kv_async_request* request;
+
+    if ((request = redis_async_request(async, KV_ASYNC_FOREACH, callback,
+                                       arg)) == NULL)
+        return EXIT_FAILURE;
+
+    request->each = each;
+    request->each_arg = each_arg;
+
+    return redis_async_issue(request, fmt, src);
+}
+
+int redis_async_list_len(struct kv_async* async, char* fmt, uint64_t src,
+                         uint64_t* len, redis_async_callback callback,
+                         void* arg)
+{
+    struct kv_async_request* request;
+
+    if ((request = redis_async_request(async, KV_ASYNC_INTEGER, callback,
+                                       arg)) == NULL)
+        return EXIT_FAILURE;
+
+    request->integer = len;
+
+    return redis_async_issue(request, fmt, src);
 }
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ * alloc_map.h                                                               *
+ *                                                                           *
+ * This file contains function prototypes for a set of sector ranges the     *
+ * guest has just allocated, each tagged with its block group, kept until    *
+ * the metadata mapping them arrives.                                        *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_ALLOC_MAP_H
+#define __GAMMARAY_ALLOC_MAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ALLOC_MAP_DEFAULT_RANGES 65536 /* ranges held before adds fail */
+
+struct alloc_map;
+
+struct alloc_map_stats
+{
+    uint64_t ranges;
+    uint64_t sectors;  /* covered by every range held */
+    uint64_t added;    /* sectors newly recorded */
+    uint64_t removed;  /* sectors mapped or freed since */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t rejected; /* adds refused with the map full */
+};
+
+struct alloc_map* alloc_map_init(size_t max_ranges);
+void alloc_map_destroy(struct alloc_map* map);
+
+/* records [start, end) for group, replacing whatever overlapped it and
+ * merging with neighbouring ranges of the same group */
+int alloc_map_add(struct alloc_map* map, uint64_t group, uint64_t start,
+                  uint64_t end);
+/* forgets any part of [start, end) held, splitting ranges that straddle
+ * it; returns the sectors forgotten */
+uint64_t alloc_map_remove(struct alloc_map* map, uint64_t start,
+                          uint64_t end);
+/* whether sector lies in a range, and that range's group if so */
+bool alloc_map_lookup(struct alloc_map* map, uint64_t sector,
+                      uint64_t* group);
+void alloc_map_get_stats(struct alloc_map* map,
+                         struct alloc_map_stats* stats);
+
+#endif
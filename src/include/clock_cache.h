@@ -0,0 +1,69 @@
+/*****************************************************************************
+ * clock_cache.h                                                             *
+ *                                                                           *
+ * This file contains prototypes for functions implementing a hash table of  *
+ * byte strings under a byte budget with CLOCK eviction, which the pending   *
+ * write cache and the metadata shadow store are built on.                   *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_CLOCK_CACHE_H
+#define __GAMMARAY_CLOCK_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct clock_cache;
+
+struct clock_cache_stats
+{
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t pinned;           /* entries currently pinned */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t evicted_bytes;
+    uint64_t pinned_evictions; /* pinned entries evicted, nothing else left */
+    uint64_t rejected;         /* entries larger than the whole budget */
+};
+
+struct clock_cache* clock_cache_init(size_t budget);
+void clock_cache_destroy(struct clock_cache* cache);
+void clock_cache_configure(struct clock_cache* cache, size_t budget);
+
+/* pinned entries are only evicted once no unpinned entry is left; a put
+ * replaces whatever was held for key, and the new entry counts as
+ * referenced if it did */
+int clock_cache_put(struct clock_cache* cache, uint64_t key,
+                    const uint8_t* data, size_t len, bool pinned);
+/* copies the entry for key into data and marks it referenced; *len is the
+ * capacity of data on entry and the entry's size on return, false on a miss
+ * or if it did not fit */
+bool clock_cache_get(struct clock_cache* cache, uint64_t key, uint8_t* data,
+                     size_t* len);
+/* as clock_cache_get, but removes the entry, even one that did not fit */
+bool clock_cache_take(struct clock_cache* cache, uint64_t key, uint8_t* data,
+                      size_t* len);
+bool clock_cache_remove(struct clock_cache* cache, uint64_t key);
+void clock_cache_get_stats(struct clock_cache* cache,
+                           struct clock_cache_stats* stats);
+
+#endif
@@ -0,0 +1,59 @@
+/*****************************************************************************
+ * coalesce.h                                                                *
+ *                                                                           *
+ * This file contains prototypes for functions implementing a window which   *
+ * merges overlapping and adjacent QEMU writes, keeping the last write for   *
+ * each sector, before they are handed on for inference.                     *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_COALESCE_H
+#define __GAMMARAY_COALESCE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "qemu_common.h"
+
+#define COALESCE_DEFAULT_BYTES 67108864 /* bytes; 64 MiB */
+#define COALESCE_MAX_EXTENT 4194304 /* bytes; cap for adjacent merges */
+
+struct coalescer;
+
+struct coalesce_stats
+{
+    uint64_t writes_in;
+    uint64_t bytes_in;
+    uint64_t writes_out;
+    uint64_t bytes_out;
+};
+
+typedef int (*coalesce_emit)(void* ctx, struct qemu_bdrv_write* write);
+
+struct coalescer* coalesce_init(uint64_t window_us, uint64_t window_bytes);
+void coalesce_destroy(struct coalescer* window);
+
+int coalesce_add(struct coalescer* window, struct qemu_bdrv_write* write);
+bool coalesce_ready(struct coalescer* window);
+int64_t coalesce_remaining(struct coalescer* window);
+int coalesce_flush(struct coalescer* window, coalesce_emit emit, void* ctx);
+void coalesce_get_stats(struct coalescer* window,
+                        struct coalesce_stats* stats);
+
+#endif
@@ -27,11 +27,14 @@
 
 #include <stdbool.h>
 
+#include "alloc_map.h"
 #include "ext4.h"
+#include "log.h"
 #include "ntfs.h"
 #include "mbr.h"
 #include "redis_queue.h"
 #include "qemu_common.h"
+#include "shadow_store.h"
 
 #define FIELD_COMPARE(field, fname, type, btype) {\
     if (old->field != new->field) \
@@ -49,14 +52,23 @@
    len = sizeof(field); \
    if (redis_hash_field_get(store, cmd, id, \
                             #field, (uint8_t*) &field, &len)) \
-    fprintf_light_red(stderr, "Error getting field: %s\n", #field); }
+    log_error("Error getting field: %s\n", #field); }
 
 #define SET_FIELD(cmd, id, field, len) {\
    len = sizeof(new_##field); \
    if ((new_##field != field) && \
        redis_hash_field_set(store, cmd, id, \
                             #field, (uint8_t*) &new_##field, len)) \
-    fprintf_light_red(stderr, "Error setting field: %s\n", #field); }
+    log_error("Error setting field: %s\n", #field); }
+
+#define HASH_FIELD(field) { #field, (uint8_t*) &(field), sizeof(field) }
+
+#define HASH_FIELD_UPDATE(fields, count, field) {\
+    if (new_##field != field) { \
+        fields[count].name = #field; \
+        fields[count].data = (uint8_t*) &(new_##field); \
+        fields[count].len = sizeof(new_##field); \
+        count++; } }
 
 /* custom indexes */
 struct mbr
@@ -84,7 +96,7 @@ struct partition
     uint64_t final_sector_lba;
     uint64_t sector;
     struct ext4_fs fs;
-} __attribute__packed;
+} __attribute__((packed));
 
 struct ext4_file
 {
@@ -117,6 +129,11 @@ struct super_info
 } __attribute__((packed));
 
 /* functions */
+void qemu_set_async(struct kv_async* async);
+void qemu_set_aggregate(bool enable);
+void qemu_shadow_configure(size_t budget);
+void qemu_shadow_stats(struct clock_cache_stats* stats);
+void qemu_alloc_stats(struct alloc_map_stats* stats);
 int qemu_load_index(int index, struct kv_store* store);
 int qemu_print_write(struct qemu_bdrv_write* write);
 enum SECTOR_TYPE qemu_infer_sector_type(struct ext4_superblock* super,
@@ -144,4 +161,12 @@ int qemu_deep_inspect(struct super_info* superblock,
                       uint64_t write_counter, char* vmname,
                       uint64_t partition_offset,
                       int index);
+/* true with the owning file's *key when write may run on a worker: it only
+ * touches one file's data, and waits behind earlier writes to that file
+ * only.  False writes take the serializing lane, after every earlier write
+ * has finished and before any later one starts; that is where all metadata
+ * and every write to a block not yet mapped go */
+bool qemu_write_shard(struct super_info* superblock,
+                      struct qemu_bdrv_write* write, struct kv_store* store,
+                      uint64_t* key);
 #endif
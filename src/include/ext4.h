@@ -200,6 +200,15 @@ struct ext4_extent_idx
     uint16_t ei_unused;
 };
 
+struct ext4_dir_entry
+{
+    uint32_t inode;     /* 4 bytes */
+    uint16_t rec_len;   /* 6 bytes */
+    uint8_t name_len;   /* 7 bytes */
+    uint8_t file_type;  /* 8 bytes */
+    uint8_t name[255];  /* 263 bytes */
+} __attribute__((packed));
+
 int ext4_probe(int disk, struct fs* fs);
 int ext4_serialize(int disk, struct fs* fs, int serializef);
 int ext4_cleanup(struct fs* fs);
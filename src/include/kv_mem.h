@@ -0,0 +1,49 @@
+/*****************************************************************************
+ * kv_mem.h                                                                  *
+ *                                                                           *
+ * This file contains prototypes for functions implementing an embedded      *
+ * key-value engine which speaks the Redis protocol, with strings, hashes,   *
+ * lists and sets, kept in a shared mapping that several processes can       *
+ * attach to, optionally backed by a file.                                   *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_KV_MEM_H
+#define __GAMMARAY_KV_MEM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define KV_MEM_DATABASES 16
+
+struct kv_mem;
+
+/* every process opening the same path shares one store, which lives in
+ * that file; without a path the store is private to this process */
+struct kv_mem* kv_mem_init(const char* path);
+void kv_mem_destroy(struct kv_mem* mem);
+
+/* cmd holds one or more RESP encoded commands, *db is the caller's selected
+ * database; replies are returned RESP encoded in a malloc'd buffer */
+int kv_mem_execute(struct kv_mem* mem, int* db, const uint8_t* cmd,
+                   size_t len, uint8_t** reply, size_t* reply_len);
+int kv_mem_save(struct kv_mem* mem);
+uint64_t kv_mem_keys(struct kv_mem* mem, int db);
+
+#endif
@@ -0,0 +1,82 @@
+/*****************************************************************************
+ * log.h                                                                     *
+ *                                                                           *
+ * This file contains function prototypes and macros for leveled logging.    *
+ * Messages are formatted into a per-thread buffer and written out in bulk,  *
+ * so logging threads never contend with each other.                         *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_UTIL_LOG_H
+#define __GAMMARAY_UTIL_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOG_ENV "GAMMARAY_LOG" /* error, warn, info or debug; or 0-3 */
+#define LOG_BUFSIZE 65536 /* bytes buffered per thread before a write */
+#define LOG_FLUSH_INTERVAL 1000000 /* microseconds a buffered line may wait */
+
+enum LOG_LEVEL
+{
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN = 1,
+    LOG_LEVEL_INFO = 2,
+    LOG_LEVEL_DEBUG = 3
+};
+
+/* the runtime verbosity, read on every call site before any formatting */
+extern volatile int log_verbosity;
+
+#define log_enabled(level) ((int) (level) <= log_verbosity)
+
+int log_level_parse(const char* str, enum LOG_LEVEL* level);
+void log_set_level(enum LOG_LEVEL level);
+void log_set_fd(int fd);
+void log_write(enum LOG_LEVEL level, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+void log_hexdump(enum LOG_LEVEL level, const uint8_t* buf, size_t len);
+void log_flush(void);
+
+#define log_at(level, ...) do { if (log_enabled(level)) \
+                                    log_write(level, __VA_ARGS__); } while (0)
+
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+
+/* release builds (-DNDEBUG) keep the arguments type-checked but emit no
+ * code for debug calls */
+#ifdef NDEBUG
+    #define log_debug(...) do { if (0) \
+                                log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); \
+                           } while (0)
+    #define log_debug_enabled() false
+#else
+    #define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+    #define log_debug_enabled() log_enabled(LOG_LEVEL_DEBUG)
+#endif
+
+#define log_debug_hexdump(buf, len) do { if (log_debug_enabled()) \
+                                             log_hexdump(LOG_LEVEL_DEBUG, \
+                                                         buf, len); \
+                                    } while (0)
+
+#endif
@@ -0,0 +1,50 @@
+/*****************************************************************************
+ * mpscq.h                                                                   *
+ *                                                                           *
+ * This file contains prototypes for functions implementing an intrusive,    *
+ * lock-free, multi-producer single-consumer FIFO.                           *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_MPSCQ_H
+#define __GAMMARAY_MPSCQ_H
+
+#include <stdbool.h>
+
+/* embed as the first member of a queued record */
+struct mpscq_node
+{
+    struct mpscq_node* next;
+};
+
+struct mpscq;
+
+struct mpscq* mpscq_init(void);
+void mpscq_destroy(struct mpscq* queue);
+
+/* any thread; never blocks */
+void mpscq_push(struct mpscq* queue, struct mpscq_node* node);
+
+/* the single consumer only; NULL when empty, or while a push is half done */
+struct mpscq_node* mpscq_pop(struct mpscq* queue);
+
+/* the single consumer only; a half done push counts as not empty */
+bool mpscq_empty(struct mpscq* queue);
+
+#endif
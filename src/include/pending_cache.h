@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * pending_cache.h                                                           *
+ *                                                                           *
+ * This file contains prototypes for functions implementing a bounded cache  *
+ * of writes to sectors not yet classified, kept until the metadata that     *
+ * classifies them arrives, with CLOCK eviction under a byte budget.         *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_PENDING_CACHE_H
+#define __GAMMARAY_PENDING_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "clock_cache.h"
+
+#define PENDING_CACHE_DEFAULT_BUDGET 67108864 /* bytes; 64 MiB */
+
+struct pending_cache;
+
+struct pending_cache* pending_cache_init(size_t budget);
+void pending_cache_destroy(struct pending_cache* cache);
+void pending_cache_configure(struct pending_cache* cache, size_t budget);
+
+/* a pinned write is a file's last block, kept over everything else; a put
+ * replaces whatever was held for sector */
+int pending_cache_put(struct pending_cache* cache, uint64_t sector,
+                      const uint8_t* data, size_t len, bool pinned);
+/* removes the entry for sector; *len is the capacity of data on entry and
+ * the bytes copied, 0 on a miss or if the entry did not fit, on return */
+int pending_cache_take(struct pending_cache* cache, uint64_t sector,
+                       uint8_t* data, size_t* len);
+bool pending_cache_remove(struct pending_cache* cache, uint64_t sector);
+void pending_cache_get_stats(struct pending_cache* cache,
+                             struct clock_cache_stats* stats);
+
+#endif
@@ -26,12 +26,16 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "bitarray.h"
 
 #define QEMU_HEADER_SIZE sizeof(struct qemu_bdrv_write_header)
 #define SECTOR_SIZE 512
 
+#define QEMU_STREAM_DEFAULT_BUFSIZE 16777216 /* bytes; 16 MiB */
+#define QEMU_STREAM_MAX_WRITE 268435456 /* bytes; 256 MiB sanity bound */
+
 enum SECTOR_TYPE
 {
     SECTOR_UNKNOWN = -1,
@@ -46,6 +50,41 @@ enum SECTOR_TYPE
     SECTOR_EXT4_EXTENT = 8
 };
 
+/* what a sector:N key points at, one per object kind in the Redis schema */
+enum SECTOR_POINTER
+{
+    SECTOR_PTR_NONE = 0,
+    SECTOR_PTR_FILE_DATA = 1,   /* bytes [start, end) of file:<id> */
+    SECTOR_PTR_FS = 2,          /* fs:<id> */
+    SECTOR_PTR_MBR = 3,         /* mbr:<id> */
+    SECTOR_PTR_BGDS = 4,        /* bgds:<id> */
+    SECTOR_PTR_FILES = 5,       /* files:<id> */
+    SECTOR_PTR_BGD = 6,         /* bgd:<id> */
+    SECTOR_PTR_EXTENT = 7,      /* extent:<id> */
+    SECTOR_PTR_DIRDATA = 8,     /* dirdata:<id> */
+    SECTOR_PTR_LOADLIST = 9,    /* loadlist:<id> */
+    SECTOR_PTR_LOAD = 10,       /* metadata document at offset <id> */
+    SECTOR_PTR_MAX = 11
+};
+
+struct sector_descriptor
+{
+    int32_t type;
+    uint64_t id;
+    uint64_t start;
+    uint64_t end;
+};
+
+/* the value stored under sector:N and in loadlists, fixed size so a lookup
+ * is a length check and a copy */
+struct sector_descriptor_packed
+{
+    int32_t type;
+    uint64_t id;
+    uint64_t start;
+    uint64_t end;
+} __attribute__((packed));
+
 struct qemu_bdrv_write_header
 {
     int64_t sector_num;
@@ -58,7 +97,20 @@ struct qemu_bdrv_write
     uint8_t* data;
 };
 
+struct qemu_stream;
+
 int qemu_load_md_filter(int index, struct bitarray** bits);
 void qemu_parse_header(uint8_t* event_stream, struct qemu_bdrv_write* write);
 
+/* buffered, zero-copy reader for a stream of qemu_bdrv_write records */
+struct qemu_stream* qemu_stream_init(int fd, size_t bufsize);
+ssize_t qemu_stream_fill(struct qemu_stream* stream);
+int qemu_stream_wait(struct qemu_stream* stream, int timeout_ms);
+int qemu_stream_parse(struct qemu_stream* stream,
+                      struct qemu_bdrv_write* write);
+int qemu_stream_next(struct qemu_stream* stream,
+                     struct qemu_bdrv_write* write);
+size_t qemu_stream_buffered(struct qemu_stream* stream);
+void qemu_stream_destroy(struct qemu_stream* stream);
+
 #endif
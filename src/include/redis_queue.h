@@ -26,7 +26,9 @@
 #define __INFERENCE_ENGINE_REDIS_QUEUE_H
 
 #include "bitarray.h"
+#include "pending_cache.h"
 #include "qemu_common.h"
+#include "spillq.h"
 
 #include <inttypes.h>
 #include <stddef.h>
@@ -34,26 +36,25 @@
 
 #define REDIS_MBR_SECTOR_INSERT "HSET mbr:%"PRIu64" %s %b"
 #define REDIS_MBR_SECTOR_GET "HGET mbr:%"PRIu64" %s"
-#define REDIS_MBR_INSERT "SET sector:%"PRIu64" mbr:%"PRIu64
 
 #define REDIS_SUPERBLOCK_SECTOR_INSERT "HSET fs:%"PRIu64" %s %b"
 #define REDIS_SUPERBLOCK_SECTOR_GET "HGET fs:%"PRIu64" %s"
-#define REDIS_SUPERBLOCK_INSERT "SET sector:%"PRIu64" fs:%"PRIu64
 
 #define REDIS_BGD_SECTOR_INSERT "HSET bgd:%"PRIu64" %s %b"
 #define REDIS_BGD_SECTOR_GET "HGET bgd:%"PRIu64" %s"
 #define REDIS_BGDS_INSERT "RPUSH bgds:%"PRIu64" bgd:%"PRIu64
 #define REDIS_BGDS_LGET "LRANGE bgds:%"PRIu64" 0 -1"
-#define REDIS_BGDS_SECTOR_INSERT "SET sector:%"PRIu64" lbgds:%"PRIu64
-
-#define REDIS_BLOCKDMAP_INSERT "SET sector:%"PRIu64" bgd:%"PRIu64
-#define REDIS_BLOCKIMAP_INSERT "SET sector:%"PRIu64" bgd:%"PRIu64
 
 #define REDIS_INODE_INSERT "RPUSH inode:%"PRIu64" file:%"PRIu64
 #define REDIS_INODE_LGET "LRANGE inode:%"PRIu64" 0 -1"
+#define REDIS_INODE_LLEN "LLEN inode:%"PRIu64
+#define REDIS_DETACHED_SET "SET detached:%"PRIu64" %"PRIu64
+#define REDIS_DETACHED_GET "GET detached:%"PRIu64
+#define REDIS_DETACHED_DELETE "DEL detached:%"PRIu64
 
 #define REDIS_FILE_SECTOR_INSERT "HSET file:%"PRIu64" %s %b"
 #define REDIS_FILE_SECTOR_GET "HGET file:%"PRIu64" %s"
+#define REDIS_FILE_KEY "file:%"PRIu64
 #define REDIS_FILE_SECTORS_INSERT "RPUSH filesectors:%"PRIu64" sector:%"PRId64
 #define REDIS_FILE_SECTORS_LGET "LRANGE filesectors:%"PRIu64" 0 -1"
 #define REDIS_FILE_SECTORS_LGET_VAR "LRANGE filesectors:%"PRIu64" %"PRIu64 \
@@ -65,7 +66,6 @@
 #define REDIS_FILE_SECTORS_DELETE "DEL filesectors:%"PRIu64
 #define REDIS_FILES_INSERT "RPUSH files:%"PRIu64" file:%"PRIu64
 #define REDIS_FILES_LGET "LRANGE files:%"PRIu64" 0 -1"
-#define REDIS_FILES_SECTOR_INSERT "SET sector:%"PRIu64" lfiles:%"PRIu64
 #define REDIS_FILES_SECTOR_DELETE "DEL sector:%"PRIu64
 
 #define REDIS_PATH_SET "SET path:%b %"PRIu64
@@ -78,16 +78,19 @@
 #define REDIS_EXTENTS_LINSERT "LINSERT extents:%"PRIu64" BEFORE %"PRIu64 \
                               " extent:%"PRIu64
 #define REDIS_EXTENTS_LLEN "LLEN extents:%"PRIu64
-#define REDIS_EXTENTS_SECTOR_INSERT "SET sector:%"PRIu64" extent:%"PRIu64
 
 #define REDIS_DIR_SECTOR_INSERT "HSET dirdata:%"PRIu64" %s %b"
 #define REDIS_DIR_SECTOR_GET "HGET dirdata:%"PRIu64" %s"
 #define REDIS_DIR_FILES_INSERT "RPUSH dirlist:%"PRIu64" %b"
 #define REDIS_DIR_FILES_LGET "LRANGE dirlist:%"PRIu64" 0 -1"
-#define REDIS_DIR_INSERT "SET sector:%"PRIu64" dirdata:%"PRIu64
+#define REDIS_DIR_FILES_REMOVE "LREM dirlist:%"PRIu64" 0 %b"
 
 #define REDIS_ASYNC_QUEUE_PUSH "LPUSH writequeue %b"
 #define REDIS_ASYNC_QUEUE_POP "BRPOP writequeue 0"
+#define REDIS_DEFAULT_DEQUEUE_BATCH 512 /* writes per round trip */
+#define REDIS_DEFAULT_PIPELINED 16384 /* commands outstanding before a flush */
+#define REDIS_DEFAULT_PIPELINED_BYTES 16777216 /* bytes; 16 MiB outstanding */
+#define REDIS_DEFAULT_FLUSH_DEADLINE 2000 /* microseconds; idle pipeline */
 
 #define REDIS_RESET_CREATED "DEL createset"
 #define REDIS_RESET_DELETED "DEL deleteset"
@@ -98,29 +101,84 @@
 #define REDIS_LIST_DELETED "SDIFF deleteset createset"
 #define REDIS_LIST_CREATED "SDIFF createset deleteset"
 
-#define REDIS_LOAD_LRECORDS "SET sector:%"PRIu64" loadlist:%"PRIu64
-#define REDIS_LOAD_LRECORDS_INSERT "RPUSH loadlist:%"PRIu64" load:%"PRIu64
+#define REDIS_LOAD_LRECORDS_INSERT "RPUSH loadlist:%"PRIu64" %b"
 #define REDIS_GET_LRECORDS "LRANGE loadlist:%"PRIu64" 0 -1"
 
+#define REDIS_HASH_FIELDS_MAX 32 /* fields per HMGET/HMSET */
+
+#define REDIS_MD_REGION_SECTORS 4096 /* sectors per metadata filter bit */
+#define REDIS_MD_HOT_BATCH 1024 /* regions picked up per round trip */
+
 struct kv_store;
-struct thread_job;
+struct kv_async;
+
+/* status is EXIT_SUCCESS once the lookup's results have been stored */
+typedef void (*redis_async_callback)(int status, void* arg);
+
+/* the background flusher's pipeline, latencies are in microseconds from
+ * the oldest command sent to its reply */
+struct redis_flush_stats
+{
+    uint64_t depth;         /* commands awaiting replies */
+    uint64_t bytes;         /* payload bytes awaiting replies */
+    uint64_t queued_bytes;  /* payload bytes not yet sent */
+    uint64_t flushes;
+    uint64_t last_latency;
+    uint64_t max_latency;
+    uint64_t total_latency;
+};
+
+struct redis_hash_field
+{
+    const char* name;
+    uint8_t* data;
+    size_t len;
+};
+
+/* one element of a list reply, borrowed for the length of the callback;
+ * data is NUL terminated, and prefix:number elements come parsed */
+struct redis_list_element
+{
+    const uint8_t* data;
+    size_t len;
+    uint64_t index;
+    uint64_t count; /* elements in the whole list */
+    bool has_number;
+    int64_t number;
+};
+
+/* return false to stop before the end of the list */
+typedef bool (*redis_list_callback)(const struct redis_list_element* element,
+                                    void* arg);
 
 void redis_print_version();
 
-struct kv_store* redis_init(char* db, bool background_flush);
+/* spec is a connection-spec string, see struct kv_spec in util.h */
+struct kv_store* redis_init(const char* spec, bool background_flush);
 void redis_shutdown(int clear, struct kv_store* store);
 
 int redis_get_fcounter(struct kv_store* handle, uint64_t* counter);
 int redis_set_fcounter(struct kv_store* handle, uint64_t counter);
 
 int redis_flush_pipeline(struct kv_store* handle);
-int redis_enqueue_pipelined(struct kv_store* handle, uint64_t sector_num,
-                            const uint8_t* data, size_t len);
-int redis_dequeue(struct kv_store* handle, uint64_t sector_num,
-                  uint8_t* data, size_t* len);
-int redis_delqueue_pipelined(struct kv_store* handle, uint64_t sector_num);
+
+/* writes to sectors not yet classified, held in process until the metadata
+ * that classifies them arrives; pinned entries (a file's last block) are
+ * evicted last */
+int redis_pending_put(struct kv_store* handle, uint64_t sector_num,
+                      const uint8_t* data, size_t len, bool pinned);
+int redis_pending_take(struct kv_store* handle, uint64_t sector_num,
+                       uint8_t* data, size_t* len);
+int redis_pending_remove(struct kv_store* handle, uint64_t sector_num);
+void redis_pending_configure(struct kv_store* handle, size_t budget);
+void redis_pending_stats(struct kv_store* handle,
+                         struct clock_cache_stats* stats);
+
 int redis_publish(struct kv_store* handle, char* channel, uint8_t* data,
                   size_t len);
+/* queued on the pipeline, sent with the next flush */
+int redis_publish_pipelined(struct kv_store* handle, char* channel,
+                            uint8_t* data, size_t len);
 
 int redis_reverse_pointer_set(struct kv_store* handle, const char* fmt,
                               uint64_t src, int64_t dst);
@@ -130,23 +188,33 @@ int redis_hash_field_set(struct kv_store* handle, const char* fmt,
 int redis_hash_field_get(struct kv_store* handle, const char* fmt,
                          uint64_t src, const char* field, uint8_t* data,
                          size_t* len);
-int redis_reverse_file_data_pointer_set(struct kv_store* handle,
-                                        int64_t src, uint64_t start,
-                                        uint64_t end, uint64_t dst);
-int redis_sector_lookup(struct kv_store* store, uint64_t sector, uint8_t* data,
-                        size_t* len);
+int redis_hash_fields_get(struct kv_store* handle, const char* key_fmt,
+                          uint64_t src, struct redis_hash_field* fields,
+                          size_t count);
+int redis_hash_fields_set(struct kv_store* handle, const char* key_fmt,
+                          uint64_t src, const struct redis_hash_field* fields,
+                          size_t count);
+void redis_sector_pack(const struct sector_descriptor* desc,
+                       struct sector_descriptor_packed* packed);
+int redis_sector_unpack(const uint8_t* data, size_t len,
+                        struct sector_descriptor* desc);
+int redis_sector_set(struct kv_store* handle, uint64_t sector,
+                     const struct sector_descriptor* desc);
+int redis_sector_lookup(struct kv_store* handle, uint64_t sector,
+                        struct sector_descriptor* desc);
+int redis_sector_lookup_multi(struct kv_store* handle, const uint64_t* sectors,
+                              size_t count, struct sector_descriptor* descs);
 int redis_binary_insert(struct kv_store* handle, const char* fmt,
                         uint64_t src, const uint8_t* data, size_t len);
-int redis_list_get(struct kv_store* handle, char* fmt, uint64_t src,
-                   uint8_t** result[], size_t* len);
-int redis_list_get_var(struct kv_store* handle, char* fmt, uint64_t src,
-                       uint8_t** result[], size_t* len, 
-                       int64_t start, int64_t end);
+int redis_list_foreach(struct kv_store* handle, char* fmt, uint64_t src,
+                       redis_list_callback callback, void* arg);
+int redis_list_foreach_var(struct kv_store* handle, char* fmt, uint64_t src,
+                           int64_t start, int64_t end,
+                           redis_list_callback callback, void* arg);
 int redis_list_len(struct kv_store* handle, char* fmt, uint64_t src,
                    uint64_t* len);
 int redis_list_set(struct kv_store* handle, char* fmt, uint64_t src,
                    uint64_t index, int64_t value);
-void redis_free_list(uint8_t* list[], size_t len);
 
 int redis_last_file_sector(struct kv_store* handle, uint64_t id, 
                            uint64_t* sector);
@@ -158,8 +226,61 @@ int redis_set_remove(struct kv_store* handle, char* fmt, uint64_t id,
 
 int redis_async_write_enqueue(struct kv_store* handle, struct bitarray* bits,
                               int64_t sector, uint8_t* data, size_t len);
+int redis_async_write_enqueue_db(struct kv_store* handle,
+                                 struct bitarray* bits, const char* db,
+                                 int64_t sector, uint8_t* data, size_t len);
 int redis_async_write_dequeue(struct kv_store* handle,
                               struct qemu_bdrv_write* write);
+int redis_async_write_dequeue_batch(struct kv_store* handle,
+                                    struct qemu_bdrv_write* writes,
+                                    size_t max, size_t* count);
+int redis_spill_configure(struct kv_store* handle, size_t mem_budget,
+                          const char* path, size_t disk_budget);
+void redis_spill_stats(struct kv_store* handle, struct spillq_stats* stats);
+int redis_flush_configure(struct kv_store* handle, uint64_t max_cmds,
+                          size_t max_bytes, uint64_t deadline);
+void redis_flush_stats(struct kv_store* handle,
+                       struct redis_flush_stats* stats);
+
+/* compound file updates, each one atomic server-side script round trip */
+int redis_file_create(struct kv_store* handle, uint64_t inode_num,
+                      uint64_t files_id, const uint8_t* path, size_t len,
+                      const struct redis_hash_field* fields, size_t count,
+                      uint64_t* id);
+/* *sectors is malloc'd and lists the sectors whose descriptors went with a
+ * released file, the caller frees it */
+int redis_file_delete(struct kv_store* handle, uint64_t id,
+                      uint64_t inode_num, uint64_t files_id,
+                      const uint8_t* path, size_t len, bool* released,
+                      uint64_t** sectors, size_t* count);
+int redis_file_rename(struct kv_store* handle, uint64_t id,
+                      const uint8_t* old_path, size_t old_len,
+                      const uint8_t* new_path, size_t new_len,
+                      uint64_t* renamed);
+/* a file whose last entry went away while its inode is still linked keeps
+ * its record and blocks, only its path goes; *id is UINT64_MAX when nothing
+ * is detached from inode_num */
+int redis_file_detach(struct kv_store* handle, uint64_t id,
+                      uint64_t inode_num, const uint8_t* path, size_t len);
+int redis_file_detached(struct kv_store* handle, uint64_t inode_num,
+                        uint64_t* id);
+
+/* lookups issued without waiting, each completed by its callback from
+ * redis_async_wait(); results land in the caller's storage, which must
+ * outlive the wait; a kv_async belongs to the thread that opened it */
+struct kv_async* redis_async_open(struct kv_store* handle);
+void redis_async_close(struct kv_async* async);
+int redis_async_wait(struct kv_async* async);
+int redis_async_hash_fields_get(struct kv_async* async, const char* key_fmt,
+                                uint64_t src, struct redis_hash_field* fields,
+                                size_t count, redis_async_callback callback,
+                                void* arg);
+int redis_async_list_foreach(struct kv_async* async, char* fmt, uint64_t src,
+                             redis_list_callback each, void* each_arg,
+                             redis_async_callback callback, void* arg);
+int redis_async_list_len(struct kv_async* async, char* fmt, uint64_t src,
+                         uint64_t* len, redis_async_callback callback,
+                         void* arg);
 
 int redis_path_set(struct kv_store* handle, const uint8_t* path, size_t len,
                    uint64_t id);
@@ -169,5 +290,8 @@ int redis_metadata_set(struct kv_store* handle, const uint8_t* data,
                        size_t len);
 int redis_metadata_get(struct kv_store* handle, uint8_t** data,
                        size_t* len);
+int redis_metadata_hot(struct kv_store* handle, uint64_t region);
+int redis_metadata_hot_drain(struct kv_store* handle, const char* db,
+                             struct bitarray* bits, uint64_t* drained);
 int redis_delete_key(struct kv_store* handle, char* fmt, uint64_t id);
 #endif
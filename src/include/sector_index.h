@@ -0,0 +1,46 @@
+/*****************************************************************************
+ * sector_index.h                                                            *
+ *                                                                           *
+ * This file contains prototypes for functions implementing an in-memory     *
+ * index from disk sectors to typed sector descriptors, stored as sorted     *
+ * strided runs so that large contiguous files cost a single entry.          *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_SECTOR_INDEX_H
+#define __GAMMARAY_SECTOR_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "qemu_common.h"
+
+struct sector_index;
+
+struct sector_index* sector_index_init(void);
+void sector_index_destroy(struct sector_index* index);
+
+int sector_index_set(struct sector_index* index, uint64_t sector,
+                     const struct sector_descriptor* desc);
+int sector_index_remove(struct sector_index* index, uint64_t sector);
+bool sector_index_lookup(struct sector_index* index, uint64_t sector,
+                         struct sector_descriptor* desc);
+uint64_t sector_index_runs(struct sector_index* index);
+
+#endif
@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * shadow_store.h                                                            *
+ *                                                                           *
+ * This file contains function prototypes for a bounded in-memory copy of    *
+ * the last bytes seen for each metadata block, so a new write can be diffed *
+ * against it locally.                                                       *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_SHADOW_STORE_H
+#define __GAMMARAY_SHADOW_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "clock_cache.h"
+
+#define SHADOW_STORE_DEFAULT_BUDGET 67108864 /* bytes; 64 MiB */
+
+struct shadow_store;
+
+struct shadow_store* shadow_store_init(size_t budget);
+void shadow_store_destroy(struct shadow_store* store);
+void shadow_store_configure(struct shadow_store* store, size_t budget);
+
+/* a put replaces whatever was held for key */
+int shadow_store_put(struct shadow_store* store, uint64_t key,
+                     const uint8_t* data, size_t len);
+/* copies the entry for key into data, which stays held; *len is the
+ * capacity of data on entry and the entry's size on return, false on a miss
+ * or if it did not fit */
+bool shadow_store_get(struct shadow_store* store, uint64_t key,
+                      uint8_t* data, size_t* len);
+bool shadow_store_remove(struct shadow_store* store, uint64_t key);
+void shadow_store_get_stats(struct shadow_store* store,
+                            struct clock_cache_stats* stats);
+
+#endif
@@ -0,0 +1,56 @@
+/*****************************************************************************
+ * shmring.h                                                                 *
+ *                                                                           *
+ * This file contains prototypes for functions implementing a named,         *
+ * memory-mapped single-producer single-consumer ring of variable-length     *
+ * records shared between processes on the same host.                        *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_SHMRING_H
+#define __GAMMARAY_SHMRING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHMRING_DEFAULT_SIZE 268435456 /* bytes; 256 MiB */
+
+struct shmring;
+
+struct shmring* shmring_open(const char* name, uint64_t size);
+void shmring_close(struct shmring* ring);
+/* whether this handle created the segment, or took over a stale one left
+ * shut down by an earlier run; that side unlinks it on a clean exit */
+bool shmring_created(struct shmring* ring);
+int shmring_unlink(const char* name);
+/* closes ring at a clean exit, unlinking name if this side created it */
+void shmring_release(struct shmring* ring, const char* name);
+
+int shmring_push(struct shmring* ring, int64_t tag, const uint8_t* data,
+                 size_t len);
+int shmring_pop(struct shmring* ring, int64_t* tag, uint8_t** data,
+                size_t* len);
+int shmring_try_pop(struct shmring* ring, int64_t* tag, uint8_t** data,
+                    size_t* len);
+void shmring_shutdown(struct shmring* ring);
+bool shmring_is_shutdown(struct shmring* ring);
+uint64_t shmring_used(struct shmring* ring);
+
+#endif
@@ -0,0 +1,59 @@
+/*****************************************************************************
+ * spillq.h                                                                  *
+ *                                                                           *
+ * This file contains prototypes for functions implementing a bounded FIFO   *
+ * of tagged variable-length records which holds records in memory up to a   *
+ * budget and then spills them to an on-disk overflow log.                   *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#ifndef __GAMMARAY_SPILLQ_H
+#define __GAMMARAY_SPILLQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPILLQ_DEFAULT_MEM_BUDGET 268435456 /* bytes; 256 MiB */
+
+struct spillq;
+
+struct spillq_stats
+{
+    uint64_t depth;         /* records currently queued */
+    uint64_t mem_bytes;     /* bytes currently held in memory */
+    uint64_t disk_bytes;    /* bytes currently held in the overflow log */
+    uint64_t spilled_bytes; /* total bytes ever written to the overflow log */
+    uint64_t max_depth;     /* high-water mark of depth */
+    uint64_t drops;         /* records rejected with both budgets exhausted */
+    uint64_t dropped_bytes;
+};
+
+struct spillq* spillq_init(size_t mem_budget, const char* path,
+                           size_t disk_budget);
+void spillq_destroy(struct spillq* queue);
+
+int spillq_push(struct spillq* queue, int64_t tag, const uint8_t* data,
+                size_t len);
+int spillq_pop(struct spillq* queue, int64_t* tag, uint8_t** data,
+               size_t* len);
+bool spillq_empty(struct spillq* queue);
+void spillq_get_stats(struct spillq* queue, struct spillq_stats* stats);
+
+#endif
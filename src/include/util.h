@@ -25,10 +25,42 @@
 #ifndef __GAMMARAY_UTIL_UTIL_H
 #define __GAMMARAY_UTIL_UTIL_H
 
+#include <limits.h>
+#include <stddef.h>
 #include <sys/time.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+#define KV_SPEC_DEFAULT_HOST "127.0.0.1"
+#define KV_SPEC_DEFAULT_PORT 6379
+#define KV_SPEC_UNIX_PREFIX "unix:"
+#define KV_SPEC_MEM_PREFIX "mem:"
+#define KV_SPEC_DB_MAX 16
+
+enum KV_SPEC_TRANSPORT
+{
+    KV_SPEC_TCP,
+    KV_SPEC_UNIX,
+    KV_SPEC_MEM
+};
+
+/* where a key-value store lives, parsed from one connection-spec string:
+ *
+ *     <db>                         TCP to 127.0.0.1:6379
+ *     <host>[:<port>]/<db>         TCP
+ *     unix:<socket path>/<db>      Unix domain socket
+ *     mem:<db>[:<store path>]      embedded engine, shared through the file
+ *
+ * address is the host, the socket path, or the (possibly empty) store
+ * path */
+struct kv_spec
+{
+    enum KV_SPEC_TRANSPORT transport;
+    char address[PATH_MAX];
+    int port;
+    char db[KV_SPEC_DB_MAX];
+};
+
 int hexdump(uint8_t* buf, uint64_t len);
 
 int pretty_print_bytes(uint64_t bytes, char* buf, uint64_t bufsize);
@@ -42,5 +74,18 @@ int64_t sign_extend64(uint64_t val, uint64_t bits);
 
 uint64_t diff_time(struct timeval start, struct timeval end);
 
+/* mask words needed for a block split into slots */
+#define BLOCK_DIFF_WORDS(slots) (((slots) + 63) / 64)
+
+/* sets bit i of mask when bytes [i * slot, (i + 1) * slot) of a and b
+ * differ, the last slot may be short; returns how many slots differ.
+ * block_diff_mask uses the widest vector compare the CPU supports */
+size_t block_diff_mask(const uint8_t* a, const uint8_t* b, size_t len,
+                       size_t slot, uint64_t* mask);
+size_t block_diff_mask_scalar(const uint8_t* a, const uint8_t* b, size_t len,
+                              size_t slot, uint64_t* mask);
+
 int check_syscall(int ret);
+
+int kv_spec_parse(const char* spec, struct kv_spec* parsed);
 #endif
@@ -28,8 +28,9 @@
 
 #include "color.h"
 #include "nbd.h"
+#include "util.h"
 
-#define USAGE "%s <export name> <Redis IP> <Redis port> <Redis DB> " \
+#define USAGE "%s <export name> <kv spec> " \
 "<Export Size> <NBD Bind IP> <NBD Port> <Old Handshake y|n>\n"
 
 struct nbd_handle
@@ -38,10 +39,8 @@ struct nbd_handle
     uint64_t size;
     uint64_t handle;
     char* export_name;
-    char* redis_server;
     uint32_t name_len;
-    uint16_t redis_port;
-    uint16_t redis_db;
+    struct kv_spec redis;
     struct event_base* eb;
     struct evconnlistener* conn;
     struct redisAsyncContext* redis_c;
@@ -51,7 +50,7 @@ int main(int argc, char* argv[])
 {
     struct nbd_handle* handle;
    
-    if (argc < 9)
+    if (argc < 7)
     {
         fprintf_light_red(stderr, USAGE, argv[0]);
         exit(EXIT_FAILURE);
@@ -60,10 +59,9 @@ int main(int argc, char* argv[])
     fprintf_blue(stdout, "nbd-queuer-test program by: Wolfgang Richter "
                          "<wolf@cs.cmu.edu>\n");
 
-    handle = nbd_init_redis(argv[1], argv[2], atoi(argv[3]), atoi(argv[4]),
-                            atoll(argv[5]), argv[6], argv[7],
-                            (strncmp(argv[8], "y", 1) == 0) ||
-                            (strncmp(argv[8], "Y", 1) == 0));
+    handle = nbd_init_redis(argv[1], argv[2], atoll(argv[3]), argv[4],
+                            argv[5], (strncmp(argv[6], "y", 1) == 0) ||
+                                     (strncmp(argv[6], "Y", 1) == 0));
 
     assert(handle != NULL);
     assert(handle->fd != 0);
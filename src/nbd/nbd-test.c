@@ -28,6 +28,7 @@
 
 #include "color.h"
 #include "nbd.h"
+#include "util.h"
 
 #define USAGE "%s <export name> <export file> <NBD Bind IP> <NBD Port> " \
               "<Old Handshake y|n>\n"
@@ -38,10 +39,8 @@ struct nbd_handle
     uint64_t size;
     uint64_t handle;
     char* export_name;
-    char* redis_server;
     uint32_t name_len;
-    uint16_t redis_port;
-    uint16_t redis_db;
+    struct kv_spec redis;
     struct event_base* eb;
     struct evconnlistener* conn;
     struct redisAsyncContext* redis_c;
@@ -53,7 +53,7 @@
 #include "async.h"
 #include "adapters/libevent.h"
 
-#include "color.h"
+#include "log.h"
 #include "nbd.h"
 #include "util.h"
 
@@ -177,10 +177,8 @@ struct nbd_handle
     uint64_t size;
     uint64_t handle;
     char* export_name;
-    char* redis_server;
     uint32_t name_len;
-    uint16_t redis_port;
-    uint16_t redis_db;
+    struct kv_spec redis;
     struct event_base* eb;
     struct evconnlistener* conn;
     struct redisAsyncContext* redis_c;
@@ -216,6 +214,14 @@ void redis_async_callback(redisAsyncContext* c, void* reply, void* data)
     assert(reply != NULL); /* check error status */
 }
 
+struct redisAsyncContext* nbd_redis_connect(struct kv_spec* spec)
+{
+    if (spec->transport == KV_SPEC_UNIX)
+        return redisAsyncConnectUnix(spec->address);
+
+    return redisAsyncConnect(spec->address, spec->port);
+}
+
 void redis_disconnect_callback(const redisAsyncContext* c, int status)
 {
     struct nbd_handle* handle;
@@ -226,8 +232,7 @@ void redis_disconnect_callback(const redisAsyncContext* c, int status)
     }
     else
     {
-        fprintf_light_red(stderr, "FATAL: Handle not passed to disconnect "
-                                  "callback.\n");
+        log_error("FATAL: Handle not passed to disconnect callback.\n");
         assert(c->data != NULL);
         return;
     }
@@ -236,39 +241,37 @@ void redis_disconnect_callback(const redisAsyncContext* c, int status)
     {
         if (c->err == REDIS_ERR_EOF) /* probably standard timeout, reconnect */
         {
-            fprintf_red(stderr, "Redis server disconnected us.\n");
-            if ((handle->redis_c = redisAsyncConnect(handle->redis_server,
-                 handle->redis_port)) != NULL)
+            log_warn("Redis server disconnected us.\n");
+            if ((handle->redis_c = nbd_redis_connect(&(handle->redis))) !=
+                NULL)
             {
-                fprintf_blue(stderr, "New Redis context, attaching to "
-                                    "libevent.\n");
+                log_debug("New Redis context, attaching to libevent.\n");
                 handle->redis_c->data = c->data;
                 redisLibeventAttach(handle->redis_c, handle->eb);
-                fprintf_blue(stderr, "Setting disconnect callback.\n");
+                log_debug("Setting disconnect callback.\n");
                 if (redisAsyncSetDisconnectCallback(handle->redis_c,
                     &redis_disconnect_callback) != REDIS_ERR)
                 {
                     assert(redisAsyncCommand(handle->redis_c,
-                           &redis_async_callback, NULL, "select %d",
-                           handle->redis_db) == REDIS_OK);
-                    fprintf_light_blue(stderr, "Successfully reconnected to "
-                                               "the Redis server.\n");
+                           &redis_async_callback, NULL, "select %s",
+                           handle->redis.db) == REDIS_OK);
+                    log_info("Successfully reconnected to the Redis "
+                             "server.\n");
                 }
                 else
                 {
-                    fprintf_light_red(stderr, "Error setting disconnect "
-                                              "callback handler for Redis.\n");
+                    log_error("Error setting disconnect "
+                              "callback handler for Redis.\n");
                 }
             }
             else
             {
-                fprintf_light_red(stderr, "Error trying to reconnect to "
-                                          "Redis.\n");
+                log_error("Error trying to reconnect to Redis.\n");
             }
             return;
         }
-        fprintf_light_red(stderr, "FATAL ERROR DISCONNECTION FROM REDIS\n");
-        fprintf_light_blue(stderr, "Error: %s\n", c->errstr);
+        log_error("FATAL ERROR DISCONNECTION FROM REDIS\n");
+        log_error("Error: %s\n", c->errstr);
         assert(false);
     }
 }
@@ -278,7 +281,7 @@ static void nbd_signal_handler(evutil_socket_t sig, short events, void *handle)
     struct event_base *eb = ((struct nbd_handle*) handle)->eb;
     struct timeval delay = { 2, 0 };
 
-    fprintf(stderr, "Caught interrupt.  Exiting in 2 seconds.\n");
+    log_info("Caught interrupt.  Exiting in 2 seconds.\n");
 
     event_base_loopexit(eb, &delay);
 }
@@ -476,9 +479,13 @@ uint32_t __handle_write(struct nbd_req_header* req, struct nbd_client* client,
 
     client->write_count += 1;
     client->write_bytes += len;
-    gettimeofday(&curtime, NULL);
-    fprintf(stderr, "\t[%ld] write size: %zd\n", curtime.tv_sec * 1000000 +
-                                                 curtime.tv_usec, len);
+
+    if (log_debug_enabled())
+    {
+        gettimeofday(&curtime, NULL);
+        log_debug("\t[%ld] write size: %zd\n", curtime.tv_sec * 1000000 +
+                                               curtime.tv_usec, len);
+    }
 
     if (fd < 0)
     {
@@ -536,26 +543,29 @@ bool __check_request(struct bufferevent* bev, struct evbuffer* in,
                                     client->buf, be32toh(req.length));
                     return false;
                 case NBD_CMD_WRITE:
-                    fprintf(stderr, "+");
+                    log_debug("+");
                     err = __handle_write(peek, client, in);
                     if (err == -1)
                         return true;
-                    pretty_print_bytes(client->write_bytes, bytestr, 32);
-                    fprintf(stderr, "\twrite[%"PRIu64"]: %"PRIu64" cumulative "
-                                    "bytes (%s)\n", client->write_count,
-                                                    client->write_bytes,
-                                                    bytestr);
+                    if (log_debug_enabled())
+                    {
+                        pretty_print_bytes(client->write_bytes, bytestr, 32);
+                        log_debug("\twrite[%"PRIu64"]: %"PRIu64" cumulative "
+                                  "bytes (%s)\n", client->write_count,
+                                                  client->write_bytes,
+                                                  bytestr);
+                    }
                     evbuffer_drain(in, be32toh(req.length));
                     __send_response(bev, err, handle, NULL, 0);
                     return false;
                 case NBD_CMD_DISC:
-                    fprintf(stderr, "got disconnect.\n");
+                    log_debug("got disconnect.\n");
                     client->state = NBD_DISCONNECTED;
                     evbuffer_drain(in, sizeof(struct nbd_req_header));
                     nbd_ev_handler(bev, BEV_EVENT_EOF, client);
                     return false;
                 case NBD_CMD_FLUSH:
-                    fprintf(stderr, "got flush.\n");
+                    log_debug("got flush.\n");
                     evbuffer_drain(in, sizeof(struct nbd_req_header));
                     if (fsync(client->handle->fd))
                         __send_response(bev, errno, handle, NULL, 0);
@@ -563,7 +573,7 @@ bool __check_request(struct bufferevent* bev, struct evbuffer* in,
                         __send_response(bev, 0, handle, NULL, 0);
                     return false;
                 case NBD_CMD_TRIM:
-                    fprintf(stderr, "got trim.\n");
+                    log_debug("got trim.\n");
                     evbuffer_drain(in, sizeof(struct nbd_req_header));
                     if (fallocate(client->handle->fd,
                                   FALLOC_FL_PUNCH_HOLE |
@@ -580,11 +590,11 @@ bool __check_request(struct bufferevent* bev, struct evbuffer* in,
                     if (test)
                         evbuffer_drain(in, sizeof(struct nbd_req_header) +
                                        be32toh(req.length));
-                    fprintf(stderr, "unknown command!\n");
-                    fprintf(stderr, "-- Hexdumping --\n");
+                    log_error("unknown command!\n");
+                    log_debug("-- Hexdumping --\n");
                     if (test)
-                        hexdump(test, be32toh(req.length));
-                    fprintf(stderr, "disconnecting, protocol error!\n");
+                        log_debug_hexdump(test, be32toh(req.length));
+                    log_error("disconnecting, protocol error!\n");
                     client->state = NBD_DISCONNECTED;
                     nbd_ev_handler(bev, BEV_EVENT_EOF, client);
             };
@@ -617,7 +627,7 @@ static void nbd_client_handler(struct bufferevent* bev, void* client)
                    return;
                break;
             case NBD_DISCONNECTED:
-               fprintf(stderr, "DISCONNECTED STATE.\n");
+               log_debug("DISCONNECTED STATE.\n");
                nbd_ev_handler(bev, BEV_EVENT_EOF, client);
             default:
                return;
@@ -799,9 +809,9 @@ struct nbd_handle* nbd_init_file(char* export_name, char* fname,
     return ret;
 }
 
-struct nbd_handle* nbd_init_redis(char* export_name, char* redis_server,
-                                  int redis_port, int redis_db, uint64_t fsize,
-                                  char* nodename, char* port, bool old)
+struct nbd_handle* nbd_init_redis(char* export_name, char* redis_spec,
+                                  uint64_t fsize, char* nodename, char* port,
+                                  bool old)
 {
     struct addrinfo hints;
     struct addrinfo* server = NULL;
@@ -810,12 +820,17 @@ struct nbd_handle* nbd_init_redis(char* export_name, char* redis_server,
     struct event* evsignal = NULL;
     struct evconnlistener* conn = NULL;
     struct redisAsyncContext* redis_c = NULL;
+    struct kv_spec spec;
 
     /* sanity check */
-    if (redis_server == NULL || nodename == NULL || port == NULL ||
+    if (redis_spec == NULL || nodename == NULL || port == NULL ||
         export_name == NULL)
         return NULL;
 
+    /* the embedded engine is private to the process that opened it */
+    if (kv_spec_parse(redis_spec, &spec) || spec.transport == KV_SPEC_MEM)
+        return NULL;
+
     /* setup network socket */
     memset(&hints, 0, sizeof(struct addrinfo));
 
@@ -837,7 +852,7 @@ struct nbd_handle* nbd_init_redis(char* export_name, char* redis_server,
     }
 
     /* initialize libhiredis */
-    if ((redis_c = redisAsyncConnect(redis_server, redis_port)) == NULL)
+    if ((redis_c = nbd_redis_connect(&spec)) == NULL)
     {
         freeaddrinfo(server);
         event_base_free(eb);
@@ -893,16 +908,14 @@ struct nbd_handle* nbd_init_redis(char* export_name, char* redis_server,
     ret->fd = -1;
     ret->size = fsize;
     ret->export_name = export_name;
-    ret->redis_server = redis_server;
     ret->name_len = strlen(export_name);
-    ret->redis_port = redis_port;
-    ret->redis_db = redis_db;
+    ret->redis = spec;
     ret->eb = eb;
     ret->conn = conn;
     ret->redis_c = redis_c;
 
-    assert(redisAsyncCommand(redis_c, &redis_async_callback, NULL, "select %d",
-                             redis_db) == REDIS_OK);
+    assert(redisAsyncCommand(redis_c, &redis_async_callback, NULL, "select %s",
+                             spec.db) == REDIS_OK);
 
     freeaddrinfo(server);
 
@@ -0,0 +1,188 @@
+/*****************************************************************************
+ * log-test.c                                                                *
+ *                                                                           *
+ * This file executes the leveled logger to test its gating and buffering.   *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include "log.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_THREADS 4
+#define TEST_LINES 1000
+
+static int pipefd[2];
+
+/* everything written to the pipe so far, NUL-terminated */
+static size_t drain(char* buf, size_t size)
+{
+    ssize_t ret;
+    size_t len = 0;
+
+    while (len < size - 1 &&
+           (ret = read(pipefd[0], &(buf[len]), size - 1 - len)) > 0)
+        len += (size_t) ret;
+
+    buf[len] = 0;
+
+    return len;
+}
+
+static int evaluations = 0;
+
+static int count(void)
+{
+    return ++evaluations;
+}
+
+void test_parse()
+{
+    enum LOG_LEVEL level;
+
+    assert(log_level_parse("debug", &level) == EXIT_SUCCESS);
+    assert(level == LOG_LEVEL_DEBUG);
+    assert(log_level_parse("WARN", &level) == EXIT_SUCCESS);
+    assert(level == LOG_LEVEL_WARN);
+    assert(log_level_parse("0", &level) == EXIT_SUCCESS);
+    assert(level == LOG_LEVEL_ERROR);
+    assert(log_level_parse("4", &level) == EXIT_FAILURE);
+    assert(log_level_parse("loud", &level) == EXIT_FAILURE);
+}
+
+void test_gating()
+{
+    char buf[256];
+
+    log_set_level(LOG_LEVEL_WARN);
+    log_info("hidden %d\n", count());
+    log_debug("hidden %d\n", count());
+    log_flush();
+    assert(drain(buf, sizeof(buf)) == 0);
+    assert(evaluations == 0);
+
+    log_set_level(LOG_LEVEL_DEBUG);
+    log_debug("shown %d\n", count());
+    log_flush();
+    drain(buf, sizeof(buf));
+    assert(evaluations == 1 && strcmp(buf, "shown 1\n") == 0);
+}
+
+void test_buffering()
+{
+    char buf[256];
+
+    log_set_level(LOG_LEVEL_INFO);
+
+    /* info waits in the thread's buffer, an error pushes it out in order */
+    log_info("first\n");
+    assert(drain(buf, sizeof(buf)) == 0);
+    log_error("second\n");
+    drain(buf, sizeof(buf));
+    assert(strcmp(buf, "first\nsecond\n") == 0);
+
+    log_hexdump(LOG_LEVEL_INFO, (const uint8_t*) "gammaray", 8);
+    log_flush();
+    drain(buf, sizeof(buf));
+    assert(strcmp(buf, "00000000 67 61 6d 6d 61 72 61 79 "
+                       "                          |gammaray|\n") == 0);
+}
+
+void test_idle()
+{
+    char buf[256];
+
+    log_set_level(LOG_LEVEL_INFO);
+
+    /* after a quiet spell nothing may follow to push a line out */
+    usleep(LOG_FLUSH_INTERVAL);
+    log_info("alone\n");
+    drain(buf, sizeof(buf));
+    assert(strcmp(buf, "alone\n") == 0);
+
+    /* the lines right behind it are batched, and written out for a thread
+     * that went quiet without another log call */
+    log_info("batched\n");
+    assert(drain(buf, sizeof(buf)) == 0);
+    usleep(2 * LOG_FLUSH_INTERVAL);
+    drain(buf, sizeof(buf));
+    assert(strcmp(buf, "batched\n") == 0);
+}
+
+static void* writer(void* arg)
+{
+    int i;
+
+    for (i = 0; i < TEST_LINES; i++)
+        log_info("%d\n", (int) (intptr_t) arg);
+
+    return NULL;
+}
+
+void test_threads()
+{
+    pthread_t threads[TEST_THREADS];
+    char* buf = (char*) malloc(TEST_THREADS * TEST_LINES * 2 + 1);
+    size_t len, seen[TEST_THREADS] = { 0 }, i;
+
+    assert(buf);
+
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_create(&(threads[i]), NULL, writer, (void*) (intptr_t) i);
+
+    for (i = 0; i < TEST_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    /* each thread's buffer is written out when it exits, lines intact */
+    len = drain(buf, TEST_THREADS * TEST_LINES * 2 + 1);
+    assert(len == TEST_THREADS * TEST_LINES * 2);
+
+    for (i = 0; i < len; i += 2)
+    {
+        assert(buf[i + 1] == '\n');
+        seen[buf[i] - '0']++;
+    }
+
+    for (i = 0; i < TEST_THREADS; i++)
+        assert(seen[i] == TEST_LINES);
+
+    free(buf);
+}
+
+int main(int argc, char* argv[])
+{
+    assert(pipe(pipefd) == 0);
+    assert(fcntl(pipefd[0], F_SETFL, O_NONBLOCK) == 0);
+    log_set_fd(pipefd[1]);
+
+    test_parse();
+    test_gating();
+    test_buffering();
+    test_idle();
+    test_threads();
+
+    log_set_fd(STDERR_FILENO);
+
+    return EXIT_SUCCESS;
+}
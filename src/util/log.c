@@ -0,0 +1,449 @@
+/*****************************************************************************
+ * log.c                                                                     *
+ *                                                                           *
+ * This file contains implementations for leveled logging through           *
+ * per-thread buffers.  Each thread formats into its own buffer and hands    *
+ * whole buffers to write(2); errors and warnings, full buffers, and buffers *
+ * holding a line older than LOG_FLUSH_INTERVAL are written out at once, and *
+ * a background thread writes out those whose thread went quiet.             *
+ *                                                                           *
+ *                                                                           *
+ *   Authors: Wolfgang Richter <wolf@cs.cmu.edu>                             *
+ *                                                                           *
+ *                                                                           *
+ *   Copyright 2013-2014 Carnegie Mellon University                          *
+ *                                                                           *
+ *   Licensed under the Apache License, Version 2.0 (the "License");         *
+ *   you may not use this file except in compliance with the License.        *
+ *   You may obtain a copy of the License at                                 *
+ *                                                                           *
+ *       http://www.apache.org/licenses/LICENSE-2.0                          *
+ *                                                                           *
+ *   Unless required by applicable law or agreed to in writing, software     *
+ *   distributed under the License is distributed on an "AS IS" BASIS,       *
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.*
+ *   See the License for the specific language governing permissions and     *
+ *   limitations under the License.                                          *
+ *****************************************************************************/
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+
+#define LOG_HEXDUMP_LINE 80
+
+volatile int log_verbosity = LOG_LEVEL_INFO;
+
+struct log_buffer
+{
+    pthread_mutex_t lock;     /* only ever contended by the flusher */
+    struct log_buffer* next;  /* every live thread's buffer */
+    size_t len;
+    struct timeval oldest; /* when the first buffered byte was added */
+    struct timeval last; /* when this thread last finished a line */
+    char data[LOG_BUFSIZE];
+};
+
+static int log_fd = STDERR_FILENO;
+static bool log_color = false;
+static pthread_key_t log_key;
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+static __thread struct log_buffer* log_local = NULL;
+static pthread_mutex_t log_buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_buffer* log_buffers = NULL;
+static pthread_once_t log_flusher_once = PTHREAD_ONCE_INIT;
+
+/* bold escapes like color.c, indexed by level; info is left plain */
+static const char* log_colors[] = {
+    "\x1b[1m\x1b[31m",
+    "\x1b[1m\x1b[33m",
+    "",
+    "\x1b[1m\x1b[34m"
+};
+
+static const char* log_names[] = { "error", "warn", "info", "debug" };
+
+static void log_write_fd(const char* data, size_t len)
+{
+    ssize_t ret;
+
+    while (len > 0)
+    {
+        ret = write(log_fd, data, len);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        data += ret;
+        len -= (size_t) ret;
+    }
+}
+
+static void log_buffer_flush(struct log_buffer* buf)
+{
+    if (buf->len)
+        log_write_fd(buf->data, buf->len);
+
+    buf->len = 0;
+}
+
+static void log_thread_exit(void* arg)
+{
+    struct log_buffer* buf = (struct log_buffer*) arg, **slot;
+
+    pthread_mutex_lock(&log_buffers_lock);
+
+    for (slot = &log_buffers; *slot; slot = &((*slot)->next))
+    {
+        if (*slot == buf)
+        {
+            *slot = buf->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&log_buffers_lock);
+
+    log_buffer_flush(buf);
+    pthread_mutex_destroy(&(buf->lock));
+    free(buf);
+    log_local = NULL;
+}
+
+/* a thread that logs a few lines and then blocks never comes back to push
+ * them out, so whatever has waited LOG_FLUSH_INTERVAL is written from here */
+static void* log_flusher(void* arg)
+{
+    struct log_buffer* buf;
+    struct timeval now;
+    sigset_t signals;
+
+    /* signals stay with the threads whose buffers log_signal writes */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    while (1)
+    {
+        usleep(LOG_FLUSH_INTERVAL / 2);
+        gettimeofday(&now, NULL);
+        pthread_mutex_lock(&log_buffers_lock);
+
+        for (buf = log_buffers; buf; buf = buf->next)
+        {
+            pthread_mutex_lock(&(buf->lock));
+
+            if (buf->len &&
+                diff_time(buf->oldest, now) >= LOG_FLUSH_INTERVAL)
+                log_buffer_flush(buf);
+
+            pthread_mutex_unlock(&(buf->lock));
+        }
+
+        pthread_mutex_unlock(&log_buffers_lock);
+    }
+
+    return NULL;
+}
+
+static void log_flusher_start(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, log_flusher, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+static void log_key_create(void)
+{
+    pthread_key_create(&log_key, log_thread_exit);
+}
+
+static struct log_buffer* log_buffer_get(void)
+{
+    if (log_local)
+        return log_local;
+
+    pthread_once(&log_key_once, log_key_create);
+
+    if ((log_local = (struct log_buffer*) malloc(sizeof(*log_local))) == NULL)
+        return NULL;
+
+    log_local->len = 0;
+    timerclear(&(log_local->last));
+    pthread_mutex_init(&(log_local->lock), NULL);
+    pthread_setspecific(log_key, log_local);
+
+    pthread_mutex_lock(&log_buffers_lock);
+    log_local->next = log_buffers;
+    log_buffers = log_local;
+    pthread_mutex_unlock(&log_buffers_lock);
+
+    pthread_once(&log_flusher_once, log_flusher_start);
+
+    return log_local;
+}
+
+static void log_append(struct log_buffer* buf, const char* data, size_t len)
+{
+    if (buf->len + len > LOG_BUFSIZE)
+        log_buffer_flush(buf);
+
+    if (len > LOG_BUFSIZE)
+        len = LOG_BUFSIZE;
+
+    if (buf->len == 0)
+        gettimeofday(&(buf->oldest), NULL);
+
+    memcpy(&(buf->data[buf->len]), data, len);
+    buf->len += len;
+}
+
+static void log_vappend(struct log_buffer* buf, const char* format,
+                        va_list args)
+{
+    size_t space = LOG_BUFSIZE - buf->len;
+    va_list copy;
+    int len;
+
+    if (buf->len == 0)
+        gettimeofday(&(buf->oldest), NULL);
+
+    va_copy(copy, args);
+    len = vsnprintf(&(buf->data[buf->len]), space, format, copy);
+    va_end(copy);
+
+    if (len < 0)
+        return;
+
+    /* didn't fit, retry into an empty buffer and truncate if still too long */
+    if ((size_t) len >= space)
+    {
+        log_buffer_flush(buf);
+        gettimeofday(&(buf->oldest), NULL);
+
+        if ((len = vsnprintf(buf->data, LOG_BUFSIZE, format, args)) < 0)
+            return;
+
+        if ((size_t) len >= LOG_BUFSIZE)
+            len = LOG_BUFSIZE - 1;
+    }
+
+    buf->len += (size_t) len;
+}
+
+static void log_finish(struct log_buffer* buf, enum LOG_LEVEL level)
+{
+    struct timeval now;
+
+    if (log_color && log_colors[level][0])
+        log_append(buf, "\x1b[0m", strlen("\x1b[0m"));
+
+    if (level <= LOG_LEVEL_WARN)
+    {
+        log_buffer_flush(buf);
+        return;
+    }
+
+    gettimeofday(&now, NULL);
+
+    /* a line after a quiet spell goes out at once, nothing may come after
+     * it to push it out; only lines in a steady stream are batched */
+    if (diff_time(buf->last, now) >= LOG_FLUSH_INTERVAL ||
+        diff_time(buf->oldest, now) >= LOG_FLUSH_INTERVAL)
+        log_buffer_flush(buf);
+
+    buf->last = now;
+}
+
+/* write() is async-signal-safe and len only grows after the bytes land,
+ * so the interrupted thread's batch can go out before the default action */
+static void log_signal(int sig)
+{
+    if (log_local && log_local->len)
+        log_write_fd(log_local->data, log_local->len);
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* only claims signals nobody else handles, so a binary's own handlers win */
+static void log_catch(int sig)
+{
+    struct sigaction old, act;
+
+    if (sigaction(sig, NULL, &old) || old.sa_handler != SIG_DFL)
+        return;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = log_signal;
+    sigemptyset(&(act.sa_mask));
+    sigaction(sig, &act, NULL);
+}
+
+/* at exit no thread is left to push out what it buffered */
+static void log_flush_all(void)
+{
+    struct log_buffer* buf;
+
+    pthread_mutex_lock(&log_buffers_lock);
+
+    for (buf = log_buffers; buf; buf = buf->next)
+    {
+        pthread_mutex_lock(&(buf->lock));
+        log_buffer_flush(buf);
+        pthread_mutex_unlock(&(buf->lock));
+    }
+
+    pthread_mutex_unlock(&log_buffers_lock);
+}
+
+/* picks up LOG_ENV before main() so every binary shares the same knob */
+__attribute__((constructor)) static void log_configure(void)
+{
+    enum LOG_LEVEL level;
+    const char* env = getenv(LOG_ENV);
+
+    if (env && log_level_parse(env, &level) == EXIT_SUCCESS)
+        log_verbosity = level;
+
+    #ifndef NOCOLOR
+    log_color = isatty(log_fd);
+    #endif
+
+    atexit(log_flush_all);
+    log_catch(SIGINT);
+    log_catch(SIGTERM);
+}
+
+int log_level_parse(const char* str, enum LOG_LEVEL* level)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(log_names) / sizeof(log_names[0]); i++)
+    {
+        if (strcasecmp(str, log_names[i]) == 0 ||
+            (isdigit((unsigned char) str[0]) && str[1] == '\0' &&
+             (size_t) (str[0] - '0') == i))
+        {
+            *level = (enum LOG_LEVEL) i;
+            return EXIT_SUCCESS;
+        }
+    }
+
+    return EXIT_FAILURE;
+}
+
+void log_set_level(enum LOG_LEVEL level)
+{
+    log_verbosity = level;
+}
+
+void log_set_fd(int fd)
+{
+    log_flush();
+    log_fd = fd;
+
+    #ifndef NOCOLOR
+    log_color = isatty(fd);
+    #endif
+}
+
+void log_write(enum LOG_LEVEL level, const char* format, ...)
+{
+    struct log_buffer* buf = log_buffer_get();
+    va_list args;
+
+    va_start(args, format);
+
+    if (buf == NULL)
+    {
+        vdprintf(log_fd, format, args);
+        va_end(args);
+        return;
+    }
+
+    pthread_mutex_lock(&(buf->lock));
+
+    if (log_color && log_colors[level][0])
+        log_append(buf, log_colors[level], strlen(log_colors[level]));
+
+    log_vappend(buf, format, args);
+    va_end(args);
+
+    log_finish(buf, level);
+    pthread_mutex_unlock(&(buf->lock));
+}
+
+/* the layout of hexdump(): offset, 16 bytes split in two groups, ASCII */
+void log_hexdump(enum LOG_LEVEL level, const uint8_t* buf, size_t len)
+{
+    struct log_buffer* lbuf;
+    char line[LOG_HEXDUMP_LINE];
+    size_t i, j, pos;
+
+    if (!log_enabled(level) || buf == NULL || (lbuf = log_buffer_get()) ==
+        NULL)
+        return;
+
+    pthread_mutex_lock(&(lbuf->lock));
+
+    if (log_color && log_colors[level][0])
+        log_append(lbuf, log_colors[level], strlen(log_colors[level]));
+
+    for (i = 0; i < len; i += 16)
+    {
+        pos = snprintf(line, sizeof(line), "%.8zx", i);
+
+        for (j = 0; j < 16; j++)
+        {
+            if (i + j < len)
+                pos += snprintf(&(line[pos]), sizeof(line) - pos,
+                                j % 8 == 0 ? " %.2x " : "%.2x ",
+                                buf[i + j]);
+            else
+                pos += snprintf(&(line[pos]), sizeof(line) - pos,
+                                j % 8 == 0 ? "    " : "   ");
+        }
+
+        pos += snprintf(&(line[pos]), sizeof(line) - pos, " |");
+
+        for (j = 0; j < 16 && i + j < len; j++)
+            line[pos++] = isprint(buf[i + j]) ? (char) buf[i + j] : '.';
+
+        line[pos++] = '|';
+        line[pos++] = '\n';
+        log_append(lbuf, line, pos);
+    }
+
+    log_finish(lbuf, level);
+    pthread_mutex_unlock(&(lbuf->lock));
+}
+
+void log_flush(void)
+{
+    if (log_local == NULL)
+        return;
+
+    pthread_mutex_lock(&(log_local->lock));
+    log_buffer_flush(log_local);
+    pthread_mutex_unlock(&(log_local->lock));
+}
@@ -23,13 +23,118 @@
  *****************************************************************************/
 #include "util.h"
 
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define TEST_BLOCK_MAX 65536
+
+void test_kv_spec()
+{
+    struct kv_spec spec;
+
+    assert(kv_spec_parse("4", &spec) == EXIT_SUCCESS);
+    assert(spec.transport == KV_SPEC_TCP);
+    assert(strcmp(spec.address, KV_SPEC_DEFAULT_HOST) == 0);
+    assert(spec.port == KV_SPEC_DEFAULT_PORT);
+    assert(strcmp(spec.db, "4") == 0);
+
+    assert(kv_spec_parse("redis.local:6380/12", &spec) == EXIT_SUCCESS);
+    assert(spec.transport == KV_SPEC_TCP);
+    assert(strcmp(spec.address, "redis.local") == 0);
+    assert(spec.port == 6380);
+    assert(strcmp(spec.db, "12") == 0);
+
+    assert(kv_spec_parse(":6380/1", &spec) == EXIT_SUCCESS);
+    assert(strcmp(spec.address, KV_SPEC_DEFAULT_HOST) == 0);
+    assert(spec.port == 6380);
+
+    assert(kv_spec_parse("unix:/var/run/redis/redis.sock/4", &spec) ==
+           EXIT_SUCCESS);
+    assert(spec.transport == KV_SPEC_UNIX);
+    assert(strcmp(spec.address, "/var/run/redis/redis.sock") == 0);
+    assert(strcmp(spec.db, "4") == 0);
+
+    assert(kv_spec_parse("mem:4:/tmp/disk.kv", &spec) == EXIT_SUCCESS);
+    assert(spec.transport == KV_SPEC_MEM);
+    assert(strcmp(spec.address, "/tmp/disk.kv") == 0);
+    assert(strcmp(spec.db, "4") == 0);
+
+    assert(kv_spec_parse("mem:4", &spec) == EXIT_SUCCESS);
+    assert(spec.address[0] == 0);
+
+    assert(kv_spec_parse("", &spec) == EXIT_FAILURE);
+    assert(kv_spec_parse("four", &spec) == EXIT_FAILURE);
+    assert(kv_spec_parse("host:0/4", &spec) == EXIT_FAILURE);
+    assert(kv_spec_parse("host:port/4", &spec) == EXIT_FAILURE);
+    assert(kv_spec_parse("unix:/4", &spec) == EXIT_FAILURE);
+    assert(kv_spec_parse("host/", &spec) == EXIT_FAILURE);
+    assert(kv_spec_parse("4:5", &spec) == EXIT_FAILURE);
+}
+
+/* flips one byte at each offset and checks only its slot is reported, by
+ * both the dispatched and the scalar compare */
+void check_block_diff(size_t len, size_t slot, const size_t* offsets,
+                      size_t count)
+{
+    uint8_t a[TEST_BLOCK_MAX], b[TEST_BLOCK_MAX];
+    uint64_t mask[BLOCK_DIFF_WORDS(TEST_BLOCK_MAX)];
+    uint64_t expected[BLOCK_DIFF_WORDS(TEST_BLOCK_MAX)];
+    uint64_t scalar[BLOCK_DIFF_WORDS(TEST_BLOCK_MAX)];
+    size_t i, slots = (len + slot - 1) / slot, changed = 0;
+
+    for (i = 0; i < len; i++)
+        a[i] = (uint8_t) rand();
+
+    memcpy(b, a, len);
+    memset(expected, 0, sizeof(expected));
+
+    assert(block_diff_mask(a, b, len, slot, mask) == 0);
+    for (i = 0; i < BLOCK_DIFF_WORDS(slots); i++)
+        assert(mask[i] == 0);
+
+    for (i = 0; i < count; i++)
+    {
+        b[offsets[i]] ^= 0x80;
+
+        if (!(expected[offsets[i] / slot / 64] &
+              ((uint64_t) 1 << (offsets[i] / slot % 64))))
+            changed++;
+
+        expected[offsets[i] / slot / 64] |= (uint64_t) 1 <<
+                                            (offsets[i] / slot % 64);
+    }
+
+    assert(block_diff_mask(a, b, len, slot, mask) == changed);
+    assert(block_diff_mask_scalar(a, b, len, slot, scalar) == changed);
+
+    for (i = 0; i < BLOCK_DIFF_WORDS(slots); i++)
+        assert(mask[i] == expected[i] && scalar[i] == expected[i]);
+}
+
+void test_block_diff()
+{
+    /* first and last byte of a slot, and a byte inside a vector's tail */
+    size_t inodes[] = { 0, 255, 256 * 5 + 17, 4095 };
+    size_t small[] = { 127, 128 * 31 };
+    size_t odd[] = { 23, 24, 999 };
+    size_t wide[] = { 128 * 300 + 64, 65535 };
+
+    check_block_diff(4096, 256, inodes, 4);
+    check_block_diff(4096, 128, small, 2);
+    check_block_diff(4096, 4096, small, 1);
+    /* slots narrower than a vector, and a short final slot */
+    check_block_diff(1000, 24, odd, 3);
+    check_block_diff(65536, 128, wide, 2);
+}
 
 int main(int argc, char* argv[])
 {
     uint64_t test = 4;
 
     hexdump((uint8_t*) &test, sizeof(uint64_t));
+    test_kv_spec();
+    test_block_diff();
 
     return EXIT_SUCCESS;
 }
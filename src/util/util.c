@@ -30,6 +30,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #define KB 1024L
 #define MB (KB*1024)
 #define GB (MB*1024)
@@ -216,3 +220,193 @@ int check_syscall(int ret)
         fprintf(stderr, "Syscall Error: %s\n", strerror(errno));
     return ret;
 }
+
+int kv_spec_parse(const char* spec, struct kv_spec* parsed)
+{
+    const char* db = spec, *end, *port;
+    char* port_end;
+    size_t len;
+
+    memset(parsed, 0, sizeof(struct kv_spec));
+    parsed->transport = KV_SPEC_TCP;
+    parsed->port = KV_SPEC_DEFAULT_PORT;
+    strcpy(parsed->address, KV_SPEC_DEFAULT_HOST);
+
+    if (strncmp(spec, KV_SPEC_MEM_PREFIX, strlen(KV_SPEC_MEM_PREFIX)) == 0)
+    {
+        parsed->transport = KV_SPEC_MEM;
+        parsed->address[0] = 0;
+        db += strlen(KV_SPEC_MEM_PREFIX);
+
+        if ((end = strchr(db, ':')))
+        {
+            if (strlen(end + 1) >= PATH_MAX)
+                return EXIT_FAILURE;
+            strcpy(parsed->address, end + 1);
+        }
+    }
+    else if ((end = strrchr(spec, '/')))
+    {
+        db = end + 1;
+
+        if (strncmp(spec, KV_SPEC_UNIX_PREFIX,
+                    strlen(KV_SPEC_UNIX_PREFIX)) == 0)
+        {
+            parsed->transport = KV_SPEC_UNIX;
+            spec += strlen(KV_SPEC_UNIX_PREFIX);
+            port = end;
+        }
+        else if ((port = memchr(spec, ':', end - spec)))
+        {
+            parsed->port = strtol(port + 1, &port_end, 10);
+
+            if (port_end != end || parsed->port <= 0 || parsed->port > 65535)
+                return EXIT_FAILURE;
+        }
+        else
+        {
+            port = end;
+        }
+
+        len = port - spec;
+
+        if (len >= PATH_MAX || (len == 0 && parsed->transport == KV_SPEC_UNIX))
+            return EXIT_FAILURE;
+
+        /* ":6380/4" keeps the default host */
+        if (len)
+        {
+            memcpy(parsed->address, spec, len);
+            parsed->address[len] = 0;
+        }
+    }
+
+    len = strcspn(db, ":");
+
+    if (len == 0 || len >= KV_SPEC_DB_MAX || strspn(db, "0123456789") != len ||
+        (parsed->transport != KV_SPEC_MEM && db[len]))
+        return EXIT_FAILURE;
+
+    memcpy(parsed->db, db, len);
+    parsed->db[len] = 0;
+
+    return EXIT_SUCCESS;
+}
+
+static bool __slot_differs_scalar(const uint8_t* a, const uint8_t* b,
+                                  size_t len)
+{
+    uint64_t x, y, acc = 0;
+    size_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        memcpy(&x, &(a[i]), sizeof(uint64_t));
+        memcpy(&y, &(b[i]), sizeof(uint64_t));
+        acc |= x ^ y;
+    }
+
+    for (; i < len; i++)
+        acc |= a[i] ^ b[i];
+
+    return acc != 0;
+}
+
+#ifdef __SSE2__
+static bool __slot_differs_sse2(const uint8_t* a, const uint8_t* b,
+                                size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i + sizeof(__m128i) <= len; i += sizeof(__m128i))
+        acc = _mm_or_si128(acc,
+                           _mm_xor_si128(_mm_loadu_si128((const __m128i*)
+                                                         &(a[i])),
+                                         _mm_loadu_si128((const __m128i*)
+                                                         &(b[i]))));
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) !=
+        0xffff)
+        return true;
+
+    return __slot_differs_scalar(&(a[i]), &(b[i]), len - i);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static bool __slot_differs_avx2(const uint8_t* a, const uint8_t* b,
+                                size_t len)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + sizeof(__m256i) <= len; i += sizeof(__m256i))
+        acc = _mm256_or_si256(acc,
+                              _mm256_xor_si256(_mm256_loadu_si256(
+                                                   (const __m256i*) &(a[i])),
+                                               _mm256_loadu_si256(
+                                                   (const __m256i*) &(b[i]))));
+
+    if (!_mm256_testz_si256(acc, acc))
+        return true;
+
+    return __slot_differs_scalar(&(a[i]), &(b[i]), len - i);
+}
+#endif
+
+typedef bool (*slot_compare)(const uint8_t* a, const uint8_t* b, size_t len);
+
+static slot_compare slot_differs = __slot_differs_scalar;
+
+/* AVX2 is only taken when the running CPU has it, SSE2 is the x86-64
+ * baseline */
+__attribute__((constructor)) static void __block_diff_select(void)
+{
+    #if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        slot_differs = __slot_differs_avx2;
+        return;
+    }
+    #endif
+
+    #ifdef __SSE2__
+    slot_differs = __slot_differs_sse2;
+    #endif
+}
+
+static size_t __block_diff(const uint8_t* a, const uint8_t* b, size_t len,
+                           size_t slot, uint64_t* mask, slot_compare differs)
+{
+    size_t i, slots = (len + slot - 1) / slot, changed = 0;
+
+    memset(mask, 0, BLOCK_DIFF_WORDS(slots) * sizeof(uint64_t));
+
+    for (i = 0; i < slots; i++)
+    {
+        if (differs(&(a[i * slot]), &(b[i * slot]),
+                    i * slot + slot <= len ? slot : len - i * slot))
+        {
+            mask[i / 64] |= ((uint64_t) 1) << (i % 64);
+            changed++;
+        }
+    }
+
+    return changed;
+}
+
+size_t block_diff_mask(const uint8_t* a, const uint8_t* b, size_t len,
+                       size_t slot, uint64_t* mask)
+{
+    return __block_diff(a, b, len, slot, mask, slot_differs);
+}
+
+size_t block_diff_mask_scalar(const uint8_t* a, const uint8_t* b, size_t len,
+                              size_t slot, uint64_t* mask)
+{
+    return __block_diff(a, b, len, slot, mask, __slot_differs_scalar);
+}